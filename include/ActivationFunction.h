@@ -10,6 +10,7 @@
 #define ACTIVATION_FUNCTION_H
 
 #include "Tensor.h"
+#include "Gemm.h"
 
 /**
  * @class ActivationFunction
@@ -18,20 +19,45 @@
 
 class ActivationFunction {
 public:
+    virtual ~ActivationFunction() = default;
+    Tensor getValues(const TensorView &input, int batchSize);
+    Tensor getDerivatives(const TensorView &input, int batchSize);
+    void applyInPlace(TensorView &values, int batchSize);
+
     /**
-     * Let f be the activation function. If input is a tensor (whose dimension is accepted by the function) then for all component xi of the input tensor, calculate f(xi) and return a tensor, whose size is the same as the input, that contains the result for each xi.
+     * Let f be the activation function. If input is a tensor (whose dimension is accepted by the function) then for all component xi of the input tensor, calculate f(xi) and write it in the output tensor, whose size is the same as the input.
      * @param input Input tensor
      * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
-     * @return Tensor of the outputs of the function for each component of the input tensor
+     * @param output Tensor where the outputs of the function for each component of the input tensor are written. It can be the input tensor itself
      */
-    virtual Tensor *getValues(const Tensor &input, int batchSize) = 0;
+    virtual void getValuesInto(const TensorView &input, int batchSize, TensorView &output) = 0;
 
     /**
-     * Let f be the activation function. If input is a tensor (whose dimension is accepted by the function) then for all component xi of the input tensor, calculate df(xi)/dxi and return a tensor, whose size is the same as the input, that contains the result for each xi.
+     * Let f be the activation function. If input is a tensor (whose dimension is accepted by the function) then for all component xi of the input tensor, calculate df(xi)/dxi and write it in the output tensor, whose size is the same as the input.
      * @param input Input tensor
      * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
-     * @return Tensor of the derivative of the function for each component of the input tensor
+     * @param output Tensor where the derivatives of the function for each component of the input tensor are written. It can be the input tensor itself
+     */
+    virtual void getDerivativesInto(const TensorView &input, int batchSize, TensorView &output) = 0;
+
+    virtual bool canMultiplyByDerivativeInPlace();
+
+    /**
+     * Let f be the activation function. For all component gi of the gradient, multiply it by df(xi)/dxi, where xi is the corresponding input of the function. It's only called if canMultiplyByDerivativeInPlace() returns true
+     * @param gradient Tensor multiplied in place, e.g. the derivatives of the cost in respect for the outputs of the function
+     * @param output Outputs f(xi) of the function, same shape as the gradient
+     * @param batchSize Size of the batch. It's not used by all functions.
      */
-    virtual Tensor* getDerivatives(const Tensor &input, int batchSize) = 0;
+    virtual void multiplyByDerivativeInPlace(TensorView &gradient, const TensorView &output, int batchSize) = 0;
+    virtual bool getFusedActivation(Gemm::Activation &activation, float &parameter);
+    virtual bool isFusedWithCrossEntropy();
+
+    /**
+     * Get the name of the function, used to identify it in the model files
+     * @return Name
+     */
+    virtual std::string getName() = 0;
+
+    static ActivationFunction* create(const std::string &name);
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,37 @@
+/**
+ * @file Adam.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of Adam.cpp
+ * @date 2024-01-28
+ */
+
+#ifndef ADAM_H
+#define ADAM_H
+
+#include "Optimizer.h"
+
+/**
+ * @class Adam
+ * @brief Adam optimizer: the step is the mean of the gradients divided by the square root of the mean of their squares (both are exponential moving averages with a bias correction). With a decoupled weight decay, it's AdamW.
+ */
+
+class Adam : public Optimizer {
+private:
+    float beta1; /**< Decay rate of the mean of the gradients */
+    float beta2; /**< Decay rate of the mean of the squared gradients */
+    float epsilon; /**< Value added to the denominator to avoid dividing by 0 */
+
+protected:
+    void updateRange(float learningRate, float weightDecay, float* parameters, const float* gradients, float* state, int size, int begin, int end);
+
+public:
+    Adam(float beta1 = 0.9f, float beta2 = 0.999f, float epsilon = 1e-8f, float weightDecay = 0.0f, bool decoupledWeightDecay = true);
+
+    float getBeta1() const;
+    float getBeta2() const;
+    float getEpsilon() const;
+    int getNbStateValues() const;
+    std::string getName() const;
+};
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * @file BFloat16.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of BFloat16.cpp
+ * @date 2024-01-29
+ */
+
+#ifndef BFLOAT16_H
+#define BFLOAT16_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+/**
+ * @class BFloat16
+ * @brief 16-bit floating point number made of the upper half of a float (same exponent, 7 bits of mantissa). It's used to store the tensors and weights of the mixed-precision training, the computations are done on floats.
+ * @remark The conversions are done in software: a float is rounded to the nearest bfloat16 (ties to even), and a bfloat16 is converted back exactly
+ */
+
+class BFloat16 {
+private:
+    uint16_t bits; /**< Upper 16 bits of the float */
+
+public:
+    BFloat16() = default;
+
+    /**
+     * Round a float to the nearest bfloat16, ties to even. NaN stays NaN
+     * @param value Float converted
+     * @return Nearest bfloat16
+     */
+    static BFloat16 fromFloat(float value) {
+        uint32_t x;
+        std::memcpy(&x, &value, sizeof(x));
+        BFloat16 result;
+        if((x & 0x7fffffffu) > 0x7f800000u) {
+            result.bits = (uint16_t) ((x >> 16) | 0x40u);
+        } else {
+            result.bits = (uint16_t) ((x + 0x7fffu + ((x >> 16) & 1u)) >> 16);
+        }
+        return result;
+    }
+
+    /**
+     * Convert to a float (exact)
+     * @return Float having the same value
+     */
+    float toFloat() const {
+        uint32_t x = (uint32_t) bits << 16;
+        float value;
+        std::memcpy(&value, &x, sizeof(value));
+        return value;
+    }
+
+    static void convertInto(const float* source, BFloat16* destination, size_t size);
+    static void convertInto(const BFloat16* source, float* destination, size_t size);
+};
+
+#endif
@@ -17,15 +17,20 @@
 
 class Batch {
 private:
-    Tensor data; /**< Instances data stored as a tensor whose first dimension is the size of the batch */
+    TensorView data; /**< Instances data seen as a tensor whose first dimension is the size of the batch. The batch shares the ownership of this data */
     std::vector<float*> targets; /**< List of target output for each instance represented in a one-hot representation. It's a list of pointers that is not deleted when the batch is deleted */
+    std::vector<int> labels; /**< Index of the target class of each instance, empty if the targets are given in a one-hot representation */
     int size; /**< Size of the batch: number of instances in the batch */
 public:
     Batch(int nDimData, std::vector<int> dimSizes, float *data, const std::vector<float *> &targets);
+    Batch(const TensorView &data, const std::vector<float *> &targets);
+    Batch(const TensorView &data, const std::vector<int> &labels);
     ~Batch() = default;
     int getSize() const;
     float * getTarget(int i) const;
-    Tensor *getData();
+    bool hasLabels() const;
+    int getLabel(int i) const;
+    TensorView *getData();
 };
 
 #endif
@@ -0,0 +1,54 @@
+/**
+ * @file Checkpointer.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of Checkpointer.cpp
+ * @date 2024-01-29
+ */
+
+#ifndef CHECKPOINTER_H
+#define CHECKPOINTER_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "NeuralNetwork.h"
+
+/**
+ * @class Checkpointer
+ * @brief Write the checkpoints of a training in the background. save() only copies the training state in one of two buffers, and an I/O thread writes the other buffer in the file (see ModelFile::writeFile()), so the training thread never waits for the disk.
+ * @remark If a checkpoint is saved while the previous one is still waiting to be written, the previous one is replaced by the new one: only the latest checkpoint is written
+ */
+
+class Checkpointer {
+private:
+    std::string fileName; /**< Name of the checkpoint file */
+    std::vector<char> buffers[2]; /**< Serialized checkpoints, one is filled by save() while the other one is written */
+    int writtenBuffer; /**< Index of the buffer being written by the I/O thread, -1 if it's idle */
+    int pendingBuffer; /**< Index of the buffer waiting to be written, -1 if there is none */
+    long nbWritten; /**< Number of checkpoints written in the file */
+    long nbDropped; /**< Number of checkpoints replaced by a newer one before being written */
+    long nbFailed; /**< Number of checkpoints that couldn't be written */
+    bool stop; /**< True when the I/O thread must exit */
+    std::mutex mutex; /**< Protects everything except the content of the buffer being written */
+    std::condition_variable condition; /**< Wakes the I/O thread when a checkpoint is pending, and wait() when a checkpoint is written */
+    std::thread ioThread; /**< Thread writing the checkpoints */
+
+    void ioLoop();
+
+public:
+    explicit Checkpointer(const std::string &fileName);
+    ~Checkpointer();
+    Checkpointer(Checkpointer const&) = delete;
+    Checkpointer& operator=(Checkpointer const&) = delete;
+
+    bool save(NeuralNetwork &network, long epoch, const std::string &userState);
+    void wait();
+    const std::string& getFileName() const;
+    long getNbWritten();
+    long getNbDropped();
+    long getNbFailed();
+};
+
+#endif
@@ -10,6 +10,7 @@
 
 #include "ActivationFunction.h"
 #include "Layer.h"
+#include "SparseMatrix.h"
 
 /**
  * @class DenseLayer
@@ -18,11 +19,28 @@
 
 class DenseLayer : public Layer {
 private:
-    Tensor weights; /**< Tensor of rank (dimension) 2 that contains all the weight of this layer. The first dimension size is the same as this layer number of neurons which is the first output dimension size. The second one is the same as the previous number of neurons */
+    TensorView weights; /**< Tensor of rank (dimension) 2 that contains all the weight of this layer. The first dimension size is the same as this layer number of neurons which is the first output dimension size. The second one is the same as the previous number of neurons */
     float* biases; /**< List of all the biases of this layer. We might want to change the type from float* to Tensor in the future */
+    std::shared_ptr<void> storage; /**< Owner of the memory of the weights and biases when the layer doesn't own them (e.g. a mapped model file), nullptr otherwise */
+    std::vector<float> gradients; /**< Mean over the last batch of dC/dw_i,j (same layout as weights) followed by the mean of dC/db_i, empty until they are first needed */
+    std::vector<float> optimizerState; /**< State kept by the optimizer for the weights followed by the state for the biases, empty until the first update */
+    std::vector<float> pruningMask; /**< 1 for the weights kept and 0 for the pruned ones (same layout as weights), empty if the layer was never pruned */
+    std::vector<BFloat16> mixedPrecisionWeights; /**< Weights rounded to bfloat16, used by the products of the training passes in mixed precision. Empty if the mixed precision is disabled */
+    SparseMatrix* sparseWeights; /**< Weights in the CSR format, used instead of the dense weights when the density is below sparseDensityThreshold. nullptr otherwise */
+
+    static float sparseDensityThreshold; /**< Density of the weights below which the sparse kernels are used */
+
+    void multiplyByWeightsInto(const TensorView &input, TensorView &output, const Gemm::Epilogue &epilogue);
+    void multiplyByWeightsInto(const BFloat16* input, TensorView &output, const Gemm::Epilogue &epilogue);
+    void maskWeightGradients(float* weightGradients);
+    void computeBiasGradientsInto(const TensorView &currentCostDerivatives, float scale, float* biasGradients, bool accumulate);
+    void updateSparseWeights();
+    void updateMixedPrecisionWeights();
+    Tensor toFloatInput(const BFloat16* input, int batchSize);
 
 public:
     DenseLayer(int nbNeurons, int nbNeuronsPrevLayer, ActivationFunction* activationFunction);
+    DenseLayer(int nbNeurons, int nbNeuronsPrevLayer, ActivationFunction* activationFunction, float* weights, float* biases, const std::shared_ptr<void> &storage);
     DenseLayer(DenseLayer const& copy);
     ~DenseLayer();
 
@@ -32,12 +50,39 @@ public:
     void setBias(int neuron, float newValue);
     int getNbNeurons();
     int getNbNeuronsPrevLayer();
+    const TensorView& getWeights();
+    const float* getBiases();
 
-    Tensor* getOutput(const Tensor &input);
-    void adjustParams(float learningRate, Tensor* currentCostDerivatives, Tensor* prevLayerOutput);
-    Tensor* getPreActivationDerivatives(int currentLayerOutputIndex, int prevLayerOutputIndex);
-    Tensor* getPreActivationDerivatives();
-    Tensor* getPreActivationValues(const Tensor &tensor);
+    void getOutputInto(const TensorView &input, TensorView &output);
+    void getOutputAndDerivativesInto(const TensorView &input, TensorView &output, TensorView &activationDerivatives);
+    void getOutputAndDerivativesInto(const BFloat16* input, TensorView &output, TensorView &activationDerivatives);
+    void getOutputAndDerivativesInto(const BFloat16* input, TensorView &output, BFloat16* halfOutput, BFloat16* halfActivationDerivatives);
+    void computeGradients(const TensorView &currentCostDerivatives, const TensorView &prevLayerOutput);
+    void computeGradientsInto(const TensorView &currentCostDerivatives, const TensorView &prevLayerOutput, float scale, float* gradients, bool accumulate);
+    void computeGradientsInto(const TensorView &currentCostDerivatives, const BFloat16* prevLayerOutput, float scale, float* gradients, bool accumulate);
+    int getNbParameters();
+    float* getGradients();
+    void applyGradients(Optimizer &optimizer, float learningRate);
+    void resetOptimizerState();
+    const std::vector<float>& getOptimizerState();
+    void setOptimizerState(const float* state, size_t size);
+    const std::vector<float>& getPruningMask();
+    void setParameters(const float* newWeights, const float* newBiases, const float* newPruningMask);
+    void setMixedPrecision(bool enabled);
+    bool isMixedPrecision();
+    Tensor getPreActivationDerivatives(int currentLayerOutputIndex, int prevLayerOutputIndex);
+    const TensorView& getPreActivationDerivatives();
+    void getPreActivationValuesInto(const TensorView &input, TensorView &output);
+    void getInputDerivativesInto(const TensorView &currentCostDerivatives, TensorView &inputDerivatives);
     std::string toString();
+
+    void prune(float threshold);
+    void pruneToSparsity(float sparsity);
+    float getDensity();
+    bool isSparse();
+    size_t getNbWeightBytes();
+
+    static void setSparseDensityThreshold(float threshold);
+    static float getSparseDensityThreshold();
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,88 @@
+/**
+ * @file ExecutionPlan.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of ExecutionPlan.cpp
+ * @date 2024-01-26
+ */
+
+#ifndef EXECUTION_PLAN_H
+#define EXECUTION_PLAN_H
+
+#include <vector>
+#include <cstddef>
+#include "Layer.h"
+#include "LayersList.h"
+#include "Tensor.h"
+#include "BFloat16.h"
+
+/**
+ * @class ExecutionPlan
+ * @brief Layers of a network and the tensors used to run them for a given batch size, computed once. Each intermediate tensor is a view on one of a few buffers: two tensors share a buffer when they are never needed at the same time.
+ * @remark The plan must be built again if the layers of the network change. A training plan can keep the outputs of only some layers (the checkpoints) for the backward pass: the output of any other layer is only kept until the forward pass of the next layer, and it's recomputed from the previous checkpoint when the backward pass needs it. The activation derivatives of a layer (other than the last one) whose function can be applied from its output, like ReLU, are not stored: the backward pass multiplies the cost derivatives by them in place. Neither are those of a last layer using a softmax, whose cost derivatives only need its output. In a mixed-precision training plan, the outputs and activation derivatives kept for the backward pass are stored in bfloat16 (except for the last layer): the input of the first layer is rounded to bfloat16, and each layer writes its output in a float tensor only used during its forward pass while the epilogue of the product writes the bfloat16 copies.
+ */
+
+class ExecutionPlan {
+private:
+    /**
+     * @struct Value
+     * @brief Intermediate tensor of the plan and the steps where it's needed
+     */
+    struct Value {
+        int size; /**< Number of elements */
+        int firstStep; /**< Step where it's written */
+        int lastStep; /**< Last step where it's read */
+        int inPlaceOf; /**< Index of a value read at firstStep whose buffer can be overwritten element by element while this value is written, -1 if there is none */
+        int buffer; /**< Index of the buffer assigned to this value */
+        bool half; /**< True if it's stored in bfloat16, false if it's stored in float */
+    };
+
+    std::vector<Layer*> layers; /**< Layers of the network, in order */
+    int batchSize; /**< Batch size of all the tensors */
+    int nbInstances; /**< Number of instances the tensors are currently sliced to (see setNbInstances()) */
+    bool training; /**< True if the tensors needed by the backward pass are included */
+    bool mixedPrecision; /**< True if the tensors kept for the backward pass are stored in bfloat16 */
+    std::vector<bool> keptOutputs; /**< True for each layer whose output is kept for the backward pass, false if it's recomputed (training only) */
+    std::vector<bool> derivativesFromOutputs; /**< True for each layer whose activation derivatives are applied from its output instead of being stored (training only) */
+    std::vector<std::vector<float>> buffers; /**< Memory shared by the intermediate tensors. They are always on the heap, even if the plan is built while an arena scope is active */
+    std::vector<std::vector<BFloat16>> halfBuffers; /**< Memory shared by the intermediate tensors stored in bfloat16 */
+    std::vector<TensorView> outputs; /**< Output of each layer */
+    std::vector<TensorView> activationDerivatives; /**< Derivatives of the activation function of each layer (training only) */
+    std::vector<TensorView> costDerivatives; /**< Derivatives of the cost in respect for the pre-activation values of each layer (training only) */
+    std::vector<TensorView> forwardOutputs; /**< Output of each layer during the forward pass (training only) */
+    std::vector<TensorView> fullViews; /**< Outputs, then activation derivatives, then cost derivatives, then forward outputs for the whole batch size, sliced by setNbInstances() */
+    BFloat16* savedInput; /**< Input of the first layer rounded to bfloat16 (mixed precision only) */
+    std::vector<BFloat16*> savedOutputs; /**< Output of each layer rounded to bfloat16 (mixed precision only, nullptr for the last layer) */
+    std::vector<BFloat16*> savedActivationDerivatives; /**< Activation derivatives of each layer rounded to bfloat16 (mixed precision only, nullptr for the last layer) */
+    size_t nbBytesWithoutReuse; /**< Memory that the intermediate tensors would need if each of them had its own buffer */
+
+    int addValue(std::vector<Value> &values, int size, int firstStep, int lastStep, int inPlaceOf = -1, bool half = false);
+    static std::vector<int> assignBuffers(std::vector<Value> &values, int nbSteps, bool half);
+    TensorView createView(const std::vector<Value> &values, int value, Layer* layer);
+
+public:
+    ExecutionPlan(LayersList &layersList, int batchSize, bool training, bool mixedPrecision = false, const std::vector<bool> &keptOutputs = std::vector<bool>());
+    ExecutionPlan(ExecutionPlan const&) = delete;
+    ExecutionPlan& operator=(ExecutionPlan const&) = delete;
+
+    int getNbLayers() const;
+    Layer* getLayer(int i) const;
+    int getBatchSize() const;
+    void setNbInstances(int n);
+    int getNbInstances() const;
+    bool isTraining() const;
+    bool isMixedPrecision() const;
+    bool isOutputKept(int i) const;
+    bool hasActivationDerivativesFromOutput(int i) const;
+    TensorView& getOutput(int i);
+    TensorView& getActivationDerivatives(int i);
+    TensorView& getCostDerivatives(int i);
+    TensorView& getForwardOutput(int i);
+    BFloat16* getSavedInput();
+    BFloat16* getSavedOutput(int i);
+    BFloat16* getSavedActivationDerivatives(int i);
+    int getNbBuffers() const;
+    size_t getNbBytes() const;
+    size_t getNbBytesWithoutReuse() const;
+};
+
+#endif
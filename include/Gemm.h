@@ -0,0 +1,69 @@
+/**
+ * @file Gemm.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of Gemm.cpp
+ * @date 2024-01-20
+ */
+
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <string>
+#include "BFloat16.h"
+
+/**
+ * @class Gemm
+ * @brief General matrix multiplication C = alpha * op(A) * op(B) + beta * C on row-major float matrices, where op(X) is X or its transpose.
+ * @remark The matrices are split in blocks that fit in the caches, the blocks are packed in contiguous panels and each tile of C is computed by a register-blocked microkernel. The microkernel (scalar, SSE4.2, AVX2+FMA or AVX-512) is chosen at runtime from the instruction sets supported by the CPU.
+ */
+
+class Gemm {
+public:
+    /**
+     * @enum Isa
+     * @brief Instruction sets for which a microkernel exists
+     */
+    enum Isa {
+        SCALAR, /**< Portable C++ kernel */
+        SSE42, /**< 128-bit vectors */
+        AVX2, /**< 256-bit vectors and fused multiply-add */
+        AVX512 /**< 512-bit vectors and fused multiply-add */
+    };
+
+    /**
+     * @enum Activation
+     * @brief Activation functions that can be applied by the epilogue
+     */
+    enum Activation {
+        IDENTITY, /**< f(x) = x */
+        RELU, /**< f(x) = max(0, x) */
+        LEAKY_RELU, /**< f(x) = x if x > 0, otherwise parameter * x */
+        SIGMOID /**< f(x) = 1 / (1 + e^-x) */
+    };
+
+    /**
+     * @struct Epilogue
+     * @brief Operations applied to each tile of C once it's computed, while it's still in the cache: C_i,j = f(C_i,j + bias_j), and optionally the derivatives f'(C_i,j + bias_j) are written in another matrix. For the mixed-precision training, C and the derivatives can also be written in bfloat16
+     */
+    struct Epilogue {
+        const float* bias; /**< Value added to each column of C, nullptr if there is none */
+        Activation activation; /**< Activation function f */
+        float parameter; /**< Parameter of the activation function (slope of LEAKY_RELU for negative values) */
+        float* derivatives; /**< Matrix (same size as C) where f' is written, nullptr if it's not needed */
+        int ldd; /**< Distance between two rows of derivatives */
+        BFloat16* halfOutput = nullptr; /**< Matrix (same size as C) where the final values of C are also written in bfloat16, nullptr if it's not needed */
+        BFloat16* halfDerivatives = nullptr; /**< Matrix (same size as C) where f' is written in bfloat16 instead of derivatives, nullptr if it's not needed */
+        int ldh = 0; /**< Distance between two rows of halfOutput and halfDerivatives */
+    };
+
+    static void multiply(bool transA, bool transB, int m, int n, int k, float alpha, const float* a, int lda, const float* b, int ldb, float beta, float* c, int ldc, const Epilogue* epilogue = nullptr);
+    static void multiply(bool transA, bool transB, int m, int n, int k, float alpha, const float* a, int lda, const BFloat16* b, int ldb, float beta, float* c, int ldc, const Epilogue* epilogue = nullptr);
+    static void multiply(bool transA, bool transB, int m, int n, int k, float alpha, const BFloat16* a, int lda, const BFloat16* b, int ldb, float beta, float* c, int ldc, const Epilogue* epilogue = nullptr);
+    static void applyEpilogue(const Epilogue &epilogue, float* c, int ldc, int i0, int j0, int nbRows, int nbCols);
+    static Isa getIsa();
+    static Isa getBestSupportedIsa();
+    static bool setIsa(Isa isa);
+    static std::string getIsaName(Isa isa);
+};
+
+#endif
@@ -0,0 +1,53 @@
+/**
+ * @file InferenceClient.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of InferenceClient.cpp
+ * @date 2024-02-01
+ */
+
+#ifndef INFERENCE_CLIENT_H
+#define INFERENCE_CLIENT_H
+
+#include <string>
+#include "TensorView.h"
+#include "InferenceProtocol.h"
+
+/**
+ * @class InferenceClient
+ * @brief Connection to an InferenceServer. The inputs are written directly in the slots of the shared memory given by the server, so a client doesn't need the network nor its code
+ * @remark The slots can be used as a ring: write the input of a slot with getInput(), send() it, and reuse it once receive() returned it. The answers can come in any order. An instance must be used by one thread at a time
+ */
+
+class InferenceClient {
+private:
+    int socket; /**< Socket connected to the server */
+    char* memory; /**< Shared memory of the slots */
+    size_t memorySize; /**< Size of the shared memory in bytes */
+    int nbSlots; /**< Number of slots */
+    int inputSize; /**< Number of floats of an input */
+    int outputSize; /**< Number of floats of an output */
+    size_t outputOffset; /**< Offset in bytes of the output in a slot */
+    size_t slotSize; /**< Size in bytes of a slot */
+
+    InferenceClient(int socket, char* memory, size_t memorySize, const InferenceProtocol::Message &welcome);
+
+public:
+    ~InferenceClient();
+    InferenceClient(InferenceClient const&) = delete;
+    InferenceClient& operator=(InferenceClient const&) = delete;
+
+    static InferenceClient* connect(const std::string &socketPath, int nbSlots);
+
+    float* getInput(int slot);
+    const float* getOutput(int slot) const;
+    int getNbSlots() const;
+    int getInputSize() const;
+    int getOutputSize() const;
+
+    bool send(int slot);
+    int receive(int &slot);
+    int predict(const TensorView &input);
+    bool getStats(InferenceProtocol::StatsMessage &stats);
+};
+
+#endif
@@ -0,0 +1,75 @@
+/**
+ * @file InferenceProtocol.h
+ * @author Robin MENEUST
+ * @brief Messages exchanged by InferenceServer and InferenceClient
+ * @date 2024-02-01
+ */
+
+#ifndef INFERENCE_PROTOCOL_H
+#define INFERENCE_PROTOCOL_H
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @class InferenceProtocol
+ * @brief Protocol between the inference server and its local clients. The control messages are fixed-size structures sent on a Unix domain socket of type SOCK_SEQPACKET (one message per packet). The tensors are not sent on the socket: each client gets a shared memory region (a memfd whose descriptor is passed with the WELCOME message) split in slots, each slot holding the input and the output of one request.
+ * @remark A client writes an input in a free slot, then sends REQUEST with the index of the slot. The server answers DONE with the label once the output is written in the slot. The slot must not be written again before its DONE is received. STATS can be sent on any connection (even without HELLO) when no request of this connection is in flight.
+ */
+
+class InferenceProtocol {
+public:
+    static const uint32_t VERSION = 1; /**< Version of the protocol, sent in HELLO */
+    static const int MAX_SLOTS = 4096; /**< Maximum number of slots of a client */
+    static const size_t ALIGNMENT = 64; /**< Alignment (in bytes) of the inputs and the outputs in the shared memory */
+
+    /**
+     * @enum MessageType
+     * @brief Type of a message
+     */
+    enum MessageType : uint32_t {
+        HELLO = 1, /**< Client to server: request a shared memory of nbSlots slots */
+        WELCOME = 2, /**< Server to client: layout of the shared memory, whose descriptor comes with the message */
+        REQUEST = 3, /**< Client to server: predict the input of a slot */
+        DONE = 4, /**< Server to client: the output of a slot is written */
+        STATS = 5, /**< Client to server: request a StatsMessage */
+        FAILURE = 6 /**< Server to client: the last message was invalid */
+    };
+
+    /**
+     * @struct Message
+     * @brief Control message. The fields not used by a type are 0
+     */
+    struct Message {
+        uint32_t type; /**< Type of the message (see MessageType) */
+        uint32_t version; /**< Version of the protocol (HELLO) */
+        int32_t slot; /**< Index of the slot (REQUEST, DONE) */
+        int32_t label; /**< Label predicted for the input of the slot (DONE) */
+        int32_t nbSlots; /**< Number of slots (HELLO, WELCOME) */
+        int32_t inputSize; /**< Number of floats of an input (WELCOME) */
+        int32_t outputSize; /**< Number of floats of an output (WELCOME) */
+        uint32_t outputOffset; /**< Offset in bytes of the output in a slot, the input is at the start of the slot (WELCOME) */
+        uint64_t slotSize; /**< Size in bytes of a slot (WELCOME) */
+    };
+
+    /**
+     * @struct StatsMessage
+     * @brief Answer to STATS: activity of the server since it started
+     */
+    struct StatsMessage {
+        uint32_t type; /**< STATS */
+        int32_t nbClients; /**< Number of connected clients */
+        int64_t nbRequests; /**< Number of requests computed */
+        int64_t nbBatches; /**< Number of batches computed */
+        float uptime; /**< Time since the server started, in seconds */
+        float requestsPerSecond; /**< Mean throughput since the server started */
+        float meanBatchSize; /**< Mean number of requests per batch */
+        float queueP50; /**< Median time (in microseconds) between the reception of a request and the start of its batch */
+        float queueP99; /**< 99th percentile of the time spent in the queue */
+        float computeP50; /**< Median time (in microseconds) of the forward pass of the batch of a request */
+        float computeP99; /**< 99th percentile of the time of the forward pass */
+        uint32_t reserved; /**< Zero */
+    };
+};
+
+#endif
@@ -0,0 +1,106 @@
+/**
+ * @file InferenceQueue.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of InferenceQueue.cpp
+ * @date 2024-01-31
+ */
+
+#ifndef INFERENCE_QUEUE_H
+#define INFERENCE_QUEUE_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include "NeuralNetwork.h"
+
+/**
+ * @class InferenceQueue
+ * @brief Thread-safe front-end batching the predictions requested by many threads. submit() copies the input in the pending batch and returns a future, and a scheduler thread runs the pending requests as one batch when it's full or when its first request has waited for the maximum wait time. A batched forward pass multiplies the throughput under load, and the maximum wait time bounds the latency added when the load is low.
+ * @remark The pending batch and the batch being computed are two buffers swapped by the scheduler (like the buffers of Checkpointer), so submit() only waits when the pending batch is full. The network must not be used by other threads while the queue runs.
+ */
+
+class InferenceQueue {
+public:
+    /**
+     * @struct Stats
+     * @brief Counters and latencies of the requests since the creation of the queue. The percentiles are computed on the last LATENCY_WINDOW requests
+     */
+    struct Stats {
+        long nbRequests; /**< Number of requests computed */
+        long nbBatches; /**< Number of batches computed */
+        float meanBatchSize; /**< Mean number of requests per batch */
+        float queueP50; /**< Median time (in microseconds) between the submission of a request and the start of its batch */
+        float queueP99; /**< 99th percentile of the time spent in the queue */
+        float computeP50; /**< Median time (in microseconds) of the forward pass of the batch of a request */
+        float computeP99; /**< 99th percentile of the time of the forward pass */
+    };
+
+    static const int LATENCY_WINDOW = 65536; /**< Number of requests whose latencies are kept for the percentiles */
+
+    /**
+     * Function called by the scheduler thread when a request submitted with a callback is done
+     * @param context Context given to submit()
+     * @param label Label of the input
+     */
+    typedef void (*Callback)(void* context, int label);
+
+private:
+    /**
+     * @struct PendingBatch
+     * @brief Requests gathered in one batch
+     */
+    struct PendingBatch {
+        std::vector<float> inputs; /**< Inputs of the requests, one row of the network input size per request */
+        std::vector<float> outputs; /**< Outputs of the network for the requests, one row of the network output size per request */
+        std::vector<float*> requestOutputs; /**< Where the output of each request is copied, nullptr if it's not needed */
+        std::vector<std::promise<int>> promises; /**< Promise of the label of each request submitted without a callback */
+        std::vector<Callback> callbacks; /**< Callback of each request, nullptr if it uses its promise */
+        std::vector<void*> contexts; /**< Context given to the callback of each request */
+        std::vector<std::chrono::steady_clock::time_point> submitTimes; /**< Time of submission of each request */
+        int size; /**< Number of requests */
+    };
+
+    NeuralNetwork &network; /**< Network running the batches */
+    int inputSize; /**< Number of values of an input */
+    int outputSize; /**< Number of values of an output */
+    int maxBatchSize; /**< Maximum number of requests of a batch */
+    std::chrono::microseconds maxWait; /**< Maximum time between the submission of the first request of a batch and the start of the batch */
+    PendingBatch batches[2]; /**< One batch gathers the requests while the other one is computed */
+    int pendingBatch; /**< Index of the batch gathering the requests */
+
+    long nbRequests; /**< Number of requests computed */
+    long nbBatches; /**< Number of batches computed */
+    std::vector<float> queueLatencies; /**< Last queue latencies (in microseconds), used as a circular buffer */
+    std::vector<float> computeLatencies; /**< Last compute latencies (in microseconds), same order as queueLatencies */
+    bool stop; /**< True when the scheduler must exit */
+
+    std::mutex mutex; /**< Protects the pending batch, pendingBatch and stop */
+    std::mutex statsMutex; /**< Protects the counters and the latencies */
+    std::condition_variable requestAvailable; /**< Wakes the scheduler when a request is submitted */
+    std::condition_variable spaceAvailable; /**< Wakes submit() when the pending batch was taken by the scheduler */
+    std::thread scheduler; /**< Thread running the batches */
+
+    void enqueue(const float* input, float* output, Callback callback, void* context, std::future<int>* label);
+    void schedulerLoop(bool pinThread);
+    void runBatch(PendingBatch &batch);
+    static float getPercentile(std::vector<float> &values, float percentile);
+
+public:
+    InferenceQueue(NeuralNetwork &network, int maxBatchSize, std::chrono::microseconds maxWait, bool pinScheduler = false);
+    ~InferenceQueue();
+    InferenceQueue(InferenceQueue const&) = delete;
+    InferenceQueue& operator=(InferenceQueue const&) = delete;
+
+    std::future<int> submit(const TensorView &input);
+    void submit(const float* input, float* output, Callback callback, void* context);
+    int getInputSize() const;
+    int getOutputSize() const;
+    Stats getStats();
+    int getMaxBatchSize() const;
+    std::chrono::microseconds getMaxWait() const;
+};
+
+#endif
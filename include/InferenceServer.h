@@ -0,0 +1,82 @@
+/**
+ * @file InferenceServer.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of InferenceServer.cpp
+ * @date 2024-02-01
+ */
+
+#ifndef INFERENCE_SERVER_H
+#define INFERENCE_SERVER_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include "NeuralNetwork.h"
+#include "InferenceQueue.h"
+#include "InferenceProtocol.h"
+
+/**
+ * @class InferenceServer
+ * @brief Long-running server answering the predictions of local clients with a network loaded once (see InferenceProtocol). An I/O thread accepts the clients and reads their control messages, the requests of all the clients are batched by an InferenceQueue whose scheduler answers each request when its batch is done.
+ * @remark The inputs are read from the shared memory of the clients and the outputs are written in it, so the tensors never go through the kernel: the only copy of an input is the one in the batch of the queue.
+ */
+
+class InferenceServer {
+private:
+    struct Client;
+
+    /**
+     * @struct SlotContext
+     * @brief Context of the callback of a request: the client and the slot to answer
+     */
+    struct SlotContext {
+        Client* client; /**< Client of the request */
+        int slot; /**< Slot of the request */
+    };
+
+    /**
+     * @struct Client
+     * @brief Connection of a client and its shared memory
+     */
+    struct Client {
+        int socket; /**< Socket of the connection. It's closed when the client is deleted, so that the callbacks in flight never write to a reused descriptor */
+        char* memory; /**< Shared memory of the slots, nullptr before HELLO */
+        size_t memorySize; /**< Size of the shared memory in bytes */
+        int nbSlots; /**< Number of slots */
+        std::vector<SlotContext> slots; /**< Context of the callback of each slot */
+        std::atomic<int> nbInFlight; /**< Number of requests submitted to the queue and not answered yet */
+        bool closed; /**< True when the connection is closed, the client is deleted once nbInFlight is 0 */
+    };
+
+    NeuralNetwork &network; /**< Network predicting the labels */
+    InferenceQueue queue; /**< Queue batching the requests of all the clients */
+    std::string socketPath; /**< Path of the listening socket */
+    int listenSocket; /**< Listening socket, -1 if the server is not running */
+    int wakePipe[2]; /**< Pipe written by stop() to wake the I/O thread */
+    std::vector<Client*> clients; /**< Connected clients, and the closed ones with requests in flight. Only used by the I/O thread */
+    std::atomic<int> nbClients; /**< Number of connected clients */
+    size_t outputOffset; /**< Offset in bytes of the output in a slot */
+    size_t slotSize; /**< Size in bytes of a slot */
+    std::atomic<bool> stopRequested; /**< True when run() must return */
+    std::chrono::steady_clock::time_point startTime; /**< Time when the server was created */
+
+    bool acceptClient();
+    bool handleMessage(Client* client);
+    int createSharedMemory(Client* client, int nbSlots);
+    static bool sendMessage(int socket, const InferenceProtocol::Message &message, int fd = -1);
+    void deleteClient(Client* client);
+    static void onRequestDone(void* context, int label);
+
+public:
+    InferenceServer(NeuralNetwork &network, const std::string &socketPath, int maxBatchSize, std::chrono::microseconds maxWait, bool pinThreads);
+    ~InferenceServer();
+    InferenceServer(InferenceServer const&) = delete;
+    InferenceServer& operator=(InferenceServer const&) = delete;
+
+    bool run();
+    void stop();
+    InferenceProtocol::StatsMessage getStats();
+};
+
+#endif
@@ -19,11 +19,15 @@
 class Instance {
 private:
     Tensor* data; /**< Input tensor (data that will be fed to the AI model) */
-    float* labelOneHot; /**< Label associated to the input vector in a one hot representation. It's shared between instances so it should not be deleted when an instance is deleted */
+    float* labelOneHot; /**< Label associated to the input vector in a one hot representation, nullptr if only the index of the class is given. It's shared between instances so it should not be deleted when an instance is deleted */
+    int label; /**< Index of the class of the input, -1 if the label is given in a one hot representation */
 public:
     Instance(Tensor* data, float* labelOneHot);
+    Instance(Tensor* data, int label);
     Tensor* getData();
     float* getOneHotLabel();
+    int getLabel();
+    bool isLabel(int predictedLabel);
 };
 
 
@@ -10,6 +10,8 @@
 
 #include "../include/ActivationFunction.h"
 #include "Tensor.h"
+#include "Optimizer.h"
+#include "BFloat16.h"
 
 /**
  * @class Layer
@@ -26,28 +28,97 @@ public:
     Layer(const std::vector<int> &inputShape, const std::vector<int> &outputShape, ActivationFunction* activationFunction);
     Layer(const std::vector<int> &inputShape, const std::vector<int> &outputShape);
     Layer(Layer const& copy);
-    ~Layer() = default;
+    virtual ~Layer() = default;
     int getDimInput();
     int getOutputDim();
     int getInputSize(int dim);
     int getOutputSize(int dim);
-    Tensor* getActivationDerivatives(const Tensor &input);
-    Tensor* getActivationValues(const Tensor &input);
+    ActivationFunction* getActivationFunction();
+    Tensor getActivationDerivatives(const TensorView &input);
+    Tensor getActivationValues(const TensorView &input);
+    void getActivationDerivativesInto(const TensorView &input, TensorView &output);
+    void getActivationValuesInto(const TensorView &input, TensorView &output);
+    bool hasActivationDerivativesFromOutput();
+    void multiplyByActivationDerivativesInPlace(TensorView &costDerivatives, const TensorView &output);
+    Tensor createOutput(int batchSize);
+    Tensor getOutput(const TensorView &input);
+    Tensor getPreActivationValues(const TensorView &input);
 
     /**
      * Get the output of the layer given input
      * @param input Input tensor
-     * @return Output tensor of this layer. The shape of this tensor must match the output shape of this layer
+     * @param output Tensor where the output of this layer is written. Its shape must match the output shape of this layer (see createOutput())
      */
-    virtual Tensor* getOutput(const Tensor &input) = 0;
+    virtual void getOutputInto(const TensorView &input, TensorView &output) = 0;
+
+    virtual void getOutputAndDerivativesInto(const TensorView &input, TensorView &output, TensorView &activationDerivatives);
+
+    /**
+     * Get the output of the layer and the derivatives of its activation function given an input stored in bfloat16 (mixed-precision training)
+     * @param input Input of the layer in bfloat16, batch size x input size contiguous elements
+     * @param output Tensor where the output of this layer is written. Its first dimension is the batch size
+     * @param activationDerivatives Tensor where the derivatives da/dz are written. Its shape is the same as the output
+     */
+    virtual void getOutputAndDerivativesInto(const BFloat16* input, TensorView &output, TensorView &activationDerivatives) = 0;
 
     /**
-     * Adjust the parameters of the layer depending on the gradient
-     * @param learningRate Learning rate of the neural network (it's the speed, the strength of the variation: if it's high, one iteration may change a lot the parameters and if it's low, then it won't change it much)
+     * Get the output of the layer and the derivatives of its activation function given an input stored in bfloat16, and write them in bfloat16 (mixed-precision training)
+     * @param input Input of the layer in bfloat16, batch size x input size contiguous elements
+     * @param output Float tensor used to compute the output of this layer. Its first dimension is the batch size
+     * @param halfOutput Array where the output is written in bfloat16 (same number of elements as output)
+     * @param halfActivationDerivatives Array where the derivatives da/dz are written in bfloat16 (same number of elements as output)
+     */
+    virtual void getOutputAndDerivativesInto(const BFloat16* input, TensorView &output, BFloat16* halfOutput, BFloat16* halfActivationDerivatives) = 0;
+
+    /**
+     * Calculate the sum over the batch of the gradient of the cost in respect for the parameters of the layer, multiplied by a factor, and write it in the given array. The parameters are not modified.
      * @param currentCostDerivatives Tensor containing dC/dz_i, where C is the total cost and z_i is the output i of the current layer
      * @param prevLayerOutput Tensor containing the output of the previous layer (it's the input of this layer)
+     * @param scale Factor applied to the sums (1 / batch size for the mean)
+     * @param gradients Array of getNbParameters() elements where the gradients are written
+     * @param accumulate True to add the gradients to the values already in the array (e.g. to sum the micro-batches of a batch), false to overwrite them
      */
-    virtual void adjustParams(float learningRate, Tensor* currentCostDerivatives, Tensor* prevLayerOutput) = 0;
+    virtual void computeGradientsInto(const TensorView &currentCostDerivatives, const TensorView &prevLayerOutput, float scale, float* gradients, bool accumulate) = 0;
+
+    /**
+     * Calculate the sum over the batch of the gradient of the cost in respect for the parameters of the layer, multiplied by a factor, given an input stored in bfloat16 (mixed-precision training)
+     * @param currentCostDerivatives Tensor containing dC/dz_i, where C is the total cost and z_i is the output i of the current layer
+     * @param prevLayerOutput Output of the previous layer in bfloat16, batch size x input size contiguous elements
+     * @param scale Factor applied to the sums (1 / batch size for the mean)
+     * @param gradients Array of getNbParameters() elements where the gradients are written
+     * @param accumulate True to add the gradients to the values already in the array, false to overwrite them
+     */
+    virtual void computeGradientsInto(const TensorView &currentCostDerivatives, const BFloat16* prevLayerOutput, float scale, float* gradients, bool accumulate) = 0;
+
+    /**
+     * Enable or disable the mixed-precision training: a bfloat16 copy of the parameters is used by the products of the training passes, and the parameters are still updated in float
+     * @param enabled True to enable it
+     */
+    virtual void setMixedPrecision(bool enabled) = 0;
+
+    /**
+     * Get the number of trainable parameters of the layer
+     * @return Number of parameters
+     */
+    virtual int getNbParameters() = 0;
+
+    /**
+     * Get the gradients used by applyGradients()
+     * @return Array of getNbParameters() elements
+     */
+    virtual float* getGradients() = 0;
+
+    /**
+     * Update the parameters of the layer with the gradients stored in getGradients()
+     * @param optimizer Optimizer computing the update of each parameter from its gradient
+     * @param learningRate Learning rate of the neural network
+     */
+    virtual void applyGradients(Optimizer &optimizer, float learningRate) = 0;
+
+    /**
+     * Clear the state kept by the optimizer for the parameters of the layer (momentum, moments...), e.g. when the optimizer is changed
+     */
+    virtual void resetOptimizerState() = 0;
 
     /**
      * Get the derivative of the pre-activation function output i (input of the activation function) in respect for the input j (output of the previous layer)
@@ -55,20 +126,27 @@ public:
      * @param prevLayerOutputIndex Index j (associated to input, it's the component xj in dfi/dxj)
      * @return Tensor of the derivatives dfi/dxj for the given i and j
      */
-    virtual Tensor* getPreActivationDerivatives(int currentLayerOutputIndex, int prevLayerOutputIndex) = 0;
+    virtual Tensor getPreActivationDerivatives(int currentLayerOutputIndex, int prevLayerOutputIndex) = 0;
 
     /**
      * Get the derivatives of the pre-activation function output i (input of the activation function) in respect for the input j (output of the previous layer) for all i,j
-     * @return Tensor of the derivatives dfi/dxj for all i,j
+     * @return Tensor of the derivatives dfi/dxj for all i,j. It belongs to the layer
      */
-    virtual Tensor* getPreActivationDerivatives() = 0;
+    virtual const TensorView& getPreActivationDerivatives() = 0;
 
     /**
      * Get the pre-activations values of the layer for the given input. It's the input of the activation function
      * @param input Input tensor given to this layer.
-     * @return Tensor of the pre-activation values z_i,j for the given input for all i,j.
+     * @param output Tensor where the pre-activation values z_i,j for the given input for all i,j are written. Its shape must match the output shape of this layer (see createOutput())
+     */
+    virtual void getPreActivationValuesInto(const TensorView &input, TensorView &output) = 0;
+
+    /**
+     * Get the derivatives of the cost in respect for the input of this layer, given the derivatives in respect for its pre-activation values
+     * @param currentCostDerivatives Tensor containing dC/dz_i, where C is the total cost and z_i is the pre-activation value i of this layer
+     * @param inputDerivatives Tensor where dC/dx_j, where x_j is the input j of this layer, is written for all j. Its shape is the input shape with the batch size as first dimension
      */
-    virtual Tensor* getPreActivationValues(const Tensor &input) = 0;
+    virtual void getInputDerivativesInto(const TensorView &currentCostDerivatives, TensorView &inputDerivatives) = 0;
 
     /**
      * Get a string representing the layer
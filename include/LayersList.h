@@ -22,8 +22,11 @@ private:
     std::vector<Layer*> layers; /**< List of layers */
 public:
     LayersList() = default;
-    ~LayersList() = default;
+    ~LayersList();
+    LayersList(LayersList const&) = delete;
+    LayersList& operator=(LayersList const&) = delete;
     void add(int nbNeurons, int nbNeuronsPrevLayer, ActivationFunction* activationFunction);
+    void add(Layer* layer);
     Layer* getLayer(int i);
     int getNbLayers();
 };
@@ -17,8 +17,12 @@
 
 class LeakyRelu : public ActivationFunction {
 public:
-    Tensor *getValues(const Tensor &input, int batchSize);
-    Tensor* getDerivatives(const Tensor &input, int batchSize);
+    void getValuesInto(const TensorView &input, int batchSize, TensorView &output);
+    void getDerivativesInto(const TensorView &input, int batchSize, TensorView &output);
+    bool canMultiplyByDerivativeInPlace();
+    void multiplyByDerivativeInPlace(TensorView &gradient, const TensorView &output, int batchSize);
+    bool getFusedActivation(Gemm::Activation &activation, float &parameter);
+    std::string getName();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,115 @@
+/**
+ * @file ModelFile.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of ModelFile.cpp
+ * @date 2024-01-29
+ */
+
+#ifndef MODEL_FILE_H
+#define MODEL_FILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include "DenseLayer.h"
+
+/**
+ * @class ModelFile
+ * @brief Binary file storing the layers of a network: a header, one record per layer (topology and activation function), then the raw weights and biases of each layer. Each array starts at an offset multiple of ALIGNMENT, so that the file can be mapped in memory and its arrays used in place. A checkpoint also stores the state needed to resume the training: the optimizer state and the pruning mask of each layer, the step counters and a state defined by the caller (epoch, random generator...).
+ * @remark The file is mapped privately (copy-on-write): the processes that map the same file share its pages in the page cache as long as they don't modify them. The numbers are stored in the byte order of the machine that wrote the file, a file written with another byte order is rejected
+ */
+
+class ModelFile {
+public:
+    static const uint32_t VERSION = 2; /**< Version of the format written by serializeInto(). The version 2 adds the training state, the fields it uses are zeros in the version 1 */
+    static const size_t ALIGNMENT = 64; /**< Alignment (in bytes) of the offset of each array in the file */
+    static const uint32_t BYTE_ORDER_MARK = 0x01020304; /**< Written in the header to detect files written with another byte order */
+
+    /**
+     * @enum LayerType
+     * @brief Type of a layer stored in the file
+     */
+    enum LayerType : uint32_t {
+        DENSE = 1
+    };
+
+    /**
+     * @struct Header
+     * @brief First bytes of the file
+     */
+    struct Header {
+        char magic[8]; /**< "AIMODEL" followed by a null character */
+        uint32_t version; /**< Version of the format */
+        uint32_t byteOrderMark; /**< BYTE_ORDER_MARK in the byte order of the file */
+        uint32_t nbLayers; /**< Number of layer records following the header */
+        int32_t inputSize; /**< Input size of the network */
+        uint64_t fileSize; /**< Size of the whole file in bytes */
+        uint64_t trainingStateOffset; /**< Offset in bytes of the TrainingState, 0 if the file only contains the model */
+        uint8_t reserved[24]; /**< Zeros, reserved for the next versions */
+    };
+
+    /**
+     * @struct LayerRecord
+     * @brief Description of a layer and position of its parameters in the file
+     */
+    struct LayerRecord {
+        uint32_t type; /**< Type of the layer (see LayerType) */
+        int32_t nbNeurons; /**< Output size of the layer */
+        int32_t nbNeuronsPrevLayer; /**< Input size of the layer */
+        uint32_t nbOptimizerStateValues; /**< Number of values kept by the optimizer for each parameter, 0 if the optimizer state is not stored */
+        char activationFunction[16]; /**< Name of the activation function (see ActivationFunction::getName()), null-terminated */
+        uint64_t weightsOffset; /**< Offset in bytes of the nbNeurons x nbNeuronsPrevLayer weights (row-major) */
+        uint64_t biasesOffset; /**< Offset in bytes of the nbNeurons biases */
+        uint64_t optimizerStateOffset; /**< Offset in bytes of the optimizer state of the weights then of the biases (same layout as in DenseLayer), 0 if it's not stored */
+        uint64_t pruningMaskOffset; /**< Offset in bytes of the nbNeurons x nbNeuronsPrevLayer pruning mask, 0 if it's not stored */
+    };
+
+    /**
+     * @struct TrainingState
+     * @brief Progress of the training stored in a checkpoint. It's followed by the state of the caller
+     */
+    struct TrainingState {
+        int64_t nbSteps; /**< Number of training steps (calls to fit()) of the network */
+        int64_t nbOptimizerSteps; /**< Number of steps of the optimizer */
+        int64_t epoch; /**< Epoch reached by the training (defined by the caller) */
+        float learningRate; /**< Learning rate of the network */
+        uint32_t userStateSize; /**< Size in bytes of the state of the caller following this structure */
+        char optimizer[16]; /**< Name of the optimizer (see Optimizer::getName()), truncated to 15 characters and null-terminated */
+        uint8_t reserved[16]; /**< Zeros, reserved for the next versions */
+    };
+
+private:
+    char* data; /**< Start of the mapped file */
+    size_t size; /**< Size of the mapped file in bytes */
+
+    ModelFile(char* data, size_t size);
+    bool isValid(const std::string &fileName) const;
+    bool isArrayValid(uint64_t offset, uint64_t nbBlocks, uint64_t nbValuesPerBlock) const;
+    static size_t align(size_t offset);
+    static size_t copyAligned(std::vector<char> &bytes, size_t offset, const void* array, size_t nbBytes);
+
+public:
+    ~ModelFile();
+    ModelFile(ModelFile const&) = delete;
+    ModelFile& operator=(ModelFile const&) = delete;
+
+    static std::shared_ptr<ModelFile> open(const std::string &fileName);
+    static bool serializeInto(std::vector<char> &bytes, int inputSize, const std::vector<DenseLayer*> &layers, const TrainingState* trainingState = nullptr, const std::string &userState = "");
+    static bool writeFile(const std::string &fileName, const std::vector<char> &bytes);
+
+    int getInputSize() const;
+    int getNbLayers() const;
+    const LayerRecord& getLayer(int i) const;
+    std::string getActivationFunctionName(int i) const;
+    float* getWeights(int i) const;
+    float* getBiases(int i) const;
+    float* getOptimizerState(int i) const;
+    float* getPruningMask(int i) const;
+    const TrainingState* getTrainingState() const;
+    std::string getUserState() const;
+    size_t getSize() const;
+};
+
+#endif
@@ -10,11 +10,17 @@
 
 #include <string>
 #include <vector>
+#include <mutex>
 #include "DenseLayer.h"
 #include "ActivationFunction.h"
 #include "LayersList.h"
 #include "../include/Batch.h"
 #include "Instance.h"
+#include "TensorArena.h"
+#include "ExecutionPlan.h"
+#include "Optimizer.h"
+
+class Pipeline;
 
 /**
  * @class NeuralNetwork
@@ -23,25 +29,141 @@
  */
 
 class NeuralNetwork {
+    friend class Pipeline;
+
 private:
+    /**
+     * @struct PruningSchedule
+     * @brief Gradual magnitude pruning applied during the training: the sparsity goes from 0 to finalSparsity between startStep and endStep, following s = finalSparsity * (1 - (1 - progress)^3)
+     */
+    struct PruningSchedule {
+        float finalSparsity; /**< Proportion of the weights of each dense layer that are 0 at the end, 0 if there is no schedule */
+        long startStep; /**< Training step (call to fit()) where the pruning starts */
+        long endStep; /**< Training step where the final sparsity is reached */
+        long frequency; /**< Number of training steps between two prunings */
+    };
+
     int inputSize; /**< Size of the input. This will be a list of dimension sizes in the future */ //TODO Change to a list of dimension sizes so that we can send multi dimensional data without flattening it beforehand
     float learningRate; /**< Learning rate */
     LayersList* layers; /**< List of the layers */
+    TensorArena arena; /**< Arena where the temporary tensors of a training step are allocated */
+    /**
+     * @struct Replica
+     * @brief Tensors and gradients of a worker of the data-parallel training: it computes the gradients of one shard of the batch
+     */
+    struct Replica {
+        ExecutionPlan* plan; /**< Plan built for the size of the shard. nullptr if it's not built yet */
+        TensorArena arena; /**< Arena where the temporary tensors of the worker are allocated */
+        std::vector<std::vector<float>> gradientBuffers; /**< Sum of the gradients of the shard for each layer, divided by the batch size */
+        std::vector<float*> gradients; /**< Data of gradientBuffers */
+    };
+
+    /**
+     * @struct InferenceContext
+     * @brief Tensors used by one evaluation at a time, so that several threads can evaluate the network concurrently
+     */
+    struct InferenceContext {
+        ExecutionPlan* plan; /**< Plan built for the largest batch evaluated with this context so far. nullptr if it's not built yet */
+        TensorArena arena; /**< Arena where the temporary tensors of the evaluation are allocated */
+    };
+
+    ExecutionPlan* trainingPlan; /**< Plan used by fit() for the whole batch or for its first shard. nullptr if it's not built yet */
+    std::vector<InferenceContext*> inferenceContexts; /**< Contexts used by evaluate() and predict(), one per evaluation that ran concurrently */
+    std::vector<InferenceContext*> freeInferenceContexts; /**< Contexts not used by an evaluation right now */
+    std::mutex inferenceContextsMutex; /**< Mutex protecting the lists of inference contexts */
+    std::vector<float*> layerGradients; /**< Gradients of each layer, where fit() writes the gradients of the whole batch */
+    std::vector<Replica*> replicas; /**< Workers computing the gradients of the other shards in the data-parallel training */
+    std::vector<float*> shardGradients; /**< Gradients of a layer for each shard, used by the reduction */
+    int dataParallelism; /**< Maximum number of shards of a batch, 0 to use one shard per thread of the pool */
+    long nbSteps; /**< Number of calls to fit() */
+    PruningSchedule pruningSchedule; /**< Pruning applied by fit() */
+    Optimizer* optimizer; /**< Optimizer used by fit() to update the parameters, SGD with an L2 weight decay of 0.02 / batch size by default */
+    bool defaultOptimizer; /**< True while the optimizer is the default one, whose weight decay is divided by the batch size */
+    bool mixedPrecision; /**< True if fit() stores the tensors kept for the backward pass and the weights used by the products in bfloat16 */
+    size_t microBatchMemory; /**< Memory budget (in bytes) of the training plans of fit(), 0 if the batches are not split in micro-batches */
+    size_t trainingBytesPerInstance; /**< Memory of the training plans for one instance, 0 if it's not computed yet */
+    bool recomputeActivations; /**< True if fit() only keeps the outputs of the checkpoints for the backward pass and recomputes the other ones */
+    std::vector<int> activationCheckpoints; /**< Layers whose outputs are kept when the checkpoints are chosen by the user */
+    size_t checkpointMemory; /**< Memory budget from which the checkpoints are chosen, 0 if they are chosen by the user */
+    int checkpointBatchSize; /**< Largest batch size seen, for which the checkpoints were chosen from the memory budget, 0 if they are not chosen yet */
+    std::vector<bool> keptOutputs; /**< True for each layer whose output is kept by the training plans, empty if all of them are kept */
+    int nbPipelineStages; /**< Number of stages of the pipeline-parallel training, 1 if it's disabled */
+    int nbPipelineMicroBatches; /**< Number of micro-batches in which the pipeline splits a batch */
+    bool pinPipelineThreads; /**< True if the threads of the stages are bound to cores */
+    Pipeline* pipeline; /**< Stages used by fit() when the pipeline-parallel training is enabled. nullptr if it's not built yet */
+    std::vector<ActivationFunction*> activationFunctions; /**< Activation functions created by load(), deleted with the network */
+
+    InferenceContext* acquireInferenceContext();
+    void releaseInferenceContext(InferenceContext* context);
+    TensorView getBatchOutput(InferenceContext &context, const TensorView &batchInput);
+    void getBatchOutputInto(InferenceContext &context, const TensorView &batchInput, TensorView &output);
+    static Tensor gatherInputs(const std::vector<Instance*> &instances, int begin, int end);
+    ExecutionPlan& getExecutionPlan(ExecutionPlan* &plan, int batchSize, bool training);
+    void deleteExecutionPlans();
+    void propagateCostDerivativesInto(const TensorView &currentCostDerivatives, const TensorView &activationDerivativesPrevLayer, Layer* layer, TensorView &nextCostDerivatives);
+    void propagateCostDerivativesInto(const TensorView &currentCostDerivatives, const BFloat16* activationDerivativesPrevLayer, Layer* layer, TensorView &nextCostDerivatives);
+    void applyPruningSchedule();
+    int getNbShards(int batchSize);
+    void updateKeptOutputs(int batchSize);
+    std::vector<bool> getKeptOutputs(int batchSize);
+    std::vector<bool> chooseKeptOutputs(int batchSize);
+    void backpropagate(ExecutionPlan &plan, const TensorView &input, const Batch &batch, int firstInstance, float gradientScale, bool accumulate, float* const* gradients);
+    void computeGradients(Batch &batch, int begin, int end, int planBatchSize, float gradientScale, bool accumulate);
+    void computeGradientsDataParallel(Batch &batch, int begin, int end, int planBatchSize, int nbShards, float gradientScale, bool accumulate);
+    void getCostDerivativesInto(const TensorView &prediction, const Batch &batch, int firstInstance, TensorView &costDerivatives);
+    void getOutputCostDerivativesInto(const TensorView &output, const TensorView &activationDerivatives, const Batch &batch, int firstInstance, TensorView &costDerivatives);
+    void getCrossEntropyDerivativesInto(const TensorView &output, const Batch &batch, int firstInstance, TensorView &costDerivatives);
+    bool getDenseLayers(std::vector<DenseLayer*> &denseLayers);
 
 public:
     NeuralNetwork(int nbNeuronsInputLayer);
     ~NeuralNetwork();
     int getNbLayers();
+    Layer* getLayer(int i);
+    int getInputSize();
     void addLayer(int nbNeurons, ActivationFunction* activationFunction);
-    Tensor * evaluate(const Tensor &input);
-    Tensor* getNextCostDerivatives(Tensor* currentCostDerivatives, Tensor* weightedSumsPrevLayer, int layerIndex);
-    void fit(Batch batch);
-    Tensor* getCostDerivatives(const Tensor &prediction, const Batch &batch);
+    Tensor evaluate(const TensorView &input);
+    Tensor evaluateBatch(const TensorView &inputs);
+    Tensor evaluateBatch(const std::vector<Instance*> &instances);
+    void evaluateBatchInto(const TensorView &inputs, TensorView &outputs);
+    Tensor getNextCostDerivatives(const TensorView &currentCostDerivatives, const TensorView &weightedSumsPrevLayer, int layerIndex);
+    void getNextCostDerivativesInto(const TensorView &currentCostDerivatives, const TensorView &weightedSumsPrevLayer, int layerIndex, TensorView &nextCostDerivatives);
+    void fit(Batch &batch);
+    Tensor getCostDerivatives(const TensorView &prediction, const Batch &batch);
+    void getCostDerivativesInto(const TensorView &prediction, const Batch &batch, TensorView &costDerivatives);
     void setLearningRate(float newValue);
+    void setMixedPrecision(bool enabled);
+    bool isMixedPrecision() const;
+    void setOptimizer(Optimizer* newOptimizer);
+    Optimizer* getOptimizer();
+    void setDataParallelism(int maxNbShards);
+    int getDataParallelism() const;
+    TensorArena::Stats getArenaStats() const;
+    size_t getTrainingMemory(int batchSize);
+    void setMicroBatchMemory(size_t nbBytes);
+    size_t getMicroBatchMemory() const;
+    int getMicroBatchSize(int batchSize);
+    void setActivationCheckpoints(const std::vector<int> &layerIndices);
+    void setActivationCheckpointMemory(size_t nbBytes);
+    void clearActivationCheckpoints();
+    std::vector<int> getActivationCheckpoints(int batchSize);
+    void setPipelineParallelism(int nbStages, int nbMicroBatches, bool pinThreads = false);
+    int getNbPipelineStages() const;
+    Pipeline* getPipeline();
 //    void save(std::string fileName);
-    int predict(const Tensor &input);
+    int predict(const TensorView &input);
+    std::vector<int> predictBatch(const TensorView &inputs);
+    std::vector<int> predictBatch(const std::vector<Instance*> &instances);
+    void predictTopK(const TensorView &inputs, int k, std::vector<int> &indices, std::vector<float> &probabilities);
     float getAccuracy(const std::vector<Instance*> &testSet);
-    void save(const std::string& fileName);
+    bool save(const std::string& fileName);
+    static NeuralNetwork* load(const std::string& fileName);
+    bool getCheckpointInto(std::vector<char> &bytes, long epoch, const std::string &userState);
+    bool restoreCheckpoint(const std::string &fileName, long &epoch, std::string &userState);
+    void prune(float threshold);
+    void pruneToSparsity(float sparsity);
+    float getSparsity();
+    void setPruningSchedule(float finalSparsity, long startStep, long endStep, long frequency);
 };
 
 #endif
\ No newline at end of file
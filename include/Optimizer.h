@@ -0,0 +1,63 @@
+/**
+ * @file Optimizer.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of Optimizer.cpp
+ * @date 2024-01-28
+ */
+
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <string>
+
+/**
+ * @class Optimizer
+ * @brief Interface for the algorithms updating the parameters of a model from their gradients (SGD, Adam...). Each update is a single pass over the parameters, the gradients and the state of the optimizer (momentum, moments...), split between the threads.
+ * @remark The weight decay is either decoupled (w -= learningRate * weightDecay * w, applied next to the update) or an L2 penalty (weightDecay * w added to the gradient before it's used by the optimizer). Both are the same for SGD without momentum.
+ */
+
+class Optimizer {
+protected:
+    float weightDecay; /**< Factor of the weight decay */
+    bool decoupledWeightDecay; /**< True if the weight decay is decoupled from the gradient, false if it's an L2 penalty */
+    long nbSteps; /**< Number of updates started with nextStep() */
+
+    /**
+     * Update the parameters of the range [begin, end) of an array
+     * @param learningRate Learning rate
+     * @param weightDecay Factor of the weight decay applied to these parameters (0 if they are not decayed)
+     * @param parameters Parameters updated
+     * @param gradients Gradients of the parameters
+     * @param state State of the optimizer for this array: getNbStateValues() blocks of size elements
+     * @param size Number of parameters of the array
+     * @param begin First parameter updated
+     * @param end Parameter after the last one updated
+     */
+    virtual void updateRange(float learningRate, float weightDecay, float* parameters, const float* gradients, float* state, int size, int begin, int end) = 0;
+
+public:
+    Optimizer(float weightDecay, bool decoupledWeightDecay);
+    virtual ~Optimizer() = default;
+
+    void update(float learningRate, float* parameters, const float* gradients, float* state, int size, bool applyWeightDecay);
+    void nextStep();
+    long getNbSteps() const;
+    void setNbSteps(long newValue);
+    float getWeightDecay() const;
+    void setWeightDecay(float newValue);
+    bool isWeightDecayDecoupled() const;
+
+    /**
+     * Get the number of values of the state of the optimizer for each parameter
+     * @return Number of state values per parameter (0 if the optimizer has no state)
+     */
+    virtual int getNbStateValues() const = 0;
+
+    /**
+     * Get the name of the optimizer
+     * @return Name
+     */
+    virtual std::string getName() const = 0;
+};
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * @file Pipeline.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of Pipeline.cpp
+ * @date 2024-01-30
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "LayersList.h"
+#include "TensorView.h"
+#include "TensorArena.h"
+#include "Batch.h"
+#include "Optimizer.h"
+
+class NeuralNetwork;
+
+/**
+ * @class Pipeline
+ * @brief Pipeline-parallel training: the layers are split in stages of consecutive layers, each one run by its own thread. A batch is split in micro-batches that stream through the stages with a 1F1B schedule (one forward, one backward): once the pipeline is full, each stage alternates between the forward pass of a micro-batch and the backward pass of an older one, so the stages work at the same time on different micro-batches. The gradients of the micro-batches are accumulated, then each stage updates its own layers.
+ * @remark This scales when the network is deep but its layers are too narrow to split a product between the threads. A stage only touches the weights of its layers, so they stay in the caches of its core (the threads can be pinned). A stage keeps the tensors of at most (number of stages - its index) micro-batches. The tensors are stored in float, even if the mixed-precision training is enabled.
+ */
+
+class Pipeline {
+private:
+    /**
+     * @struct Stage
+     * @brief Layers run by a thread and the tensors of the micro-batches in flight in these layers
+     */
+    struct Stage {
+        int firstLayer; /**< Index of the first layer of the stage */
+        int endLayer; /**< Index after the last layer of the stage */
+        int nbSlots; /**< Number of micro-batches whose tensors are kept at the same time */
+        std::vector<float> memory; /**< Memory of the tensors of the slots. It's always on the heap, even if the pipeline is used while an arena scope is active */
+        std::vector<TensorView> outputs; /**< Output of each layer for each slot: the tensor of the layer l in the slot k is at k * (endLayer - firstLayer) + l - firstLayer */
+        std::vector<TensorView> activationDerivatives; /**< Derivatives of the activation function of each layer for each slot (same layout as outputs) */
+        std::vector<TensorView> costDerivatives; /**< Derivatives of the cost in respect for the pre-activation values of each layer for each slot (same layout as outputs). The next stage writes the ones of the last layer */
+        TensorArena arena; /**< Arena where the temporary tensors of the stage are allocated */
+        std::atomic<int> nbForwards; /**< Number of micro-batches of the current step whose forward pass is done */
+        std::atomic<int> nbBackwards; /**< Number of micro-batches of the current step whose backward pass is done */
+        std::thread thread; /**< Thread running the stage */
+    };
+
+    NeuralNetwork &network; /**< Network trained, used for the cost derivatives */
+    LayersList &layers; /**< Layers of the network */
+    std::vector<Stage*> stages; /**< Stages, in the order of the layers */
+    std::vector<float*> gradients; /**< Gradients of each layer */
+    bool pinThreads; /**< True if the thread of each stage is bound to its own core, after the ones of the pinned workers of the thread pool */
+    int capacity; /**< Number of instances of the tensors of the slots */
+
+    Batch* batch; /**< Batch of the current step */
+    int microBatchSize; /**< Number of instances of the micro-batches of the current step (the last one can be smaller) */
+    int nbMicroBatches; /**< Number of micro-batches of the current step */
+    Optimizer* optimizer; /**< Optimizer of the current step */
+    float learningRate; /**< Learning rate of the current step */
+
+    std::mutex mutex; /**< Protects generation, nbRunningStages and stop */
+    std::condition_variable stepStarted; /**< Wakes the stages when a step starts */
+    std::condition_variable stepDone; /**< Wakes fit() when the last stage is done */
+    long generation; /**< Incremented for each step so that a stage doesn't run the same step twice */
+    int nbRunningStages; /**< Number of stages that haven't finished the current step */
+    bool stop; /**< True when the stages must exit */
+
+    void partition(int nbStages);
+    void allocateSlots();
+    void stageLoop(int s);
+    void runStage(int s);
+    void forward(int s, int m);
+    void backward(int s, int m);
+    int getSlot(int s, int m) const;
+    TensorView getInput(int s, int m, int layer, int nbInstances);
+    static void waitFor(const std::atomic<int> &counter, int value);
+
+public:
+    Pipeline(NeuralNetwork &network, LayersList &layers, int nbStages, bool pinThreads);
+    ~Pipeline();
+    Pipeline(Pipeline const&) = delete;
+    Pipeline& operator=(Pipeline const&) = delete;
+
+    void fit(Batch &batch, int nbMicroBatches, Optimizer &optimizer, float learningRate);
+    int getNbStages() const;
+    int getFirstLayer(int s) const;
+    int getEndLayer(int s) const;
+    size_t getNbBytes() const;
+};
+
+#endif
@@ -0,0 +1,46 @@
+/**
+ * @file QuantizedDenseLayer.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of QuantizedDenseLayer.cpp
+ * @date 2024-01-18
+ */
+
+#ifndef QUANTIZED_DENSE_LAYER_H
+#define QUANTIZED_DENSE_LAYER_H
+
+#include <cstdint>
+#include "DenseLayer.h"
+
+/**
+ * @class QuantizedDenseLayer
+ * @brief Inference-only copy of a DenseLayer whose weights are stored as int8. Each neuron (output channel) has its own symmetric weight scale and the input is quantized with a scale calibrated beforehand.
+ * @remark A real value x is represented by the int8 q = round(x / scale), clamped to [-127, 127]
+ */
+
+class QuantizedDenseLayer {
+private:
+    int nbNeurons; /**< Number of neurons of this layer (output size) */
+    int nbNeuronsPrevLayer; /**< Number of neurons of the previous layer (input size) */
+    int8_t* weights; /**< Quantized weights, the element i*nbNeuronsPrevLayer+j is w_i,j */
+    float* weightScales; /**< Scale of the weights of each neuron */
+    float* biases; /**< Biases of each neuron (not quantized) */
+    float inputScale; /**< Scale of the quantized input of this layer */
+    ActivationFunction* activationFunction; /**< Activation function of this layer (shared with the original layer) */
+
+public:
+    QuantizedDenseLayer(DenseLayer &layer, float inputScale);
+    QuantizedDenseLayer(QuantizedDenseLayer const& copy) = delete;
+    QuantizedDenseLayer& operator=(QuantizedDenseLayer const& copy) = delete;
+    ~QuantizedDenseLayer();
+
+    int getNbNeurons() const;
+    int getNbNeuronsPrevLayer() const;
+    float getInputScale() const;
+    size_t getNbParameterBytes() const;
+    void forward(const int8_t* input, int batchSize, float outputScale, int8_t* quantizedOutput, float* output) const;
+
+    static float getScale(float absMax);
+    static void quantize(const float* input, int size, float scale, int8_t* output);
+};
+
+#endif
@@ -0,0 +1,48 @@
+/**
+ * @file QuantizedNeuralNetwork.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of QuantizedNeuralNetwork.cpp
+ * @date 2024-01-18
+ */
+
+#ifndef QUANTIZED_NEURAL_NETWORK_H
+#define QUANTIZED_NEURAL_NETWORK_H
+
+#include <vector>
+#include <cstdint>
+#include "NeuralNetwork.h"
+#include "QuantizedDenseLayer.h"
+#include "Instance.h"
+
+/**
+ * @class QuantizedNeuralNetwork
+ * @brief Int8 copy of a trained network made only of dense layers, used for inference (post-training quantization). The input scale of each layer is calibrated on a set of instances given at creation.
+ * @remark The network copied must not be deleted while this one is used since the activation functions are shared
+ */
+
+class QuantizedNeuralNetwork {
+private:
+    int inputSize; /**< Size of the input */
+    float inputScale; /**< Scale of the quantized input of the network */
+    std::vector<QuantizedDenseLayer*> layers; /**< Quantized layers */
+    std::vector<int8_t> buffers[2]; /**< Quantized outputs of the layers, each layer reads the buffer written by the previous one and writes in the other one */
+    std::vector<float> outputBuffer; /**< Output of the last layer used by predict() */
+
+    void getBatchOutputInto(const float* input, int batchSize, float* output);
+
+public:
+    QuantizedNeuralNetwork(NeuralNetwork &network, const std::vector<Instance*> &calibrationSet);
+    QuantizedNeuralNetwork(QuantizedNeuralNetwork const& copy) = delete;
+    QuantizedNeuralNetwork& operator=(QuantizedNeuralNetwork const& copy) = delete;
+    ~QuantizedNeuralNetwork();
+
+    int getNbLayers();
+    int getOutputSize();
+    size_t getNbParameterBytes();
+    size_t getNbFloatParameterBytes();
+    Tensor evaluate(const TensorView &input);
+    int predict(const TensorView &input);
+    float getAccuracy(const std::vector<Instance*> &testSet);
+};
+
+#endif
@@ -0,0 +1,35 @@
+/**
+ * @file RmsProp.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of RmsProp.cpp
+ * @date 2024-01-28
+ */
+
+#ifndef RMS_PROP_H
+#define RMS_PROP_H
+
+#include "Optimizer.h"
+
+/**
+ * @class RmsProp
+ * @brief RMSProp optimizer: the gradient is divided by the square root of the exponential moving average of the squared gradients
+ */
+
+class RmsProp : public Optimizer {
+private:
+    float decay; /**< Decay rate of the mean of the squared gradients */
+    float epsilon; /**< Value added to the denominator to avoid dividing by 0 */
+
+protected:
+    void updateRange(float learningRate, float weightDecay, float* parameters, const float* gradients, float* state, int size, int begin, int end);
+
+public:
+    RmsProp(float decay = 0.9f, float epsilon = 1e-8f, float weightDecay = 0.0f, bool decoupledWeightDecay = false);
+
+    float getDecay() const;
+    float getEpsilon() const;
+    int getNbStateValues() const;
+    std::string getName() const;
+};
+
+#endif
@@ -0,0 +1,35 @@
+/**
+ * @file Sgd.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of Sgd.cpp
+ * @date 2024-01-28
+ */
+
+#ifndef SGD_H
+#define SGD_H
+
+#include "Optimizer.h"
+
+/**
+ * @class Sgd
+ * @brief Stochastic gradient descent, with an optional momentum (classical or Nesterov): v = momentum * v + g, then w -= learningRate * v (or g + momentum * v with Nesterov)
+ */
+
+class Sgd : public Optimizer {
+private:
+    float momentum; /**< Factor applied to the velocity at each step, 0 for the plain gradient descent */
+    bool nesterov; /**< True if the Nesterov momentum is used */
+
+protected:
+    void updateRange(float learningRate, float weightDecay, float* parameters, const float* gradients, float* state, int size, int begin, int end);
+
+public:
+    Sgd(float momentum = 0.0f, bool nesterov = false, float weightDecay = 0.0f, bool decoupledWeightDecay = false);
+
+    float getMomentum() const;
+    bool isNesterov() const;
+    int getNbStateValues() const;
+    std::string getName() const;
+};
+
+#endif
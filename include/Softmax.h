@@ -17,9 +17,11 @@
 
 class Softmax : public ActivationFunction {
 public:
-    Tensor *getValues(const Tensor &input, int batchSize);
-    Tensor* getDerivatives(const Tensor &input, int batchSize);
-private:
-    float getAbsMax(float* input, int size);
+    void getValuesInto(const TensorView &input, int batchSize, TensorView &output);
+    void getDerivativesInto(const TensorView &input, int batchSize, TensorView &output);
+    bool canMultiplyByDerivativeInPlace();
+    void multiplyByDerivativeInPlace(TensorView &gradient, const TensorView &output, int batchSize);
+    bool isFusedWithCrossEntropy();
+    std::string getName();
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+/**
+ * @file SparseMatrix.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of SparseMatrix.cpp
+ * @date 2024-01-24
+ */
+
+#ifndef SPARSE_MATRIX_H
+#define SPARSE_MATRIX_H
+
+#include <vector>
+#include <cstddef>
+#include "Gemm.h"
+
+/**
+ * @class SparseMatrix
+ * @brief Matrix stored in the compressed sparse row format (CSR): only the non-zero elements are stored, row by row, with their column index. It's used for the weights of pruned layers.
+ * @remark The sparsity pattern is fixed when the matrix is created, the values can then be updated from a dense matrix having the same pattern
+ */
+
+class SparseMatrix {
+private:
+    int nbRows; /**< Number of rows */
+    int nbCols; /**< Number of columns */
+    std::vector<int> rowStarts; /**< Index in values of the first element of each row, the last element is the number of non-zero elements */
+    std::vector<int> columns; /**< Column of each non-zero element */
+    std::vector<float> values; /**< Non-zero elements, row by row */
+    std::vector<int> columnStarts; /**< Index in transposedValues of the first element of each column (the matrix is also stored column by column for the products by S) */
+    std::vector<int> rows; /**< Row of each non-zero element, column by column */
+    std::vector<int> transposedPositions; /**< Index in values of each non-zero element, column by column */
+    std::vector<float> transposedValues; /**< Non-zero elements, column by column */
+
+public:
+    SparseMatrix(const float* dense, int nbRows, int nbCols);
+
+    int getNbRows() const;
+    int getNbCols() const;
+    int getNbNonZeros() const;
+    float getDensity() const;
+    size_t getNbBytes() const;
+    void updateValues(const float* dense);
+
+    void multiplyByTransposeInto(const float* x, int ldx, int batchSize, float* y, int ldy, const Gemm::Epilogue* epilogue) const;
+    void multiplyInto(const float* x, int ldx, int batchSize, float* y, int ldy) const;
+    void getProductGradientsInto(const float* d, int ldd, const float* x, int ldx, int batchSize, float alpha, float* gradients, bool accumulate) const;
+};
+
+#endif
@@ -10,34 +10,34 @@
 
 #include <vector>
 #include <string>
+#include <initializer_list>
+#include "TensorView.h"
 
 /**
  * @class Tensor
- * @brief Tensor of rank n (greater or equal to 1)
+ * @brief Tensor of rank n (greater or equal to 1). It owns its data, use TensorView (e.g. with reshape(), slice() or unsqueeze()) to change its shape without copying it
+ * @remark The data (and the tensor itself if it's created with new) is allocated in the current TensorArena if there is one, so such a tensor must not be used after its arena is reset
  */
 
-class Tensor {
+class Tensor : public TensorView {
 private:
-    int nDim; /**< Number of dimensions, also called the rank of a tensor. In the comments of this project I use both "dimension" and "rank" */
-    std::vector<int> dimSizes; /**< Size of each dimension */
-    int* strides; /**< Strides for each dimension (used to get and set data with coordinates) */
-    float* data; /**< Data (in a flattened representation) */
+    bool isDataInArena; /**< True if the data was allocated in a TensorArena (then it's not freed by the destructor) */
+
+    void allocateData();
 
 public:
     Tensor(int nDim, const std::vector<int> &dimSizes);
+    Tensor(int nDim, std::initializer_list<int> dimSizes);
+    Tensor(int nDim, const int* dimSizes);
     Tensor(int nDim, const std::vector<int> &dimSizes, const float *data);
     Tensor(Tensor const& copy);
+    Tensor(Tensor&& other) noexcept;
+    explicit Tensor(TensorView const& view);
     ~Tensor();
-    float get(const std::vector<int>& coord) const;
-    void set(const std::vector<int>& coord, float newValue);
-    int getNDim() const;
-    float * getData() const;
-    std::vector<int> getDimSizes() const;
-    std::string toString();
-    int size() const;
-    int getDimSize(int i) const;
-    float* getStart(const std::vector<int> &coordStart) const;
-    int getIndex(const std::vector<int> &coord) const;
+    Tensor& operator=(Tensor const& copy);
+    Tensor& operator=(Tensor&& other) noexcept;
 
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr);
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,91 @@
+/**
+ * @file TensorArena.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of TensorArena.cpp
+ * @date 2024-01-15
+ */
+
+#ifndef TENSOR_ARENA_H
+#define TENSOR_ARENA_H
+
+#include <cstddef>
+#include <vector>
+#include <atomic>
+
+/**
+ * @class TensorArena
+ * @brief Bump allocator used for the temporary tensors of a training step or an evaluation. All the allocations are 64-byte aligned and they are all freed at once when the arena is reset.
+ * @remark Tensors created while a TensorArena::Scope is active on the current thread are allocated in its arena, the others are allocated on the heap
+ */
+
+class TensorArena {
+public:
+    static const size_t ALIGNMENT = 64; /**< Alignment (in bytes) of every allocation, it's the size of a cache line and of an AVX-512 register */
+
+    /**
+     * @class Scope
+     * @brief Reset an arena and make it the current arena of this thread until the scope is left
+     */
+    class Scope {
+    private:
+        TensorArena* previous; /**< Arena that was current before this scope */
+    public:
+        explicit Scope(TensorArena &arena);
+        ~Scope();
+        Scope(Scope const&) = delete;
+        Scope& operator=(Scope const&) = delete;
+    };
+
+    /**
+     * @struct Stats
+     * @brief Counters of an arena since its creation
+     */
+    struct Stats {
+        long nbAllocations; /**< Number of allocations served by the arena */
+        long nbBlockAllocations; /**< Number of blocks allocated on the heap by the arena (this is 0 in the steady state) */
+        long nbResets; /**< Number of times the arena was reset */
+        size_t peakBytes; /**< Maximum number of bytes used between two resets */
+        size_t capacity; /**< Number of bytes currently reserved by the arena */
+    };
+
+private:
+    /**
+     * @struct Block
+     * @brief Chunk of memory from which the allocations are taken
+     */
+    struct Block {
+        char* data; /**< Start of the block (aligned) */
+        size_t capacity; /**< Size of the block in bytes */
+    };
+
+    std::vector<Block> blocks; /**< Blocks reserved by this arena */
+    int currentBlock; /**< Index of the block where the next allocation is done */
+    size_t offset; /**< Offset of the next allocation in the current block */
+    size_t nbBytesUsed; /**< Number of bytes allocated since the last reset (including the padding) */
+    size_t minBlockSize; /**< Minimum size of a new block */
+    Stats stats; /**< Counters of this arena */
+
+    static thread_local TensorArena* current; /**< Arena used by the tensors created on this thread, nullptr if there is none */
+    static std::atomic<long> nbHeapAllocations; /**< Number of tensor allocations done on the heap because no arena was active */
+
+    void addBlock(size_t capacity);
+    void releaseBlocks();
+
+public:
+    explicit TensorArena(size_t minBlockSize = 1 << 20);
+    ~TensorArena();
+    TensorArena(TensorArena const&) = delete;
+    TensorArena& operator=(TensorArena const&) = delete;
+
+    void* allocate(size_t nbBytes);
+    void reset();
+    size_t getNbBytesUsed() const;
+    Stats getStats() const;
+
+    static TensorArena* getCurrent();
+    static void* allocateTensorMemory(size_t nbBytes, bool &isInArena);
+    static void freeTensorMemory(void* ptr, bool isInArena);
+    static long getNbHeapAllocations();
+};
+
+#endif
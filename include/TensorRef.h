@@ -0,0 +1,76 @@
+/**
+ * @file TensorRef.h
+ * @author Robin MENEUST
+ * @brief Definition of the template class TensorRef
+ * @date 2024-01-17
+ */
+
+#ifndef TENSOR_REF_H
+#define TENSOR_REF_H
+
+#include "TensorView.h"
+#include <iostream>
+
+/**
+ * @class TensorRef
+ * @brief Accessor to the elements of a tensor whose rank N is known at compile time. The rank is checked once when it's created, so it's meant to be used in loops, e.g. TensorRef<2> w(weights); w(i,j) = 0;
+ * @remark The coordinates are only checked in debug builds (when NDEBUG is not defined)
+ * @tparam N Rank of the tensor
+ */
+
+template<int N>
+class TensorRef {
+    static_assert(N >= 1 && N <= TensorView::MAX_N_DIM, "Invalid rank");
+
+private:
+    float* data; /**< Data of the tensor (in a flattened representation) */
+    int dimSizes[N]; /**< Size of each dimension */
+    int strides[N]; /**< Strides for each dimension */
+
+public:
+    /**
+     * Create an accessor to the elements of a tensor
+     * @param view Tensor (or view) accessed. Its rank must be N
+     */
+    explicit TensorRef(const TensorView &view) : data(view.getData()) {
+        if(view.getNDim() != N) {
+            std::cerr << "ERROR: TensorRef of rank " << N << " created from a tensor of rank " << view.getNDim() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        for(int i=0; i<N; i++) {
+            dimSizes[i] = view.getDimSize(i);
+            strides[i] = view.getStride(i);
+        }
+    }
+
+    /**
+     * Get a reference to an element from its coordinates
+     * @param indices Coordinates of the element (N ints)
+     * @return Reference to the element at the given coordinates
+     */
+    template<typename... Indices>
+    float& operator()(Indices... indices) const {
+        static_assert(sizeof...(Indices) == N, "The number of coordinates must be equal to the rank");
+        const int coord[] = {static_cast<int>(indices)...};
+#ifndef NDEBUG
+        TensorView::checkCoordinates(N, dimSizes, N, coord);
+#endif
+
+        int index = 0;
+        for(int i=0; i<N; i++) {
+            index += coord[i] * strides[i];
+        }
+        return data[index];
+    }
+
+    /**
+     * Get the size of a dimension from its index
+     * @param i Index of the dimension
+     * @return Size of the dimension
+     */
+    int getDimSize(int i) const {
+        return dimSizes[i];
+    }
+};
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * @file TensorView.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of TensorView.cpp
+ * @date 2024-01-14
+ */
+
+#ifndef TENSOR_VIEW_H
+#define TENSOR_VIEW_H
+
+#include <vector>
+#include <string>
+#include <memory>
+
+/**
+ * @class TensorView
+ * @brief Non-owning view of a tensor of rank n (greater or equal to 1): a shape, strides and a pointer to the data. The data is either borrowed (the owner must outlive the view) or shared (the view keeps it alive).
+ * @remark Reshaping, slicing along the first (batch) dimension and unsqueezing never copy the data
+ */
+
+class TensorView {
+public:
+    static const int MAX_N_DIM = 6; /**< Maximum rank of a tensor. The shape is stored inline so that creating a tensor or a view does not allocate it */
+
+protected:
+    int nDim; /**< Number of dimensions, also called the rank of a tensor. In the comments of this project I use both "dimension" and "rank" */
+    int dimSizes[MAX_N_DIM]; /**< Size of each dimension */
+    int strides[MAX_N_DIM]; /**< Strides for each dimension (used to get and set data with coordinates) */
+    float* data; /**< Data (in a flattened representation) */
+    std::shared_ptr<float> owner; /**< Owner of the data if it's shared with this view, nullptr if the data is borrowed */
+
+    TensorView(int nDim, const int* dimSizes);
+
+public:
+    TensorView(int nDim, const std::vector<int> &dimSizes, float* data);
+    TensorView(int nDim, const std::vector<int> &dimSizes, const std::shared_ptr<float> &owner);
+    float get(const std::vector<int>& coord) const;
+    void set(const std::vector<int>& coord, float newValue);
+    int getNDim() const;
+    float * getData() const;
+    std::vector<int> getDimSizes() const;
+    const int* getShape() const;
+    std::string toString();
+    int size() const;
+    int getDimSize(int i) const;
+    float* getStart(const std::vector<int> &coordStart) const;
+    int getIndex(const std::vector<int> &coord) const;
+    bool isContiguous() const;
+    int getStride(int i) const;
+
+    template<typename... Indices>
+    float& at(Indices... indices) const;
+    static void checkCoordinates(int nDim, const int* dimSizes, int nbCoord, const int* coord);
+
+    TensorView reshape(int newNDim, const std::vector<int> &newDimSizes) const;
+    TensorView slice(int start, int end) const;
+    TensorView unsqueeze(int dim) const;
+};
+
+/**
+ * Get a reference to an element from its coordinates. The rank is known at compile time so no std::vector is created and the index computation is unrolled.
+ * @remark The coordinates are only checked in debug builds (when NDEBUG is not defined)
+ * @param indices Coordinates of the element (one int per dimension)
+ * @return Reference to the element at the given coordinates
+ */
+template<typename... Indices>
+float& TensorView::at(Indices... indices) const {
+    static_assert(sizeof...(Indices) >= 1 && sizeof...(Indices) <= MAX_N_DIM, "Invalid number of coordinates");
+    const int coord[] = {static_cast<int>(indices)...};
+#ifndef NDEBUG
+    checkCoordinates(nDim, dimSizes, sizeof...(Indices), coord);
+#endif
+
+    int index = 0;
+    for(int i=0; i<(int) sizeof...(Indices); i++) {
+        index += coord[i] * strides[i];
+    }
+    return data[index];
+}
+#endif
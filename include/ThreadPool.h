@@ -0,0 +1,113 @@
+/**
+ * @file ThreadPool.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of ThreadPool.cpp
+ * @date 2024-01-22
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+/**
+ * @class ThreadPool
+ * @brief Persistent worker threads used to split the work of a layer (matrix products, activation functions...) between the cores. The thread calling parallelFor() works too and waits until all the tasks are done.
+ * @remark A parallelFor() called from a task, or while another thread is already using the pool, is run on the calling thread only
+ */
+
+class ThreadPool {
+private:
+    /**
+     * @struct Job
+     * @brief Tasks given to the pool by one call to run(). It lives on the stack of the calling thread.
+     */
+    struct Job {
+        void (*function)(void* context, int task); /**< Function executed for each task */
+        void* context; /**< First argument of the function */
+        int nbTasks; /**< Number of tasks */
+        std::atomic<int> nextTask; /**< Index of the next task that is not started yet */
+        int nbActiveWorkers; /**< Number of workers working on this job (protected by the mutex) */
+    };
+
+    std::vector<std::thread> workers; /**< Worker threads (the calling thread is not included) */
+    std::mutex mutex; /**< Protects currentJob, generation, stop and the nbActiveWorkers of the jobs */
+    std::mutex runMutex; /**< Held by the thread using the pool */
+    std::condition_variable jobAvailable; /**< Wakes the workers when a job is given */
+    std::condition_variable jobDone; /**< Wakes the calling thread when the workers left the job */
+    Job* currentJob; /**< Job in progress, nullptr if there is none */
+    long generation; /**< Incremented for each new job so that a worker doesn't join the same job twice */
+    bool stop; /**< True when the workers must exit */
+    int nbThreads; /**< Number of threads working on a job (including the calling thread) */
+    bool pinThreads; /**< True if each worker is bound to one core */
+    long minWorkPerThread; /**< Minimum amount of work (approximately in floating point operations) given to a thread */
+
+    static thread_local bool isInTask; /**< True if the current thread is running a task */
+
+    void workerLoop();
+    static void runTasks(Job &job);
+    void run(int nbTasks, void (*function)(void* context, int task), void* context);
+
+public:
+    explicit ThreadPool(int nbThreads = 0, bool pinThreads = false, long minWorkPerThread = 100000);
+    ~ThreadPool();
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    int getNbThreads() const;
+    bool arePinned() const;
+    long getMinWorkPerThread() const;
+    int getNbThreadsFor(long work) const;
+
+    /**
+     * Call f(task) for each task in [0, nbTasks) in parallel, and wait until they are all done
+     * @tparam F Function or lambda taking (int task)
+     * @param nbTasks Number of tasks
+     * @param f Function called for each task
+     */
+    template<typename F>
+    void parallelTasks(int nbTasks, const F &f) {
+        if(nbTasks <= 1) {
+            if(nbTasks == 1) {
+                f(0);
+            }
+            return;
+        }
+        run(nbTasks, [](void* c, int task) {
+            (*static_cast<const F*>(c))(task);
+        }, const_cast<F*>(&f));
+    }
+
+    /**
+     * Split the range [0, size) in contiguous chunks and call f(begin, end) on each chunk in parallel. The number of chunks depends on the work to do so that each thread gets at least getMinWorkPerThread() operations.
+     * @tparam F Function or lambda taking (int begin, int end)
+     * @param size Size of the range
+     * @param workPerItem Approximate number of operations done for each element of the range
+     * @param f Function called on each chunk
+     */
+    template<typename F>
+    void parallelFor(int size, long workPerItem, const F &f) {
+        int nbChunks = std::min(size, getNbThreadsFor((long) size * workPerItem));
+        if(nbChunks <= 1) {
+            if(size > 0) {
+                f(0, size);
+            }
+            return;
+        }
+        parallelTasks(nbChunks, [&](int chunk) {
+            int begin = (int) ((long) size * chunk / nbChunks);
+            int end = (int) ((long) size * (chunk + 1) / nbChunks);
+            f(begin, end);
+        });
+    }
+
+    static ThreadPool& getInstance();
+    static void configure(int nbThreads, bool pinThreads, long minWorkPerThread);
+};
+
+#endif
@@ -0,0 +1,39 @@
+/**
+ * @file VectorMath.h
+ * @author Robin MENEUST
+ * @brief Functions prototypes and class definitions of VectorMath.cpp
+ * @date 2024-02-02
+ */
+
+#ifndef VECTOR_MATH_H
+#define VECTOR_MATH_H
+
+/**
+ * @class VectorMath
+ * @brief Element-wise kernels of the activation functions on float arrays, used by the activation functions and by the epilogue of the matrix multiplication. Each kernel has an AVX-512 and an AVX2 version, chosen from the instruction set used by Gemm, and a portable scalar version.
+ * @remark The exponential is computed the same way by all the versions (range reduction to [-ln(2)/2, ln(2)/2] and a polynomial), so the results only depend on the instruction set through the use of fused multiply-add. Its maximum relative error is ACCURATE_EXP_ERROR, or FAST_EXP_ERROR in the fast mode, which uses a polynomial of degree 3 instead of 5. It saturates at exp(88) and returns 0 below exp(-87). The input and output arrays can be the same.
+ */
+
+class VectorMath {
+public:
+    static constexpr float ACCURATE_EXP_ERROR = 2.0e-7f; /**< Maximum relative error of the exponential (about 2 units in the last place) */
+    static constexpr float FAST_EXP_ERROR = 8.0e-5f; /**< Maximum relative error of the exponential in the fast mode */
+
+    static void reluInto(const float* x, float* y, int n);
+    static void reluDerivativesInto(const float* x, float* d, int n);
+    static void leakyReluInto(const float* x, float* y, int n, float slope);
+    static void leakyReluDerivativesInto(const float* x, float* d, int n, float slope);
+    static void multiplyByReluDerivatives(const float* x, float* g, int n);
+    static void multiplyByLeakyReluDerivatives(const float* x, float* g, int n, float slope);
+    static void sigmoidInto(const float* x, float* y, int n);
+    static void sigmoidDerivativesInto(const float* y, float* d, int n);
+    static void multiplyBySigmoidDerivatives(const float* y, float* g, int n);
+    static float expInto(const float* x, float* y, int n, float scale, float offset);
+    static float max(const float* x, int n);
+    static float absMax(const float* x, int n);
+    static void scale(float* x, int n, float factor);
+    static void setFastExp(bool enabled);
+    static bool isFastExp();
+};
+
+#endif
@@ -0,0 +1,98 @@
+/**
+ * @file ActivationFunction.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the interface ActivationFunction shared by all the activation functions
+ * @date 2024-01-16
+ */
+
+#include "../include/ActivationFunction.h"
+#include "../include/Identity.h"
+#include "../include/Relu.h"
+#include "../include/LeakyRelu.h"
+#include "../include/Sigmoid.h"
+#include "../include/Softmax.h"
+
+/**
+ * Let f be the activation function. If input is a tensor (whose dimension is accepted by the function) then for all component xi of the input tensor, calculate f(xi) and return a tensor, whose size is the same as the input, that contains the result for each xi.
+ * @param input Input tensor
+ * @param batchSize Size of the batch. It's not used by all functions.
+ * @return Tensor of the outputs of the function for each component of the input tensor
+ */
+Tensor ActivationFunction::getValues(const TensorView &input, int batchSize) {
+    Tensor output(input.getNDim(), input.getShape());
+    getValuesInto(input, batchSize, output);
+    return output;
+}
+
+/**
+ * Let f be the activation function. If input is a tensor (whose dimension is accepted by the function) then for all component xi of the input tensor, calculate df(xi)/dxi and return a tensor, whose size is the same as the input, that contains the result for each xi.
+ * @param input Input tensor
+ * @param batchSize Size of the batch. It's not used by all functions.
+ * @return Tensor of the derivative of the function for each component of the input tensor
+ */
+Tensor ActivationFunction::getDerivatives(const TensorView &input, int batchSize) {
+    Tensor output(input.getNDim(), input.getShape());
+    getDerivativesInto(input, batchSize, output);
+    return output;
+}
+
+/**
+ * Apply the activation function to a tensor and replace its values by the results
+ * @param values Tensor passed through the function
+ * @param batchSize Size of the batch. It's not used by all functions.
+ */
+void ActivationFunction::applyInPlace(TensorView &values, int batchSize) {
+    getValuesInto(values, batchSize, values);
+}
+
+/**
+ * Check if multiplyByDerivativeInPlace() can be used, i.e. if the derivatives can be found from the outputs of the function without being stored. The backward pass then scales the cost derivatives directly instead of reading a tensor of derivatives
+ * @return False by default
+ */
+bool ActivationFunction::canMultiplyByDerivativeInPlace() {
+    return false;
+}
+
+/**
+ * Get the activation that the matrix multiplication epilogue must apply to compute this function, so that a layer can apply it while its output is still in the cache. This is only possible for element-wise functions.
+ * @param activation Set to the activation applied by the epilogue
+ * @param parameter Set to the parameter of this activation
+ * @return True if this function can be fused with the matrix multiplication, false otherwise (the default)
+ */
+bool ActivationFunction::getFusedActivation(Gemm::Activation &activation, float &parameter) {
+    (void) activation;
+    (void) parameter;
+    return false;
+}
+
+/**
+ * Check if the cost of a network whose last layer uses this function is the cross-entropy, whose derivatives in respect for the inputs of the function are computed directly from its outputs and the targets (see NeuralNetwork::getOutputCostDerivativesInto())
+ * @return False by default: the cost is the mean squared error, multiplied by the derivatives of the function
+ */
+bool ActivationFunction::isFusedWithCrossEntropy() {
+    return false;
+}
+
+/**
+ * Create an activation function from its name (see getName())
+ * @param name Name of the function
+ * @return Function allocated with new, nullptr if the name is unknown
+ */
+ActivationFunction* ActivationFunction::create(const std::string &name) {
+    if(name == "Identity") {
+        return new Identity();
+    }
+    if(name == "Relu") {
+        return new Relu();
+    }
+    if(name == "LeakyRelu") {
+        return new LeakyRelu();
+    }
+    if(name == "Sigmoid") {
+        return new Sigmoid();
+    }
+    if(name == "Softmax") {
+        return new Softmax();
+    }
+    return nullptr;
+}
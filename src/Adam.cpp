@@ -0,0 +1,169 @@
+/**
+ * @file Adam.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class Adam, the Adam and AdamW optimizers
+ * @date 2024-01-28
+ */
+
+#include "../include/Adam.h"
+#include "../include/Gemm.h"
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ADAM_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * Coefficients of an Adam update, computed once per range
+ */
+struct AdamCoefficients {
+    float learningRate; /**< Learning rate */
+    float l2; /**< Factor of the weight decay added to the gradient */
+    float decoupled; /**< Factor of the weight decay added to the step */
+    float beta1; /**< Decay rate of the first moment */
+    float beta2; /**< Decay rate of the second moment */
+    float correction1; /**< 1 / (1 - beta1^t) */
+    float correction2; /**< 1 / (1 - beta2^t) */
+    float epsilon; /**< Value added to the denominator */
+};
+
+/**
+ * Update the parameters w and their first and second moments m and v in a single pass
+ */
+static void updateScalar(const AdamCoefficients &c, float* w, const float* g, float* m, float* v, int begin, int end) {
+    for(int k=begin; k<end; k++) {
+        float gradient = g[k] + c.l2 * w[k];
+        m[k] = c.beta1 * m[k] + (1.0f - c.beta1) * gradient;
+        v[k] = c.beta2 * v[k] + (1.0f - c.beta2) * (gradient * gradient);
+        float step = (m[k] * c.correction1) / (std::sqrt(v[k] * c.correction2) + c.epsilon);
+        w[k] -= c.learningRate * (step + c.decoupled * w[k]);
+    }
+}
+
+#ifdef ADAM_X86
+
+/**
+ * AVX2 version of updateScalar(). No FMA is used so that the result is the same as the scalar version
+ */
+__attribute__((target("avx2")))
+static void updateAvx2(const AdamCoefficients &c, float* w, const float* g, float* m, float* v, int begin, int end) {
+    __m256 lr = _mm256_set1_ps(c.learningRate);
+    __m256 l2 = _mm256_set1_ps(c.l2);
+    __m256 decoupled = _mm256_set1_ps(c.decoupled);
+    __m256 beta1 = _mm256_set1_ps(c.beta1);
+    __m256 beta2 = _mm256_set1_ps(c.beta2);
+    __m256 oneMinusBeta1 = _mm256_set1_ps(1.0f - c.beta1);
+    __m256 oneMinusBeta2 = _mm256_set1_ps(1.0f - c.beta2);
+    __m256 correction1 = _mm256_set1_ps(c.correction1);
+    __m256 correction2 = _mm256_set1_ps(c.correction2);
+    __m256 epsilon = _mm256_set1_ps(c.epsilon);
+    int k = begin;
+    for(; k+8<=end; k+=8) {
+        __m256 wk = _mm256_loadu_ps(w + k);
+        __m256 gradient = _mm256_add_ps(_mm256_loadu_ps(g + k), _mm256_mul_ps(l2, wk));
+        __m256 mk = _mm256_add_ps(_mm256_mul_ps(beta1, _mm256_loadu_ps(m + k)), _mm256_mul_ps(oneMinusBeta1, gradient));
+        __m256 vk = _mm256_add_ps(_mm256_mul_ps(beta2, _mm256_loadu_ps(v + k)), _mm256_mul_ps(oneMinusBeta2, _mm256_mul_ps(gradient, gradient)));
+        _mm256_storeu_ps(m + k, mk);
+        _mm256_storeu_ps(v + k, vk);
+        __m256 denominator = _mm256_add_ps(_mm256_sqrt_ps(_mm256_mul_ps(vk, correction2)), epsilon);
+        __m256 step = _mm256_div_ps(_mm256_mul_ps(mk, correction1), denominator);
+        step = _mm256_add_ps(step, _mm256_mul_ps(decoupled, wk));
+        _mm256_storeu_ps(w + k, _mm256_sub_ps(wk, _mm256_mul_ps(lr, step)));
+    }
+    updateScalar(c, w, g, m, v, k, end);
+}
+
+#endif
+
+/**
+ * Create an Adam optimizer
+ * @param beta1 Decay rate of the mean of the gradients, in [0, 1)
+ * @param beta2 Decay rate of the mean of the squared gradients, in [0, 1)
+ * @param epsilon Value added to the denominator to avoid dividing by 0
+ * @param weightDecay Factor of the weight decay
+ * @param decoupledWeightDecay True for AdamW (the weight decay is not divided by the second moment), false if it's an L2 penalty added to the gradient
+ */
+Adam::Adam(float beta1, float beta2, float epsilon, float weightDecay, bool decoupledWeightDecay) : Optimizer(weightDecay, decoupledWeightDecay), beta1(beta1), beta2(beta2), epsilon(epsilon) {
+    if(beta1 < 0.0f || beta1 >= 1.0f || beta2 < 0.0f || beta2 >= 1.0f) {
+        std::cerr << "ERROR: The decay rates of Adam must be in [0, 1)" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Update the parameters of the range [begin, end) of an array
+ * @param learningRate Learning rate
+ * @param weightDecay Factor of the weight decay applied to these parameters
+ * @param parameters Parameters updated
+ * @param gradients Gradients of the parameters
+ * @param state First moment of each parameter, followed by the second moment of each parameter
+ * @param size Number of parameters of the array
+ * @param begin First parameter updated
+ * @param end Parameter after the last one updated
+ */
+void Adam::updateRange(float learningRate, float weightDecay, float* parameters, const float* gradients, float* state, int size, int begin, int end) {
+    // The moments start at 0, so they are divided by 1 - beta^t to remove the bias toward 0 of the first steps
+    double t = (double) std::max(nbSteps, 1L);
+    AdamCoefficients c;
+    c.learningRate = learningRate;
+    c.l2 = decoupledWeightDecay ? 0.0f : weightDecay;
+    c.decoupled = decoupledWeightDecay ? weightDecay : 0.0f;
+    c.beta1 = beta1;
+    c.beta2 = beta2;
+    c.correction1 = (float) (1.0 / (1.0 - std::pow((double) beta1, t)));
+    c.correction2 = (float) (1.0 / (1.0 - std::pow((double) beta2, t)));
+    c.epsilon = epsilon;
+
+    float* firstMoments = state;
+    float* secondMoments = state + size;
+#ifdef ADAM_X86
+    if(Gemm::getIsa() >= Gemm::AVX2) {
+        updateAvx2(c, parameters, gradients, firstMoments, secondMoments, begin, end);
+        return;
+    }
+#endif
+    updateScalar(c, parameters, gradients, firstMoments, secondMoments, begin, end);
+}
+
+/**
+ * Get the decay rate of the mean of the gradients
+ * @return Beta 1
+ */
+float Adam::getBeta1() const {
+    return beta1;
+}
+
+/**
+ * Get the decay rate of the mean of the squared gradients
+ * @return Beta 2
+ */
+float Adam::getBeta2() const {
+    return beta2;
+}
+
+/**
+ * Get the value added to the denominator of the step
+ * @return Epsilon
+ */
+float Adam::getEpsilon() const {
+    return epsilon;
+}
+
+/**
+ * Get the number of values of the state of the optimizer for each parameter
+ * @return 2 (first and second moments)
+ */
+int Adam::getNbStateValues() const {
+    return 2;
+}
+
+/**
+ * Get the name of the optimizer
+ * @return Name
+ */
+std::string Adam::getName() const {
+    return decoupledWeightDecay && weightDecay != 0.0f ? "AdamW" : "Adam";
+}
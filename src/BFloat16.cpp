@@ -0,0 +1,91 @@
+/**
+ * @file BFloat16.cpp
+ * @author Robin MENEUST
+ * @brief Conversions of arrays between float and bfloat16
+ * @date 2024-01-29
+ */
+
+#include "../include/BFloat16.h"
+#include "../include/Gemm.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BFLOAT16_X86
+#include <immintrin.h>
+#endif
+
+#ifdef BFLOAT16_X86
+
+/**
+ * AVX2 version of the conversion from float to bfloat16: same rounding as BFloat16::fromFloat(), 8 elements at a time
+ */
+__attribute__((target("avx2")))
+static size_t toBFloat16Avx2(const float* source, BFloat16* destination, size_t size) {
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i roundingBias = _mm256_set1_epi32(0x7fff);
+    const __m256i absMask = _mm256_set1_epi32(0x7fffffff);
+    const __m256i infinity = _mm256_set1_epi32(0x7f800000);
+    const __m256i quietBit = _mm256_set1_epi32(0x400000);
+    size_t i = 0;
+    for(; i+8<=size; i+=8) {
+        __m256i x = _mm256_castps_si256(_mm256_loadu_ps(source + i));
+        __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(x, 16), one);
+        __m256i rounded = _mm256_add_epi32(x, _mm256_add_epi32(roundingBias, lsb));
+        __m256i isNan = _mm256_cmpgt_epi32(_mm256_and_si256(x, absMask), infinity);
+        __m256i result = _mm256_srli_epi32(_mm256_blendv_epi8(rounded, _mm256_or_si256(x, quietBit), isNan), 16);
+        // Pack the 8 results of 32 bits in 8 values of 16 bits (the upper halves are 0, so there is no saturation)
+        __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(result), _mm256_extracti128_si256(result, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), packed);
+    }
+    return i;
+}
+
+/**
+ * AVX2 version of the conversion from bfloat16 to float, 8 elements at a time
+ */
+__attribute__((target("avx2")))
+static size_t toFloatAvx2(const BFloat16* source, float* destination, size_t size) {
+    size_t i = 0;
+    for(; i+8<=size; i+=8) {
+        __m256i x = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i)));
+        _mm256_storeu_ps(destination + i, _mm256_castsi256_ps(_mm256_slli_epi32(x, 16)));
+    }
+    return i;
+}
+
+#endif
+
+/**
+ * Round an array of floats to bfloat16
+ * @param source Floats converted
+ * @param destination Array where the bfloat16 values are written
+ * @param size Number of elements
+ */
+void BFloat16::convertInto(const float* source, BFloat16* destination, size_t size) {
+    size_t i = 0;
+#ifdef BFLOAT16_X86
+    if(Gemm::getIsa() >= Gemm::AVX2) {
+        i = toBFloat16Avx2(source, destination, size);
+    }
+#endif
+    for(; i<size; i++) {
+        destination[i] = fromFloat(source[i]);
+    }
+}
+
+/**
+ * Convert an array of bfloat16 to floats
+ * @param source Bfloat16 values converted
+ * @param destination Array where the floats are written
+ * @param size Number of elements
+ */
+void BFloat16::convertInto(const BFloat16* source, float* destination, size_t size) {
+    size_t i = 0;
+#ifdef BFLOAT16_X86
+    if(Gemm::getIsa() >= Gemm::AVX2) {
+        i = toFloatAvx2(source, destination, size);
+    }
+#endif
+    for(; i<size; i++) {
+        destination[i] = source[i].toFloat();
+    }
+}
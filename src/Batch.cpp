@@ -14,7 +14,25 @@
  * @param data Flattened Tensor containing all the data of the batch. The first dimension size of the original tensor is equal to the batch size. This can be deleted after calling this constructor, since the values are copied.
  * @param targets List of target output for each instance represented in a one-hot representation. Don't delete the content of the list after creating a batch since we just keep the address of the target data and not the values.
  */
-Batch::Batch(int nDimData, std::vector<int> dimSizes, float *data, const std::vector<float *> &targets) : size(dimSizes[0]), data(Tensor(nDimData, dimSizes, data)), targets(targets) {}
+Batch::Batch(int nDimData, std::vector<int> dimSizes, float *data, const std::vector<float *> &targets) : data(TensorView(nDimData, dimSizes, data)), targets(targets), size(dimSizes[0]) {
+    // The view shares the ownership of the copy, so it's freed with the last copy of this batch
+    std::shared_ptr<Tensor> copy = std::make_shared<Tensor>(nDimData, dimSizes, data);
+    this->data = TensorView(nDimData, dimSizes, std::shared_ptr<float>(copy, copy->getData()));
+}
+
+/**
+ * Create a batch from a view of its data, without copying it
+ * @param data View of the data of the batch. Its first dimension size is the batch size. If the view shares the ownership of its data, then the batch keeps it alive, otherwise the data must outlive the batch.
+ * @param targets List of target output for each instance represented in a one-hot representation. Don't delete the content of the list after creating a batch since we just keep the address of the target data and not the values.
+ */
+Batch::Batch(const TensorView &data, const std::vector<float *> &targets) : data(data), targets(targets), size(data.getDimSize(0)) {}
+
+/**
+ * Create a batch from a view of its data and the index of the class of each instance, without copying the data. The one-hot targets are never built: the cost derivatives are computed from the labels
+ * @param data View of the data of the batch. Its first dimension size is the batch size. If the view shares the ownership of its data, then the batch keeps it alive, otherwise the data must outlive the batch.
+ * @param labels Index of the target class of each instance
+ */
+Batch::Batch(const TensorView &data, const std::vector<int> &labels) : data(data), labels(labels), size(data.getDimSize(0)) {}
 
 /**
  * Get the size of the batch (number of instances)
@@ -26,17 +44,34 @@ int Batch::getSize() const {
 
 /**
  * Get the data of this batch
- * @return A tensor containing the data of the batch
+ * @return A view of the data of the batch
  */
-Tensor* Batch::getData() {
+TensorView* Batch::getData() {
     return &data;
 }
 
 /**
  * Get the target output corresponding to the ith instance of the batch.
  * @param i Index of the instance's target output we want to get
- * @return Target output of the instance i
+ * @return Target output of the instance i. Only available if hasLabels() is false
  */
 float* Batch::getTarget(int i) const {
     return targets[i];
 }
+
+/**
+ * Check if the targets are given by the index of their class instead of a one-hot representation
+ * @return True if getLabel() must be used, false if getTarget() must be used
+ */
+bool Batch::hasLabels() const {
+    return !labels.empty();
+}
+
+/**
+ * Get the index of the target class of the ith instance of the batch
+ * @param i Index of the instance
+ * @return Index of the class. Only available if hasLabels() is true
+ */
+int Batch::getLabel(int i) const {
+    return labels[i];
+}
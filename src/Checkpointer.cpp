@@ -0,0 +1,123 @@
+/**
+ * @file Checkpointer.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class Checkpointer, used to write the checkpoints of a training from a background thread
+ * @date 2024-01-29
+ */
+
+#include "../include/Checkpointer.h"
+#include "../include/ModelFile.h"
+
+/**
+ * Create a checkpointer and start its I/O thread
+ * @param fileName Name of the checkpoint file. It's replaced atomically by each checkpoint
+ */
+Checkpointer::Checkpointer(const std::string &fileName) : fileName(fileName), writtenBuffer(-1), pendingBuffer(-1), nbWritten(0), nbDropped(0), nbFailed(0), stop(false) {
+    ioThread = std::thread(&Checkpointer::ioLoop, this);
+}
+
+/**
+ * Write the pending checkpoint if there is one, then stop the I/O thread
+ */
+Checkpointer::~Checkpointer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    condition.notify_all();
+    ioThread.join();
+}
+
+/**
+ * Take a snapshot of the training state and give it to the I/O thread. This only copies the state in memory: the buffer is reused, so nothing is allocated once its size is reached, and the file is written in the background
+ * @param network Network whose training state is saved (see NeuralNetwork::getCheckpointInto())
+ * @param epoch Epoch reached by the training
+ * @param userState Other state of the caller needed to resume the training (e.g. its random generator)
+ * @return True if the snapshot was taken, false if the network can't be stored in a model file
+ */
+bool Checkpointer::save(NeuralNetwork &network, long epoch, const std::string &userState) {
+    std::unique_lock<std::mutex> lock(mutex);
+    // The I/O thread only holds the lock to swap the buffers, so it doesn't block the copy for long
+    int buffer = writtenBuffer == 0 ? 1 : 0;
+    if(!network.getCheckpointInto(buffers[buffer], epoch, userState)) {
+        return false;
+    }
+    if(pendingBuffer != -1) {
+        nbDropped++;
+    }
+    pendingBuffer = buffer;
+    lock.unlock();
+    condition.notify_all();
+    return true;
+}
+
+/**
+ * Wait until all the checkpoints saved so far are written (or dropped)
+ */
+void Checkpointer::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this] { return pendingBuffer == -1 && writtenBuffer == -1; });
+}
+
+/**
+ * Write the pending checkpoints until the checkpointer is destroyed
+ */
+void Checkpointer::ioLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        condition.wait(lock, [this] { return pendingBuffer != -1 || stop; });
+        if(pendingBuffer == -1) {
+            return;
+        }
+        writtenBuffer = pendingBuffer;
+        pendingBuffer = -1;
+
+        // save() only fills the other buffer, so this one can be written without the lock
+        lock.unlock();
+        bool written = ModelFile::writeFile(fileName, buffers[writtenBuffer]);
+        lock.lock();
+
+        if(written) {
+            nbWritten++;
+        } else {
+            nbFailed++;
+        }
+        writtenBuffer = -1;
+        condition.notify_all();
+    }
+}
+
+/**
+ * Get the name of the checkpoint file
+ * @return Name of the file
+ */
+const std::string& Checkpointer::getFileName() const {
+    return fileName;
+}
+
+/**
+ * Get the number of checkpoints written in the file
+ * @return Number of checkpoints written
+ */
+long Checkpointer::getNbWritten() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nbWritten;
+}
+
+/**
+ * Get the number of checkpoints replaced by a newer one before the I/O thread could write them
+ * @return Number of checkpoints dropped
+ */
+long Checkpointer::getNbDropped() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nbDropped;
+}
+
+/**
+ * Get the number of checkpoints that couldn't be written (the reason is written on the standard error)
+ * @return Number of failed writes
+ */
+long Checkpointer::getNbFailed() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nbFailed;
+}
@@ -6,11 +6,16 @@
  */
 
 #include "../include/DenseLayer.h"
+#include "../include/TensorRef.h"
+#include "../include/Gemm.h"
+#include "../include/ThreadPool.h"
 #include <iostream>
 #include <cstdlib>
 #include <cmath>
 #include <bits/stdc++.h>
 
+float DenseLayer::sparseDensityThreshold = 0.25f;
+
 
 /**
  * Create a dense neuron layer
@@ -18,7 +23,7 @@
  * @param nbNeuronsPrevLayer Number of neurons of the previous layer (input size)
  * @param activationFunction Activation function used (Softmax, Sigmoid...)
  */
-DenseLayer::DenseLayer(int nbNeurons, int nbNeuronsPrevLayer, ActivationFunction *activationFunction) : Layer({nbNeuronsPrevLayer},{nbNeurons}, activationFunction), weights(Tensor(2, {nbNeurons, nbNeuronsPrevLayer})), biases(nullptr) {
+DenseLayer::DenseLayer(int nbNeurons, int nbNeuronsPrevLayer, ActivationFunction *activationFunction) : Layer({nbNeuronsPrevLayer},{nbNeurons}, activationFunction), weights(2, {nbNeurons, nbNeuronsPrevLayer}, std::shared_ptr<float>(new float[(size_t) nbNeurons * nbNeuronsPrevLayer], std::default_delete<float[]>())), biases(nullptr), sparseWeights(nullptr) {
 	// Allocate memory and initialize neuron layer with random values for bias and weight
     // Use Uniform Xavier Initialization
 
@@ -35,22 +40,41 @@ DenseLayer::DenseLayer(int nbNeurons, int nbNeuronsPrevLayer, ActivationFunction
 		biases[i] = distribution(gen);
 	}
 
+    TensorRef<2> w(weights);
     for(int i=0; i<nbNeurons; i++){
         for(int j=0; j<nbNeuronsPrevLayer; j++) {
-            weights.set({i,j}, distribution(gen));
+            w(i,j) = distribution(gen);
         }
     }
 }
 
 /**
- * Copy a dense neuron layer
+ * Create a dense neuron layer whose weights and biases are stored in memory that it doesn't own (e.g. a mapped model file). They are used in place, nothing is copied
+ * @remark The memory must be writable if the layer is trained or pruned
+ * @param nbNeurons Number of neurons in the layer
+ * @param nbNeuronsPrevLayer Number of neurons of the previous layer (input size)
+ * @param activationFunction Activation function used (Softmax, Sigmoid...)
+ * @param weights Array of nbNeurons x nbNeuronsPrevLayer weights, w_i,j is at the index i * nbNeuronsPrevLayer + j
+ * @param biases Array of nbNeurons biases
+ * @param storage Owner of the memory of weights and biases, kept alive as long as the layer
+ */
+DenseLayer::DenseLayer(int nbNeurons, int nbNeuronsPrevLayer, ActivationFunction *activationFunction, float* weights, float* biases, const std::shared_ptr<void> &storage) : Layer({nbNeuronsPrevLayer},{nbNeurons}, activationFunction), weights(2, {nbNeurons, nbNeuronsPrevLayer}, weights), biases(biases), storage(storage), sparseWeights(nullptr) {}
+
+/**
+ * Copy a dense neuron layer. The copy owns its weights and biases, even if the copied layer doesn't
  * @param copy Copied neuron layer
  */
-DenseLayer::DenseLayer(DenseLayer const& copy) : Layer({copy.inputShape[0]},{copy.outputShape[0]}, copy.activationFunction), weights(copy.weights), biases(nullptr) {
+DenseLayer::DenseLayer(DenseLayer const& copy) : Layer({copy.inputShape[0]},{copy.outputShape[0]}, copy.activationFunction), weights(2, {copy.outputShape[0], copy.inputShape[0]}, std::shared_ptr<float>(new float[(size_t) copy.outputShape[0] * copy.inputShape[0]], std::default_delete<float[]>())), biases(nullptr), pruningMask(copy.pruningMask), mixedPrecisionWeights(copy.mixedPrecisionWeights), sparseWeights(nullptr) {
     if(copy.biases == nullptr || copy.weights.getNDim() != 2 || copy.activationFunction == nullptr) {
         return;
     }
 
+    std::copy(copy.weights.getData(), copy.weights.getData() + copy.weights.size(), weights.getData());
+
+    if(copy.sparseWeights != nullptr) {
+        sparseWeights = new SparseMatrix(*copy.sparseWeights);
+    }
+
     biases=new float[copy.outputShape[0]];
 	for(int i=0; i<copy.outputShape[0]; i++){
 		biases[i]=copy.biases[i];
@@ -64,7 +88,11 @@ DenseLayer::DenseLayer(DenseLayer const& copy) : Layer({copy.inputShape[0]},{cop
  */
 DenseLayer::~DenseLayer()
 {
-	delete [] biases;
+    // The biases are freed with the storage if the layer doesn't own them
+    if(storage == nullptr) {
+        delete [] biases;
+    }
+	delete sparseWeights;
 }
 
 /**
@@ -84,153 +112,631 @@ int DenseLayer::getNbNeuronsPrevLayer() {
 }
 
 /**
- * Get the weighted sums tensor from the previous layer output
- * @return Weighted sums tensor. For each batch, each component xi is the weighted sum of the ith neuron
+ * Get all the weights of this layer
+ * @return Tensor of rank 2 whose element (i,j) is the weight w_i,j. It belongs to the layer
  */
+const TensorView& DenseLayer::getWeights() {
+    return weights;
+}
 
-Tensor* DenseLayer::getPreActivationValues(const Tensor &input) {
-    Tensor* output = new Tensor(2, {input.getDimSize(0),getNbNeurons()});
-
-    float* outputData = output->getData();
-    float* weightsData = weights.getData();
-    float* inputData = input.getData();
+/**
+ * Get all the biases of this layer
+ * @return Array of the getNbNeurons() biases. It belongs to the layer
+ */
+const float* DenseLayer::getBiases() {
+    return biases;
+}
 
+/**
+ * Calculate the weighted sums X * W^T and apply the epilogue (bias, activation function...) to them while they are still in the cache
+ * @param input Tensor of the previous layer output
+ * @param output Tensor where the result is written
+ * @param epilogue Operations applied to the weighted sums
+ */
+void DenseLayer::multiplyByWeightsInto(const TensorView &input, TensorView &output, const Gemm::Epilogue &epilogue) {
     int nbNeuronsPrevLayer = getNbNeuronsPrevLayer();
-    int nbNeurons = getNbNeurons();
 
-    for(int b=0; b<input.getDimSize(0); b++) {
-        int k = 0;
-        int p = nbNeurons * b;
+    if(input.getStride(1) != 1 || output.getStride(1) != 1) {
+        std::cerr << "ERROR: The rows of the input and output of a dense layer must be contiguous" << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
-        int p2Init = b*nbNeuronsPrevLayer;
-        for (int i = 0; i < nbNeurons; i++) {
-            outputData[p] = getBias(i);
-            int p2 = p2Init;
+    if(sparseWeights != nullptr) {
+        sparseWeights->multiplyByTransposeInto(input.getData(), input.getStride(0), input.getDimSize(0), output.getData(), output.getStride(0), &epilogue);
+        return;
+    }
+    Gemm::multiply(false, true, input.getDimSize(0), getNbNeurons(), nbNeuronsPrevLayer, 1.0f, input.getData(), input.getStride(0), weights.getData(), nbNeuronsPrevLayer, 0.0f, output.getData(), output.getStride(0), &epilogue);
+}
 
-            for (int j = 0; j < nbNeuronsPrevLayer; j++) {
-                outputData[p] += inputData[p2] * weightsData[k];
-                k++;
-                p2++;
-            }
-            p++;
-        }
+/**
+ * Calculate the weighted sums X * W^T of an input stored in bfloat16 and apply the epilogue to them. The bfloat16 weights are used if the mixed precision is enabled
+ * @param input Previous layer output in bfloat16, batch size x input size contiguous elements
+ * @param output Tensor where the result is written. Its first dimension is the batch size
+ * @param epilogue Operations applied to the weighted sums
+ */
+void DenseLayer::multiplyByWeightsInto(const BFloat16* input, TensorView &output, const Gemm::Epilogue &epilogue) {
+    int batchSize = output.getDimSize(0);
+    int nbNeuronsPrevLayer = getNbNeuronsPrevLayer();
+    if(sparseWeights != nullptr || mixedPrecisionWeights.empty()) {
+        // The sparse and float kernels only read floats
+        Tensor floatInput = toFloatInput(input, batchSize);
+        multiplyByWeightsInto(floatInput, output, epilogue);
+        return;
+    }
+    if(output.getStride(1) != 1) {
+        std::cerr << "ERROR: The rows of the output of a dense layer must be contiguous" << std::endl;
+        exit(EXIT_FAILURE);
     }
+    Gemm::multiply(false, true, batchSize, getNbNeurons(), nbNeuronsPrevLayer, 1.0f, input, nbNeuronsPrevLayer, mixedPrecisionWeights.data(), nbNeuronsPrevLayer, 0.0f, output.getData(), output.getStride(0), &epilogue);
+}
 
-    return output;
+/**
+ * Convert an input stored in bfloat16 to a float tensor
+ * @remark The tensor is allocated in the current arena if there is one
+ * @param input Previous layer output in bfloat16, batch size x input size contiguous elements
+ * @param batchSize Batch size
+ * @return Input tensor in float
+ */
+Tensor DenseLayer::toFloatInput(const BFloat16* input, int batchSize) {
+    Tensor floatInput(2, {batchSize, getNbNeuronsPrevLayer()});
+    BFloat16::convertInto(input, floatInput.getData(), (size_t) floatInput.size());
+    return floatInput;
 }
 
+/**
+ * Get the weighted sums tensor from the previous layer output
+ * @param input Tensor of the previous layer output
+ * @param output Weighted sums tensor. For each batch, each component xi is the weighted sum of the ith neuron
+ */
+void DenseLayer::getPreActivationValuesInto(const TensorView &input, TensorView &output) {
+    Gemm::Epilogue epilogue = {biases, Gemm::IDENTITY, 0.0f, nullptr, 0};
+    multiplyByWeightsInto(input, output, epilogue);
+}
 
 /**
  * Get the output of the layer given the previous layer output (calculate the weighted sums and then the activation function)
+ * @remark If the activation function is element-wise, the bias and the activation are applied by the matrix multiplication to each tile of the output while it's in the cache. Otherwise (e.g. Softmax) the activation function is applied in place on the weighted sums.
  * @param input Tensor of the previous layer output
- * @return Output tensor of this layer
+ * @param output Output tensor of this layer
  */
-Tensor* DenseLayer::getOutput(const Tensor &input) {
-    Tensor* preActivationValues = getPreActivationValues(input);
-    Tensor* output = getActivationValues(*preActivationValues);
-    delete preActivationValues;
-    return output;
+void DenseLayer::getOutputInto(const TensorView &input, TensorView &output) {
+    Gemm::Epilogue epilogue = {biases, Gemm::IDENTITY, 0.0f, nullptr, 0};
+    if(activationFunction->getFusedActivation(epilogue.activation, epilogue.parameter)) {
+        multiplyByWeightsInto(input, output, epilogue);
+        return;
+    }
+    getPreActivationValuesInto(input, output);
+    getActivationValuesInto(output, output);
+}
+
+/**
+ * Get the output of the layer and the derivatives of its activation function (da/dz) in respect for the weighted sums
+ * @remark If the activation function is element-wise, everything is computed in one pass by the epilogue of the matrix multiplication and the weighted sums are never written in memory
+ * @param input Tensor of the previous layer output
+ * @param output Output tensor of this layer
+ * @param activationDerivatives Tensor where the derivatives da/dz are written. Its shape is the same as the output
+ */
+void DenseLayer::getOutputAndDerivativesInto(const TensorView &input, TensorView &output, TensorView &activationDerivatives) {
+    Gemm::Epilogue epilogue = {biases, Gemm::IDENTITY, 0.0f, activationDerivatives.getData(), activationDerivatives.getStride(0)};
+    if(activationFunction->getFusedActivation(epilogue.activation, epilogue.parameter) && activationDerivatives.getStride(1) == 1) {
+        multiplyByWeightsInto(input, output, epilogue);
+        return;
+    }
+    Layer::getOutputAndDerivativesInto(input, output, activationDerivatives);
+}
+
+/**
+ * Get the output of the layer and the derivatives of its activation function (da/dz) given an input stored in bfloat16, for the mixed-precision training
+ * @param input Previous layer output in bfloat16, batch size x input size contiguous elements
+ * @param output Output tensor of this layer
+ * @param activationDerivatives Tensor where the derivatives da/dz are written. Its shape is the same as the output
+ */
+void DenseLayer::getOutputAndDerivativesInto(const BFloat16* input, TensorView &output, TensorView &activationDerivatives) {
+    Gemm::Epilogue epilogue = {biases, Gemm::IDENTITY, 0.0f, activationDerivatives.getData(), activationDerivatives.getStride(0)};
+    if(activationFunction->getFusedActivation(epilogue.activation, epilogue.parameter) && activationDerivatives.getStride(1) == 1) {
+        multiplyByWeightsInto(input, output, epilogue);
+        return;
+    }
+    // The weighted sums are written in the derivatives tensor, then replaced by the derivatives
+    Gemm::Epilogue biasEpilogue = {biases, Gemm::IDENTITY, 0.0f, nullptr, 0};
+    multiplyByWeightsInto(input, activationDerivatives, biasEpilogue);
+    getActivationValuesInto(activationDerivatives, output);
+    getActivationDerivativesInto(activationDerivatives, activationDerivatives);
+}
+
+/**
+ * Get the output of the layer and the derivatives of its activation function given an input stored in bfloat16, and write them in bfloat16 for the mixed-precision training
+ * @remark If the activation function is element-wise, the epilogue of the matrix multiplication writes the bfloat16 values while the tile is in the cache, so the derivatives are never stored in float
+ * @param input Previous layer output in bfloat16, batch size x input size contiguous elements
+ * @param output Float tensor used to compute the output of this layer, its values are the output in float
+ * @param halfOutput Array where the output is written in bfloat16 (same number of elements as output)
+ * @param halfActivationDerivatives Array where the derivatives da/dz are written in bfloat16 (same number of elements as output)
+ */
+void DenseLayer::getOutputAndDerivativesInto(const BFloat16* input, TensorView &output, BFloat16* halfOutput, BFloat16* halfActivationDerivatives) {
+    Gemm::Epilogue epilogue = {biases, Gemm::IDENTITY, 0.0f, nullptr, 0, halfOutput, halfActivationDerivatives, getNbNeurons()};
+    if(activationFunction->getFusedActivation(epilogue.activation, epilogue.parameter)) {
+        multiplyByWeightsInto(input, output, epilogue);
+        return;
+    }
+    // The activation function needs float tensors, so its derivatives are computed in a temporary tensor (allocated in the current arena)
+    Tensor activationDerivatives(2, {output.getDimSize(0), getNbNeurons()});
+    getOutputAndDerivativesInto(input, output, activationDerivatives);
+    BFloat16::convertInto(output.getData(), halfOutput, (size_t) output.size());
+    BFloat16::convertInto(activationDerivatives.getData(), halfActivationDerivatives, (size_t) activationDerivatives.size());
 }
 
 /**
  * Get the weight w_i,j of this layer
+ * @remark The indices are only checked in debug builds (when NDEBUG is not defined)
  * @param neuron Index i
  * @param prevNeuron Index j
  * @return Weight w_i,j
  */
 float DenseLayer::getWeight(int neuron, int prevNeuron) {
-    if(neuron >= 0 && neuron < getNbNeurons() && prevNeuron >= 0 && prevNeuron < getNbNeuronsPrevLayer()) {
-        return weights.get({neuron,prevNeuron});
+#ifndef NDEBUG
+    if(neuron < 0 || neuron >= getNbNeurons() || prevNeuron < 0 || prevNeuron >= getNbNeuronsPrevLayer()) {
+        std::cerr << "getWeight(): Invalid neuron index and previous neuron index for weight" << std::endl;
+        exit(EXIT_FAILURE);
     }
-    std::cerr << "getWeight(): Invalid neuron index and previous neuron index for weight" << std::endl;
-    exit(EXIT_FAILURE);
+#endif
+    return weights.at(neuron, prevNeuron);
 }
 
 /**
  * Set the value of the weight w_i,j of this layer
+ * @remark The indices are only checked in debug builds (when NDEBUG is not defined). If the layer uses sparse weights, setting a pruned weight has no effect on the output
  * @param neuron Index i
  * @param prevNeuron Index j
  * @param newValue New value of the weight
  */
 void DenseLayer::setWeight(int neuron, int prevNeuron, float newValue) {
-    if(neuron >= 0 && neuron < getNbNeurons() && prevNeuron >= 0 && prevNeuron < getNbNeuronsPrevLayer()) {
-        weights.set({neuron,prevNeuron}, newValue);
-        return;
+#ifndef NDEBUG
+    if(neuron < 0 || neuron >= getNbNeurons() || prevNeuron < 0 || prevNeuron >= getNbNeuronsPrevLayer()) {
+        std::cerr << "setWeight(): Invalid neuron index and previous neuron index for weight" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+#endif
+    weights.at(neuron, prevNeuron) = newValue;
+    if(sparseWeights != nullptr) {
+        sparseWeights->updateValues(weights.getData());
+    }
+    if(!mixedPrecisionWeights.empty()) {
+        mixedPrecisionWeights[(size_t) neuron * getNbNeuronsPrevLayer() + prevNeuron] = BFloat16::fromFloat(newValue);
     }
-    exit(EXIT_FAILURE);
 }
 
 /**
  * Get the bias b_i of this layer
+ * @remark The index is only checked in debug builds (when NDEBUG is not defined)
  * @param neuron Index i
  * @return Bias b_i
  */
 float DenseLayer::getBias(int neuron) {
-    if(neuron >= 0 && neuron < getNbNeurons()) {
-        return biases[neuron];
+#ifndef NDEBUG
+    if(neuron < 0 || neuron >= getNbNeurons()) {
+        std::cerr << "Invalid neuron index for bias" << std::endl;
+        exit(EXIT_FAILURE);
     }
-    std::cerr << "Invalid neuron index for bias" << std::endl;
-    exit(EXIT_FAILURE);
+#endif
+    return biases[neuron];
 }
 
 /**
  * Set the value of the bias b_i of this layer
+ * @remark The index is only checked in debug builds (when NDEBUG is not defined)
  * @param neuron Index i
  * @param newValue New value of the bias
  */
 void DenseLayer::setBias(int neuron, float newValue) {
-    if(neuron >= 0 && neuron < getNbNeurons()) {
-        biases[neuron] = newValue;
-        return;
+#ifndef NDEBUG
+    if(neuron < 0 || neuron >= getNbNeurons()) {
+        std::cerr << "Invalid neuron index for bias" << std::endl;
+        exit(EXIT_FAILURE);
     }
-    std::cerr << "Invalid neuron index for bias" << std::endl;
-    exit(EXIT_FAILURE);
+#endif
+    biases[neuron] = newValue;
 }
 
 
 /**
- * Adjust the weights and biases depending on the gradient
- * @param learningRate Learning rate of the neural network (it's the speed, the strength of the variation: if it's high, one iteration may change a lot the parameters and if it's low, then it won't change it much)
+ * Calculate the mean over the batch of the gradient of the cost in respect for the weights and biases. The weights are not modified.
  * @param currentCostDerivatives Tensor containing dC/dz_i, where C is the total cost and z_i is the output i of the current layer
  * @param prevLayerOutput Tensor containing the output of the previous layer (it's the input of this layer)
  */
-void DenseLayer::adjustParams(float learningRate, Tensor* currentCostDerivatives, Tensor* prevLayerOutput) {
-    float* weightsData = weights.getData();
-    float* currentCostDerivativesData = currentCostDerivatives->getData();
-    float* prevLayerOutputData = prevLayerOutput->getData();
+void DenseLayer::computeGradients(const TensorView &currentCostDerivatives, const TensorView &prevLayerOutput) {
+    computeGradientsInto(currentCostDerivatives, prevLayerOutput, 1.0f / (float) currentCostDerivatives.getDimSize(0), getGradients(), false);
+}
+
+/**
+ * Calculate the sum over the batch of the gradient of the cost in respect for the weights and biases, multiplied by a factor, and write it in the given array. The weights are not modified.
+ * @param currentCostDerivatives Tensor containing dC/dz_i, where C is the total cost and z_i is the output i of the current layer
+ * @param prevLayerOutput Tensor containing the output of the previous layer (it's the input of this layer)
+ * @param scale Factor applied to the sums (1 / batch size for the mean)
+ * @param gradients Array of getNbParameters() elements where dC/dw_i,j (same layout as the weights) then dC/db_i are written. The gradients of the pruned weights are set to 0
+ * @param accumulate True to add the gradients to the values already in the array, false to overwrite them
+ */
+void DenseLayer::computeGradientsInto(const TensorView &currentCostDerivatives, const TensorView &prevLayerOutput, float scale, float* gradients, bool accumulate) {
+    int batchSize = currentCostDerivatives.getDimSize(0);
+    int nbNeurons = getNbNeurons();
+    int nbNeuronsPrevLayer = getNbNeuronsPrevLayer();
+
+    if(currentCostDerivatives.getStride(1) != 1 || prevLayerOutput.getStride(1) != 1) {
+        std::cerr << "ERROR: The rows of the cost derivatives and of the input of a dense layer must be contiguous" << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
-    int batchSize = currentCostDerivatives->getDimSize(0);
-    int currentLayerOutputDim1 = currentCostDerivatives->getDimSize(1);
-    int prevLayerOutputDim1 = prevLayerOutput->getDimSize(1);
+    const float* currentCostDerivativesData = currentCostDerivatives.getData();
+    int currentCostDerivativesStride = currentCostDerivatives.getStride(0);
 
-    int k=0;
-    for(int i=0; i<getNbNeurons(); i++) {
-        for (int j = 0; j < getNbNeuronsPrevLayer(); j++) {
-            int m=j;
-            // weightsData[k] = w_i,j
-            int p=i;
-
-            // Mean of the derivatives
-            double deltaWeight = 0.02 * weightsData[k]; // weight decay, L2: lambda d(sum w^2)/dw = lambda * 2 * w where lambda = 0.01
-            double deltaBias = 0.0f;
-            for (int b = 0; b < batchSize; b++) {
-                deltaWeight += currentCostDerivativesData[p] * prevLayerOutputData[m]; // delta = dC/da_k * da_k/dz_k * dz_k/dw_i,j
-                deltaBias += currentCostDerivativesData[p]; // delta = dC/da_k * da_k/dz_k
-                p += currentLayerOutputDim1;
-                m += prevLayerOutputDim1;
+    // dC/dw_i,j = mean over the batch of dC/dz_i * x_j, so dW = delta^T * X / batchSize. The pruned weights have no gradient, so they stay at 0
+    if(sparseWeights != nullptr) {
+        sparseWeights->getProductGradientsInto(currentCostDerivativesData, currentCostDerivativesStride, prevLayerOutput.getData(), prevLayerOutput.getStride(0), batchSize, scale, gradients, accumulate);
+    } else {
+        Gemm::multiply(true, false, nbNeurons, nbNeuronsPrevLayer, batchSize, scale, currentCostDerivativesData, currentCostDerivativesStride, prevLayerOutput.getData(), prevLayerOutput.getStride(0), accumulate ? 1.0f : 0.0f, gradients, nbNeuronsPrevLayer);
+        maskWeightGradients(gradients);
+    }
+
+    computeBiasGradientsInto(currentCostDerivatives, scale, gradients + weights.size(), accumulate);
+}
+
+/**
+ * Calculate the sum over the batch of the gradient of the cost in respect for the weights and biases, multiplied by a factor, given an input stored in bfloat16 (mixed-precision training). The product is accumulated in float
+ * @param currentCostDerivatives Tensor containing dC/dz_i, where C is the total cost and z_i is the output i of the current layer
+ * @param prevLayerOutput Output of the previous layer in bfloat16, batch size x input size contiguous elements
+ * @param scale Factor applied to the sums (1 / batch size for the mean)
+ * @param gradients Array of getNbParameters() elements where dC/dw_i,j (same layout as the weights) then dC/db_i are written
+ * @param accumulate True to add the gradients to the values already in the array, false to overwrite them
+ */
+void DenseLayer::computeGradientsInto(const TensorView &currentCostDerivatives, const BFloat16* prevLayerOutput, float scale, float* gradients, bool accumulate) {
+    int batchSize = currentCostDerivatives.getDimSize(0);
+    int nbNeuronsPrevLayer = getNbNeuronsPrevLayer();
+    if(sparseWeights != nullptr) {
+        Tensor floatInput = toFloatInput(prevLayerOutput, batchSize);
+        computeGradientsInto(currentCostDerivatives, floatInput, scale, gradients, accumulate);
+        return;
+    }
+
+    if(currentCostDerivatives.getStride(1) != 1) {
+        std::cerr << "ERROR: The rows of the cost derivatives of a dense layer must be contiguous" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    Gemm::multiply(true, false, getNbNeurons(), nbNeuronsPrevLayer, batchSize, scale, currentCostDerivatives.getData(), currentCostDerivatives.getStride(0), prevLayerOutput, nbNeuronsPrevLayer, accumulate ? 1.0f : 0.0f, gradients, nbNeuronsPrevLayer);
+    maskWeightGradients(gradients);
+    computeBiasGradientsInto(currentCostDerivatives, scale, gradients + weights.size(), accumulate);
+}
+
+/**
+ * Set the gradients of the pruned weights to 0 so that they stay pruned
+ * @param weightGradients Gradients of the weights (same layout as the weights)
+ */
+void DenseLayer::maskWeightGradients(float* weightGradients) {
+    if(pruningMask.empty()) {
+        return;
+    }
+    const float* maskData = pruningMask.data();
+    ThreadPool::getInstance().parallelFor(weights.size(), 2, [&](int begin, int end) {
+        for(int k=begin; k<end; k++) {
+            weightGradients[k] *= maskData[k];
+        }
+    });
+}
+
+/**
+ * Calculate the sum over the batch of dC/db_i = dC/dz_i, multiplied by a factor
+ * @param currentCostDerivatives Tensor containing dC/dz_i, where C is the total cost and z_i is the output i of the current layer
+ * @param scale Factor applied to the sums (1 / batch size for the mean)
+ * @param biasGradients Array where dC/db_i is written
+ * @param accumulate True to add dC/db_i to the values already in the array, false to overwrite them
+ */
+void DenseLayer::computeBiasGradientsInto(const TensorView &currentCostDerivatives, float scale, float* biasGradients, bool accumulate) {
+    int batchSize = currentCostDerivatives.getDimSize(0);
+    int nbNeurons = getNbNeurons();
+    const float* currentCostDerivativesData = currentCostDerivatives.getData();
+    int currentCostDerivativesStride = currentCostDerivatives.getStride(0);
+
+    if(accumulate) {
+        for(int b=0; b<batchSize; b++) {
+            const float* row = currentCostDerivativesData + b * currentCostDerivativesStride;
+            for(int i=0; i<nbNeurons; i++) {
+                biasGradients[i] += scale * row[i];
             }
-            deltaWeight /= (double) batchSize;
-            deltaBias /= (double) batchSize;
+        }
+        return;
+    }
+
+    std::fill(biasGradients, biasGradients + nbNeurons, 0.0f);
+    for(int b=0; b<batchSize; b++) {
+        const float* row = currentCostDerivativesData + b * currentCostDerivativesStride;
+        for(int i=0; i<nbNeurons; i++) {
+            biasGradients[i] += row[i];
+        }
+    }
+    for(int i=0; i<nbNeurons; i++) {
+        biasGradients[i] *= scale;
+    }
+}
 
-            // Adjust the parameters
-            float newWeightValue = weightsData[k] - learningRate * deltaWeight;
-            float newBiasValue = getBias(i) - learningRate * deltaBias;
+/**
+ * Get the number of trainable parameters
+ * @return Number of weights and biases
+ */
+int DenseLayer::getNbParameters() {
+    return weights.size() + getNbNeurons();
+}
+
+/**
+ * Get the gradients computed by computeGradients(), used by applyGradients()
+ * @remark They are allocated on the first call, so that a layer only used for inference doesn't reserve them
+ * @return Array of getNbParameters() elements: dC/dw_i,j (same layout as the weights) then dC/db_i
+ */
+float* DenseLayer::getGradients() {
+    if(gradients.empty()) {
+        gradients.assign(getNbParameters(), 0.0f);
+    }
+    return gradients.data();
+}
+
+/**
+ * Update the weights and biases with the gradients computed by computeGradients(). The weight decay of the optimizer is only applied to the weights.
+ * @param optimizer Optimizer computing the update of each parameter from its gradient
+ * @param learningRate Learning rate of the neural network
+ */
+void DenseLayer::applyGradients(Optimizer &optimizer, float learningRate) {
+    int nbWeights = weights.size();
+    int nbNeurons = getNbNeurons();
+    size_t nbStateValues = (size_t) optimizer.getNbStateValues();
+    if(optimizerState.size() != nbStateValues * getNbParameters()) {
+        optimizerState.assign(nbStateValues * getNbParameters(), 0.0f);
+    }
+
+    // The state of the weights comes first, each array has its own blocks of state values
+    float* layerGradients = getGradients();
+    float* weightsState = optimizerState.data();
+    float* biasesState = optimizerState.data() + nbStateValues * nbWeights;
+    optimizer.update(learningRate, weights.getData(), layerGradients, weightsState, nbWeights, true);
+    optimizer.update(learningRate, biases, layerGradients + nbWeights, biasesState, nbNeurons, false);
+
+    if(sparseWeights != nullptr) {
+        sparseWeights->updateValues(weights.getData());
+    }
+    updateMixedPrecisionWeights();
+}
+
+/**
+ * Clear the state kept by the optimizer for the weights and biases. It's allocated again by the next update
+ */
+void DenseLayer::resetOptimizerState() {
+    optimizerState.clear();
+    optimizerState.shrink_to_fit();
+}
+
+/**
+ * Get the state kept by the optimizer, e.g. to save it in a checkpoint
+ * @return State of the weights followed by the state of the biases (each state value has its own block of getNbParameters() elements), empty before the first update
+ */
+const std::vector<float>& DenseLayer::getOptimizerState() {
+    return optimizerState;
+}
+
+/**
+ * Replace the state kept by the optimizer, e.g. when a training is resumed from a checkpoint
+ * @param state Array with the layout of getOptimizerState(), copied by the layer
+ * @param size Number of elements of state, a multiple of getNbParameters()
+ */
+void DenseLayer::setOptimizerState(const float* state, size_t size) {
+    optimizerState.assign(state, state + size);
+}
 
-            weightsData[k] = newWeightValue;
-            setBias(i, newBiasValue);
-            k++;
+/**
+ * Get the pruning mask of the weights
+ * @return 1 for the weights kept and 0 for the pruned ones (same layout as the weights), empty if the layer was never pruned
+ */
+const std::vector<float>& DenseLayer::getPruningMask() {
+    return pruningMask;
+}
+
+/**
+ * Replace the weights, the biases and the pruning mask, e.g. when a training is resumed from a checkpoint. The sparse and bfloat16 copies of the weights are updated
+ * @param newWeights Array of getNbNeurons() x getNbNeuronsPrevLayer() weights, w_i,j is at the index i * getNbNeuronsPrevLayer() + j
+ * @param newBiases Array of getNbNeurons() biases
+ * @param newPruningMask Array with the layout of the weights (1 for the weights kept and 0 for the pruned ones), nullptr if the layer is not pruned
+ */
+void DenseLayer::setParameters(const float* newWeights, const float* newBiases, const float* newPruningMask) {
+    std::copy(newWeights, newWeights + weights.size(), weights.getData());
+    std::copy(newBiases, newBiases + getNbNeurons(), biases);
+
+    delete sparseWeights;
+    sparseWeights = nullptr;
+    if(newPruningMask != nullptr) {
+        pruningMask.assign(newPruningMask, newPruningMask + weights.size());
+        updateSparseWeights();
+    } else {
+        pruningMask.clear();
+    }
+    updateMixedPrecisionWeights();
+}
+
+/**
+ * Get the derivatives of the cost in respect for the input of this layer (output of the previous layer): dC/dx_j = sum over i of dC/dz_i * w_i,j
+ * @param currentCostDerivatives Tensor containing dC/dz_i, where C is the total cost and z_i is the output i of the current layer
+ * @param inputDerivatives Tensor where dC/dx_j is written for all j, for all the batch
+ */
+void DenseLayer::getInputDerivativesInto(const TensorView &currentCostDerivatives, TensorView &inputDerivatives) {
+    int batchSize = currentCostDerivatives.getDimSize(0);
+    int nbNeuronsPrevLayer = getNbNeuronsPrevLayer();
+
+    if(currentCostDerivatives.getStride(1) != 1 || inputDerivatives.getStride(1) != 1) {
+        std::cerr << "ERROR: The rows of the cost derivatives of a dense layer must be contiguous" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // For the whole batch it's delta * W
+    if(sparseWeights != nullptr) {
+        sparseWeights->multiplyInto(currentCostDerivatives.getData(), currentCostDerivatives.getStride(0), batchSize, inputDerivatives.getData(), inputDerivatives.getStride(0));
+        return;
+    }
+    if(!mixedPrecisionWeights.empty()) {
+        Gemm::multiply(false, false, batchSize, nbNeuronsPrevLayer, getNbNeurons(), 1.0f, currentCostDerivatives.getData(), currentCostDerivatives.getStride(0), mixedPrecisionWeights.data(), nbNeuronsPrevLayer, 0.0f, inputDerivatives.getData(), inputDerivatives.getStride(0));
+        return;
+    }
+    Gemm::multiply(false, false, batchSize, nbNeuronsPrevLayer, getNbNeurons(), 1.0f, currentCostDerivatives.getData(), currentCostDerivatives.getStride(0), weights.getData(), nbNeuronsPrevLayer, 0.0f, inputDerivatives.getData(), inputDerivatives.getStride(0));
+}
+
+/**
+ * Prune the weights whose absolute value is below a threshold: they are set to 0 and they stay at 0 during the next trainings. The weights already pruned stay pruned.
+ * @remark If the density becomes low enough, the sparse kernels are used instead of the dense matrix multiplication (see setSparseDensityThreshold())
+ * @param threshold Weights w such that |w| < threshold are pruned
+ */
+void DenseLayer::prune(float threshold) {
+    float* weightsData = weights.getData();
+    int nbWeights = weights.size();
+    if(pruningMask.empty()) {
+        pruningMask.assign(nbWeights, 1.0f);
+    }
+    for(int k=0; k<nbWeights; k++) {
+        if(std::fabs(weightsData[k]) < threshold) {
+            pruningMask[k] = 0.0f;
         }
+        weightsData[k] *= pruningMask[k];
     }
+
+    // The momentum of a pruned weight would move it away from 0, so its optimizer state is cleared too
+    int nbStateBlocks = (int) (optimizerState.size() / getNbParameters());
+    for(int j=0; j<nbStateBlocks; j++) {
+        float* weightsState = optimizerState.data() + (size_t) j * nbWeights;
+        for(int k=0; k<nbWeights; k++) {
+            weightsState[k] *= pruningMask[k];
+        }
+    }
+    updateSparseWeights();
+    updateMixedPrecisionWeights();
+}
+
+/**
+ * Prune the weights with the lowest absolute values so that the given proportion of the weights is 0
+ * @param sparsity Proportion of the weights that must be 0 (between 0 and 1)
+ */
+void DenseLayer::pruneToSparsity(float sparsity) {
+    int nbWeights = weights.size();
+    int nbPruned = (int) (std::min(std::max(sparsity, 0.0f), 1.0f) * (float) nbWeights);
+    if(nbPruned <= 0) {
+        return;
+    }
+
+    // The threshold is the smallest absolute value that is kept
+    std::vector<float> absValues(nbWeights);
+    const float* weightsData = weights.getData();
+    for(int k=0; k<nbWeights; k++) {
+        absValues[k] = std::fabs(weightsData[k]);
+    }
+    if(nbPruned >= nbWeights) {
+        prune(std::numeric_limits<float>::infinity());
+        return;
+    }
+    std::nth_element(absValues.begin(), absValues.begin() + nbPruned, absValues.end());
+    prune(absValues[nbPruned]);
+}
+
+/**
+ * Get the proportion of non-zero weights
+ * @return Density of the weights (between 0 and 1)
+ */
+float DenseLayer::getDensity() {
+    if(sparseWeights != nullptr) {
+        return sparseWeights->getDensity();
+    }
+    const float* weightsData = weights.getData();
+    int nbWeights = weights.size();
+    int nbNonZeros = 0;
+    for(int k=0; k<nbWeights; k++) {
+        nbNonZeros += weightsData[k] != 0.0f;
+    }
+    return nbWeights > 0 ? (float) nbNonZeros / (float) nbWeights : 0.0f;
+}
+
+/**
+ * Check if the sparse kernels are used for this layer
+ * @return True if the weights are used in the CSR format
+ */
+bool DenseLayer::isSparse() {
+    return sparseWeights != nullptr;
+}
+
+/**
+ * Get the memory needed to store the weights, in the format currently used
+ * @return Number of bytes of the weights (dense or CSR)
+ */
+size_t DenseLayer::getNbWeightBytes() {
+    if(sparseWeights != nullptr) {
+        return sparseWeights->getNbBytes();
+    }
+    return (size_t) weights.size() * sizeof(float);
+}
+
+/**
+ * Choose between the dense and the sparse kernels from the density of the weights, and build the CSR weights if they are used
+ */
+void DenseLayer::updateSparseWeights() {
+    delete sparseWeights;
+    sparseWeights = nullptr;
+
+    SparseMatrix candidate(weights.getData(), getNbNeurons(), getNbNeuronsPrevLayer());
+    if(candidate.getDensity() < sparseDensityThreshold) {
+        sparseWeights = new SparseMatrix(std::move(candidate));
+    }
+}
+
+/**
+ * Round the weights to bfloat16 if the mixed precision is enabled
+ */
+void DenseLayer::updateMixedPrecisionWeights() {
+    if(mixedPrecisionWeights.empty()) {
+        return;
+    }
+    const float* weightsData = weights.getData();
+    BFloat16* halfWeightsData = mixedPrecisionWeights.data();
+    ThreadPool::getInstance().parallelFor(weights.size(), 2, [&](int begin, int end) {
+        BFloat16::convertInto(weightsData + begin, halfWeightsData + begin, (size_t) (end - begin));
+    });
+}
+
+/**
+ * Enable or disable the mixed-precision training. When it's enabled, the training passes multiply by a copy of the weights rounded to bfloat16, while the optimizer updates the float weights and the inference uses the float weights
+ * @remark The sparse kernels always use the float weights
+ * @param enabled True to enable it
+ */
+void DenseLayer::setMixedPrecision(bool enabled) {
+    if(!enabled) {
+        mixedPrecisionWeights.clear();
+        mixedPrecisionWeights.shrink_to_fit();
+        return;
+    }
+    mixedPrecisionWeights.resize(weights.size());
+    updateMixedPrecisionWeights();
+}
+
+/**
+ * Check if the mixed-precision training is enabled
+ * @return True if the training passes use bfloat16 weights
+ */
+bool DenseLayer::isMixedPrecision() {
+    return !mixedPrecisionWeights.empty();
+}
+
+/**
+ * Set the density of the weights below which the layers use the sparse kernels. It's applied the next time a layer is pruned.
+ * @param threshold Density threshold (between 0 and 1). 0 means that the sparse kernels are never used
+ */
+void DenseLayer::setSparseDensityThreshold(float threshold) {
+    sparseDensityThreshold = threshold;
+}
+
+/**
+ * Get the density of the weights below which the layers use the sparse kernels
+ * @return Density threshold
+ */
+float DenseLayer::getSparseDensityThreshold() {
+    return sparseDensityThreshold;
 }
 
 /**
@@ -240,18 +746,18 @@ void DenseLayer::adjustParams(float learningRate, Tensor* currentCostDerivatives
  * @param prevLayerOutputIndex Index j (jth neuron of the previous layer)
  * @return Weight w_i,j
  */
-Tensor* DenseLayer::getPreActivationDerivatives(int currentLayerOutputIndex, int prevLayerOutputIndex) {
-    Tensor* output = new Tensor(1, {1});
-    output->set({0},getWeight(currentLayerOutputIndex, prevLayerOutputIndex));
+Tensor DenseLayer::getPreActivationDerivatives(int currentLayerOutputIndex, int prevLayerOutputIndex) {
+    Tensor output(1, {1});
+    output.at(0) = getWeight(currentLayerOutputIndex, prevLayerOutputIndex);
     return output;
 }
 
 /**
  * Get the derivative of the weighted sum for all i,j in respect for the input j (output of the previous layer). This is the weight w_i,j of the neuron currentLayerOutputIndex in the current layer that is associated to the neuron prevLayerOutputIndex in the previous layer
- * @return Tensor of rank 2 containing all the weights weight w_i,j
+ * @return Tensor of rank 2 containing all the weights weight w_i,j. It belongs to the layer
  */
-Tensor *DenseLayer::getPreActivationDerivatives() {
-    return &weights;
+const TensorView& DenseLayer::getPreActivationDerivatives() {
+    return weights;
 }
 
 /**
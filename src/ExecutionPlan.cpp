@@ -0,0 +1,432 @@
+/**
+ * @file ExecutionPlan.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class ExecutionPlan, used to run the layers of a network without allocating or looking up anything
+ * @date 2024-01-26
+ */
+
+#include "../include/ExecutionPlan.h"
+#include <iostream>
+#include <algorithm>
+
+/**
+ * Build the plan of a network: compute the shape of every intermediate tensor, when it's written and when it's read for the last time, and give it a buffer
+ * @remark The steps are the forward pass of each layer, then the computation of the cost derivatives and the backward pass of each layer, from the last one to the first one. When some outputs are recomputed, the backward pass of a checkpoint whose previous layer is not kept is preceded by a step recomputing the outputs and activation derivatives of the layers between this checkpoint and the previous one. A tensor is only needed between its first step and its last step.
+ * @param layersList Layers of the network
+ * @param batchSize Batch size of the tensors
+ * @param training True if the plan is used by fit(), false if only the outputs are needed
+ * @param mixedPrecision True if the tensors kept for the backward pass are stored in bfloat16 (training only)
+ * @param keptOutputs For each layer, true if its output is kept for the backward pass and false if it's recomputed (the output of the last layer is always kept). Empty to keep all of them. It's ignored by the mixed-precision plans
+ */
+ExecutionPlan::ExecutionPlan(LayersList &layersList, int batchSize, bool training, bool mixedPrecision, const std::vector<bool> &keptOutputs) : batchSize(batchSize), nbInstances(batchSize), training(training), mixedPrecision(training && mixedPrecision), savedInput(nullptr), nbBytesWithoutReuse(0) {
+    int nbLayers = layersList.getNbLayers();
+    if(nbLayers <= 0 || batchSize <= 0) {
+        std::cerr << "ERROR: An execution plan needs at least one layer and a positive batch size" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if(!keptOutputs.empty() && (int) keptOutputs.size() != nbLayers) {
+        std::cerr << "ERROR: The plan of " << nbLayers << " layers needs one checkpoint flag per layer" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    for(int i=0; i<nbLayers; i++) {
+        layers.push_back(layersList.getLayer(i));
+    }
+    if(training) {
+        this->keptOutputs.assign(nbLayers, true);
+        if(!keptOutputs.empty() && !this->mixedPrecision) {
+            this->keptOutputs = keptOutputs;
+            this->keptOutputs[nbLayers - 1] = true;
+        }
+        // The cost derivatives of the last layer overwrite its output, so its activation derivatives are stored unless the cost is fused with them (cross-entropy of a softmax). The bfloat16 derivatives of the mixed-precision plans are already half the size
+        this->derivativesFromOutputs.assign(nbLayers, false);
+        for(int i=0; i<nbLayers && !this->mixedPrecision; i++) {
+            this->derivativesFromOutputs[i] = i < nbLayers - 1 ? layers[i]->hasActivationDerivativesFromOutput() : layers[i]->getActivationFunction()->isFusedWithCrossEntropy();
+        }
+    }
+
+    std::vector<Value> values;
+    std::vector<int> outputValues(nbLayers);
+    std::vector<int> activationDerivativesValues;
+    std::vector<int> costDerivativesValues;
+    std::vector<int> forwardOutputValues;
+    std::vector<int> savedOutputValues(nbLayers, -1);
+    std::vector<int> savedActivationDerivativesValues(nbLayers, -1);
+    int savedInputValue = -1;
+    int nbSteps;
+
+    if(!training) {
+        // Step i is the forward pass of the layer i, its output is read by the next one
+        for(int i=0; i<nbLayers; i++) {
+            outputValues[i] = addValue(values, layers[i]->getOutputSize(0) * batchSize, i, i + 1);
+        }
+        nbSteps = nbLayers + 1;
+    } else {
+        // Step nbLayers computes the cost derivatives of the last layer, then come the backward passes from the last layer to the first one, the backward pass of a checkpoint being preceded by the recomputation of the layers below it if needed. Without recomputation, step 2 * nbLayers - l is the backward pass of the layer l
+        std::vector<int> backwardSteps(nbLayers + 1);
+        std::vector<int> recomputeSteps(nbLayers, -1);
+        int step = nbLayers + 1;
+        for(int l=nbLayers-1; l>=0; l--) {
+            if(l > 0 && !this->keptOutputs[l-1] && this->keptOutputs[l]) {
+                recomputeSteps[l] = step++;
+            }
+            backwardSteps[l] = step++;
+        }
+        // The output of the last layer is read by the computation of its cost derivatives
+        backwardSteps[nbLayers] = nbLayers;
+
+        activationDerivativesValues.resize(nbLayers);
+        costDerivativesValues.resize(nbLayers);
+        forwardOutputValues.resize(nbLayers);
+        if(this->mixedPrecision) {
+            // The input of the first layer is converted to bfloat16 before its forward pass, and read again by its backward pass
+            savedInputValue = addValue(values, layers[0]->getInputSize(0) * batchSize, 0, 2 * nbLayers, -1, true);
+        }
+        for(int i=0; i<nbLayers; i++) {
+            int size = layers[i]->getOutputSize(0) * batchSize;
+            // The output and the activation derivatives of the layer i are read by the backward pass of the layer i + 1
+            int lastStep = backwardSteps[i + 1];
+            if(!this->keptOutputs[i]) {
+                // The forward pass only writes an output read by the next layer, the tensors of the backward pass are written by the recomputation below the next checkpoint
+                int checkpoint = i + 1;
+                while(!this->keptOutputs[checkpoint]) {
+                    checkpoint++;
+                }
+                forwardOutputValues[i] = addValue(values, size, i, i + 1);
+                outputValues[i] = addValue(values, size, recomputeSteps[checkpoint], lastStep);
+                activationDerivativesValues[i] = this->derivativesFromOutputs[i] ? -1 : addValue(values, size, recomputeSteps[checkpoint], lastStep);
+            } else if(this->mixedPrecision && i < nbLayers - 1) {
+                // The float output is only used by the forward pass of the layer, the next steps read the bfloat16 copies. The derivatives are directly written in bfloat16
+                outputValues[i] = addValue(values, size, i, i);
+                activationDerivativesValues[i] = -1;
+                savedOutputValues[i] = addValue(values, size, i, lastStep, -1, true);
+                savedActivationDerivativesValues[i] = addValue(values, size, i, lastStep, -1, true);
+            } else {
+                outputValues[i] = addValue(values, size, i, lastStep);
+                activationDerivativesValues[i] = this->derivativesFromOutputs[i] ? -1 : addValue(values, size, i, lastStep);
+            }
+            if(this->keptOutputs[i]) {
+                forwardOutputValues[i] = outputValues[i];
+            }
+        }
+        // The cost derivatives of the last layer are computed from its output element by element, so they can overwrite it
+        int last = nbLayers - 1;
+        costDerivativesValues[last] = addValue(values, layers[last]->getOutputSize(0) * batchSize, nbLayers, backwardSteps[last], outputValues[last]);
+        for(int l=last-1; l>=0; l--) {
+            costDerivativesValues[l] = addValue(values, layers[l]->getOutputSize(0) * batchSize, backwardSteps[l + 1], backwardSteps[l]);
+        }
+        nbSteps = step;
+    }
+
+    for(int capacity : assignBuffers(values, nbSteps, false)) {
+        buffers.emplace_back(capacity);
+    }
+    for(int capacity : assignBuffers(values, nbSteps, true)) {
+        halfBuffers.emplace_back(capacity);
+    }
+
+    for(int i=0; i<nbLayers; i++) {
+        outputs.push_back(createView(values, outputValues[i], layers[i]));
+    }
+    for(size_t i=0; i<activationDerivativesValues.size(); i++) {
+        activationDerivatives.push_back(activationDerivativesValues[i] >= 0 ? createView(values, activationDerivativesValues[i], layers[i]) : TensorView(1, {batchSize}, nullptr));
+        costDerivatives.push_back(createView(values, costDerivativesValues[i], layers[i]));
+        forwardOutputs.push_back(createView(values, forwardOutputValues[i], layers[i]));
+    }
+    for(int i=0; i<nbLayers; i++) {
+        savedOutputs.push_back(savedOutputValues[i] >= 0 ? halfBuffers[values[savedOutputValues[i]].buffer].data() : nullptr);
+        savedActivationDerivatives.push_back(savedActivationDerivativesValues[i] >= 0 ? halfBuffers[values[savedActivationDerivativesValues[i]].buffer].data() : nullptr);
+    }
+    savedInput = savedInputValue >= 0 ? halfBuffers[values[savedInputValue].buffer].data() : nullptr;
+
+    fullViews.insert(fullViews.end(), outputs.begin(), outputs.end());
+    fullViews.insert(fullViews.end(), activationDerivatives.begin(), activationDerivatives.end());
+    fullViews.insert(fullViews.end(), costDerivatives.begin(), costDerivatives.end());
+    fullViews.insert(fullViews.end(), forwardOutputs.begin(), forwardOutputs.end());
+}
+
+/**
+ * Add an intermediate tensor to the plan
+ * @param values Intermediate tensors of the plan
+ * @param size Number of elements
+ * @param firstStep Step where it's written
+ * @param lastStep Last step where it's read
+ * @param inPlaceOf Index of a value read at firstStep whose buffer can be used for this value, -1 if there is none
+ * @param half True if the value is stored in bfloat16
+ * @return Index of the new value
+ */
+int ExecutionPlan::addValue(std::vector<Value> &values, int size, int firstStep, int lastStep, int inPlaceOf, bool half) {
+    values.push_back({size, firstStep, lastStep, inPlaceOf, -1, half});
+    nbBytesWithoutReuse += (size_t) size * (half ? sizeof(BFloat16) : sizeof(float));
+    return (int) values.size() - 1;
+}
+
+/**
+ * Give a buffer to each value of a type so that the values that are needed at the same step never share a buffer
+ * @remark The steps are visited in order. A buffer becomes free after the last step of its value. A new value takes the smallest free buffer that is large enough, otherwise the largest free buffer is enlarged, and a new buffer is only created if none is free.
+ * @param values Intermediate tensors of the plan
+ * @param nbSteps Number of steps
+ * @param half True to assign the buffers of the bfloat16 values, false for the float values
+ * @return Number of elements of each buffer
+ */
+std::vector<int> ExecutionPlan::assignBuffers(std::vector<Value> &values, int nbSteps, bool half) {
+    std::vector<int> capacities;
+    std::vector<int> freeBuffers;
+
+    for(int step=0; step<nbSteps; step++) {
+        for(Value &value : values) {
+            if(value.firstStep != step || value.half != half) {
+                continue;
+            }
+            if(value.inPlaceOf >= 0 && values[value.inPlaceOf].lastStep == step && capacities[values[value.inPlaceOf].buffer] >= value.size) {
+                value.buffer = values[value.inPlaceOf].buffer;
+                continue;
+            }
+
+            int best = -1;
+            int largest = -1;
+            for(int k=0; k<(int) freeBuffers.size(); k++) {
+                int capacity = capacities[freeBuffers[k]];
+                if(capacity >= value.size && (best < 0 || capacity < capacities[freeBuffers[best]])) {
+                    best = k;
+                }
+                if(largest < 0 || capacity > capacities[freeBuffers[largest]]) {
+                    largest = k;
+                }
+            }
+            if(best < 0) {
+                best = largest;
+            }
+            if(best >= 0) {
+                value.buffer = freeBuffers[best];
+                freeBuffers.erase(freeBuffers.begin() + best);
+                capacities[value.buffer] = std::max(capacities[value.buffer], value.size);
+            } else {
+                value.buffer = (int) capacities.size();
+                capacities.push_back(value.size);
+            }
+        }
+
+        // The buffers whose value is not read anymore can be used by the next steps
+        for(int v=0; v<(int) values.size(); v++) {
+            if(values[v].lastStep != step || values[v].half != half) {
+                continue;
+            }
+            bool usedInPlace = false;
+            for(const Value &other : values) {
+                usedInPlace = usedInPlace || (other.inPlaceOf == v && other.buffer == values[v].buffer);
+            }
+            if(!usedInPlace) {
+                freeBuffers.push_back(values[v].buffer);
+            }
+        }
+    }
+
+    return capacities;
+}
+
+/**
+ * Create the view of a value on its buffer
+ * @param values Intermediate tensors of the plan
+ * @param value Index of the value
+ * @param layer Layer whose output shape is the shape of the value
+ * @return View whose first dimension is the batch size
+ */
+TensorView ExecutionPlan::createView(const std::vector<Value> &values, int value, Layer* layer) {
+    std::vector<int> dimSizes = {batchSize};
+    for(int d=0; d<layer->getOutputDim(); d++) {
+        dimSizes.push_back(layer->getOutputSize(d));
+    }
+    return TensorView((int) dimSizes.size(), dimSizes, buffers[values[value].buffer].data());
+}
+
+/**
+ * Get the number of layers
+ * @return Number of layers
+ */
+int ExecutionPlan::getNbLayers() const {
+    return (int) layers.size();
+}
+
+/**
+ * Get the ith layer
+ * @param i Index of the layer
+ * @return Layer
+ */
+Layer* ExecutionPlan::getLayer(int i) const {
+    return layers[i];
+}
+
+/**
+ * Get the batch size of the tensors
+ * @return Batch size
+ */
+int ExecutionPlan::getBatchSize() const {
+    return batchSize;
+}
+
+/**
+ * Run the plan on fewer instances than its batch size: the tensors returned by the getters become views of their first n rows. The bfloat16 tensors are contiguous, so their first rows are used as they are.
+ * @remark This lets fit() run the last, smaller micro-batch of a batch with the plan of the other ones instead of building a new plan
+ * @param n Number of instances, between 1 and the batch size of the plan
+ */
+void ExecutionPlan::setNbInstances(int n) {
+    if(n <= 0 || n > batchSize) {
+        std::cerr << "ERROR: A plan built for " << batchSize << " instances can't run " << n << " instances" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if(n == nbInstances) {
+        return;
+    }
+    nbInstances = n;
+    size_t nbLayers = outputs.size();
+    for(size_t i=0; i<nbLayers; i++) {
+        outputs[i] = fullViews[i].slice(0, n);
+    }
+    for(size_t i=0; i<activationDerivatives.size(); i++) {
+        activationDerivatives[i] = fullViews[nbLayers + i].slice(0, n);
+        costDerivatives[i] = fullViews[2 * nbLayers + i].slice(0, n);
+        forwardOutputs[i] = fullViews[3 * nbLayers + i].slice(0, n);
+    }
+}
+
+/**
+ * Get the number of instances the tensors are sliced to
+ * @return Number of instances, the batch size unless setNbInstances() was called with a smaller one
+ */
+int ExecutionPlan::getNbInstances() const {
+    return nbInstances;
+}
+
+/**
+ * Check if the tensors of the backward pass are included
+ * @return True if the plan can be used to train the network
+ */
+bool ExecutionPlan::isTraining() const {
+    return training;
+}
+
+/**
+ * Check if the tensors kept for the backward pass are stored in bfloat16
+ * @return True if it's a mixed-precision training plan
+ */
+bool ExecutionPlan::isMixedPrecision() const {
+    return mixedPrecision;
+}
+
+/**
+ * Check if the output of a layer is kept between the forward and the backward pass
+ * @param i Index of the layer
+ * @return True if it's kept, false if the backward pass must recompute it (training only)
+ */
+bool ExecutionPlan::isOutputKept(int i) const {
+    return keptOutputs[i];
+}
+
+/**
+ * Check if the activation derivatives of a layer are applied from its output instead of being stored (see Layer::multiplyByActivationDerivativesInPlace()). For the last layer, it means that its cost derivatives are computed from its output without them (see ActivationFunction::isFusedWithCrossEntropy())
+ * @param i Index of the layer
+ * @return True if getActivationDerivatives() has no data for this layer (training only)
+ */
+bool ExecutionPlan::hasActivationDerivativesFromOutput(int i) const {
+    return derivativesFromOutputs[i];
+}
+
+/**
+ * Get the tensor where the output of a layer is written
+ * @remark In a training plan, the output of a layer that is not kept is written there when it's recomputed, the forward pass uses getForwardOutput(). In a mixed-precision plan, it's only valid during the forward pass of the layer (except for the last layer), the next steps use getSavedOutput()
+ * @param i Index of the layer
+ * @return Output tensor of the layer
+ */
+TensorView& ExecutionPlan::getOutput(int i) {
+    return outputs[i];
+}
+
+/**
+ * Get the tensor where the derivatives of the activation function of a layer are written
+ * @remark Only available if the plan is used for the training. In a mixed-precision plan, only the last layer has one, the other layers use getSavedActivationDerivatives(). It has no data if hasActivationDerivativesFromOutput() is true
+ * @param i Index of the layer
+ * @return Activation derivatives of the layer
+ */
+TensorView& ExecutionPlan::getActivationDerivatives(int i) {
+    return activationDerivatives[i];
+}
+
+/**
+ * Get the tensor where the derivatives of the cost in respect for the pre-activation values of a layer are written
+ * @remark Only available if the plan is used for the training. The cost derivatives of the last layer can share the memory of its output.
+ * @param i Index of the layer
+ * @return Cost derivatives of the layer
+ */
+TensorView& ExecutionPlan::getCostDerivatives(int i) {
+    return costDerivatives[i];
+}
+
+/**
+ * Get the tensor where the forward pass writes the output of a layer
+ * @remark Only available if the plan is used for the training. It's the tensor returned by getOutput() if the output is kept, otherwise it's only valid until the forward pass of the next layer
+ * @param i Index of the layer
+ * @return Output tensor of the layer during the forward pass
+ */
+TensorView& ExecutionPlan::getForwardOutput(int i) {
+    return forwardOutputs[i];
+}
+
+/**
+ * Get the bfloat16 copy of the input of the first layer, read by its forward and backward passes
+ * @remark Only available in a mixed-precision plan
+ * @return batchSize x input size elements
+ */
+BFloat16* ExecutionPlan::getSavedInput() {
+    return savedInput;
+}
+
+/**
+ * Get the bfloat16 copy of the output of a layer, kept for the forward pass of the next layer and for the backward pass
+ * @remark Only available in a mixed-precision plan
+ * @param i Index of the layer
+ * @return batchSize x output size elements, nullptr for the last layer (its output is kept in float)
+ */
+BFloat16* ExecutionPlan::getSavedOutput(int i) {
+    return savedOutputs[i];
+}
+
+/**
+ * Get the bfloat16 copy of the activation derivatives of a layer, kept for the backward pass
+ * @remark Only available in a mixed-precision plan
+ * @param i Index of the layer
+ * @return batchSize x output size elements, nullptr for the last layer (its derivatives are kept in float)
+ */
+BFloat16* ExecutionPlan::getSavedActivationDerivatives(int i) {
+    return savedActivationDerivatives[i];
+}
+
+/**
+ * Get the number of buffers shared by the intermediate tensors
+ * @return Number of buffers
+ */
+int ExecutionPlan::getNbBuffers() const {
+    return (int) (buffers.size() + halfBuffers.size());
+}
+
+/**
+ * Get the memory used by the intermediate tensors
+ * @return Number of bytes of the buffers
+ */
+size_t ExecutionPlan::getNbBytes() const {
+    size_t nbBytes = 0;
+    for(const std::vector<float> &buffer : buffers) {
+        nbBytes += buffer.size() * sizeof(float);
+    }
+    for(const std::vector<BFloat16> &buffer : halfBuffers) {
+        nbBytes += buffer.size() * sizeof(BFloat16);
+    }
+    return nbBytes;
+}
+
+/**
+ * Get the memory that the intermediate tensors would use if they didn't share buffers
+ * @return Number of bytes
+ */
+size_t ExecutionPlan::getNbBytesWithoutReuse() const {
+    return nbBytesWithoutReuse;
+}
@@ -0,0 +1,762 @@
+/**
+ * @file Gemm.cpp
+ * @author Robin MENEUST
+ * @brief Packed and cache-blocked matrix multiplication with microkernels selected at runtime
+ * @date 2024-01-20
+ */
+
+#include "../include/Gemm.h"
+#include "../include/ThreadPool.h"
+#include "../include/BFloat16.h"
+#include "../include/VectorMath.h"
+#include <new>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GEMM_X86
+#include <immintrin.h>
+#endif
+
+// Sizes of the blocks of A (MC x KC) and B (KC x NC). A packed block of A stays in the L2 cache and a panel of B (KC x NR) in the L1 cache
+static const int MC = 96;
+static const int KC = 256;
+static const int NC = 1024;
+
+// Maximum tile size of the microkernels
+static const int MAX_MR = 8;
+static const int MAX_NR = 32;
+
+static const size_t ALIGNMENT = 64;
+
+/**
+ * Microkernel: C[0:mr, 0:nr] += A_panel * B_panel where A_panel contains kc columns of mr elements and B_panel kc rows of nr elements (both packed)
+ */
+typedef void (*MicroKernel)(int kc, const float* a, const float* b, float* c, int ldc);
+
+/**
+ * @struct KernelInfo
+ * @brief Microkernel and the size of the tile of C it computes
+ */
+struct KernelInfo {
+    int mr; /**< Number of rows of the tile */
+    int nr; /**< Number of columns of the tile */
+    MicroKernel run; /**< Microkernel */
+};
+
+/**
+ * Portable microkernel computing a 4x4 tile
+ * @param kc Number of columns of the A panel (and rows of the B panel)
+ * @param a Packed panel of A
+ * @param b Packed panel of B
+ * @param c Top left element of the tile of C
+ * @param ldc Distance between two rows of C
+ */
+static void kernelScalar(int kc, const float* a, const float* b, float* c, int ldc) {
+    float acc[4][4] = {};
+    for(int p=0; p<kc; p++) {
+        for(int r=0; r<4; r++) {
+            float ar = a[r];
+            for(int j=0; j<4; j++) {
+                acc[r][j] += ar * b[j];
+            }
+        }
+        a += 4;
+        b += 4;
+    }
+    for(int r=0; r<4; r++) {
+        for(int j=0; j<4; j++) {
+            c[r*ldc + j] += acc[r][j];
+        }
+    }
+}
+
+#ifdef GEMM_X86
+
+/**
+ * SSE4.2 microkernel computing a 4x8 tile (8 accumulators of 4 floats)
+ * @param kc Number of columns of the A panel (and rows of the B panel)
+ * @param a Packed panel of A
+ * @param b Packed panel of B (aligned on 16 bytes)
+ * @param c Top left element of the tile of C
+ * @param ldc Distance between two rows of C
+ */
+__attribute__((target("sse4.2")))
+static void kernelSse42(int kc, const float* a, const float* b, float* c, int ldc) {
+    __m128 acc[4][2];
+#pragma GCC unroll 4
+    for(int r=0; r<4; r++) {
+        acc[r][0] = _mm_setzero_ps();
+        acc[r][1] = _mm_setzero_ps();
+    }
+    for(int p=0; p<kc; p++) {
+        __m128 b0 = _mm_load_ps(b);
+        __m128 b1 = _mm_load_ps(b + 4);
+#pragma GCC unroll 4
+        for(int r=0; r<4; r++) {
+            __m128 ar = _mm_set1_ps(a[r]);
+            acc[r][0] = _mm_add_ps(acc[r][0], _mm_mul_ps(ar, b0));
+            acc[r][1] = _mm_add_ps(acc[r][1], _mm_mul_ps(ar, b1));
+        }
+        a += 4;
+        b += 8;
+    }
+#pragma GCC unroll 4
+    for(int r=0; r<4; r++) {
+        float* cr = c + r*ldc;
+        _mm_storeu_ps(cr, _mm_add_ps(_mm_loadu_ps(cr), acc[r][0]));
+        _mm_storeu_ps(cr + 4, _mm_add_ps(_mm_loadu_ps(cr + 4), acc[r][1]));
+    }
+}
+
+/**
+ * AVX2 microkernel computing a 6x16 tile (12 accumulators of 8 floats)
+ * @param kc Number of columns of the A panel (and rows of the B panel)
+ * @param a Packed panel of A
+ * @param b Packed panel of B (aligned on 32 bytes)
+ * @param c Top left element of the tile of C
+ * @param ldc Distance between two rows of C
+ */
+__attribute__((target("avx2,fma")))
+static void kernelAvx2(int kc, const float* a, const float* b, float* c, int ldc) {
+    __m256 acc[6][2];
+#pragma GCC unroll 6
+    for(int r=0; r<6; r++) {
+        acc[r][0] = _mm256_setzero_ps();
+        acc[r][1] = _mm256_setzero_ps();
+    }
+    for(int p=0; p<kc; p++) {
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+#pragma GCC unroll 6
+        for(int r=0; r<6; r++) {
+            __m256 ar = _mm256_broadcast_ss(a + r);
+            acc[r][0] = _mm256_fmadd_ps(ar, b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_ps(ar, b1, acc[r][1]);
+        }
+        a += 6;
+        b += 16;
+    }
+#pragma GCC unroll 6
+    for(int r=0; r<6; r++) {
+        float* cr = c + r*ldc;
+        _mm256_storeu_ps(cr, _mm256_add_ps(_mm256_loadu_ps(cr), acc[r][0]));
+        _mm256_storeu_ps(cr + 8, _mm256_add_ps(_mm256_loadu_ps(cr + 8), acc[r][1]));
+    }
+}
+
+/**
+ * AVX-512 microkernel computing an 8x32 tile (16 accumulators of 16 floats)
+ * @param kc Number of columns of the A panel (and rows of the B panel)
+ * @param a Packed panel of A
+ * @param b Packed panel of B (aligned on 64 bytes)
+ * @param c Top left element of the tile of C
+ * @param ldc Distance between two rows of C
+ */
+__attribute__((target("avx512f")))
+static void kernelAvx512(int kc, const float* a, const float* b, float* c, int ldc) {
+    __m512 acc[8][2];
+#pragma GCC unroll 8
+    for(int r=0; r<8; r++) {
+        acc[r][0] = _mm512_setzero_ps();
+        acc[r][1] = _mm512_setzero_ps();
+    }
+    for(int p=0; p<kc; p++) {
+        __m512 b0 = _mm512_load_ps(b);
+        __m512 b1 = _mm512_load_ps(b + 16);
+#pragma GCC unroll 8
+        for(int r=0; r<8; r++) {
+            __m512 ar = _mm512_set1_ps(a[r]);
+            acc[r][0] = _mm512_fmadd_ps(ar, b0, acc[r][0]);
+            acc[r][1] = _mm512_fmadd_ps(ar, b1, acc[r][1]);
+        }
+        a += 8;
+        b += 32;
+    }
+#pragma GCC unroll 8
+    for(int r=0; r<8; r++) {
+        float* cr = c + r*ldc;
+        _mm512_storeu_ps(cr, _mm512_add_ps(_mm512_loadu_ps(cr), acc[r][0]));
+        _mm512_storeu_ps(cr + 16, _mm512_add_ps(_mm512_loadu_ps(cr + 16), acc[r][1]));
+    }
+}
+
+/**
+ * AVX2 dot product of two contiguous arrays, used when A has a single row
+ * @param x First array
+ * @param y Second array
+ * @param k Size of the arrays
+ * @return Sum of x[p] * y[p]
+ */
+__attribute__((target("avx2,fma")))
+static float dotAvx2(const float* x, const float* y, int k) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    int p = 0;
+    for(; p+32<=k; p+=32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + p), _mm256_loadu_ps(y + p), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + p + 8), _mm256_loadu_ps(y + p + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(x + p + 16), _mm256_loadu_ps(y + p + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(x + p + 24), _mm256_loadu_ps(y + p + 24), acc3);
+    }
+    for(; p+8<=k; p+=8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + p), _mm256_loadu_ps(y + p), acc0);
+    }
+    __m256 acc = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    float result = _mm_cvtss_f32(sum);
+    for(; p<k; p++) {
+        result += x[p] * y[p];
+    }
+    return result;
+}
+
+#endif
+
+/**
+ * Portable dot product of two contiguous arrays
+ * @param x First array
+ * @param y Second array
+ * @param k Size of the arrays
+ * @return Sum of x[p] * y[p]
+ */
+static float dotScalar(const float* x, const float* y, int k) {
+    float acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f, acc3 = 0.0f;
+    int p = 0;
+    for(; p+4<=k; p+=4) {
+        acc0 += x[p] * y[p];
+        acc1 += x[p+1] * y[p+1];
+        acc2 += x[p+2] * y[p+2];
+        acc3 += x[p+3] * y[p+3];
+    }
+    for(; p<k; p++) {
+        acc0 += x[p] * y[p];
+    }
+    return (acc0 + acc1) + (acc2 + acc3);
+}
+
+/**
+ * Get the microkernel of an instruction set
+ * @param isa Instruction set
+ * @return Microkernel and its tile size
+ */
+static KernelInfo getKernelInfo(Gemm::Isa isa) {
+    switch(isa) {
+#ifdef GEMM_X86
+        case Gemm::AVX512: return {8, 32, kernelAvx512};
+        case Gemm::AVX2: return {6, 16, kernelAvx2};
+        case Gemm::SSE42: return {4, 8, kernelSse42};
+#endif
+        default: return {4, 4, kernelScalar};
+    }
+}
+
+static std::atomic<Gemm::Isa> currentIsa(Gemm::getBestSupportedIsa()); /**< Instruction set used by multiply(). It can be changed while other threads multiply, and only selects a kernel, so it is accessed with a relaxed order */
+
+/**
+ * @struct PackBuffers
+ * @brief Buffers where the blocks of A and B are packed. There is one per thread and they are allocated once.
+ */
+struct PackBuffers {
+    float* a; /**< Packed block of A (MC x KC, rounded up to whole panels) */
+    float* b; /**< Packed block of B (KC x NC, rounded up to whole panels) */
+
+    PackBuffers() {
+        a = static_cast<float*>(::operator new((MC + MAX_MR) * KC * sizeof(float), std::align_val_t(ALIGNMENT)));
+        b = static_cast<float*>(::operator new((NC + MAX_NR) * KC * sizeof(float), std::align_val_t(ALIGNMENT)));
+    }
+    ~PackBuffers() {
+        ::operator delete(a, std::align_val_t(ALIGNMENT));
+        ::operator delete(b, std::align_val_t(ALIGNMENT));
+    }
+    PackBuffers(PackBuffers const&) = delete;
+    PackBuffers& operator=(PackBuffers const&) = delete;
+};
+
+/**
+ * Read an element of a matrix as a float, whatever the type used to store the matrix
+ * @param x Element
+ * @return Value of the element
+ */
+static inline float toFloat(float x) {
+    return x;
+}
+
+static inline float toFloat(BFloat16 x) {
+    return x.toFloat();
+}
+
+/**
+ * Get the pack buffers of the calling thread, shared by the products of all the element types
+ * @return Buffers of the thread
+ */
+static PackBuffers& getPackBuffers() {
+    static thread_local PackBuffers buffers;
+    return buffers;
+}
+
+/**
+ * Pack a block of alpha * op(A) in panels of mr rows. In each panel the mr elements of a column are contiguous. The missing rows of the last panel are filled with 0.
+ * @param transA True if op(A) is the transpose of A
+ * @param a Matrix A (float or bfloat16, converted to float while it is packed)
+ * @param lda Distance between two rows of A
+ * @param i0 First row of op(A) packed
+ * @param mc Number of rows packed
+ * @param p0 First column of op(A) packed
+ * @param kc Number of columns packed
+ * @param alpha Factor applied to the packed elements
+ * @param mr Number of rows of a panel
+ * @param packed Destination buffer
+ */
+template<typename T>
+static void packA(bool transA, const T* a, int lda, int i0, int mc, int p0, int kc, float alpha, int mr, float* packed) {
+    for(int ir=0; ir<mc; ir+=mr) {
+        int nbRows = std::min(mr, mc - ir);
+        for(int p=0; p<kc; p++) {
+            for(int r=0; r<nbRows; r++) {
+                int i = i0 + ir + r;
+                float value = toFloat(transA ? a[(size_t) (p0 + p) * lda + i] : a[(size_t) i * lda + p0 + p]);
+                packed[r] = alpha * value;
+            }
+            for(int r=nbRows; r<mr; r++) {
+                packed[r] = 0.0f;
+            }
+            packed += mr;
+        }
+    }
+}
+
+/**
+ * Pack a block of op(B) in panels of nr columns. In each panel the nr elements of a row are contiguous. The missing columns of the last panel are filled with 0.
+ * @param transB True if op(B) is the transpose of B
+ * @param b Matrix B (float or bfloat16, converted to float while it is packed)
+ * @param ldb Distance between two rows of B
+ * @param p0 First row of op(B) packed
+ * @param kc Number of rows packed
+ * @param j0 First column of op(B) packed
+ * @param nc Number of columns packed
+ * @param nr Number of columns of a panel
+ * @param packed Destination buffer
+ */
+template<typename T>
+static void packB(bool transB, const T* b, int ldb, int p0, int kc, int j0, int nc, int nr, float* packed) {
+    for(int jr=0; jr<nc; jr+=nr) {
+        int nbCols = std::min(nr, nc - jr);
+        if(transB) {
+            // The rows of B are read contiguously, each one is a column of the panel
+            for(int j=0; j<nbCols; j++) {
+                const T* row = b + (size_t) (j0 + jr + j) * ldb + p0;
+                for(int p=0; p<kc; p++) {
+                    packed[(size_t) p * nr + j] = toFloat(row[p]);
+                }
+            }
+            for(int p=0; p<kc; p++) {
+                for(int j=nbCols; j<nr; j++) {
+                    packed[(size_t) p * nr + j] = 0.0f;
+                }
+            }
+            packed += (size_t) kc * nr;
+            continue;
+        }
+        for(int p=0; p<kc; p++) {
+            const T* row = b + (size_t) (p0 + p) * ldb + j0 + jr;
+            for(int j=0; j<nbCols; j++) {
+                packed[j] = toFloat(row[j]);
+            }
+            for(int j=nbCols; j<nr; j++) {
+                packed[j] = 0.0f;
+            }
+            packed += nr;
+        }
+    }
+}
+
+/**
+ * Multiply C by beta
+ * @param m Number of rows of C
+ * @param n Number of columns of C
+ * @param beta Factor. If it's 0, C is set to 0 without being read
+ * @param c Matrix C
+ * @param ldc Distance between two rows of C
+ */
+static void scale(int m, int n, float beta, float* c, int ldc) {
+    if(beta == 1.0f) {
+        return;
+    }
+    for(int i=0; i<m; i++) {
+        float* row = c + (size_t) i * ldc;
+        if(beta == 0.0f) {
+            std::fill(row, row + n, 0.0f);
+        } else {
+            for(int j=0; j<n; j++) {
+                row[j] *= beta;
+            }
+        }
+    }
+}
+
+/**
+ * Compute C = alpha * op(A) * op(B) + C when A has a single row. Packing would cost as much as the product itself in this case.
+ * @param transA True if op(A) is the transpose of A
+ * @param transB True if op(B) is the transpose of B
+ * @param n Number of columns of C
+ * @param k Number of columns of op(A)
+ * @param alpha Factor applied to the product
+ * @param a Matrix A (float or bfloat16)
+ * @param lda Distance between two rows of A
+ * @param b Matrix B (float or bfloat16)
+ * @param ldb Distance between two rows of B
+ * @param c Matrix C
+ */
+template<typename TA, typename TB>
+static void multiplyRow(bool transA, bool transB, int n, int k, float alpha, const TA* a, int lda, const TB* b, int ldb, float* c) {
+    if(transB && !transA) {
+        // Each element of C is the dot product of A with a row of B
+        for(int j=0; j<n; j++) {
+            const TB* row = b + (size_t) j * ldb;
+            float sum = 0.0f;
+            for(int p=0; p<k; p++) {
+                sum += toFloat(a[p]) * toFloat(row[p]);
+            }
+            c[j] += alpha * sum;
+        }
+        return;
+    }
+    for(int p=0; p<k; p++) {
+        float ap = alpha * toFloat(transA ? a[(size_t) p * lda] : a[p]);
+        if(transB) {
+            for(int j=0; j<n; j++) {
+                c[j] += ap * toFloat(b[(size_t) j * ldb + p]);
+            }
+        } else {
+            const TB* row = b + (size_t) p * ldb;
+            for(int j=0; j<n; j++) {
+                c[j] += ap * toFloat(row[j]);
+            }
+        }
+    }
+}
+
+/**
+ * Float version of multiplyRow(), using the vectorized dot product when the rows of B are contiguous
+ */
+static void multiplyRow(bool transA, bool transB, int n, int k, float alpha, const float* a, int lda, const float* b, int ldb, float* c) {
+    if(transB && !transA) {
+        float (*dot)(const float*, const float*, int) = dotScalar;
+#ifdef GEMM_X86
+        if(currentIsa.load(std::memory_order_relaxed) >= Gemm::AVX2) {
+            dot = dotAvx2;
+        }
+#endif
+        for(int j=0; j<n; j++) {
+            c[j] += alpha * dot(a, b + (size_t) j * ldb, k);
+        }
+        return;
+    }
+    multiplyRow<float, float>(transA, transB, n, k, alpha, a, lda, b, ldb, c);
+}
+
+/**
+ * Apply the epilogue to a block of C: add the bias, apply the activation function, write its derivatives and the bfloat16 copies. It's called by multiply() on each tile, it can also be used by other kernels producing the same output
+ * @param epilogue Epilogue applied
+ * @param c Top left element of the block
+ * @param ldc Distance between two rows of C
+ * @param i0 Row of the block in C
+ * @param j0 Column of the block in C
+ * @param nbRows Number of rows of the block
+ * @param nbCols Number of columns of the block
+ */
+void Gemm::applyEpilogue(const Epilogue &epilogue, float* c, int ldc, int i0, int j0, int nbRows, int nbCols) {
+    // The derivatives written in bfloat16 are first computed in this buffer, so the row is split in chunks
+    const int chunkSize = 64;
+    float halfDerivativesChunk[chunkSize];
+
+    for(int r=0; r<nbRows; r++) {
+        for(int jc=0; jc<nbCols; jc+=chunkSize) {
+            int nbChunkCols = std::min(chunkSize, nbCols - jc);
+            float* row = c + (size_t) r * ldc + jc;
+            float* derivatives = nullptr;
+            if(epilogue.halfDerivatives != nullptr) {
+                derivatives = halfDerivativesChunk;
+            } else if(epilogue.derivatives != nullptr) {
+                derivatives = epilogue.derivatives + (size_t) (i0 + r) * epilogue.ldd + j0 + jc;
+            }
+
+            if(epilogue.bias != nullptr) {
+                const float* bias = epilogue.bias + j0 + jc;
+                for(int j=0; j<nbChunkCols; j++) {
+                    row[j] += bias[j];
+                }
+            }
+
+            switch(epilogue.activation) {
+                case RELU:
+                    if(derivatives != nullptr) {
+                        VectorMath::reluDerivativesInto(row, derivatives, nbChunkCols);
+                    }
+                    VectorMath::reluInto(row, row, nbChunkCols);
+                    break;
+                case LEAKY_RELU:
+                    if(derivatives != nullptr) {
+                        VectorMath::leakyReluDerivativesInto(row, derivatives, nbChunkCols, epilogue.parameter);
+                    }
+                    VectorMath::leakyReluInto(row, row, nbChunkCols, epilogue.parameter);
+                    break;
+                case SIGMOID:
+                    VectorMath::sigmoidInto(row, row, nbChunkCols);
+                    if(derivatives != nullptr) {
+                        VectorMath::sigmoidDerivativesInto(row, derivatives, nbChunkCols);
+                    }
+                    break;
+                default:
+                    if(derivatives != nullptr) {
+                        std::fill(derivatives, derivatives + nbChunkCols, 1.0f);
+                    }
+                    break;
+            }
+
+            size_t halfOffset = (size_t) (i0 + r) * epilogue.ldh + j0 + jc;
+            if(epilogue.halfDerivatives != nullptr) {
+                BFloat16::convertInto(halfDerivativesChunk, epilogue.halfDerivatives + halfOffset, (size_t) nbChunkCols);
+            }
+            if(epilogue.halfOutput != nullptr) {
+                BFloat16::convertInto(row, epilogue.halfOutput + halfOffset, (size_t) nbChunkCols);
+            }
+        }
+    }
+}
+
+/**
+ * Compute C = alpha * op(A) * op(B) + C on the calling thread, block by block
+ * @param transA True if op(A) is the transpose of A
+ * @param transB True if op(B) is the transpose of B
+ * @param m Number of rows of op(A) and C
+ * @param n Number of columns of op(B) and C
+ * @param k Number of columns of op(A) and rows of op(B)
+ * @param alpha Factor applied to the product
+ * @param a Matrix A (float or bfloat16)
+ * @param lda Distance between two rows of A
+ * @param b Matrix B (float or bfloat16)
+ * @param ldb Distance between two rows of B
+ * @param c Matrix C (m x n)
+ * @param ldc Distance between two rows of C
+ * @param kernel Microkernel used
+ * @param epilogue Epilogue applied to each tile once it's complete, nullptr if there is none
+ * @param i0 Row of this block in the whole matrix C (used by the epilogue)
+ * @param j0 Column of this block in the whole matrix C (used by the epilogue)
+ */
+template<typename TA, typename TB>
+static void multiplyBlocks(bool transA, bool transB, int m, int n, int k, float alpha, const TA* a, int lda, const TB* b, int ldb, float* c, int ldc, const KernelInfo &kernel, const Gemm::Epilogue* epilogue, int i0, int j0) {
+    PackBuffers& buffers = getPackBuffers();
+    int mr = kernel.mr;
+    int nr = kernel.nr;
+    int mcMax = MC / mr * mr;
+    int ncMax = NC / nr * nr;
+    alignas(64) float tile[MAX_MR * MAX_NR];
+
+    for(int jc=0; jc<n; jc+=ncMax) {
+        int nc = std::min(ncMax, n - jc);
+        for(int pc=0; pc<k; pc+=KC) {
+            int kc = std::min(KC, k - pc);
+            bool isLastBlock = pc + kc == k;
+            packB(transB, b, ldb, pc, kc, jc, nc, nr, buffers.b);
+
+            for(int ic=0; ic<m; ic+=mcMax) {
+                int mc = std::min(mcMax, m - ic);
+                packA(transA, a, lda, ic, mc, pc, kc, alpha, mr, buffers.a);
+
+                for(int jr=0; jr<nc; jr+=nr) {
+                    int nbCols = std::min(nr, nc - jr);
+                    const float* bPanel = buffers.b + (size_t) jr * kc;
+                    for(int ir=0; ir<mc; ir+=mr) {
+                        int nbRows = std::min(mr, mc - ir);
+                        const float* aPanel = buffers.a + (size_t) ir * kc;
+                        float* cTile = c + (size_t) (ic + ir) * ldc + jc + jr;
+
+                        if(nbRows == mr && nbCols == nr) {
+                            kernel.run(kc, aPanel, bPanel, cTile, ldc);
+                        } else {
+                            // Partial tile on the edge of C: computed in a local tile and then added to C
+                            std::fill(tile, tile + mr * nr, 0.0f);
+                            kernel.run(kc, aPanel, bPanel, tile, nr);
+                            for(int r=0; r<nbRows; r++) {
+                                for(int j=0; j<nbCols; j++) {
+                                    cTile[(size_t) r * ldc + j] += tile[r * nr + j];
+                                }
+                            }
+                        }
+
+                        if(isLastBlock && epilogue != nullptr) {
+                            Gemm::applyEpilogue(*epilogue, cTile, ldc, i0 + ic + ir, j0 + jc + jr, nbRows, nbCols);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Compute C = alpha * op(A) * op(B) + beta * C for any storage type of A and B. They are converted to float when they are packed
+ * @remark C is split in blocks of rows and columns computed in parallel by the threads of ThreadPool::getInstance(), if the product is large enough
+ * @param transA True if op(A) is the transpose of A
+ * @param transB True if op(B) is the transpose of B
+ * @param m Number of rows of op(A) and C
+ * @param n Number of columns of op(B) and C
+ * @param k Number of columns of op(A) and rows of op(B)
+ * @param alpha Factor applied to the product
+ * @param a Matrix A (float or bfloat16)
+ * @param lda Distance between two rows of A
+ * @param b Matrix B (float or bfloat16)
+ * @param ldb Distance between two rows of B
+ * @param beta Factor applied to C before adding the product. If it's 0, C is not read
+ * @param c Matrix C (m x n)
+ * @param ldc Distance between two rows of C
+ * @param epilogue Bias and activation function applied to C once the product is computed, nullptr if there is none
+ */
+template<typename TA, typename TB>
+static void multiplyGeneric(bool transA, bool transB, int m, int n, int k, float alpha, const TA* a, int lda, const TB* b, int ldb, float beta, float* c, int ldc, const Gemm::Epilogue* epilogue) {
+    if(m <= 0 || n <= 0) {
+        return;
+    }
+    scale(m, n, beta, c, ldc);
+    if(k <= 0 || alpha == 0.0f) {
+        if(epilogue != nullptr) {
+            Gemm::applyEpilogue(*epilogue, c, ldc, 0, 0, m, n);
+        }
+        return;
+    }
+
+    ThreadPool& pool = ThreadPool::getInstance();
+    if(m == 1) {
+        // The columns of C are independent
+        pool.parallelFor(n, 2L * k, [&](int begin, int end) {
+            const TB* bColumns = transB ? b + (size_t) begin * ldb : b + begin;
+            multiplyRow(transA, transB, end - begin, k, alpha, a, lda, bColumns, ldb, c + begin);
+            if(epilogue != nullptr) {
+                Gemm::applyEpilogue(*epilogue, c + begin, ldc, 0, begin, 1, end - begin);
+            }
+        });
+        return;
+    }
+
+    KernelInfo kernel = getKernelInfo(currentIsa.load(std::memory_order_relaxed));
+    int nbThreads = pool.getNbThreadsFor(2L * m * n * k);
+
+    // C is split in a grid of blocks made of whole tiles. The columns are split first because each block of columns only needs its part of B
+    int nbColPanels = (n + kernel.nr - 1) / kernel.nr;
+    int nbRowPanels = (m + kernel.mr - 1) / kernel.mr;
+    int nbColBlocks = std::min(nbThreads, nbColPanels);
+    int nbRowBlocks = std::min(std::max(1, nbThreads / nbColBlocks), nbRowPanels);
+    int colsPerBlock = (nbColPanels + nbColBlocks - 1) / nbColBlocks * kernel.nr;
+    int rowsPerBlock = (nbRowPanels + nbRowBlocks - 1) / nbRowBlocks * kernel.mr;
+
+    pool.parallelTasks(nbRowBlocks * nbColBlocks, [&](int task) {
+        int i0 = (task / nbColBlocks) * rowsPerBlock;
+        int j0 = (task % nbColBlocks) * colsPerBlock;
+        if(i0 >= m || j0 >= n) {
+            return;
+        }
+        const TA* aBlock = transA ? a + i0 : a + (size_t) i0 * lda;
+        const TB* bBlock = transB ? b + (size_t) j0 * ldb : b + j0;
+        multiplyBlocks(transA, transB, std::min(rowsPerBlock, m - i0), std::min(colsPerBlock, n - j0), k, alpha, aBlock, lda, bBlock, ldb, c + (size_t) i0 * ldc + j0, ldc, kernel, epilogue, i0, j0);
+    });
+}
+
+/**
+ * Compute C = alpha * op(A) * op(B) + beta * C, where op(X) is X or its transpose. All the matrices are stored in row-major order.
+ * @remark C is split in blocks of rows and columns computed in parallel by the threads of ThreadPool::getInstance(), if the product is large enough
+ * @param transA True if op(A) is the transpose of A
+ * @param transB True if op(B) is the transpose of B
+ * @param m Number of rows of op(A) and C
+ * @param n Number of columns of op(B) and C
+ * @param k Number of columns of op(A) and rows of op(B)
+ * @param alpha Factor applied to the product
+ * @param a Matrix A
+ * @param lda Distance between two rows of A
+ * @param b Matrix B
+ * @param ldb Distance between two rows of B
+ * @param beta Factor applied to C before adding the product. If it's 0, C is not read
+ * @param c Matrix C (m x n)
+ * @param ldc Distance between two rows of C
+ * @param epilogue Bias and activation function applied to C once the product is computed, nullptr if there is none
+ */
+void Gemm::multiply(bool transA, bool transB, int m, int n, int k, float alpha, const float *a, int lda, const float *b, int ldb, float beta, float *c, int ldc, const Epilogue* epilogue) {
+    multiplyGeneric(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, epilogue);
+}
+
+/**
+ * Compute C = alpha * op(A) * op(B) + beta * C where B is stored in bfloat16. The elements of B are converted to float when they are packed, so the product is accumulated in float
+ * @remark Same parameters as the float version
+ */
+void Gemm::multiply(bool transA, bool transB, int m, int n, int k, float alpha, const float *a, int lda, const BFloat16 *b, int ldb, float beta, float *c, int ldc, const Epilogue* epilogue) {
+    multiplyGeneric(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, epilogue);
+}
+
+/**
+ * Compute C = alpha * op(A) * op(B) + beta * C where A and B are stored in bfloat16. The elements are converted to float when they are packed, so the product is accumulated in float
+ * @remark Same parameters as the float version
+ */
+void Gemm::multiply(bool transA, bool transB, int m, int n, int k, float alpha, const BFloat16 *a, int lda, const BFloat16 *b, int ldb, float beta, float *c, int ldc, const Epilogue* epilogue) {
+    multiplyGeneric(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, epilogue);
+}
+
+/**
+ * Get the instruction set currently used by multiply()
+ * @return Instruction set used
+ */
+Gemm::Isa Gemm::getIsa() {
+    return currentIsa.load(std::memory_order_relaxed);
+}
+
+/**
+ * Get the most efficient instruction set supported by this CPU
+ * @return Best instruction set supported
+ */
+Gemm::Isa Gemm::getBestSupportedIsa() {
+#ifdef GEMM_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) {
+        return AVX512;
+    }
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return AVX2;
+    }
+    if(__builtin_cpu_supports("sse4.2")) {
+        return SSE42;
+    }
+#endif
+    return SCALAR;
+}
+
+/**
+ * Set the instruction set used by multiply(). It's mainly used to compare the kernels, the best one is selected by default.
+ * @param isa Instruction set to use
+ * @return True if it's supported by this CPU. Otherwise the instruction set used is not changed
+ */
+bool Gemm::setIsa(Isa isa) {
+    if(isa > getBestSupportedIsa()) {
+        return false;
+    }
+    currentIsa.store(isa, std::memory_order_relaxed);
+    return true;
+}
+
+/**
+ * Get the name of an instruction set
+ * @param isa Instruction set
+ * @return Name of the instruction set
+ */
+std::string Gemm::getIsaName(Isa isa) {
+    switch(isa) {
+        case AVX512: return "AVX-512";
+        case AVX2: return "AVX2+FMA";
+        case SSE42: return "SSE4.2";
+        default: return "scalar";
+    }
+}
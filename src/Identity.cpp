@@ -8,29 +8,78 @@
 #include "../include/Identity.h"
 
 /**
- * For all component xi of the input tensor, calculate Identity(xi) and return a tensor that contains the result for each xi
+ * For all component xi of the input tensor, calculate Identity(xi) and write the result for each xi in the output tensor
  * @param input Input tensor whose rank is greater than or equal to 1
  * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
- * @return Tensor of the output of the function for each component of the input tensor
+ * @param output Tensor where the outputs of the function for each component of the input tensor are written. It can be the input tensor itself
  */
-Tensor * Identity::getValues(const Tensor &input, int batchSize) {
-    return new Tensor(input);
+void Identity::getValuesInto(const TensorView &input, int batchSize, TensorView &output) {
+    float* outputData = output.getData();
+    float* inputData = input.getData();
+
+    if(outputData == inputData) {
+        return;
+    }
+
+    int size = input.size();
+    for(int i=0; i<size; i++) {
+        outputData[i] = inputData[i];
+    }
 }
 
 /**
- * For all component xi of the input tensor, calculate the derivative dIdentity(xi)/dxi and return a tensor that contains the result for each xi.
+ * For all component xi of the input tensor, calculate the derivative dIdentity(xi)/dxi and write the result for each xi in the output tensor.
  * @param input Input tensor whose rank is greater than or equal to 1
  * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
- * @return Tensor of the derivatives of the function for each component of the input tensor
+ * @param output Tensor where the derivatives of the function for each component of the input tensor are written. It can be the input tensor itself
  */
 
-Tensor* Identity::getDerivatives(const Tensor &input, int batchSize) {
-    Tensor* output = getValues(input, batchSize);
-    float* outputData = output->getData();
+void Identity::getDerivativesInto(const TensorView &input, int batchSize, TensorView &output) {
+    float* outputData = output.getData();
 
-    for(int i=0; i<input.size(); i++) {
+    int size = input.size();
+    for(int i=0; i<size; i++) {
         outputData[i] = 1;
     }
 
-    return output;
+}
+
+/**
+ * Check if multiplyByDerivativeInPlace() can be used
+ * @return True since the derivatives are always 1
+ */
+bool Identity::canMultiplyByDerivativeInPlace() {
+    return true;
+}
+
+/**
+ * Multiply the gradient by the derivatives of the function, which are all 1, so it's not modified
+ * @param gradient Tensor multiplied in place
+ * @param output Outputs of the function. It's not used
+ * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
+ */
+void Identity::multiplyByDerivativeInPlace(TensorView &gradient, const TensorView &output, int batchSize) {
+    (void) gradient;
+    (void) output;
+    (void) batchSize;
+}
+
+/**
+ * Get the activation that the matrix multiplication epilogue must apply to compute this function
+ * @param activation Set to Gemm::IDENTITY
+ * @param parameter Set to 0 (not used)
+ * @return True since this function can be fused
+ */
+bool Identity::getFusedActivation(Gemm::Activation &activation, float &parameter) {
+    activation = Gemm::IDENTITY;
+    parameter = 0.0f;
+    return true;
+}
+
+/**
+ * Get the name of the function, used to identify it in the model files
+ * @return "Identity"
+ */
+std::string Identity::getName() {
+    return "Identity";
 }
\ No newline at end of file
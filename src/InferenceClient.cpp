@@ -0,0 +1,221 @@
+/**
+ * @file InferenceClient.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class InferenceClient, used to request predictions to an InferenceServer
+ * @date 2024-02-01
+ */
+
+#include "../include/InferenceClient.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/**
+ * Create a client from a connection whose shared memory is mapped
+ * @param socket Socket connected to the server
+ * @param memory Shared memory of the slots
+ * @param memorySize Size of the shared memory in bytes
+ * @param welcome WELCOME message of the server, describing the slots
+ */
+InferenceClient::InferenceClient(int socket, char* memory, size_t memorySize, const InferenceProtocol::Message &welcome) : socket(socket), memory(memory), memorySize(memorySize), nbSlots(welcome.nbSlots), inputSize(welcome.inputSize), outputSize(welcome.outputSize), outputOffset(welcome.outputOffset), slotSize(welcome.slotSize) {}
+
+/**
+ * Unmap the shared memory and close the connection. The server drops the requests still in flight
+ */
+InferenceClient::~InferenceClient() {
+    munmap(memory, memorySize);
+    close(socket);
+}
+
+/**
+ * Connect to a server and map the shared memory of the slots
+ * @param socketPath Path of the socket of the server
+ * @param nbSlots Number of slots, i.e. maximum number of requests in flight
+ * @return New client, nullptr if the connection failed
+ */
+InferenceClient* InferenceClient::connect(const std::string &socketPath, int nbSlots) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "ERROR: The socket path " << socketPath << " is too long" << std::endl;
+        return nullptr;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    int fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(fd < 0 || ::connect(fd, (sockaddr*) &address, sizeof(address)) != 0) {
+        std::cerr << "ERROR: Could not connect to " << socketPath << ": " << strerror(errno) << std::endl;
+        if(fd >= 0) {
+            close(fd);
+        }
+        return nullptr;
+    }
+
+    InferenceProtocol::Message hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.type = InferenceProtocol::HELLO;
+    hello.version = InferenceProtocol::VERSION;
+    hello.nbSlots = nbSlots;
+    if(::send(fd, &hello, sizeof(hello), MSG_NOSIGNAL) != (ssize_t) sizeof(hello)) {
+        std::cerr << "ERROR: Could not send the request of shared memory: " << strerror(errno) << std::endl;
+        close(fd);
+        return nullptr;
+    }
+
+    // The WELCOME message comes with the descriptor of the shared memory
+    InferenceProtocol::Message welcome;
+    iovec data = {&welcome, sizeof(welcome)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &data;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    ssize_t size = recvmsg(fd, &header, MSG_CMSG_CLOEXEC);
+    cmsghdr* controlHeader = size > 0 ? CMSG_FIRSTHDR(&header) : nullptr;
+    int memoryFd = -1;
+    if(controlHeader != nullptr && controlHeader->cmsg_level == SOL_SOCKET && controlHeader->cmsg_type == SCM_RIGHTS) {
+        memcpy(&memoryFd, CMSG_DATA(controlHeader), sizeof(int));
+    }
+    if(size != (ssize_t) sizeof(welcome) || welcome.type != InferenceProtocol::WELCOME || memoryFd < 0) {
+        std::cerr << "ERROR: The server refused the connection (" << nbSlots << " slots requested)" << std::endl;
+        if(memoryFd >= 0) {
+            close(memoryFd);
+        }
+        close(fd);
+        return nullptr;
+    }
+
+    size_t memorySize = (size_t) welcome.nbSlots * welcome.slotSize;
+    void* memory = mmap(nullptr, memorySize, PROT_READ | PROT_WRITE, MAP_SHARED, memoryFd, 0);
+    close(memoryFd);
+    if(memory == MAP_FAILED) {
+        std::cerr << "ERROR: Could not map the shared memory: " << strerror(errno) << std::endl;
+        close(fd);
+        return nullptr;
+    }
+    return new InferenceClient(fd, (char*) memory, memorySize, welcome);
+}
+
+/**
+ * Get the input of a slot, where the values must be written before send()
+ * @param slot Index of the slot
+ * @return Array of getInputSize() floats in the shared memory
+ */
+float* InferenceClient::getInput(int slot) {
+    return (float*) (memory + (size_t) slot * slotSize);
+}
+
+/**
+ * Get the output of a slot, valid once receive() returned the slot
+ * @param slot Index of the slot
+ * @return Array of getOutputSize() floats in the shared memory
+ */
+const float* InferenceClient::getOutput(int slot) const {
+    return (const float*) (memory + (size_t) slot * slotSize + outputOffset);
+}
+
+/**
+ * Get the number of slots
+ * @return Maximum number of requests in flight
+ */
+int InferenceClient::getNbSlots() const {
+    return nbSlots;
+}
+
+/**
+ * Get the number of floats of an input
+ * @return Input size of the network of the server
+ */
+int InferenceClient::getInputSize() const {
+    return inputSize;
+}
+
+/**
+ * Get the number of floats of an output
+ * @return Output size of the network of the server
+ */
+int InferenceClient::getOutputSize() const {
+    return outputSize;
+}
+
+/**
+ * Request the prediction of the input written in a slot
+ * @param slot Index of the slot, not in flight
+ * @return True if the request was sent
+ */
+bool InferenceClient::send(int slot) {
+    if(slot < 0 || slot >= nbSlots) {
+        std::cerr << "ERROR: Invalid slot " << slot << std::endl;
+        return false;
+    }
+    InferenceProtocol::Message message;
+    memset(&message, 0, sizeof(message));
+    message.type = InferenceProtocol::REQUEST;
+    message.slot = slot;
+    return ::send(socket, &message, sizeof(message), MSG_NOSIGNAL) == (ssize_t) sizeof(message);
+}
+
+/**
+ * Wait for the answer of a request
+ * @param slot Set to the slot of the answered request
+ * @return Label of the input of the slot, -1 if the server refused a request or the connection is closed
+ */
+int InferenceClient::receive(int &slot) {
+    InferenceProtocol::Message message;
+    ssize_t size;
+    do {
+        size = recv(socket, &message, sizeof(message), 0);
+    } while(size < 0 && errno == EINTR);
+    if(size != (ssize_t) sizeof(message) || message.type != InferenceProtocol::DONE) {
+        std::cerr << "ERROR: No answer from the inference server" << std::endl;
+        slot = -1;
+        return -1;
+    }
+    slot = message.slot;
+    return message.label;
+}
+
+/**
+ * Predict an input synchronously, using the first slot. No request must be in flight
+ * @param input Contiguous input (getInputSize() values)
+ * @return Label of the input, -1 if the request failed
+ */
+int InferenceClient::predict(const TensorView &input) {
+    if(input.size() != inputSize || !input.isContiguous()) {
+        std::cerr << "ERROR: The input must be contiguous and have " << inputSize << " values" << std::endl;
+        return -1;
+    }
+    std::copy(input.getData(), input.getData() + inputSize, getInput(0));
+    if(!send(0)) {
+        return -1;
+    }
+    int slot;
+    return receive(slot);
+}
+
+/**
+ * Get the statistics of the server. No request must be in flight, otherwise its answer could be read instead
+ * @param stats Set to the statistics of the server
+ * @return True if the statistics were received
+ */
+bool InferenceClient::getStats(InferenceProtocol::StatsMessage &stats) {
+    InferenceProtocol::Message message;
+    memset(&message, 0, sizeof(message));
+    message.type = InferenceProtocol::STATS;
+    if(::send(socket, &message, sizeof(message), MSG_NOSIGNAL) != (ssize_t) sizeof(message)) {
+        return false;
+    }
+    ssize_t size;
+    do {
+        size = recv(socket, &stats, sizeof(stats), 0);
+    } while(size < 0 && errno == EINTR);
+    return size == (ssize_t) sizeof(stats) && stats.type == InferenceProtocol::STATS;
+}
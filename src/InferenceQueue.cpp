@@ -0,0 +1,255 @@
+/**
+ * @file InferenceQueue.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class InferenceQueue, used to batch the predictions requested by several threads
+ * @date 2024-01-31
+ */
+
+#include "../include/InferenceQueue.h"
+#include <iostream>
+#include <algorithm>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+/**
+ * Create a queue and start its scheduler thread
+ * @param network Network predicting the labels
+ * @param maxBatchSize Maximum number of requests of a batch
+ * @param maxWait Maximum time between the submission of the first request of a batch and the start of the batch. 0 to run the requests as soon as the scheduler is idle
+ * @param pinScheduler True to bind the scheduler thread to the first core (only on Linux), where a pinned ThreadPool expects its calling thread
+ */
+InferenceQueue::InferenceQueue(NeuralNetwork &network, int maxBatchSize, std::chrono::microseconds maxWait, bool pinScheduler) : network(network), inputSize(network.getInputSize()), outputSize(network.getLayer(network.getNbLayers() - 1)->getOutputSize(0)), maxBatchSize(maxBatchSize), maxWait(maxWait), pendingBatch(0), nbRequests(0), nbBatches(0), stop(false) {
+    if(maxBatchSize <= 0) {
+        std::cerr << "ERROR: The maximum batch size must be positive" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    for(PendingBatch &batch : batches) {
+        batch.inputs.resize((size_t) maxBatchSize * inputSize);
+        batch.outputs.resize((size_t) maxBatchSize * outputSize);
+        batch.requestOutputs.resize(maxBatchSize);
+        batch.promises.resize(maxBatchSize);
+        batch.callbacks.resize(maxBatchSize);
+        batch.contexts.resize(maxBatchSize);
+        batch.submitTimes.resize(maxBatchSize);
+        batch.size = 0;
+    }
+    queueLatencies.reserve(LATENCY_WINDOW);
+    computeLatencies.reserve(LATENCY_WINDOW);
+    scheduler = std::thread(&InferenceQueue::schedulerLoop, this, pinScheduler);
+}
+
+/**
+ * Run the pending requests, then stop the scheduler
+ */
+InferenceQueue::~InferenceQueue() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    requestAvailable.notify_all();
+    scheduler.join();
+}
+
+/**
+ * Request the prediction of an input. It's copied, so the input can be freed once this function returns
+ * @param input Contiguous input of the network (getInputSize() values)
+ * @return Future of the label of the input (see NeuralNetwork::predict())
+ */
+std::future<int> InferenceQueue::submit(const TensorView &input) {
+    if(input.size() != inputSize || !input.isContiguous()) {
+        std::cerr << "ERROR: The input must be contiguous and have " << inputSize << " values" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::future<int> label;
+    enqueue(input.getData(), nullptr, nullptr, nullptr, &label);
+    return label;
+}
+
+/**
+ * Request the prediction of an input and get the result through a callback instead of a future, e.g. to answer a client from the scheduler thread
+ * @param input Input of the network (getInputSize() values). It's copied, so it can be freed once this function returns
+ * @param output Array of getOutputSize() values where the output of the network is copied before the callback is called, nullptr if it's not needed
+ * @param callback Function called by the scheduler thread with the label of the input
+ * @param context First argument of the callback
+ */
+void InferenceQueue::submit(const float* input, float* output, Callback callback, void* context) {
+    enqueue(input, output, callback, context, nullptr);
+}
+
+/**
+ * Add a request to the pending batch, and wait until the scheduler takes it if it's full
+ * @param input Input of the network
+ * @param output Array where the output is copied, nullptr if it's not needed
+ * @param callback Function called with the label, nullptr to use a promise
+ * @param context First argument of the callback
+ * @param label Future of the label, set if there is no callback
+ */
+void InferenceQueue::enqueue(const float* input, float* output, Callback callback, void* context, std::future<int>* label) {
+    std::unique_lock<std::mutex> lock(mutex);
+    spaceAvailable.wait(lock, [this] { return batches[pendingBatch].size < maxBatchSize; });
+    PendingBatch &batch = batches[pendingBatch];
+    int i = batch.size++;
+    std::copy(input, input + inputSize, batch.inputs.data() + (size_t) i * inputSize);
+    batch.requestOutputs[i] = output;
+    batch.callbacks[i] = callback;
+    batch.contexts[i] = context;
+    if(callback == nullptr) {
+        batch.promises[i] = std::promise<int>();
+        *label = batch.promises[i].get_future();
+    }
+    batch.submitTimes[i] = std::chrono::steady_clock::now();
+    lock.unlock();
+
+    // The scheduler only needs to wake up for the first request (to start its timer) and when the batch is full
+    if(i == 0 || i + 1 == maxBatchSize) {
+        requestAvailable.notify_one();
+    }
+}
+
+/**
+ * Wait for requests, gather them in batches and run the batches until the queue is destroyed
+ * @param pinThread True to bind this thread to the first core
+ */
+void InferenceQueue::schedulerLoop(bool pinThread) {
+#ifdef __linux__
+    if(pinThread) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(0, &cpuSet);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet);
+    }
+#endif
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        requestAvailable.wait(lock, [this] { return stop || batches[pendingBatch].size > 0; });
+        if(batches[pendingBatch].size == 0) {
+            return;
+        }
+
+        // The batch starts when it's full or when its first request has waited long enough
+        std::chrono::steady_clock::time_point deadline = batches[pendingBatch].submitTimes[0] + maxWait;
+        requestAvailable.wait_until(lock, deadline, [this] { return stop || batches[pendingBatch].size >= maxBatchSize; });
+
+        PendingBatch &batch = batches[pendingBatch];
+        pendingBatch = 1 - pendingBatch;
+        lock.unlock();
+        spaceAvailable.notify_all();
+
+        runBatch(batch);
+
+        lock.lock();
+        batch.size = 0;
+    }
+}
+
+/**
+ * Run the forward pass of a batch, give the labels (and the outputs) to the requests and record their latencies
+ * @param batch Batch of requests
+ */
+void InferenceQueue::runBatch(PendingBatch &batch) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    TensorView outputs(2, {batch.size, outputSize}, batch.outputs.data());
+    network.evaluateBatchInto(TensorView(2, {batch.size, inputSize}, batch.inputs.data()), outputs);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        float computeLatency = std::chrono::duration<float, std::micro>(end - start).count();
+        for(int i=0; i<batch.size; i++) {
+            float queueLatency = std::chrono::duration<float, std::micro>(start - batch.submitTimes[i]).count();
+            if(queueLatencies.size() < LATENCY_WINDOW) {
+                queueLatencies.push_back(queueLatency);
+                computeLatencies.push_back(computeLatency);
+            } else {
+                queueLatencies[nbRequests % LATENCY_WINDOW] = queueLatency;
+                computeLatencies[nbRequests % LATENCY_WINDOW] = computeLatency;
+            }
+            nbRequests++;
+        }
+        nbBatches++;
+    }
+
+    for(int i=0; i<batch.size; i++) {
+        const float* output = batch.outputs.data() + (size_t) i * outputSize;
+        int label = (int) (std::max_element(output, output + outputSize) - output);
+        if(batch.requestOutputs[i] != nullptr) {
+            std::copy(output, output + outputSize, batch.requestOutputs[i]);
+        }
+        if(batch.callbacks[i] != nullptr) {
+            batch.callbacks[i](batch.contexts[i], label);
+        } else {
+            batch.promises[i].set_value(label);
+        }
+    }
+}
+
+/**
+ * Get a percentile of some values
+ * @param values Values, reordered by this function
+ * @param percentile Percentile between 0 and 100
+ * @return Value below which the given percentage of the values are, 0 if there is no value
+ */
+float InferenceQueue::getPercentile(std::vector<float> &values, float percentile) {
+    if(values.empty()) {
+        return 0.0f;
+    }
+    size_t k = std::min(values.size() - 1, (size_t) (percentile / 100.0f * (float) values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+/**
+ * Get the counters and the latencies of the requests computed so far
+ * @return Statistics of the queue
+ */
+InferenceQueue::Stats InferenceQueue::getStats() {
+    std::vector<float> queue;
+    std::vector<float> compute;
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        queue = queueLatencies;
+        compute = computeLatencies;
+        stats.nbRequests = nbRequests;
+        stats.nbBatches = nbBatches;
+    }
+    stats.meanBatchSize = stats.nbBatches > 0 ? (float) stats.nbRequests / (float) stats.nbBatches : 0.0f;
+    stats.queueP50 = getPercentile(queue, 50.0f);
+    stats.queueP99 = getPercentile(queue, 99.0f);
+    stats.computeP50 = getPercentile(compute, 50.0f);
+    stats.computeP99 = getPercentile(compute, 99.0f);
+    return stats;
+}
+
+/**
+ * Get the number of values of an input
+ * @return Input size of the network
+ */
+int InferenceQueue::getInputSize() const {
+    return inputSize;
+}
+
+/**
+ * Get the number of values of an output
+ * @return Output size of the last layer of the network
+ */
+int InferenceQueue::getOutputSize() const {
+    return outputSize;
+}
+
+/**
+ * Get the maximum number of requests of a batch
+ * @return Maximum batch size
+ */
+int InferenceQueue::getMaxBatchSize() const {
+    return maxBatchSize;
+}
+
+/**
+ * Get the maximum time between the submission of the first request of a batch and the start of the batch
+ * @return Maximum wait time
+ */
+std::chrono::microseconds InferenceQueue::getMaxWait() const {
+    return maxWait;
+}
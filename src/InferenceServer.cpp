@@ -0,0 +1,347 @@
+/**
+ * @file InferenceServer.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class InferenceServer, used to answer the predictions of local clients through a Unix socket and shared memory
+ * @date 2024-02-01
+ */
+
+#include "../include/InferenceServer.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/**
+ * Create a server. It doesn't listen until run() is called
+ * @param network Network predicting the labels. It must not be used by other threads while the server exists
+ * @param socketPath Path of the Unix socket where the clients connect. An existing file at this path is replaced
+ * @param maxBatchSize Maximum number of requests of a batch
+ * @param maxWait Maximum time between the reception of the first request of a batch and the start of the batch
+ * @param pinThreads True to bind the scheduler thread of the queue to the first core (see ThreadPool::configure() to pin the workers)
+ */
+InferenceServer::InferenceServer(NeuralNetwork &network, const std::string &socketPath, int maxBatchSize, std::chrono::microseconds maxWait, bool pinThreads) : network(network), queue(network, maxBatchSize, maxWait, pinThreads), socketPath(socketPath), listenSocket(-1), nbClients(0), stopRequested(false), startTime(std::chrono::steady_clock::now()) {
+    if(pipe2(wakePipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        std::cerr << "ERROR: Could not create the pipe of the inference server: " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    // The inputs and the outputs are aligned so that the batch gathering and the output copy use aligned vectors
+    size_t alignment = InferenceProtocol::ALIGNMENT;
+    outputOffset = ((size_t) queue.getInputSize() * sizeof(float) + alignment - 1) / alignment * alignment;
+    slotSize = (outputOffset + (size_t) queue.getOutputSize() * sizeof(float) + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * Destroy the server. run() must have returned
+ */
+InferenceServer::~InferenceServer() {
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+}
+
+/**
+ * Listen on the socket and answer the clients until stop() is called
+ * @return False if the socket could not be created, true otherwise
+ */
+bool InferenceServer::run() {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "ERROR: The socket path " << socketPath << " is too long" << std::endl;
+        return false;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    listenSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(listenSocket < 0) {
+        std::cerr << "ERROR: Could not create the socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+    unlink(socketPath.c_str());
+    if(bind(listenSocket, (sockaddr*) &address, sizeof(address)) != 0 || listen(listenSocket, SOMAXCONN) != 0) {
+        std::cerr << "ERROR: Could not listen on " << socketPath << ": " << strerror(errno) << std::endl;
+        close(listenSocket);
+        listenSocket = -1;
+        return false;
+    }
+
+    std::vector<pollfd> fds;
+    std::vector<Client*> polledClients;
+    while(!stopRequested.load()) {
+        fds.clear();
+        polledClients.clear();
+        fds.push_back({wakePipe[0], POLLIN, 0});
+        fds.push_back({listenSocket, POLLIN, 0});
+        bool cleanupPending = false;
+        for(Client* client : clients) {
+            if(client->closed) {
+                cleanupPending = true;
+            } else {
+                fds.push_back({client->socket, POLLIN, 0});
+                polledClients.push_back(client);
+            }
+        }
+
+        // The closed clients are deleted when their last request is answered, which the scheduler doesn't signal, so they are checked periodically
+        if(poll(fds.data(), fds.size(), cleanupPending ? 10 : -1) < 0 && errno != EINTR) {
+            std::cerr << "ERROR: poll failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        if(fds[0].revents != 0) {
+            char buffer[64];
+            while(read(wakePipe[0], buffer, sizeof(buffer)) > 0) {}
+        }
+        if(fds[1].revents & POLLIN) {
+            acceptClient();
+        }
+        for(size_t i=0; i<polledClients.size(); i++) {
+            if(fds[i + 2].revents != 0 && !handleMessage(polledClients[i])) {
+                polledClients[i]->closed = true;
+                nbClients--;
+            }
+        }
+
+        for(size_t i=0; i<clients.size();) {
+            if(clients[i]->closed && clients[i]->nbInFlight.load(std::memory_order_acquire) == 0) {
+                deleteClient(clients[i]);
+                clients[i] = clients.back();
+                clients.pop_back();
+            } else {
+                i++;
+            }
+        }
+    }
+
+    close(listenSocket);
+    listenSocket = -1;
+    unlink(socketPath.c_str());
+
+    // The requests in flight write in the shared memories, so they are waited for before unmapping them
+    for(Client* client : clients) {
+        if(!client->closed) {
+            client->closed = true;
+            nbClients--;
+        }
+        while(client->nbInFlight.load(std::memory_order_acquire) > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        deleteClient(client);
+    }
+    clients.clear();
+    return true;
+}
+
+/**
+ * Make run() return. It can be called from a signal handler
+ */
+void InferenceServer::stop() {
+    stopRequested.store(true);
+    char c = 0;
+    ssize_t result = write(wakePipe[1], &c, 1);
+    (void) result;
+}
+
+/**
+ * Accept a pending connection
+ * @return False if no client could be accepted
+ */
+bool InferenceServer::acceptClient() {
+    int socket = accept4(listenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+    if(socket < 0) {
+        std::cerr << "WARNING: Could not accept a client: " << strerror(errno) << std::endl;
+        return false;
+    }
+    Client* client = new Client();
+    client->socket = socket;
+    client->memory = nullptr;
+    client->memorySize = 0;
+    client->nbSlots = 0;
+    client->nbInFlight.store(0);
+    client->closed = false;
+    clients.push_back(client);
+    nbClients++;
+    return true;
+}
+
+/**
+ * Read and handle a message of a client
+ * @param client Client whose socket is readable
+ * @return False if the connection is closed or broken, true otherwise
+ */
+bool InferenceServer::handleMessage(Client* client) {
+    InferenceProtocol::Message message;
+    ssize_t size = recv(client->socket, &message, sizeof(message), MSG_DONTWAIT);
+    if(size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return true;
+    }
+    if(size != (ssize_t) sizeof(message)) {
+        return false;
+    }
+
+    InferenceProtocol::Message answer;
+    memset(&answer, 0, sizeof(answer));
+    answer.type = InferenceProtocol::FAILURE;
+
+    switch(message.type) {
+        case InferenceProtocol::HELLO: {
+            if(client->memory != nullptr || message.version != InferenceProtocol::VERSION || message.nbSlots <= 0 || message.nbSlots > InferenceProtocol::MAX_SLOTS) {
+                return sendMessage(client->socket, answer);
+            }
+            int fd = createSharedMemory(client, message.nbSlots);
+            if(fd < 0) {
+                return sendMessage(client->socket, answer);
+            }
+            answer.type = InferenceProtocol::WELCOME;
+            answer.version = InferenceProtocol::VERSION;
+            answer.nbSlots = client->nbSlots;
+            answer.inputSize = queue.getInputSize();
+            answer.outputSize = queue.getOutputSize();
+            answer.outputOffset = (uint32_t) outputOffset;
+            answer.slotSize = slotSize;
+            bool sent = sendMessage(client->socket, answer, fd);
+            close(fd);
+            return sent;
+        }
+        case InferenceProtocol::REQUEST: {
+            if(client->memory == nullptr || message.slot < 0 || message.slot >= client->nbSlots) {
+                return sendMessage(client->socket, answer);
+            }
+            // The input is copied from the shared memory to the batch by submit(), and the output is written back to the slot by the scheduler
+            char* slot = client->memory + (size_t) message.slot * slotSize;
+            client->nbInFlight.fetch_add(1, std::memory_order_relaxed);
+            queue.submit((const float*) slot, (float*) (slot + outputOffset), onRequestDone, &client->slots[message.slot]);
+            return true;
+        }
+        case InferenceProtocol::STATS: {
+            InferenceProtocol::StatsMessage stats = getStats();
+            return send(client->socket, &stats, sizeof(stats), MSG_NOSIGNAL) == (ssize_t) sizeof(stats);
+        }
+        default:
+            return sendMessage(client->socket, answer);
+    }
+}
+
+/**
+ * Create and map the shared memory of a client
+ * @param client Client without shared memory
+ * @param nbSlots Number of slots
+ * @return File descriptor of the shared memory, to send to the client and then close. -1 if it could not be created
+ */
+int InferenceServer::createSharedMemory(Client* client, int nbSlots) {
+    size_t size = (size_t) nbSlots * slotSize;
+    int fd = memfd_create("inference-slots", MFD_CLOEXEC);
+    if(fd < 0) {
+        std::cerr << "WARNING: Could not create a shared memory: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    if(ftruncate(fd, (off_t) size) != 0) {
+        std::cerr << "WARNING: Could not allocate a shared memory of " << size << " bytes: " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(memory == MAP_FAILED) {
+        std::cerr << "WARNING: Could not map a shared memory: " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    client->memory = (char*) memory;
+    client->memorySize = size;
+    client->nbSlots = nbSlots;
+    client->slots.resize(nbSlots);
+    for(int i=0; i<nbSlots; i++) {
+        client->slots[i].client = client;
+        client->slots[i].slot = i;
+    }
+    return fd;
+}
+
+/**
+ * Send a control message
+ * @param socket Socket of the client
+ * @param message Message to send
+ * @param fd File descriptor sent with the message, -1 if there is none
+ * @return True if the message was sent
+ */
+bool InferenceServer::sendMessage(int socket, const InferenceProtocol::Message &message, int fd) {
+    iovec data = {(void*) &message, sizeof(message)};
+    msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &data;
+    header.msg_iovlen = 1;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    if(fd >= 0) {
+        header.msg_control = control;
+        header.msg_controllen = sizeof(control);
+        cmsghdr* controlHeader = CMSG_FIRSTHDR(&header);
+        controlHeader->cmsg_level = SOL_SOCKET;
+        controlHeader->cmsg_type = SCM_RIGHTS;
+        controlHeader->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(controlHeader), &fd, sizeof(int));
+    }
+    return sendmsg(socket, &header, MSG_NOSIGNAL) == (ssize_t) sizeof(message);
+}
+
+/**
+ * Unmap the shared memory of a client, close its socket and delete it. It must not have requests in flight
+ * @param client Client to delete
+ */
+void InferenceServer::deleteClient(Client* client) {
+    if(client->memory != nullptr) {
+        munmap(client->memory, client->memorySize);
+    }
+    close(client->socket);
+    delete client;
+}
+
+/**
+ * Answer a request. Called by the scheduler thread of the queue once the output is written in the slot
+ * @param context SlotContext of the request
+ * @param label Label of the input
+ */
+void InferenceServer::onRequestDone(void* context, int label) {
+    SlotContext* slot = (SlotContext*) context;
+    Client* client = slot->client;
+    InferenceProtocol::Message message;
+    memset(&message, 0, sizeof(message));
+    message.type = InferenceProtocol::DONE;
+    message.slot = slot->slot;
+    message.label = label;
+
+    // The scheduler must not wait for a client that doesn't read its answers, so such a client is disconnected (the I/O thread sees the shutdown)
+    if(send(client->socket, &message, sizeof(message), MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t) sizeof(message)) {
+        shutdown(client->socket, SHUT_RDWR);
+    }
+    // Last access to the client: the I/O thread may delete it as soon as it's not in flight anymore
+    client->nbInFlight.fetch_sub(1, std::memory_order_release);
+}
+
+/**
+ * Get the activity of the server since it was created
+ * @return Statistics of the server, in the format sent to the clients
+ */
+InferenceProtocol::StatsMessage InferenceServer::getStats() {
+    InferenceQueue::Stats queueStats = queue.getStats();
+    InferenceProtocol::StatsMessage stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.type = InferenceProtocol::STATS;
+    stats.nbClients = nbClients.load();
+    stats.nbRequests = queueStats.nbRequests;
+    stats.nbBatches = queueStats.nbBatches;
+    stats.uptime = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+    stats.requestsPerSecond = stats.uptime > 0.0f ? (float) stats.nbRequests / stats.uptime : 0.0f;
+    stats.meanBatchSize = queueStats.meanBatchSize;
+    stats.queueP50 = queueStats.queueP50;
+    stats.queueP99 = queueStats.queueP99;
+    stats.computeP50 = queueStats.computeP50;
+    stats.computeP99 = queueStats.computeP99;
+    return stats;
+}
@@ -12,7 +12,14 @@
  * @param data Input tensor (data that will be fed to the AI model)
  * @param labelOneHot Label associated to the input vector in a one hot representation. It's shared between instances so it should not be deleted when an instance is deleted
  */
-Instance::Instance(Tensor* data, float *labelOneHot) : data(data), labelOneHot(labelOneHot) {}
+Instance::Instance(Tensor* data, float *labelOneHot) : data(data), labelOneHot(labelOneHot), label(-1) {}
+
+/**
+ * Create an Instance object by providing the data tensor and the index of its class, which is more compact than a one hot representation
+ * @param data Input tensor (data that will be fed to the AI model)
+ * @param label Index of the class of the input
+ */
+Instance::Instance(Tensor* data, int label) : data(data), labelOneHot(nullptr), label(label) {}
 
 /**
  * Get the data tensor of this instance
@@ -24,9 +31,25 @@ Tensor* Instance::getData() {
 
 /**
  * Get the one hot representation of the target class. It's the expected output of the AI model.
- * @return Target output. Do not free the memory pointed by this pointer
+ * @return Target output, nullptr if the instance was created with the index of its class. Do not free the memory pointed by this pointer
  */
 float* Instance::getOneHotLabel() {
     return labelOneHot;
 }
 
+/**
+ * Get the index of the target class
+ * @return Index of the class, -1 if the instance was created with a one hot representation
+ */
+int Instance::getLabel() {
+    return label;
+}
+
+/**
+ * Check if a class is the target class, whatever the representation of the label
+ * @param predictedLabel Index of a class (e.g. predicted by a model)
+ * @return True if it's the class of this instance
+ */
+bool Instance::isLabel(int predictedLabel) {
+    return labelOneHot != nullptr ? labelOneHot[predictedLabel] == 1 : label == predictedLabel;
+}
@@ -7,6 +7,18 @@
 
 #include "../include/Layer.h"
 #include "../include/Identity.h"
+#include "../include/ThreadPool.h"
+
+/**
+ * Get the approximate number of operations done by an activation function for one instance of a batch
+ * @param input Batch given to the activation function
+ * @return Work per instance, used to decide how many threads are worth using
+ */
+static long getActivationWorkPerInstance(const TensorView &input) {
+    // An activation function costs about as much as 10 multiply-adds per element (exp, division...)
+    int batchSize = input.getDimSize(0);
+    return batchSize > 0 ? 10L * input.size() / batchSize : 0;
+}
 
 /**
  * Create a Layer from a shape definition and an activation function
@@ -69,13 +81,23 @@ int Layer::getOutputSize(int dim) {
         return -1;
 }
 
+/**
+ * Get the activation function of this layer
+ * @return Activation function applied to calculate the output of this layer
+ */
+ActivationFunction* Layer::getActivationFunction() {
+    return activationFunction;
+}
+
 /**
  * Get the derivatives (in a tensor) of this layer activation function evaluated at the given input (da/dz in the LaTeX document)
  * @param input Tensor where are evaluated the derivatives
  * @return Derivatives tensor
  */
-Tensor* Layer::getActivationDerivatives(const Tensor& input) {
-    return activationFunction->getDerivatives(input, input.getDimSize(0));
+Tensor Layer::getActivationDerivatives(const TensorView& input) {
+    Tensor output(input.getNDim(), input.getShape());
+    getActivationDerivativesInto(input, output);
+    return output;
 }
 
 /**
@@ -83,6 +105,105 @@ Tensor* Layer::getActivationDerivatives(const Tensor& input) {
  * @param input Tensor passed through the activation function. e.g. for the dense layer it's the weighted sums
  * @return Tensor of the output of the activation function
  */
-Tensor* Layer::getActivationValues(const Tensor &input) {
-    return activationFunction->getValues(input, input.getDimSize(0));
+Tensor Layer::getActivationValues(const TensorView &input) {
+    Tensor output(input.getNDim(), input.getShape());
+    getActivationValuesInto(input, output);
+    return output;
+}
+
+/**
+ * Get the derivatives of this layer activation function evaluated at the given input (da/dz in the LaTeX document) and write them in the output tensor
+ * @param input Tensor where are evaluated the derivatives
+ * @param output Tensor where the derivatives are written. Its shape is the same as the input and it can be the input itself
+ */
+void Layer::getActivationDerivativesInto(const TensorView& input, TensorView &output) {
+    // The instances of the batch are independent, so the batch is split between the threads
+    ThreadPool::getInstance().parallelFor(input.getDimSize(0), getActivationWorkPerInstance(input), [&](int begin, int end) {
+        TensorView inputSlice = input.slice(begin, end);
+        TensorView outputSlice = output.slice(begin, end);
+        activationFunction->getDerivativesInto(inputSlice, end - begin, outputSlice);
+    });
+}
+
+/**
+ * Apply the activation function to the input tensor and write the result in the output tensor
+ * @param input Tensor passed through the activation function. e.g. for the dense layer it's the weighted sums
+ * @param output Tensor where the output of the activation function is written. Its shape is the same as the input and it can be the input itself
+ */
+void Layer::getActivationValuesInto(const TensorView &input, TensorView &output) {
+    ThreadPool::getInstance().parallelFor(input.getDimSize(0), getActivationWorkPerInstance(input), [&](int begin, int end) {
+        TensorView inputSlice = input.slice(begin, end);
+        TensorView outputSlice = output.slice(begin, end);
+        activationFunction->getValuesInto(inputSlice, end - begin, outputSlice);
+    });
+}
+
+/**
+ * Check if the derivatives of the activation function can be applied from the output of the layer (see multiplyByActivationDerivativesInPlace()), so that they don't need to be stored for the backward pass
+ * @return True if the activation function can multiply by its derivatives in place
+ */
+bool Layer::hasActivationDerivativesFromOutput() {
+    return activationFunction->canMultiplyByDerivativeInPlace();
+}
+
+/**
+ * Multiply the derivatives of the cost in respect for the output of this layer (dC/da) by the derivatives of its activation function (da/dz), to get dC/dz. It's only available if hasActivationDerivativesFromOutput() returns true
+ * @param costDerivatives Tensor containing dC/da, replaced by dC/dz
+ * @param output Output of this layer, same shape as the cost derivatives
+ */
+void Layer::multiplyByActivationDerivativesInPlace(TensorView &costDerivatives, const TensorView &output) {
+    ThreadPool::getInstance().parallelFor(output.getDimSize(0), getActivationWorkPerInstance(output), [&](int begin, int end) {
+        TensorView costDerivativesSlice = costDerivatives.slice(begin, end);
+        TensorView outputSlice = output.slice(begin, end);
+        activationFunction->multiplyByDerivativeInPlace(costDerivativesSlice, outputSlice, end - begin);
+    });
+}
+
+/**
+ * Create a tensor whose shape is the output shape of this layer for the given batch size. Its values are not initialized
+ * @param batchSize Size of the batch (first dimension of the tensor)
+ * @return Tensor that can be given to getOutputInto() and getPreActivationValuesInto()
+ */
+Tensor Layer::createOutput(int batchSize) {
+    int dimSizes[TensorView::MAX_N_DIM];
+    dimSizes[0] = batchSize;
+    for(int i=0; i<getOutputDim(); i++) {
+        dimSizes[i+1] = outputShape[i];
+    }
+    return Tensor(getOutputDim() + 1, dimSizes);
+}
+
+/**
+ * Get the output of the layer given input
+ * @param input Input tensor
+ * @return Output tensor of this layer. The shape of this tensor matches the output shape of this layer
+ */
+Tensor Layer::getOutput(const TensorView &input) {
+    Tensor output = createOutput(input.getDimSize(0));
+    getOutputInto(input, output);
+    return output;
+}
+
+/**
+ * Get the output of the layer and the derivatives of its activation function (da/dz) in respect for the pre-activation values, as needed to train the layer
+ * @remark By default the pre-activation values are written in activationDerivatives and then replaced by the derivatives. Layers can override it to compute everything in one pass
+ * @param input Input tensor
+ * @param output Tensor where the output of this layer is written. Its shape must match the output shape of this layer (see createOutput())
+ * @param activationDerivatives Tensor where the derivatives da/dz are written. Its shape is the same as the output
+ */
+void Layer::getOutputAndDerivativesInto(const TensorView &input, TensorView &output, TensorView &activationDerivatives) {
+    getPreActivationValuesInto(input, activationDerivatives);
+    getActivationValuesInto(activationDerivatives, output);
+    getActivationDerivativesInto(activationDerivatives, activationDerivatives);
+}
+
+/**
+ * Get the pre-activations values of the layer for the given input. It's the input of the activation function
+ * @param input Input tensor given to this layer.
+ * @return Tensor of the pre-activation values z_i,j for the given input for all i,j.
+ */
+Tensor Layer::getPreActivationValues(const TensorView &input) {
+    Tensor output = createOutput(input.getDimSize(0));
+    getPreActivationValuesInto(input, output);
+    return output;
 }
@@ -8,6 +8,15 @@
 #include "../include/LayersList.h"
 #include "../include/DenseLayer.h"
 
+/**
+ * Delete the layers of the list
+ */
+LayersList::~LayersList() {
+    for(Layer* layer : layers) {
+        delete layer;
+    }
+}
+
 /**
  * Add a neuron layer to the list of layers. This function will change in the near future since it can only creates Dense layers (even the arguments name are not consistent)
  * @param nbNeurons Number of neurons in the layer
@@ -19,6 +28,14 @@ void LayersList::add(int nbNeurons, int nbNeuronsPrevLayer, ActivationFunction*
     layers.push_back(newLayer);
 }
 
+/**
+ * Add a layer created by the caller to the list of layers
+ * @param layer Layer allocated with new. The list takes its ownership and deletes it
+ */
+void LayersList::add(Layer* layer) {
+    layers.push_back(layer);
+}
+
 /**
  * Get the ith layer
  * @param i Index of the layer to be fetched
@@ -6,37 +6,63 @@
  */
 
 #include "../include/LeakyRelu.h"
+#include "../include/VectorMath.h"
 
 /**
- * For all component xi of the input tensor, calculate LeakyReLU(xi) and return a tensor that contains the result for each xi
+ * For all component xi of the input tensor, calculate LeakyReLU(xi) and write the result for each xi in the output tensor
  * @param input Input tensor whose rank is greater than or equal to 1
  * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
- * @return Tensor of the output of the function for each component of the input tensor
+ * @param output Tensor where the outputs of the function for each component of the input tensor are written. It can be the input tensor itself
  */
-Tensor * LeakyRelu::getValues(const Tensor &input, int batchSize) {
-    Tensor* output = new Tensor(input.getNDim(), input.getDimSizes());
-    float* outputData = output->getData();
-    float* inputData = input.getData();
-
-    for(int i=0; i<output->size(); i++) {
-        outputData[i] = inputData[i] <= 0 ? 0.01f * inputData[i] : inputData[i];
-    }
-    return output;
+void LeakyRelu::getValuesInto(const TensorView &input, int batchSize, TensorView &output) {
+    VectorMath::leakyReluInto(input.getData(), output.getData(), output.size(), 0.01f);
 }
 
 /**
- * For all component xi of the input tensor, calculate the derivative dLeakyReLU(xi)/dxi and return a tensor that contains the result for each xi
+ * For all component xi of the input tensor, calculate the derivative dLeakyReLU(xi)/dxi and write the result for each xi in the output tensor
  * @param input Input tensor whose rank is greater than or equal to 1
  * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
- * @return Tensor of the derivatives of the function for each component of the input tensor
+ * @param output Tensor where the derivatives of the function for each component of the input tensor are written. It can be the input tensor itself
  */
-Tensor* LeakyRelu::getDerivatives(const Tensor &input, int batchSize) {
-    Tensor* output = new Tensor(input.getNDim(), input.getDimSizes());
-    float* outputData = output->getData();
-    float* inputData = input.getData();
+void LeakyRelu::getDerivativesInto(const TensorView &input, int batchSize, TensorView &output) {
+    VectorMath::leakyReluDerivativesInto(input.getData(), output.getData(), output.size(), 0.01f);
+}
 
-    for(int i=0; i<output->size() ; i++) {
-        outputData[i] = inputData[i] <= 0 ? 0.01f : 1;
-    }
-    return output;
+/**
+ * Check if multiplyByDerivativeInPlace() can be used
+ * @return True since the output is positive exactly where the input is positive, so the derivatives are known from the output
+ */
+bool LeakyRelu::canMultiplyByDerivativeInPlace() {
+    return true;
+}
+
+/**
+ * For all component gi of the gradient, multiply it by the derivative of the function (1 where the output is positive, 0.01 elsewhere)
+ * @param gradient Tensor multiplied in place
+ * @param output Outputs of the function, same shape as the gradient
+ * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
+ */
+void LeakyRelu::multiplyByDerivativeInPlace(TensorView &gradient, const TensorView &output, int batchSize) {
+    (void) batchSize;
+    VectorMath::multiplyByLeakyReluDerivatives(output.getData(), gradient.getData(), gradient.size(), 0.01f);
+}
+
+/**
+ * Get the activation that the matrix multiplication epilogue must apply to compute this function
+ * @param activation Set to Gemm::LEAKY_RELU
+ * @param parameter Set to the slope for negative values (0.01)
+ * @return True since this function can be fused
+ */
+bool LeakyRelu::getFusedActivation(Gemm::Activation &activation, float &parameter) {
+    activation = Gemm::LEAKY_RELU;
+    parameter = 0.01f;
+    return true;
+}
+
+/**
+ * Get the name of the function, used to identify it in the model files
+ * @return "LeakyRelu"
+ */
+std::string LeakyRelu::getName() {
+    return "LeakyRelu";
 }
\ No newline at end of file
@@ -0,0 +1,400 @@
+/**
+ * @file ModelFile.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class ModelFile, used to save a network in a binary file and to map it in memory to load it without copying its parameters
+ * @date 2024-01-29
+ */
+
+#include "../include/ModelFile.h"
+#include "../include/ThreadPool.h"
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static_assert(sizeof(ModelFile::Header) == ModelFile::ALIGNMENT, "The header must fill exactly one aligned block");
+static_assert(sizeof(ModelFile::LayerRecord) == ModelFile::ALIGNMENT, "A layer record must fill exactly one aligned block");
+static_assert(sizeof(ModelFile::TrainingState) == ModelFile::ALIGNMENT, "The training state must fill exactly one aligned block");
+
+static const char MAGIC[8] = {'A', 'I', 'M', 'O', 'D', 'E', 'L', '\0'}; /**< First bytes of a model file */
+
+/**
+ * Create a model file from its mapped memory
+ * @param data Start of the mapping
+ * @param size Size of the mapping in bytes
+ */
+ModelFile::ModelFile(char* data, size_t size) : data(data), size(size) {}
+
+/**
+ * Unmap the file. The layers using its arrays must not be used afterwards (they keep it alive with a shared pointer)
+ */
+ModelFile::~ModelFile() {
+    munmap(data, size);
+}
+
+/**
+ * Get the smallest multiple of ALIGNMENT greater than or equal to an offset
+ * @param offset Offset in bytes
+ * @return Aligned offset
+ */
+size_t ModelFile::align(size_t offset) {
+    return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+/**
+ * Copy an array in a serialized file and fill the bytes up to the next aligned offset with zeros
+ * @param bytes Content of the file, large enough for the array and its padding
+ * @param offset Offset where the array is copied
+ * @param array Array copied
+ * @param nbBytes Size of the array in bytes
+ * @return Aligned offset following the array
+ */
+size_t ModelFile::copyAligned(std::vector<char> &bytes, size_t offset, const void* array, size_t nbBytes) {
+    // The large arrays are copied by blocks of ALIGNMENT bytes in parallel, a single thread can't use all the memory bandwidth
+    char* destination = bytes.data() + offset;
+    const char* source = static_cast<const char*>(array);
+    int nbBlocks = (int) (nbBytes / ALIGNMENT);
+    ThreadPool::getInstance().parallelFor(nbBlocks, ALIGNMENT / 4, [&](int begin, int end) {
+        memcpy(destination + (size_t) begin * ALIGNMENT, source + (size_t) begin * ALIGNMENT, (size_t) (end - begin) * ALIGNMENT);
+    });
+    memcpy(destination + (size_t) nbBlocks * ALIGNMENT, source + (size_t) nbBlocks * ALIGNMENT, nbBytes - (size_t) nbBlocks * ALIGNMENT);
+    memset(bytes.data() + offset + nbBytes, 0, align(nbBytes) - nbBytes);
+    return offset + align(nbBytes);
+}
+
+/**
+ * Map a model file in memory and check its content. The pages are read from the disk when they are first used
+ * @param fileName Name of the file
+ * @return Mapped file, nullptr if it can't be opened or if it's not a valid model file (the reason is written on the standard error)
+ */
+std::shared_ptr<ModelFile> ModelFile::open(const std::string &fileName) {
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if(fd < 0) {
+        std::cerr << "ERROR: Failed to open the model file " << fileName << std::endl;
+        return nullptr;
+    }
+
+    struct stat fileStat;
+    if(fstat(fd, &fileStat) != 0 || (size_t) fileStat.st_size < sizeof(Header)) {
+        std::cerr << "ERROR: " << fileName << " is not a model file (too small)" << std::endl;
+        ::close(fd);
+        return nullptr;
+    }
+
+    // The mapping is private and writable: the pages are shared with the page cache until they are modified (e.g. by a training)
+    size_t size = (size_t) fileStat.st_size;
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(data == MAP_FAILED) {
+        std::cerr << "ERROR: Failed to map the model file " << fileName << std::endl;
+        return nullptr;
+    }
+    // All the parameters are needed by the first evaluation, so they are read ahead
+    madvise(data, size, MADV_WILLNEED);
+
+    std::shared_ptr<ModelFile> file(new ModelFile(static_cast<char*>(data), size));
+    if(!file->isValid(fileName)) {
+        return nullptr;
+    }
+    return file;
+}
+
+/**
+ * Check that the header and the layer records are consistent with each other and with the size of the file
+ * @param fileName Name of the file, used in the error messages
+ * @return True if the file can be used, false otherwise (the reason is written on the standard error)
+ */
+bool ModelFile::isValid(const std::string &fileName) const {
+    const Header* header = reinterpret_cast<const Header*>(data);
+    if(memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0) {
+        std::cerr << "ERROR: " << fileName << " is not a model file" << std::endl;
+        return false;
+    }
+    if(header->byteOrderMark != BYTE_ORDER_MARK) {
+        std::cerr << "ERROR: " << fileName << " was written with another byte order" << std::endl;
+        return false;
+    }
+    if(header->version == 0 || header->version > VERSION) {
+        std::cerr << "ERROR: " << fileName << " uses the version " << header->version << " of the format, only the versions up to " << VERSION << " are supported" << std::endl;
+        return false;
+    }
+    if(header->fileSize != size) {
+        std::cerr << "ERROR: " << fileName << " is truncated or corrupted (" << size << " bytes instead of " << header->fileSize << ")" << std::endl;
+        return false;
+    }
+    if(header->nbLayers == 0 || header->inputSize <= 0 || header->nbLayers > (size - sizeof(Header)) / sizeof(LayerRecord)) {
+        std::cerr << "ERROR: " << fileName << " has an invalid topology" << std::endl;
+        return false;
+    }
+
+    int prevSize = header->inputSize;
+    for(int i=0; i<getNbLayers(); i++) {
+        const LayerRecord& layer = getLayer(i);
+        if(layer.type != DENSE || layer.nbNeurons <= 0 || layer.nbNeuronsPrevLayer != prevSize) {
+            std::cerr << "ERROR: " << fileName << " has an invalid layer " << i << std::endl;
+            return false;
+        }
+        if(memchr(layer.activationFunction, '\0', sizeof(layer.activationFunction)) == nullptr) {
+            std::cerr << "ERROR: " << fileName << " has an invalid activation function for the layer " << i << std::endl;
+            return false;
+        }
+
+        uint64_t nbWeights = (uint64_t) layer.nbNeurons * (uint64_t) layer.nbNeuronsPrevLayer;
+        uint64_t nbParameters = nbWeights + (uint64_t) layer.nbNeurons;
+        if(!isArrayValid(layer.weightsOffset, nbWeights, 1) || !isArrayValid(layer.biasesOffset, layer.nbNeurons, 1)
+           || (layer.optimizerStateOffset != 0 && (layer.nbOptimizerStateValues == 0 || !isArrayValid(layer.optimizerStateOffset, nbParameters, layer.nbOptimizerStateValues)))
+           || (layer.pruningMaskOffset != 0 && !isArrayValid(layer.pruningMaskOffset, nbWeights, 1))) {
+            std::cerr << "ERROR: " << fileName << " has invalid parameters offsets for the layer " << i << std::endl;
+            return false;
+        }
+        prevSize = layer.nbNeurons;
+    }
+
+    if(header->trainingStateOffset != 0) {
+        const TrainingState* trainingState = reinterpret_cast<const TrainingState*>(data + header->trainingStateOffset);
+        if(header->trainingStateOffset % ALIGNMENT != 0 || header->trainingStateOffset > size || sizeof(TrainingState) > size - header->trainingStateOffset
+           || trainingState->userStateSize > size - header->trainingStateOffset - sizeof(TrainingState)
+           || memchr(trainingState->optimizer, '\0', sizeof(trainingState->optimizer)) == nullptr) {
+            std::cerr << "ERROR: " << fileName << " has an invalid training state" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Check that an array of floats is aligned and inside the file
+ * @remark The sizes are compared with divisions, so that a corrupted record can't overflow them
+ * @param offset Offset of the array in bytes
+ * @param nbBlocks Number of blocks of the array
+ * @param nbValuesPerBlock Number of floats in each block
+ * @return True if the array can be used
+ */
+bool ModelFile::isArrayValid(uint64_t offset, uint64_t nbBlocks, uint64_t nbValuesPerBlock) const {
+    if(offset % ALIGNMENT != 0 || offset > size) {
+        return false;
+    }
+    uint64_t maxNbValues = (size - offset) / sizeof(float);
+    return nbBlocks <= maxNbValues && nbValuesPerBlock <= maxNbValues / std::max(nbBlocks, (uint64_t) 1);
+}
+
+/**
+ * Serialize the layers of a network (and optionally the state of its training) in the format of a model file
+ * @remark The vector is reused: if it already has the right size (e.g. for the previous checkpoint of the same network), nothing is allocated
+ * @param bytes Vector where the content of the file is written
+ * @param inputSize Input size of the network
+ * @param layers Layers of the network, in order
+ * @param trainingState Progress of the training, nullptr to only store the model. If it's given, the optimizer state and the pruning mask of the layers are stored too
+ * @param userState State of the caller stored after the training state (only if trainingState is given)
+ * @return True if the layers were serialized, false if one of them can't be stored in a model file
+ */
+bool ModelFile::serializeInto(std::vector<char> &bytes, int inputSize, const std::vector<DenseLayer*> &layers, const TrainingState* trainingState, const std::string &userState) {
+    Header header = {};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrderMark = BYTE_ORDER_MARK;
+    header.nbLayers = (uint32_t) layers.size();
+    header.inputSize = inputSize;
+
+    // The arrays are placed after the records (and the training state), each one at the next aligned offset
+    std::vector<LayerRecord> records(layers.size());
+    size_t offset = align(sizeof(Header) + layers.size() * sizeof(LayerRecord));
+    if(trainingState != nullptr) {
+        header.trainingStateOffset = offset;
+        offset = align(offset + sizeof(TrainingState) + userState.size());
+    }
+    for(size_t i=0; i<layers.size(); i++) {
+        LayerRecord& record = records[i];
+        record = {};
+        record.type = DENSE;
+        record.nbNeurons = layers[i]->getNbNeurons();
+        record.nbNeuronsPrevLayer = layers[i]->getNbNeuronsPrevLayer();
+        std::string name = layers[i]->getActivationFunction()->getName();
+        if(name.size() >= sizeof(record.activationFunction)) {
+            std::cerr << "ERROR: The name of the activation function " << name << " is too long for a model file" << std::endl;
+            return false;
+        }
+        memcpy(record.activationFunction, name.c_str(), name.size() + 1);
+        record.weightsOffset = offset;
+        offset = align(offset + (size_t) layers[i]->getWeights().size() * sizeof(float));
+        record.biasesOffset = offset;
+        offset = align(offset + (size_t) record.nbNeurons * sizeof(float));
+        if(trainingState != nullptr && !layers[i]->getOptimizerState().empty()) {
+            record.nbOptimizerStateValues = (uint32_t) (layers[i]->getOptimizerState().size() / layers[i]->getNbParameters());
+            record.optimizerStateOffset = offset;
+            offset = align(offset + layers[i]->getOptimizerState().size() * sizeof(float));
+        }
+        if(trainingState != nullptr && !layers[i]->getPruningMask().empty()) {
+            record.pruningMaskOffset = offset;
+            offset = align(offset + layers[i]->getPruningMask().size() * sizeof(float));
+        }
+    }
+    header.fileSize = offset;
+
+    bytes.resize(offset);
+    offset = copyAligned(bytes, 0, &header, sizeof(Header));
+    offset = copyAligned(bytes, offset, records.data(), records.size() * sizeof(LayerRecord));
+    if(trainingState != nullptr) {
+        // The state of the caller directly follows the training state, the padding is after both of them
+        TrainingState state = *trainingState;
+        state.userStateSize = (uint32_t) userState.size();
+        memcpy(bytes.data() + offset, &state, sizeof(TrainingState));
+        offset = copyAligned(bytes, offset + sizeof(TrainingState), userState.data(), userState.size());
+    }
+    for(size_t i=0; i<layers.size(); i++) {
+        offset = copyAligned(bytes, offset, layers[i]->getWeights().getData(), (size_t) layers[i]->getWeights().size() * sizeof(float));
+        offset = copyAligned(bytes, offset, layers[i]->getBiases(), (size_t) records[i].nbNeurons * sizeof(float));
+        if(records[i].optimizerStateOffset != 0) {
+            offset = copyAligned(bytes, offset, layers[i]->getOptimizerState().data(), layers[i]->getOptimizerState().size() * sizeof(float));
+        }
+        if(records[i].pruningMaskOffset != 0) {
+            offset = copyAligned(bytes, offset, layers[i]->getPruningMask().data(), layers[i]->getPruningMask().size() * sizeof(float));
+        }
+    }
+    return true;
+}
+
+/**
+ * Write a serialized model file on the disk. It's written under a temporary name, flushed to the disk and then renamed: the file is either the previous version or the new one even if the process is stopped, and the processes that mapped the previous version can keep using it
+ * @param fileName Name of the file
+ * @param bytes Content of the file (see serializeInto())
+ * @return True if the file was written, false otherwise (the reason is written on the standard error)
+ */
+bool ModelFile::writeFile(const std::string &fileName, const std::vector<char> &bytes) {
+    std::string temporaryFileName = fileName + ".tmp";
+    int fd = ::open(temporaryFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        std::cerr << "ERROR: Failed to create the model file " << temporaryFileName << std::endl;
+        return false;
+    }
+
+    size_t nbBytesWritten = 0;
+    while(nbBytesWritten < bytes.size()) {
+        ssize_t result = ::write(fd, bytes.data() + nbBytesWritten, bytes.size() - nbBytesWritten);
+        if(result <= 0) {
+            break;
+        }
+        nbBytesWritten += (size_t) result;
+    }
+    bool written = nbBytesWritten == bytes.size() && fsync(fd) == 0;
+    written = ::close(fd) == 0 && written;
+
+    if(!written || std::rename(temporaryFileName.c_str(), fileName.c_str()) != 0) {
+        std::cerr << "ERROR: Failed to write the model file " << fileName << std::endl;
+        std::remove(temporaryFileName.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Get the input size of the network
+ * @return Input size
+ */
+int ModelFile::getInputSize() const {
+    return reinterpret_cast<const Header*>(data)->inputSize;
+}
+
+/**
+ * Get the number of layers stored in the file
+ * @return Number of layers
+ */
+int ModelFile::getNbLayers() const {
+    return (int) reinterpret_cast<const Header*>(data)->nbLayers;
+}
+
+/**
+ * Get the record describing a layer
+ * @param i Index of the layer
+ * @return Record of the layer i
+ */
+const ModelFile::LayerRecord& ModelFile::getLayer(int i) const {
+    return reinterpret_cast<const LayerRecord*>(data + sizeof(Header))[i];
+}
+
+/**
+ * Get the name of the activation function of a layer
+ * @param i Index of the layer
+ * @return Name of the function (see ActivationFunction::getName())
+ */
+std::string ModelFile::getActivationFunctionName(int i) const {
+    return std::string(getLayer(i).activationFunction);
+}
+
+/**
+ * Get the weights of a layer, in the mapped memory
+ * @param i Index of the layer
+ * @return Array of nbNeurons x nbNeuronsPrevLayer weights (row-major), aligned on ALIGNMENT bytes. It belongs to the file
+ */
+float* ModelFile::getWeights(int i) const {
+    return reinterpret_cast<float*>(data + getLayer(i).weightsOffset);
+}
+
+/**
+ * Get the biases of a layer, in the mapped memory
+ * @param i Index of the layer
+ * @return Array of nbNeurons biases, aligned on ALIGNMENT bytes. It belongs to the file
+ */
+float* ModelFile::getBiases(int i) const {
+    return reinterpret_cast<float*>(data + getLayer(i).biasesOffset);
+}
+
+/**
+ * Get the optimizer state of a layer, in the mapped memory
+ * @param i Index of the layer
+ * @return Array of nbOptimizerStateValues x (weights + biases) values (same layout as in DenseLayer), nullptr if it's not stored. It belongs to the file
+ */
+float* ModelFile::getOptimizerState(int i) const {
+    if(getLayer(i).optimizerStateOffset == 0) {
+        return nullptr;
+    }
+    return reinterpret_cast<float*>(data + getLayer(i).optimizerStateOffset);
+}
+
+/**
+ * Get the pruning mask of a layer, in the mapped memory
+ * @param i Index of the layer
+ * @return Array of nbNeurons x nbNeuronsPrevLayer values (1 for the weights kept, 0 for the pruned ones), nullptr if it's not stored. It belongs to the file
+ */
+float* ModelFile::getPruningMask(int i) const {
+    if(getLayer(i).pruningMaskOffset == 0) {
+        return nullptr;
+    }
+    return reinterpret_cast<float*>(data + getLayer(i).pruningMaskOffset);
+}
+
+/**
+ * Get the progress of the training stored in a checkpoint
+ * @return Training state, nullptr if the file only contains the model. It belongs to the file
+ */
+const ModelFile::TrainingState* ModelFile::getTrainingState() const {
+    uint64_t offset = reinterpret_cast<const Header*>(data)->trainingStateOffset;
+    if(offset == 0) {
+        return nullptr;
+    }
+    return reinterpret_cast<const TrainingState*>(data + offset);
+}
+
+/**
+ * Get the state of the caller stored in a checkpoint
+ * @return Copy of the state, empty if there is none
+ */
+std::string ModelFile::getUserState() const {
+    const TrainingState* trainingState = getTrainingState();
+    if(trainingState == nullptr) {
+        return "";
+    }
+    return std::string(reinterpret_cast<const char*>(trainingState + 1), trainingState->userStateSize);
+}
+
+/**
+ * Get the size of the file
+ * @return Size in bytes
+ */
+size_t ModelFile::getSize() const {
+    return size;
+}
@@ -6,8 +6,121 @@
  */
 
 #include "../include/NeuralNetwork.h"
+#include "../include/Gemm.h"
+#include "../include/ThreadPool.h"
+#include "../include/Sgd.h"
+#include "../include/ModelFile.h"
+#include "../include/Pipeline.h"
 #include <iostream>
-#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NETWORK_X86
+#include <immintrin.h>
+#endif
+
+// Number of instances evaluated at once by the batched inference functions, so that the buffers of the inference plan stay small
+static const int INFERENCE_BATCH_SIZE = 256;
+
+// Minimum number of instances in a shard of the data-parallel training, so that each worker still multiplies matrices instead of vectors
+static const int MIN_SHARD_SIZE = 8;
+
+// L2 penalty of the default optimizer. As in the first versions of fit(), it's added to the sum of the gradients of the batch, so the decay applied is divided by the batch size
+static const float DEFAULT_WEIGHT_DECAY = 0.02f;
+
+/**
+ * Get the index of the highest element of an array
+ * @param x Array
+ * @param size Size of the array (greater than 0)
+ * @return Index of the first highest element
+ */
+static int argmaxScalar(const float* x, int size) {
+    int iMax = 0;
+    for(int i=1; i<size; i++) {
+        if(x[i] > x[iMax]) {
+            iMax = i;
+        }
+    }
+    return iMax;
+}
+
+#ifdef NETWORK_X86
+
+/**
+ * AVX2 version of argmaxScalar(): the maximum is computed 8 elements at a time, then the first element equal to it is searched 8 elements at a time
+ */
+__attribute__((target("avx2")))
+static int argmaxAvx2(const float* x, int size) {
+    if(size < 8) {
+        return argmaxScalar(x, size);
+    }
+    __m256 maxValues = _mm256_loadu_ps(x);
+    int i = 8;
+    for(; i+8<=size; i+=8) {
+        maxValues = _mm256_max_ps(maxValues, _mm256_loadu_ps(x + i));
+    }
+    __m128 max4 = _mm_max_ps(_mm256_castps256_ps128(maxValues), _mm256_extractf128_ps(maxValues, 1));
+    max4 = _mm_max_ps(max4, _mm_movehl_ps(max4, max4));
+    max4 = _mm_max_ss(max4, _mm_movehdup_ps(max4));
+    float maxValue = _mm_cvtss_f32(max4);
+    for(int j=i; j<size; j++) {
+        maxValue = x[j] > maxValue ? x[j] : maxValue;
+    }
+
+    __m256 broadcastMax = _mm256_set1_ps(maxValue);
+    int j = 0;
+    for(; j+8<=size; j+=8) {
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(x + j), broadcastMax, _CMP_EQ_OQ));
+        if(mask != 0) {
+            return j + __builtin_ctz(mask);
+        }
+    }
+    for(; j<size; j++) {
+        if(x[j] == maxValue) {
+            return j;
+        }
+    }
+    return argmaxScalar(x, size);
+}
+
+#endif
+
+/**
+ * Get the index of the highest element of each row of a matrix
+ * @param x Matrix (nbRows x size, contiguous)
+ * @param nbRows Number of rows
+ * @param size Number of elements of each row
+ * @param indices Array where the index of the highest element of each row is written
+ */
+static void argmaxRows(const float* x, int nbRows, int size, int* indices) {
+    int (*argmax)(const float*, int) = argmaxScalar;
+#ifdef NETWORK_X86
+    if(Gemm::getIsa() >= Gemm::AVX2) {
+        argmax = argmaxAvx2;
+    }
+#endif
+    for(int b=0; b<nbRows; b++) {
+        indices[b] = argmax(x + (size_t) b * size, size);
+    }
+}
+
+/**
+ * Get the label of an instance of a batch, and stop the program if it's not one of the classes of the output
+ * @param batch Batch of instances with labels
+ * @param instance Index of the instance in the batch
+ * @param nbClasses Size of the output of the network
+ * @return Label of the instance, between 0 and nbClasses - 1
+ */
+static int getCheckedLabel(const Batch &batch, int instance, int nbClasses) {
+    int label = batch.getLabel(instance);
+    if(label < 0 || label >= nbClasses) {
+        std::cerr << "ERROR: The label " << label << " of the instance " << instance << " is not one of the " << nbClasses << " classes" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return label;
+}
 
 /**
  * Default constructor for the neural network
@@ -15,13 +128,21 @@
  * @remarks This will be changed so that we can accept a multi-dimensional input
  */
 
-NeuralNetwork::NeuralNetwork(int inputSize) : inputSize(inputSize), learningRate(0.1), layers(new LayersList()) {}
+NeuralNetwork::NeuralNetwork(int inputSize) : inputSize(inputSize), learningRate(0.1), layers(new LayersList()), trainingPlan(nullptr), dataParallelism(1), nbSteps(0), pruningSchedule({0.0f, 0, 0, 1}), optimizer(new Sgd(0.0f, false, DEFAULT_WEIGHT_DECAY)), defaultOptimizer(true), mixedPrecision(false), microBatchMemory(0), trainingBytesPerInstance(0), recomputeActivations(false), checkpointMemory(0), checkpointBatchSize(0), nbPipelineStages(1), nbPipelineMicroBatches(1), pinPipelineThreads(false), pipeline(nullptr) {}
 
 /**
  * Free memory space occupied by the neural network layers
  */
 NeuralNetwork::~NeuralNetwork() {
+    deleteExecutionPlans();
+    for(InferenceContext* context : inferenceContexts) {
+        delete context;
+    }
     delete layers;
+    delete optimizer;
+    for(ActivationFunction* activationFunction : activationFunctions) {
+        delete activationFunction;
+    }
 }
 
 /**
@@ -32,6 +153,23 @@ int NeuralNetwork::getNbLayers() {
     return layers->getNbLayers();
 }
 
+/**
+ * Get the ith layer of this network
+ * @param i Index of the layer
+ * @return Layer at the ith index or nullptr if the index does not correspond to a layer
+ */
+Layer* NeuralNetwork::getLayer(int i) {
+    return layers->getLayer(i);
+}
+
+/**
+ * Get the size of the input of this network
+ * @return Size of the input tensor
+ */
+int NeuralNetwork::getInputSize() {
+    return inputSize;
+}
+
 /**
  * Add a layer to the network
  * @param nbNeurons Number of neurons in the added layer
@@ -39,6 +177,9 @@ int NeuralNetwork::getNbLayers() {
  */
 void NeuralNetwork::addLayer(int nbNeurons, ActivationFunction *activationFunction) {
     int nbLayers = getNbLayers();
+    // The plans are built again with the new layer when they are used
+    deleteExecutionPlans();
+
     Layer* prevLayer = layers->getLayer(nbLayers - 1);
     if(prevLayer == nullptr) {
         // It's the first layer added
@@ -46,35 +187,162 @@ void NeuralNetwork::addLayer(int nbNeurons, ActivationFunction *activationFuncti
     } else {
         layers->add(nbNeurons, prevLayer->getOutputSize(0), activationFunction);
     }
+    layers->getLayer(nbLayers)->setMixedPrecision(mixedPrecision);
 }
 
 /**
  * Get the output of the neural network for the given input
+ * @remark Several threads can evaluate the network (evaluate(), predict() and their batch versions) at the same time: each evaluation uses its own inference context. It must not be trained or modified meanwhile
  * @param input Input tensor
  * @return Output tensor
  */
-Tensor * NeuralNetwork::evaluate(const Tensor &input) {
-    // We need the input to be considered as a batch of size 1
-    // TODO: Move some of this function code to main(), we should only accept one representation: a tensor whose first dim is the batch size
-    std::vector<int> dimSizes;
-    dimSizes.push_back(1);
-    for(int i=0; i<input.getNDim(); i++) {
-        dimSizes.push_back(input.getDimSize(i));
+Tensor NeuralNetwork::evaluate(const TensorView &input) {
+    // The output is created before the arena scope so that it's allocated on the heap and can be returned
+    Tensor output = layers->getLayer(getNbLayers() - 1)->createOutput(1);
+    InferenceContext* context = acquireInferenceContext();
+    {
+        TensorArena::Scope scope(context->arena);
+        // We need the input to be considered as a batch of size 1. The view shares the data of the input so nothing is copied
+        // TODO: Move some of this function code to main(), we should only accept one representation: a tensor whose first dim is the batch size
+        getBatchOutputInto(*context, input.unsqueeze(0), output);
     }
+    releaseInferenceContext(context);
+    return output;
+}
 
-    Tensor* output = new Tensor(input.getNDim()+1, dimSizes, input.getData());
-    bool isFirstIter = true;
-    Tensor* newOutput = nullptr;
+/**
+ * Get the output of the neural network for each element of a batch
+ * @param inputs Input tensors, the first dimension is the batch size
+ * @return Output tensor, the first dimension is the batch size
+ */
+Tensor NeuralNetwork::evaluateBatch(const TensorView &inputs) {
+    Tensor outputs = layers->getLayer(getNbLayers() - 1)->createOutput(inputs.getDimSize(0));
+    evaluateBatchInto(inputs, outputs);
+    return outputs;
+}
 
-    for(int i=0; i<getNbLayers(); i++) {
-        newOutput = layers->getLayer(i)->getOutput(*output);
-        if (isFirstIter)
-            isFirstIter = false;
-        else
-            delete output;
-        output = newOutput;
+/**
+ * Get the output of the neural network for each instance of a list
+ * @param instances Instances (only their input is used)
+ * @return Output tensor, the first dimension is the number of instances
+ */
+Tensor NeuralNetwork::evaluateBatch(const std::vector<Instance*> &instances) {
+    Tensor outputs = layers->getLayer(getNbLayers() - 1)->createOutput((int) instances.size());
+    InferenceContext* context = acquireInferenceContext();
+    for(int begin=0; begin<(int) instances.size(); begin+=INFERENCE_BATCH_SIZE) {
+        int end = std::min((int) instances.size(), begin + INFERENCE_BATCH_SIZE);
+        TensorArena::Scope scope(context->arena);
+        Tensor inputs = gatherInputs(instances, begin, end);
+        TensorView batchOutputs = outputs.slice(begin, end);
+        getBatchOutputInto(*context, inputs, batchOutputs);
     }
-    return output;
+    releaseInferenceContext(context);
+    return outputs;
+}
+
+/**
+ * Get the output of the neural network for each element of a batch and write it in the given tensor
+ * @remark The batch is split in parts of INFERENCE_BATCH_SIZE elements. Each part is computed by all the threads of the pool, since the matrix products and the activation functions are split between them.
+ * @param inputs Input tensors, the first dimension is the batch size
+ * @param outputs Tensor where the outputs are written, the first dimension is the batch size
+ */
+void NeuralNetwork::evaluateBatchInto(const TensorView &inputs, TensorView &outputs) {
+    int batchSize = inputs.getDimSize(0);
+    InferenceContext* context = acquireInferenceContext();
+    for(int begin=0; begin<batchSize; begin+=INFERENCE_BATCH_SIZE) {
+        int end = std::min(batchSize, begin + INFERENCE_BATCH_SIZE);
+        TensorArena::Scope scope(context->arena);
+        TensorView batchOutputs = outputs.slice(begin, end);
+        getBatchOutputInto(*context, inputs.slice(begin, end), batchOutputs);
+    }
+    releaseInferenceContext(context);
+}
+
+/**
+ * Take an inference context that no other evaluation uses, and create it if there is none
+ * @remark The contexts are kept until the network is deleted, so that the evaluations don't allocate memory once there is one context per concurrent evaluation
+ * @return Context, given back with releaseInferenceContext()
+ */
+NeuralNetwork::InferenceContext* NeuralNetwork::acquireInferenceContext() {
+    std::lock_guard<std::mutex> lock(inferenceContextsMutex);
+    if(freeInferenceContexts.empty()) {
+        InferenceContext* context = new InferenceContext();
+        context->plan = nullptr;
+        inferenceContexts.push_back(context);
+        freeInferenceContexts.reserve(inferenceContexts.size());
+        return context;
+    }
+    InferenceContext* context = freeInferenceContexts.back();
+    freeInferenceContexts.pop_back();
+    return context;
+}
+
+/**
+ * Give back an inference context taken by acquireInferenceContext(), once the tensors of the evaluation are not used anymore
+ * @param context Context
+ */
+void NeuralNetwork::releaseInferenceContext(InferenceContext* context) {
+    std::lock_guard<std::mutex> lock(inferenceContextsMutex);
+    freeInferenceContexts.push_back(context);
+}
+
+/**
+ * Copy the inputs of some instances in a tensor whose first dimension is the batch size
+ * @remark The tensor is allocated in the current arena if there is one
+ * @param instances Instances
+ * @param begin Index of the first instance copied
+ * @param end Index after the last instance copied
+ * @return Tensor containing the inputs
+ */
+Tensor NeuralNetwork::gatherInputs(const std::vector<Instance*> &instances, int begin, int end) {
+    const TensorView* firstInput = instances[begin]->getData();
+    int dimSizes[TensorView::MAX_N_DIM];
+    dimSizes[0] = end - begin;
+    for(int d=0; d<firstInput->getNDim(); d++) {
+        dimSizes[d+1] = firstInput->getDimSize(d);
+    }
+    Tensor inputs(firstInput->getNDim() + 1, dimSizes);
+    int inputSize = firstInput->size();
+    float* inputsData = inputs.getData();
+    for(int i=begin; i<end; i++) {
+        const float* instanceData = instances[i]->getData()->getData();
+        std::copy(instanceData, instanceData + inputSize, inputsData + (size_t) (i - begin) * inputSize);
+    }
+    return inputs;
+}
+
+/**
+ * Get the output of the neural network for a batch
+ * @param context Inference context whose plan holds the intermediate tensors
+ * @param batchInput Input tensors, the first dimension is the batch size
+ * @return Output tensor of the last layer, owned by the plan of the context. It's overwritten by the next evaluation using this context
+ */
+TensorView NeuralNetwork::getBatchOutput(InferenceContext &context, const TensorView &batchInput) {
+    int batchSize = batchInput.getDimSize(0);
+    ExecutionPlan& plan = getExecutionPlan(context.plan, batchSize, false);
+    int nbLayers = plan.getNbLayers();
+    for(int i=0; i<nbLayers; i++) {
+        TensorView output = plan.getOutput(i).slice(0, batchSize);
+        plan.getLayer(i)->getOutputInto(i > 0 ? plan.getOutput(i-1).slice(0, batchSize) : batchInput, output);
+    }
+    return plan.getOutput(nbLayers - 1).slice(0, batchSize);
+}
+
+/**
+ * Get the output of the neural network for a batch and write it in the output tensor. The intermediate tensors are the ones of the plan of the inference context.
+ * @param context Inference context whose plan holds the intermediate tensors
+ * @param batchInput Input tensors, the first dimension is the batch size
+ * @param output Tensor where the output of the network is written. Its shape is the output shape of the last layer for this batch size
+ */
+void NeuralNetwork::getBatchOutputInto(InferenceContext &context, const TensorView &batchInput, TensorView &output) {
+    int batchSize = batchInput.getDimSize(0);
+    ExecutionPlan& plan = getExecutionPlan(context.plan, batchSize, false);
+    int nbLayers = plan.getNbLayers();
+    for(int i=0; i<nbLayers-1; i++) {
+        TensorView layerOutput = plan.getOutput(i).slice(0, batchSize);
+        plan.getLayer(i)->getOutputInto(i > 0 ? plan.getOutput(i-1).slice(0, batchSize) : batchInput, layerOutput);
+    }
+    plan.getLayer(nbLayers-1)->getOutputInto(nbLayers > 1 ? plan.getOutput(nbLayers-2).slice(0, batchSize) : batchInput, output);
 }
 
 /**
@@ -84,108 +352,540 @@ Tensor * NeuralNetwork::evaluate(const Tensor &input) {
  * @param layerIndex Index of the current layer (where currentCostDerivatives is used to adjust the weights and biases)
  * @return Derivatives of the total cost in respect for the output of the layer (layerIndex - 1)
  */
-Tensor* NeuralNetwork::getNextCostDerivatives(Tensor* currentCostDerivatives, Tensor* weightedSumsPrevLayer, int layerIndex) {
-    int batchSize = currentCostDerivatives->getDimSize(0);
-    int prevLayerOutputSize = layers->getLayer(layerIndex - 1)->getOutputSize(0);
-    int layerOutputSize = layers->getLayer(layerIndex)->getOutputSize(0);
+Tensor NeuralNetwork::getNextCostDerivatives(const TensorView &currentCostDerivatives, const TensorView &weightedSumsPrevLayer, int layerIndex) {
+    Tensor nextCostDerivatives(2, {currentCostDerivatives.getDimSize(0), layers->getLayer(layerIndex - 1)->getOutputSize(0)});
+    getNextCostDerivativesInto(currentCostDerivatives, weightedSumsPrevLayer, layerIndex, nextCostDerivatives);
+    return nextCostDerivatives;
+}
 
-    Tensor* nextCostDerivatives = new Tensor(2, {batchSize, prevLayerOutputSize});
-    float* nextCostDerivativesData = nextCostDerivatives->getData();
+/**
+ * Calculate the derivatives dC/dz_i, where z_i is the output i of the layer (layerIndex - 1), for all i, for all the batch and write them in the given tensor
+ * @param currentCostDerivatives dC/dz_i, where z_i is the output i of the layer (layerIndex),
+ * @param weightedSumsPrevLayer Weighted sums of the layer (layerIndex - 1)
+ * @param layerIndex Index of the current layer (where currentCostDerivatives is used to adjust the weights and biases)
+ * @param nextCostDerivatives Tensor where the derivatives of the total cost in respect for the output of the layer (layerIndex - 1) are written. Its shape is the same as weightedSumsPrevLayer
+ */
+void NeuralNetwork::getNextCostDerivativesInto(const TensorView &currentCostDerivatives, const TensorView &weightedSumsPrevLayer, int layerIndex, TensorView &nextCostDerivatives) {
+    Tensor activationDerivatives = layers->getLayer(layerIndex-1)->getActivationDerivatives(weightedSumsPrevLayer);
+    propagateCostDerivativesInto(currentCostDerivatives, activationDerivatives, layers->getLayer(layerIndex), nextCostDerivatives);
+}
 
-    Tensor* nextActivationDerivatives = layers->getLayer(layerIndex-1)->getActivationDerivatives(*weightedSumsPrevLayer);
-    float* nextActivationDerivativesData = nextActivationDerivatives->getData();
+/**
+ * Calculate the derivatives dC/dz_i, where z_i is the output i of the layer (layerIndex - 1), for all i, for all the batch and write them in the given tensor, when the derivatives of the activation function of the layer (layerIndex - 1) are already known
+ * @param currentCostDerivatives dC/dz_i, where z_i is the output i of the layer (layerIndex),
+ * @param activationDerivativesPrevLayer Derivatives da_i/dz_i of the activation function of the layer (layerIndex - 1)
+ * @param layer Current layer (layerIndex), where currentCostDerivatives is used to adjust the weights and biases
+ * @param nextCostDerivatives Tensor where the derivatives of the total cost in respect for the output of the layer (layerIndex - 1) are written. Its shape is the same as activationDerivativesPrevLayer
+ */
+void NeuralNetwork::propagateCostDerivativesInto(const TensorView &currentCostDerivatives, const TensorView &activationDerivativesPrevLayer, Layer* layer, TensorView &nextCostDerivatives) {
+    //TODO: WARNING we don't consider layers of dim > 1 here, so we should be careful when we add Conv2D layers
 
-    float* currentCostDerivativesData = currentCostDerivatives->getData();
+    // dC/da_i = sum over k of dC/da_k * da_k/dz_k * dz_k/da_i
+    layer->getInputDerivativesInto(currentCostDerivatives, nextCostDerivatives);
 
-    Tensor* preActivationDerivatives = layers->getLayer(layerIndex)->getPreActivationDerivatives();
-    float* preActivationDerivativesData = preActivationDerivatives->getData();
+    // dC/dz_i = dC/da_i * da_i/dz_i
+    float* nextCostDerivativesData = nextCostDerivatives.getData();
+    const float* activationDerivativesData = activationDerivativesPrevLayer.getData();
+    int size = nextCostDerivatives.size();
+    for(int i=0; i<size; i++) {
+        nextCostDerivativesData[i] *= activationDerivativesData[i];
+    }
+}
 
-    //TODO: WARNING we don't consider layers of dim > 1 here, so we should be careful when we add Conv2D layers
+/**
+ * Compute the cost derivatives of the previous layer when its activation derivatives are stored in bfloat16 (mixed-precision training)
+ * @param currentCostDerivatives Cost derivatives of the current layer (dC/dz_k)
+ * @param activationDerivativesPrevLayer Activation derivatives of the previous layer in bfloat16 (da_i/dz_i), same number of elements as nextCostDerivatives
+ * @param layer Current layer
+ * @param nextCostDerivatives Tensor where the cost derivatives of the previous layer (dC/dz_i) are written
+ */
+void NeuralNetwork::propagateCostDerivativesInto(const TensorView &currentCostDerivatives, const BFloat16* activationDerivativesPrevLayer, Layer* layer, TensorView &nextCostDerivatives) {
+    layer->getInputDerivativesInto(currentCostDerivatives, nextCostDerivatives);
 
-    int p1=0;
-
-    for(int b=0; b<batchSize; b++) {
-        int p2Init = b*layerOutputSize;
-        for (int i = 0; i < prevLayerOutputSize; i++) {
-            int p2 = p2Init;
-            nextCostDerivativesData[p1] = 0.0f;
-            int p3 = i;
-            for (int k = 0; k < layers->getLayer(layerIndex)->getOutputSize(0); k++) {
-                nextCostDerivativesData[p1] += currentCostDerivativesData[p2] * preActivationDerivativesData[p3] * nextActivationDerivativesData[p1]; // dC/da_k * da_k/dz_k * dz_k/da_i * da_i/dz_i
-                p2++;
-                p3+= prevLayerOutputSize;
+    float* nextCostDerivativesData = nextCostDerivatives.getData();
+    int size = nextCostDerivatives.size();
+    for(int i=0; i<size; i++) {
+        nextCostDerivativesData[i] *= activationDerivativesPrevLayer[i].toFloat();
+    }
+}
+
+/**
+ * Get an execution plan of this network, and build it if it doesn't exist yet or if it was built for a smaller batch size
+ * @remark A plan built for a larger batch size is kept: its tensors are sliced to the number of instances, so a smaller last batch doesn't rebuild the plans
+ * @param plan Plan kept by the network (trainingPlan, the plan of a replica or of an inference context)
+ * @param batchSize Batch size of the plan
+ * @param training True if the tensors of the backward pass are needed
+ * @return Plan
+ */
+ExecutionPlan& NeuralNetwork::getExecutionPlan(ExecutionPlan* &plan, int batchSize, bool training) {
+    if(plan == nullptr || plan->getBatchSize() < batchSize) {
+        if(getNbLayers() <= 0) {
+            std::cerr << "ERROR: The network has no layer" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        delete plan;
+        plan = new ExecutionPlan(*layers, batchSize, training, mixedPrecision, keptOutputs);
+    }
+    return *plan;
+}
+
+/**
+ * Delete the execution plans, they are built again when they are needed
+ */
+void NeuralNetwork::deleteExecutionPlans() {
+    delete trainingPlan;
+    trainingPlan = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(inferenceContextsMutex);
+        for(InferenceContext* context : inferenceContexts) {
+            delete context->plan;
+            context->plan = nullptr;
+        }
+    }
+    layerGradients.clear();
+    trainingBytesPerInstance = 0;
+    keptOutputs.clear();
+    checkpointBatchSize = 0;
+    delete pipeline;
+    pipeline = nullptr;
+    for(Replica* replica : replicas) {
+        delete replica->plan;
+        delete replica;
+    }
+    replicas.clear();
+}
+
+/**
+ * Get the memory used by the intermediate tensors of fit() for a given batch size
+ * @remark The memory of a plan is proportional to its batch size, so it's computed with a plan of one instance, and the plans used by fit() are not modified
+ * @param batchSize Batch size
+ * @return Number of bytes of the buffers of a training plan of this batch size
+ */
+size_t NeuralNetwork::getTrainingMemory(int batchSize) {
+    if(getNbLayers() <= 0) {
+        std::cerr << "ERROR: The network has no layer" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return ExecutionPlan(*layers, 1, true, mixedPrecision, getKeptOutputs(batchSize)).getNbBytes() * batchSize;
+}
+
+/**
+ * Set the memory budget of the intermediate tensors of fit(). A batch whose training plans would need more memory is split in micro-batches that are run one after the other with the same plans: their gradients are accumulated, then the parameters are updated once for the whole batch. The update is the same as without micro-batches (except for the rounding errors), so the batch size can grow without growing the memory, and a budget that fits in the cache keeps the tensors of the passes in it.
+ * @remark The budget is a target: a micro-batch has at least one instance. The temporary tensors allocated in the arenas are not counted. With the data-parallel training, the budget is shared by the shards of a micro-batch.
+ * @param nbBytes Memory budget in bytes, 0 to never split the batches
+ */
+void NeuralNetwork::setMicroBatchMemory(size_t nbBytes) {
+    microBatchMemory = nbBytes;
+}
+
+/**
+ * Get the memory budget of the intermediate tensors of fit()
+ * @return Memory budget in bytes, 0 if the batches are never split in micro-batches
+ */
+size_t NeuralNetwork::getMicroBatchMemory() const {
+    return microBatchMemory;
+}
+
+/**
+ * Get the number of instances of the micro-batches in which fit() splits a batch (see setMicroBatchMemory())
+ * @remark The memory of a plan is proportional to its batch size, so it's computed once for one instance
+ * @param batchSize Size of the batch
+ * @return Size of the micro-batches (the last one can be smaller), the batch size if the batch is not split
+ */
+int NeuralNetwork::getMicroBatchSize(int batchSize) {
+    updateKeptOutputs(batchSize);
+    if(microBatchMemory == 0) {
+        return batchSize;
+    }
+    if(trainingBytesPerInstance == 0) {
+        if(getNbLayers() <= 0) {
+            std::cerr << "ERROR: The network has no layer" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        trainingBytesPerInstance = ExecutionPlan(*layers, 1, true, mixedPrecision, keptOutputs).getNbBytes();
+    }
+    size_t microBatchSize = std::max((size_t) 1, microBatchMemory / trainingBytesPerInstance);
+    return (int) std::min((size_t) batchSize, microBatchSize);
+}
+
+/**
+ * Enable the activation recomputation with checkpoints chosen by the user. fit() only keeps the outputs of the checkpoints (and of the last layer) between the forward and the backward pass. The output of a layer between two checkpoints is only kept until the forward pass of the next layer, and when the backward pass reaches the next checkpoint, the outputs of the layers below it are computed again from the previous checkpoint. The memory of the training then grows with the number of checkpoints and the size of the largest segment between two checkpoints instead of the number of layers, for about one more forward pass. The gradients are the same as without recomputation.
+ * @remark The outputs are always kept by the mixed-precision and the pipeline-parallel training
+ * @param layerIndices Indices of the layers whose outputs are kept. Empty to recompute all the layers except the last one from the input
+ */
+void NeuralNetwork::setActivationCheckpoints(const std::vector<int> &layerIndices) {
+    for(int l : layerIndices) {
+        if(l < 0 || l >= getNbLayers()) {
+            std::cerr << "ERROR: The checkpoint " << l << " is not a layer of the network" << std::endl;
+            return;
+        }
+    }
+    recomputeActivations = true;
+    activationCheckpoints = layerIndices;
+    checkpointMemory = 0;
+    checkpointBatchSize = 0;
+}
+
+/**
+ * Enable the activation recomputation with checkpoints chosen from a memory budget (see setActivationCheckpoints()). fit() keeps the outputs of one layer every k layers, with the smallest k for which the training plans of the largest batch seen fit in the budget, so that the fewest layers are recomputed. They are kept for the smaller batches, so a smaller last batch doesn't rebuild the plans
+ * @remark The budget is a target: if no k fits, the one using the least memory is used. It can be combined with setMicroBatchMemory(), the batches are then split in micro-batches of the memory used with these checkpoints
+ * @param nbBytes Memory budget of the intermediate tensors of a batch in bytes, 0 to disable the recomputation
+ */
+void NeuralNetwork::setActivationCheckpointMemory(size_t nbBytes) {
+    recomputeActivations = nbBytes > 0;
+    activationCheckpoints.clear();
+    checkpointMemory = nbBytes;
+    checkpointBatchSize = 0;
+}
+
+/**
+ * Disable the activation recomputation: fit() keeps the outputs of all the layers for the backward pass
+ */
+void NeuralNetwork::clearActivationCheckpoints() {
+    recomputeActivations = false;
+    activationCheckpoints.clear();
+    checkpointMemory = 0;
+    checkpointBatchSize = 0;
+}
+
+/**
+ * Get the layers whose outputs fit() keeps for the backward pass
+ * @param batchSize Size of the batch, used to choose the checkpoints from the memory budget
+ * @return Indices of the layers whose outputs are kept, all of them if there is no recomputation
+ */
+std::vector<int> NeuralNetwork::getActivationCheckpoints(int batchSize) {
+    updateKeptOutputs(batchSize);
+    std::vector<int> checkpoints;
+    for(int l=0; l<getNbLayers(); l++) {
+        if(keptOutputs.empty() || keptOutputs[l]) {
+            checkpoints.push_back(l);
+        }
+    }
+    return checkpoints;
+}
+
+/**
+ * Update the layers whose outputs are kept by the training plans, and delete these plans if they change
+ * @param batchSize Size of the batch, used to choose the checkpoints from the memory budget
+ */
+void NeuralNetwork::updateKeptOutputs(int batchSize) {
+    bool budget = recomputeActivations && checkpointMemory > 0 && !mixedPrecision;
+    if(budget && batchSize <= checkpointBatchSize) {
+        return;
+    }
+    std::vector<bool> kept = getKeptOutputs(batchSize);
+    if(budget) {
+        checkpointBatchSize = batchSize;
+    }
+    if(kept == keptOutputs) {
+        return;
+    }
+
+    keptOutputs = kept;
+    delete trainingPlan;
+    trainingPlan = nullptr;
+    for(Replica* replica : replicas) {
+        delete replica->plan;
+        replica->plan = nullptr;
+    }
+    trainingBytesPerInstance = 0;
+}
+
+/**
+ * Get the layers whose outputs the training plans would keep for a batch size, without changing the plans
+ * @remark With a memory budget, the checkpoints chosen for the largest batch size seen are kept for the smaller batches
+ * @param batchSize Size of the batch, used to choose the checkpoints from the memory budget
+ * @return True for each layer whose output is kept, empty if all of them are kept
+ */
+std::vector<bool> NeuralNetwork::getKeptOutputs(int batchSize) {
+    int nbLayers = getNbLayers();
+    std::vector<bool> kept;
+    // The mixed-precision plans always keep the outputs
+    if(recomputeActivations && nbLayers > 0 && !mixedPrecision) {
+        if(checkpointMemory > 0) {
+            if(batchSize <= checkpointBatchSize) {
+                return keptOutputs;
+            }
+            kept = chooseKeptOutputs(batchSize);
+        } else {
+            kept.assign(nbLayers, false);
+            for(int l : activationCheckpoints) {
+                if(l < nbLayers) {
+                    kept[l] = true;
+                }
             }
-            p1++;
+            kept[nbLayers - 1] = true;
         }
     }
+    // Keeping all the outputs is the same as not recomputing them
+    if(std::find(kept.begin(), kept.end(), false) == kept.end()) {
+        kept.clear();
+    }
+    return kept;
+}
 
-    delete nextActivationDerivatives;
-    return nextCostDerivatives;
+/**
+ * Choose the checkpoints from the memory budget: one layer every k layers (and the last one) is kept, with the smallest k for which the training plans fit in the budget
+ * @remark The memory of a plan is proportional to its batch size, so the candidates are compared with plans of one instance
+ * @param batchSize Size of the batch
+ * @return True for each layer whose output is kept
+ */
+std::vector<bool> NeuralNetwork::chooseKeptOutputs(int batchSize) {
+    int nbLayers = getNbLayers();
+    std::vector<bool> best;
+    size_t bestNbBytes = 0;
+    for(int k=1; k<=nbLayers; k++) {
+        std::vector<bool> kept(nbLayers);
+        for(int l=0; l<nbLayers; l++) {
+            kept[l] = (l + 1) % k == 0 || l == nbLayers - 1;
+        }
+        size_t nbBytes = ExecutionPlan(*layers, 1, true, mixedPrecision, kept).getNbBytes();
+        if(nbBytes * batchSize <= checkpointMemory) {
+            return kept;
+        }
+        if(best.empty() || nbBytes < bestNbBytes) {
+            best = kept;
+            bestNbBytes = nbBytes;
+        }
+    }
+    return best;
 }
 
 /**
  * Train the network with the given batch of instances
  * @param batch Batch of instances (input data + target output)
  */
-void NeuralNetwork::fit(Batch batch) {
+void NeuralNetwork::fit(Batch &batch) {
     if(batch.getSize()<=0) {
         std::cerr << "WARNING: the batch size is null" << std::endl;
         return;
     }
-    Tensor* inputData = batch.getData();
-
-    Tensor** weightedSums = new Tensor*[getNbLayers()];
-    Tensor** outputs = new Tensor*[getNbLayers()];
-
-    weightedSums[0] = layers->getLayer(0)->getPreActivationValues(*inputData);
-    outputs[0] = layers->getLayer(0)->getActivationValues(*(weightedSums[0]));
+    if(defaultOptimizer) {
+        optimizer->setWeightDecay(DEFAULT_WEIGHT_DECAY / (float) batch.getSize());
+    }
 
+    if(nbPipelineStages > 1) {
+        // Each stage updates the weights and biases of its layers once its backward passes are done
+        optimizer->nextStep();
+        getPipeline()->fit(batch, nbPipelineMicroBatches, *optimizer, learningRate);
+        nbSteps++;
+        applyPruningSchedule();
+        return;
+    }
 
-    for(int i=1; i<getNbLayers(); i++) {
-        weightedSums[i] = layers->getLayer(i)->getPreActivationValues(*(outputs[i-1]));
-        outputs[i] = layers->getLayer(i)->getActivationValues(*(weightedSums[i]));
+    int nbLayers = getNbLayers();
+    if((int) layerGradients.size() != nbLayers) {
+        layerGradients.clear();
+        for(int l=0; l<nbLayers; l++) {
+            layerGradients.push_back(layers->getLayer(l)->getGradients());
+        }
     }
 
-    // dC/da_k * da_k/dz_k
-    Tensor* currentCostDerivatives = getCostDerivatives(*(outputs[getNbLayers()-1]), batch); // dC/da_k
-    float* currentCostDerivativesData = currentCostDerivatives->getData();
+    // The gradients of the micro-batches are summed, each one scaled by 1 / batch size, which gives the mean over the whole batch
+    int batchSize = batch.getSize();
+    updateKeptOutputs(batchSize);
+    int microBatchSize = getMicroBatchSize(batchSize);
+    float gradientScale = 1.0f / (float) batchSize;
+    for(int begin=0; begin<batchSize; begin+=microBatchSize) {
+        int end = std::min(begin + microBatchSize, batchSize);
+        computeGradients(batch, begin, end, microBatchSize, gradientScale, begin > 0);
+    }
 
+    // Adjust the weights and biases of each layer
+    optimizer->nextStep();
+    for(int l=0; l<nbLayers; l++) {
+        layers->getLayer(l)->applyGradients(*optimizer, learningRate);
+    }
 
-    Tensor* activationDerivatives = layers->getLayer(getNbLayers()-1)->getActivationDerivatives(*weightedSums[getNbLayers()-1]);
-    float* activationDerivativesData = activationDerivatives->getData();
+    nbSteps++;
+    applyPruningSchedule();
+}
 
+/**
+ * Run the forward and the backward pass on some instances of a batch, and write the gradients of each layer
+ * @param plan Training plan built for at least the number of instances
+ * @param input Input of the instances, the first dimension is the number of instances
+ * @param batch Batch containing the instances (used for the targets)
+ * @param firstInstance Index in the batch of the first instance
+ * @param gradientScale Factor applied to the sums over the instances of the gradients (1 / batch size for the mean)
+ * @param accumulate True to add the gradients to the values already in the arrays, false to overwrite them
+ * @param gradients Array where the gradients of each layer are written
+ */
+void NeuralNetwork::backpropagate(ExecutionPlan &plan, const TensorView &input, const Batch &batch, int firstInstance, float gradientScale, bool accumulate, float* const* gradients) {
+    int nbLayers = plan.getNbLayers();
+    plan.setNbInstances(input.getDimSize(0));
 
-    float invSize = 1.0f/layers->getLayer(getNbLayers()-1)->getOutputSize(0);
-    for(int i=0; i<currentCostDerivatives->size(); i++) {
-        currentCostDerivativesData[i] *= invSize * activationDerivativesData[i];
+    bool mixed = plan.isMixedPrecision();
+    if(mixed) {
+        BFloat16::convertInto(input.getData(), plan.getSavedInput(), (size_t) input.size());
     }
 
+    // The derivatives of the activation functions are computed with the outputs, so the weighted sums don't need to be kept
+    for(int i=0; i<nbLayers; i++) {
+        Layer* layer = plan.getLayer(i);
+        if(!mixed) {
+            const TensorView &layerInput = i > 0 ? plan.getForwardOutput(i-1) : input;
+            if(plan.isOutputKept(i) && plan.hasActivationDerivativesFromOutput(i)) {
+                layer->getOutputInto(layerInput, plan.getOutput(i));
+            } else if(plan.isOutputKept(i)) {
+                layer->getOutputAndDerivativesInto(layerInput, plan.getOutput(i), plan.getActivationDerivatives(i));
+            } else {
+                // This output is recomputed with its derivatives by the backward pass
+                layer->getOutputInto(layerInput, plan.getForwardOutput(i));
+            }
+            continue;
+        }
+        // In mixed precision, the layers read the bfloat16 copy of their input, and only the last layer keeps its output and derivatives in float
+        const BFloat16* layerInput = i > 0 ? plan.getSavedOutput(i-1) : plan.getSavedInput();
+        if(i < nbLayers - 1) {
+            layer->getOutputAndDerivativesInto(layerInput, plan.getOutput(i), plan.getSavedOutput(i), plan.getSavedActivationDerivatives(i));
+        } else {
+            layer->getOutputAndDerivativesInto(layerInput, plan.getOutput(i), plan.getActivationDerivatives(i));
+        }
+    }
 
-    delete activationDerivatives;
+    // The output of the last layer is not needed anymore, so the cost derivatives can be written in its place
+    getOutputCostDerivativesInto(plan.getOutput(nbLayers-1), plan.getActivationDerivatives(nbLayers-1), batch, firstInstance, plan.getCostDerivatives(nbLayers-1));
 
-    Tensor* nextCostDerivatives = nullptr;
+    for(int l=nbLayers-1; l>=0; l--) {
+        // Recompute the outputs and the activation derivatives of the layers between this checkpoint and the previous one
+        if(l > 0 && !plan.isOutputKept(l-1) && plan.isOutputKept(l)) {
+            int first = l - 1;
+            while(first > 0 && !plan.isOutputKept(first-1)) {
+                first--;
+            }
+            for(int i=first; i<l; i++) {
+                const TensorView &layerInput = i > 0 ? plan.getOutput(i-1) : input;
+                if(plan.hasActivationDerivativesFromOutput(i)) {
+                    plan.getLayer(i)->getOutputInto(layerInput, plan.getOutput(i));
+                } else {
+                    plan.getLayer(i)->getOutputAndDerivativesInto(layerInput, plan.getOutput(i), plan.getActivationDerivatives(i));
+                }
+            }
+        }
 
-    for(int l=getNbLayers()-1; l>=0; l--) {
         // Next cost derivatives computation
-        if (l>0) {
-            nextCostDerivatives = getNextCostDerivatives(currentCostDerivatives, weightedSums[l-1], l);
+        if (l>0 && mixed) {
+            propagateCostDerivativesInto(plan.getCostDerivatives(l), plan.getSavedActivationDerivatives(l-1), plan.getLayer(l), plan.getCostDerivatives(l-1));
+        } else if (l>0 && plan.hasActivationDerivativesFromOutput(l-1)) {
+            // dC/da_i is scaled in place from the output a_i instead of reading a tensor of derivatives
+            plan.getLayer(l)->getInputDerivativesInto(plan.getCostDerivatives(l), plan.getCostDerivatives(l-1));
+            plan.getLayer(l-1)->multiplyByActivationDerivativesInPlace(plan.getCostDerivatives(l-1), plan.getOutput(l-1));
+        } else if (l>0) {
+            propagateCostDerivativesInto(plan.getCostDerivatives(l), plan.getActivationDerivatives(l-1), plan.getLayer(l), plan.getCostDerivatives(l-1));
         }
 
-        // Adjust the weights and biases of the current layer
-        Tensor* prevLayerOutput = l>0 ? outputs[l-1] : inputData;
-        layers->getLayer(l)->adjustParams(learningRate, currentCostDerivatives, prevLayerOutput);
+        // Gradients of the weights and biases of the current layer
+        if(mixed) {
+            plan.getLayer(l)->computeGradientsInto(plan.getCostDerivatives(l), l>0 ? plan.getSavedOutput(l-1) : plan.getSavedInput(), gradientScale, gradients[l], accumulate);
+        } else {
+            const TensorView& prevLayerOutput = l>0 ? plan.getOutput(l-1) : input;
+            plan.getLayer(l)->computeGradientsInto(plan.getCostDerivatives(l), prevLayerOutput, gradientScale, gradients[l], accumulate);
+        }
+    }
+}
+
+/**
+ * Get the number of shards in which a batch is split by the data-parallel training
+ * @param batchSize Size of the batch
+ * @return Number of shards, 1 if the batch is not split
+ */
+int NeuralNetwork::getNbShards(int batchSize) {
+    int maxNbShards = dataParallelism > 0 ? dataParallelism : ThreadPool::getInstance().getNbThreads();
+    return std::max(1, std::min(maxNbShards, batchSize / MIN_SHARD_SIZE));
+}
+
+/**
+ * Compute the gradients of some consecutive instances of a batch (the whole batch or one of its micro-batches) and write them in the gradients of the layers
+ * @param batch Batch of instances
+ * @param begin Index of the first instance
+ * @param end Index after the last instance
+ * @param planBatchSize Number of instances the training plans are built for (at least end - begin), so that all the micro-batches of a batch use the same plans
+ * @param gradientScale Factor applied to the sums over the instances of the gradients (1 / batch size for the mean)
+ * @param accumulate True to add the gradients to the ones of the previous micro-batches, false to overwrite them
+ */
+void NeuralNetwork::computeGradients(Batch &batch, int begin, int end, int planBatchSize, float gradientScale, bool accumulate) {
+    int nbShards = getNbShards(planBatchSize);
+    if(nbShards > 1) {
+        computeGradientsDataParallel(batch, begin, end, planBatchSize, nbShards, gradientScale, accumulate);
+        return;
+    }
+    ExecutionPlan& plan = getExecutionPlan(trainingPlan, planBatchSize, true);
+    // All the other temporary tensors of this step are allocated in the arena, so that they are freed at once
+    TensorArena::Scope scope(arena);
+    backpropagate(plan, batch.getData()->slice(begin, end), batch, begin, gradientScale, accumulate, layerGradients.data());
+}
 
+/**
+ * Compute the gradients of some consecutive instances of a batch by splitting them in shards processed in parallel, each worker having its own tensors and gradients. The gradients of the shards are then summed in the gradients of the layers.
+ * @remark The sum of the gradients of the shards divided by the batch size is the mean over the batch, so the update is the same as without sharding (except for the rounding errors). The shards are summed by a tree reduction whose order only depends on the number of shards.
+ * @param batch Batch of instances
+ * @param begin Index of the first instance
+ * @param end Index after the last instance
+ * @param planBatchSize Number of instances the plans are built for (at least end - begin): each plan can run a shard of up to planBatchSize / nbShards instances (rounded up)
+ * @param nbShards Number of shards
+ * @param gradientScale Factor applied to the sums over the instances of the gradients (1 / batch size for the mean)
+ * @param accumulate True to add the gradients to the ones of the previous micro-batches, false to overwrite them
+ */
+void NeuralNetwork::computeGradientsDataParallel(Batch &batch, int begin, int end, int planBatchSize, int nbShards, float gradientScale, bool accumulate) {
+    int nbLayers = getNbLayers();
+    const TensorView* inputData = batch.getData();
 
-        delete currentCostDerivatives;
-        currentCostDerivatives = nextCostDerivatives;
+    // The plans and the buffers are built here since they must not be allocated in an arena
+    while((int) replicas.size() < nbShards - 1) {
+        Replica* replica = new Replica();
+        replica->plan = nullptr;
+        for(int l=0; l<nbLayers; l++) {
+            replica->gradientBuffers.emplace_back(layers->getLayer(l)->getNbParameters(), 0.0f);
+            replica->gradients.push_back(replica->gradientBuffers.back().data());
+        }
+        replicas.push_back(replica);
     }
+    // A shard of n instances has at most ceil(n / nbShards) instances, so a smaller micro-batch fits in the same plans
+    int shardCapacity = (planBatchSize + nbShards - 1) / nbShards;
+    getExecutionPlan(trainingPlan, shardCapacity, true);
+    for(int s=1; s<nbShards; s++) {
+        getExecutionPlan(replicas[s-1]->plan, shardCapacity, true);
+    }
+
+    // The last micro-batch can have fewer instances than shards
+    int nbInstances = end - begin;
+    nbShards = std::min(nbShards, nbInstances);
 
-    for(int i=0; i<getNbLayers(); i++) {
-        delete weightedSums[i];
-        delete outputs[i];
+    ThreadPool& pool = ThreadPool::getInstance();
+    pool.parallelTasks(nbShards, [&](int s) {
+        int shardBegin = begin + (int) ((long) nbInstances * s / nbShards);
+        int shardEnd = begin + (int) ((long) nbInstances * (s + 1) / nbShards);
+        // The first shard writes its gradients directly in the layers, so it's the only one that accumulates the previous micro-batches
+        if(s == 0) {
+            TensorArena::Scope scope(arena);
+            backpropagate(*trainingPlan, inputData->slice(shardBegin, shardEnd), batch, shardBegin, gradientScale, accumulate, layerGradients.data());
+        } else {
+            Replica* replica = replicas[s-1];
+            TensorArena::Scope scope(replica->arena);
+            backpropagate(*replica->plan, inputData->slice(shardBegin, shardEnd), batch, shardBegin, gradientScale, false, replica->gradients.data());
+        }
+    });
+
+    // Tree reduction: at each level, the shard s receives the sum of the shard s + stride
+    shardGradients.resize(nbShards);
+    for(int l=0; l<nbLayers; l++) {
+        shardGradients[0] = layerGradients[l];
+        for(int s=1; s<nbShards; s++) {
+            shardGradients[s] = replicas[s-1]->gradients[l];
+        }
+        pool.parallelFor(layers->getLayer(l)->getNbParameters(), nbShards, [&](int begin, int end) {
+            for(int stride=1; stride<nbShards; stride*=2) {
+                for(int s=0; s+stride<nbShards; s+=2*stride) {
+                    float* destination = shardGradients[s];
+                    const float* source = shardGradients[s+stride];
+                    for(int k=begin; k<end; k++) {
+                        destination[k] += source[k];
+                    }
+                }
+            }
+        });
     }
-    delete[] weightedSums;
-    delete[] outputs;
 }
 
 
@@ -196,21 +896,104 @@ void NeuralNetwork::fit(Batch batch) {
  * @return Derivative of the cost for all the components of the output tensor
  */
 
-Tensor* NeuralNetwork::getCostDerivatives(const Tensor &prediction, const Batch &batch) {
-    int outputSize = layers->getLayer(getNbLayers()-1)->getOutputSize(0);
-    float* newData = new float[batch.getSize() * outputSize];
+Tensor NeuralNetwork::getCostDerivatives(const TensorView &prediction, const Batch &batch) {
+    Tensor lossDerivative(2,{batch.getSize(), layers->getLayer(getNbLayers()-1)->getOutputSize(0)}); // The size should be given in the parameters instead of being hard coded
+    getCostDerivativesInto(prediction, batch, lossDerivative);
+    return lossDerivative;
+}
+
+/**
+ * Calculate the derivative d MSE / d prediction[i] for all i and write it in the given tensor
+ * @param prediction Output of the neural network
+ * @param batch Batch of instances (input data + target output)
+ * @param costDerivatives Tensor where the derivative of the cost for all the components of the output tensor is written. Its shape is the same as the prediction
+ */
+void NeuralNetwork::getCostDerivativesInto(const TensorView &prediction, const Batch &batch, TensorView &costDerivatives) {
+    getCostDerivativesInto(prediction, batch, 0, costDerivatives);
+}
+
+/**
+ * Calculate the derivative d MSE / d prediction[i] for all i for some consecutive instances of a batch and write it in the given tensor
+ * @param prediction Output of the neural network for these instances
+ * @param batch Batch of instances (input data + target output)
+ * @param firstInstance Index in the batch of the instance of the first row of the prediction
+ * @param costDerivatives Tensor where the derivative of the cost for all the components of the output tensor is written. Its shape is the same as the prediction
+ */
+void NeuralNetwork::getCostDerivativesInto(const TensorView &prediction, const Batch &batch, int firstInstance, TensorView &costDerivatives) {
+    int nbInstances = prediction.getDimSize(0);
+    int outputSize = prediction.size() / nbInstances;
+    float* costDerivativesData = costDerivatives.getData();
     float* predictionData = prediction.getData();
     int k=0;
-    for(int b=0; b<batch.getSize(); b++) {
+    for(int b=0; b<nbInstances; b++) {
+        if(batch.hasLabels()) {
+            // The target is the one-hot representation of the label
+            int label = getCheckedLabel(batch, firstInstance + b, outputSize);
+            for(int i=0; i<outputSize; i++) {
+                costDerivativesData[k] = predictionData[k] - (i == label ? 1.0f : 0.0f);
+                k++;
+            }
+            continue;
+        }
+        const float* target = batch.getTarget(firstInstance + b);
         for(int i=0; i<outputSize; i++) {
-            newData[k] = predictionData[k] - batch.getTarget(b)[i];
+            costDerivativesData[k] = predictionData[k] - target[i];
             k++;
         }
     }
+}
 
-    Tensor* lossDerivative = new Tensor(2,{batch.getSize(), outputSize}, newData); // The size should be given in the parameters instead of being hard coded
-    delete[] newData;
-    return lossDerivative;
+/**
+ * Calculate dC/da_k * da_k/dz_k for the last layer of the network, where C is the mean over the outputs of the cost, for some consecutive instances of a batch. If the activation function of the last layer is fused with the cross-entropy (softmax), C is the cross-entropy and the derivatives are computed by getCrossEntropyDerivativesInto() instead
+ * @param output Output a_k of the last layer for these instances
+ * @param activationDerivatives Derivatives da_k/dz_k of the activation function of the last layer. Not used with the cross-entropy, so it can have no data
+ * @param batch Batch of instances (input data + target output)
+ * @param firstInstance Index in the batch of the instance of the first row of the output
+ * @param costDerivatives Tensor where the cost derivatives are written, same shape as the output. It can be the output itself
+ */
+void NeuralNetwork::getOutputCostDerivativesInto(const TensorView &output, const TensorView &activationDerivatives, const Batch &batch, int firstInstance, TensorView &costDerivatives) {
+    if(layers->getLayer(getNbLayers()-1)->getActivationFunction()->isFusedWithCrossEntropy()) {
+        getCrossEntropyDerivativesInto(output, batch, firstInstance, costDerivatives);
+        return;
+    }
+
+    getCostDerivativesInto(output, batch, firstInstance, costDerivatives); // dC/da_k
+    float* costDerivativesData = costDerivatives.getData();
+    const float* activationDerivativesData = activationDerivatives.getData();
+
+    float invSize = 1.0f/output.getDimSize(1);
+    for(int i=0; i<costDerivatives.size(); i++) {
+        costDerivativesData[i] *= invSize * activationDerivativesData[i];
+    }
+}
+
+/**
+ * Calculate dC/dz_k for the last layer of the network when its activation function is fused with the cross-entropy C = -sum over k of t_k log(a_k), for some consecutive instances of a batch. With a softmax, dC/dz_k = a_k - t_k, which is computed in one pass without the derivatives of the activation function
+ * @param output Output a_k of the last layer for these instances (the probabilities of the classes)
+ * @param batch Batch of instances (input data + target output). With labels, the one-hot targets t_k are never built: 1 is just subtracted from the probability of the label
+ * @param firstInstance Index in the batch of the instance of the first row of the output
+ * @param costDerivatives Tensor where the cost derivatives are written, same shape as the output. It can be the output itself
+ */
+void NeuralNetwork::getCrossEntropyDerivativesInto(const TensorView &output, const Batch &batch, int firstInstance, TensorView &costDerivatives) {
+    int nbInstances = output.getDimSize(0);
+    int outputSize = output.size() / nbInstances;
+    const float* outputData = output.getData();
+    float* costDerivativesData = costDerivatives.getData();
+
+    if(costDerivativesData != outputData) {
+        std::copy(outputData, outputData + output.size(), costDerivativesData);
+    }
+    for(int b=0; b<nbInstances; b++) {
+        float* instanceDerivatives = costDerivativesData + (size_t) b * outputSize;
+        if(batch.hasLabels()) {
+            instanceDerivatives[getCheckedLabel(batch, firstInstance + b, outputSize)] -= 1.0f;
+        } else {
+            const float* target = batch.getTarget(firstInstance + b);
+            for(int i=0; i<outputSize; i++) {
+                instanceDerivatives[i] -= target[i];
+            }
+        }
+    }
 }
 
 /**
@@ -225,22 +1008,236 @@ void NeuralNetwork::setLearningRate(float newValue) {
     learningRate = newValue;
 }
 
+/**
+ * Enable or disable the mixed-precision training. fit() then keeps the outputs and activation derivatives needed by the backward pass in bfloat16 and multiplies by bfloat16 copies of the weights, which halves the memory read and written by the training passes. The products are accumulated in float and the optimizer updates the float weights.
+ * @remark The inference functions still use the float weights. The output of the last layer and all the cost derivatives stay in float.
+ * @param enabled True to enable it
+ */
+void NeuralNetwork::setMixedPrecision(bool enabled) {
+    if(enabled == mixedPrecision) {
+        return;
+    }
+    mixedPrecision = enabled;
+    deleteExecutionPlans();
+    for(int l=0; l<getNbLayers(); l++) {
+        layers->getLayer(l)->setMixedPrecision(enabled);
+    }
+}
+
+/**
+ * Check if the mixed-precision training is enabled
+ * @return True if fit() stores the tensors of the training in bfloat16
+ */
+bool NeuralNetwork::isMixedPrecision() const {
+    return mixedPrecision;
+}
+
+/**
+ * Set the optimizer used by fit() to update the parameters. The state of the previous optimizer (momentum, moments...) is cleared.
+ * @param newOptimizer Optimizer allocated with new. The network takes its ownership and deletes it
+ */
+void NeuralNetwork::setOptimizer(Optimizer* newOptimizer) {
+    if(newOptimizer == nullptr) {
+        std::cerr << "ERROR: The optimizer can't be null" << std::endl;
+        return;
+    }
+    if(newOptimizer != optimizer) {
+        delete optimizer;
+        optimizer = newOptimizer;
+        defaultOptimizer = false;
+    }
+    for(int l=0; l<getNbLayers(); l++) {
+        layers->getLayer(l)->resetOptimizerState();
+    }
+}
+
+/**
+ * Get the optimizer used by fit()
+ * @remark The default optimizer is an SGD whose weight decay is set to 0.02 / batch size by each call to fit()
+ * @return Optimizer, owned by the network
+ */
+Optimizer* NeuralNetwork::getOptimizer() {
+    return optimizer;
+}
+
+/**
+ * Set the maximum number of shards in which fit() splits a batch. Each shard is processed by a thread with its own tensors and gradients, then the gradients are summed.
+ * @remark This scales better than splitting each matrix product between the threads when the layers are small. A shard has at least 8 instances.
+ * @param maxNbShards Maximum number of shards, 0 to use one shard per thread of the pool, 1 to disable the data-parallel training
+ */
+void NeuralNetwork::setDataParallelism(int maxNbShards) {
+    if(maxNbShards < 0) {
+        std::cerr << "ERROR: The number of shards can't be negative" << std::endl;
+        return;
+    }
+    dataParallelism = maxNbShards;
+}
+
+/**
+ * Get the maximum number of shards in which fit() splits a batch
+ * @return Maximum number of shards, 0 if it's the number of threads of the pool
+ */
+int NeuralNetwork::getDataParallelism() const {
+    return dataParallelism;
+}
+
+/**
+ * Enable the pipeline-parallel training: fit() splits the layers in stages of consecutive layers with about the same number of parameters, each one run by its own thread, and streams micro-batches through them (see Pipeline). It replaces the data-parallel training and the micro-batches of setMicroBatchMemory().
+ * @remark It's useful when the network is deep but its layers are too narrow to be split efficiently between the threads. The update is the same as without the pipeline (except for the rounding errors)
+ * @param nbStages Number of stages (at most the number of layers when fit() is called), 1 to disable the pipeline
+ * @param nbMicroBatches Number of micro-batches of a batch. With fewer micro-batches than stages, some stages are idle
+ * @param pinThreads True to bind the thread of each stage to a core, so that the weights of its layers stay in the caches of this core
+ */
+void NeuralNetwork::setPipelineParallelism(int nbStages, int nbMicroBatches, bool pinThreads) {
+    if(nbStages <= 0 || nbMicroBatches <= 0) {
+        std::cerr << "ERROR: The number of stages and of micro-batches must be positive" << std::endl;
+        return;
+    }
+    nbPipelineStages = nbStages;
+    nbPipelineMicroBatches = nbMicroBatches;
+    pinPipelineThreads = pinThreads;
+    delete pipeline;
+    pipeline = nullptr;
+}
+
+/**
+ * Get the number of stages of the pipeline-parallel training
+ * @return Number of stages, 1 if it's disabled
+ */
+int NeuralNetwork::getNbPipelineStages() const {
+    return nbPipelineStages;
+}
+
+/**
+ * Get the pipeline used by fit(), and build it if it doesn't exist yet
+ * @return Pipeline, owned by the network. nullptr if the pipeline-parallel training is disabled
+ */
+Pipeline* NeuralNetwork::getPipeline() {
+    if(nbPipelineStages <= 1) {
+        return nullptr;
+    }
+    if(pipeline == nullptr) {
+        if(nbPipelineStages > getNbLayers()) {
+            std::cerr << "ERROR: The pipeline has more stages than the network has layers" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        pipeline = new Pipeline(*this, *layers, nbPipelineStages, pinPipelineThreads);
+    }
+    return pipeline;
+}
+
+/**
+ * Get the counters of the arena used for the temporary tensors of fit()
+ * @return Counters of the arena
+ */
+TensorArena::Stats NeuralNetwork::getArenaStats() const {
+    return arena.getStats();
+}
+
 
 /**
  * Predict the label of the given input
+ * @remark It can be called by several threads at the same time (see evaluate())
  * @param input Input tensor
  * @return Label of the input tensor: number between 0 and the size of the last layer - 1, depending on which component of the output was the highest
  */
-int NeuralNetwork::predict(const Tensor &input) {
-    Tensor* output = evaluate(input);
-    float* outputData = output->getData();
-    int i_max = 0;
-    for(int i=1; i<layers->getLayer(getNbLayers()-1)->getOutputSize(0); i++) {
-        if(outputData[i] > outputData[i_max])
-            i_max = i;
+int NeuralNetwork::predict(const TensorView &input) {
+    InferenceContext* context = acquireInferenceContext();
+    int label;
+    {
+        TensorArena::Scope scope(context->arena);
+        TensorView output = getBatchOutput(*context, input.unsqueeze(0));
+        argmaxRows(output.getData(), 1, output.size(), &label);
+    }
+    releaseInferenceContext(context);
+    return label;
+}
+
+/**
+ * Predict the label of each element of a batch
+ * @param inputs Input tensors, the first dimension is the batch size
+ * @return Label of each input: index of the highest component of its output
+ */
+std::vector<int> NeuralNetwork::predictBatch(const TensorView &inputs) {
+    std::vector<int> labels(inputs.getDimSize(0));
+    InferenceContext* context = acquireInferenceContext();
+    for(int begin=0; begin<(int) labels.size(); begin+=INFERENCE_BATCH_SIZE) {
+        int end = std::min((int) labels.size(), begin + INFERENCE_BATCH_SIZE);
+        TensorArena::Scope scope(context->arena);
+        TensorView outputs = getBatchOutput(*context, inputs.slice(begin, end));
+        argmaxRows(outputs.getData(), end - begin, outputs.getStride(0), labels.data() + begin);
     }
-    delete output;
-    return i_max;
+    releaseInferenceContext(context);
+    return labels;
+}
+
+/**
+ * Predict the label of each instance of a list
+ * @param instances Instances (only their input is used)
+ * @return Label of each instance: index of the highest component of its output
+ */
+std::vector<int> NeuralNetwork::predictBatch(const std::vector<Instance*> &instances) {
+    std::vector<int> labels(instances.size());
+    InferenceContext* context = acquireInferenceContext();
+    for(int begin=0; begin<(int) instances.size(); begin+=INFERENCE_BATCH_SIZE) {
+        int end = std::min((int) instances.size(), begin + INFERENCE_BATCH_SIZE);
+        TensorArena::Scope scope(context->arena);
+        TensorView outputs = getBatchOutput(*context, gatherInputs(instances, begin, end));
+        argmaxRows(outputs.getData(), end - begin, outputs.getStride(0), labels.data() + begin);
+    }
+    releaseInferenceContext(context);
+    return labels;
+}
+
+/**
+ * Get the k labels with the highest outputs for each element of a batch, from the highest to the lowest
+ * @remark If the last layer uses Softmax, the values returned are the probabilities of the labels
+ * @param inputs Input tensors, the first dimension is the batch size
+ * @param k Number of labels returned for each input (at most the output size)
+ * @param indices Vector where the labels are written: k labels for each input, one input after the other
+ * @param probabilities Vector where the output value of each of these labels is written, in the same order
+ */
+void NeuralNetwork::predictTopK(const TensorView &inputs, int k, std::vector<int> &indices, std::vector<float> &probabilities) {
+    int batchSize = inputs.getDimSize(0);
+    indices.clear();
+    probabilities.clear();
+    InferenceContext* context = acquireInferenceContext();
+    for(int begin=0; begin<batchSize; begin+=INFERENCE_BATCH_SIZE) {
+        int end = std::min(batchSize, begin + INFERENCE_BATCH_SIZE);
+        TensorArena::Scope scope(context->arena);
+        TensorView outputs = getBatchOutput(*context, inputs.slice(begin, end));
+        int outputSize = outputs.getStride(0);
+        if(begin == 0) {
+            k = std::max(0, std::min(k, outputSize));
+            indices.resize((size_t) batchSize * k);
+            probabilities.resize((size_t) batchSize * k);
+        }
+
+        for(int b=begin; b<end; b++) {
+            const float* row = outputs.getData() + (size_t) (b - begin) * outputSize;
+            int* rowIndices = indices.data() + (size_t) b * k;
+            float* rowProbabilities = probabilities.data() + (size_t) b * k;
+            // Insertion in the k best elements found so far, which are sorted
+            int nbFound = 0;
+            for(int i=0; i<outputSize; i++) {
+                int position = nbFound;
+                while(position > 0 && row[i] > rowProbabilities[position-1]) {
+                    position--;
+                }
+                if(position >= k) {
+                    continue;
+                }
+                for(int p=std::min(nbFound, k-1); p>position; p--) {
+                    rowIndices[p] = rowIndices[p-1];
+                    rowProbabilities[p] = rowProbabilities[p-1];
+                }
+                rowIndices[position] = i;
+                rowProbabilities[position] = row[i];
+                nbFound = std::min(nbFound + 1, k);
+            }
+        }
+    }
+    releaseInferenceContext(context);
 }
 
 /**
@@ -250,33 +1247,236 @@ int NeuralNetwork::predict(const Tensor &input) {
  */
 
 float NeuralNetwork::getAccuracy(const std::vector<Instance*> &testSet) {
+    if(testSet.empty()) {
+        return 0.0f;
+    }
+
+    // The test set is evaluated by batches, each batch being split between the threads
     int validPredictions = 0;
-    for(int i=0; i<testSet.size(); i++) {
-        if (testSet[i]->getOneHotLabel()[predict(*(testSet[i]->getData()))] == 1) {
-            validPredictions++;
+    int labels[INFERENCE_BATCH_SIZE];
+    InferenceContext* context = acquireInferenceContext();
+    for(int begin=0; begin<(int) testSet.size(); begin+=INFERENCE_BATCH_SIZE) {
+        int end = std::min((int) testSet.size(), begin + INFERENCE_BATCH_SIZE);
+        TensorArena::Scope scope(context->arena);
+        TensorView outputs = getBatchOutput(*context, gatherInputs(testSet, begin, end));
+        argmaxRows(outputs.getData(), end - begin, outputs.getStride(0), labels);
+        for(int i=begin; i<end; i++) {
+            if(testSet[i]->isLabel(labels[i - begin])) {
+                validPredictions++;
+            }
         }
     }
+    releaseInferenceContext(context);
     return ((float)validPredictions/(float)testSet.size());
 }
 
 
 /**
- * Save the current network in a file. For now it's used for debug purposes only. The save file can't be loaded.
+ * Save the layers of the network (topology, activation functions, weights and biases) in a binary model file that can be loaded with load()
+ * @remark The optimizer state and the pruning mask are not saved. Use the toString() method of the layers to get a readable representation
  * @param fileName Name of the file where the network should be saved
+ * @return True if the file was written, false otherwise
  */
-void NeuralNetwork::save(const std::string& fileName) {
-    std::ofstream out(fileName);
+bool NeuralNetwork::save(const std::string& fileName) {
+    std::vector<DenseLayer*> denseLayers;
+    if(!getDenseLayers(denseLayers)) {
+        return false;
+    }
+    std::vector<char> bytes;
+    return ModelFile::serializeInto(bytes, inputSize, denseLayers) && ModelFile::writeFile(fileName, bytes);
+}
 
-    if(!out.is_open()) {
-        std::cerr<< "Failed to create save file" <<std::endl;
-        return;
+/**
+ * Get the layers of the network as dense layers, the only type that can be stored in a model file
+ * @param denseLayers Vector where the layers are written
+ * @return True if all the layers are dense layers, false otherwise
+ */
+bool NeuralNetwork::getDenseLayers(std::vector<DenseLayer*> &denseLayers) {
+    denseLayers.clear();
+    for(int l=0; l<getNbLayers(); l++) {
+        DenseLayer* layer = dynamic_cast<DenseLayer*>(layers->getLayer(l));
+        if(layer == nullptr) {
+            std::cerr << "ERROR: Only the dense layers can be saved in a model file" << std::endl;
+            return false;
+        }
+        denseLayers.push_back(layer);
+    }
+    return true;
+}
+
+/**
+ * Serialize everything needed to resume the training exactly in the format of a model file: the layers, their optimizer state and pruning mask, the step counters, the learning rate and a state defined by the caller. The file can also be loaded by load()
+ * @remark The vector is reused, so that the next checkpoints of the network don't allocate memory
+ * @param bytes Vector where the content of the checkpoint is written
+ * @param epoch Epoch reached by the training
+ * @param userState Other state of the caller needed to resume the training (e.g. its random generator)
+ * @return True if the checkpoint was serialized, false if the network can't be stored in a model file
+ */
+bool NeuralNetwork::getCheckpointInto(std::vector<char> &bytes, long epoch, const std::string &userState) {
+    std::vector<DenseLayer*> denseLayers;
+    if(!getDenseLayers(denseLayers)) {
+        return false;
+    }
+    ModelFile::TrainingState trainingState = {};
+    trainingState.nbSteps = nbSteps;
+    trainingState.nbOptimizerSteps = optimizer->getNbSteps();
+    trainingState.epoch = epoch;
+    trainingState.learningRate = learningRate;
+    strncpy(trainingState.optimizer, optimizer->getName().c_str(), sizeof(trainingState.optimizer) - 1);
+    return ModelFile::serializeInto(bytes, inputSize, denseLayers, &trainingState, userState);
+}
+
+/**
+ * Resume a training from a checkpoint written by getCheckpointInto() (e.g. with a Checkpointer). The network must have been created with the same layers and the same optimizer as the one that was saved: the parameters, the optimizer state, the pruning masks, the step counters and the learning rate are restored, so that the next steps are the same as if the training was never stopped
+ * @param fileName Name of the checkpoint file
+ * @param epoch Set to the epoch stored in the checkpoint
+ * @param userState Set to the state of the caller stored in the checkpoint
+ * @return True if the training state was restored, false otherwise (the network is not modified and the reason is written on the standard error)
+ */
+bool NeuralNetwork::restoreCheckpoint(const std::string &fileName, long &epoch, std::string &userState) {
+    std::vector<DenseLayer*> denseLayers;
+    std::shared_ptr<ModelFile> file = ModelFile::open(fileName);
+    if(file == nullptr || !getDenseLayers(denseLayers)) {
+        return false;
     }
 
+    const ModelFile::TrainingState* trainingState = file->getTrainingState();
+    if(trainingState == nullptr) {
+        std::cerr << "ERROR: " << fileName << " only contains a model, not a checkpoint" << std::endl;
+        return false;
+    }
+    if(file->getInputSize() != inputSize || file->getNbLayers() != getNbLayers()) {
+        std::cerr << "ERROR: The layers of the network don't match the ones of " << fileName << std::endl;
+        return false;
+    }
+    for(int l=0; l<getNbLayers(); l++) {
+        const ModelFile::LayerRecord& record = file->getLayer(l);
+        if(record.nbNeurons != denseLayers[l]->getNbNeurons() || file->getActivationFunctionName(l) != denseLayers[l]->getActivationFunction()->getName()) {
+            std::cerr << "ERROR: The layer " << l << " of the network doesn't match the one of " << fileName << std::endl;
+            return false;
+        }
+        if(record.nbOptimizerStateValues != 0 && (int) record.nbOptimizerStateValues != optimizer->getNbStateValues()) {
+            std::cerr << "ERROR: The optimizer state of " << fileName << " doesn't match the optimizer of the network" << std::endl;
+            return false;
+        }
+    }
+    if(optimizer->getName().compare(0, sizeof(trainingState->optimizer) - 1, trainingState->optimizer) != 0) {
+        std::cerr << "ERROR: " << fileName << " was saved with the optimizer " << trainingState->optimizer << " instead of " << optimizer->getName() << std::endl;
+        return false;
+    }
+
+    for(int l=0; l<getNbLayers(); l++) {
+        denseLayers[l]->setParameters(file->getWeights(l), file->getBiases(l), file->getPruningMask(l));
+        const float* optimizerState = file->getOptimizerState(l);
+        if(optimizerState != nullptr) {
+            denseLayers[l]->setOptimizerState(optimizerState, (size_t) file->getLayer(l).nbOptimizerStateValues * denseLayers[l]->getNbParameters());
+        } else {
+            denseLayers[l]->resetOptimizerState();
+        }
+    }
+    nbSteps = trainingState->nbSteps;
+    optimizer->setNbSteps(trainingState->nbOptimizerSteps);
+    learningRate = trainingState->learningRate;
+    epoch = trainingState->epoch;
+    userState = file->getUserState();
+    return true;
+}
+
+/**
+ * Load a network saved by save(). The file is mapped in memory and the layers use its weights and biases in place, nothing is copied: the processes that load the same file share its pages in the page cache (as long as they don't train the network)
+ * @param fileName Name of the model file
+ * @return Network allocated with new, nullptr if the file can't be loaded (the reason is written on the standard error)
+ */
+NeuralNetwork* NeuralNetwork::load(const std::string& fileName) {
+    std::shared_ptr<ModelFile> file = ModelFile::open(fileName);
+    if(file == nullptr) {
+        return nullptr;
+    }
+
+    NeuralNetwork* network = new NeuralNetwork(file->getInputSize());
+    for(int l=0; l<file->getNbLayers(); l++) {
+        ActivationFunction* activationFunction = ActivationFunction::create(file->getActivationFunctionName(l));
+        if(activationFunction == nullptr) {
+            std::cerr << "ERROR: Unknown activation function " << file->getActivationFunctionName(l) << " in " << fileName << std::endl;
+            delete network;
+            return nullptr;
+        }
+        network->activationFunctions.push_back(activationFunction);
+
+        const ModelFile::LayerRecord& record = file->getLayer(l);
+        network->layers->add(new DenseLayer(record.nbNeurons, record.nbNeuronsPrevLayer, activationFunction, file->getWeights(l), file->getBiases(l), file));
+    }
+    return network;
+}
+
+/**
+ * Prune the weights of all the dense layers whose absolute value is below a threshold. They are set to 0 and they stay at 0 during the next trainings.
+ * @param threshold Weights w such that |w| < threshold are pruned
+ */
+void NeuralNetwork::prune(float threshold) {
+    for(int l=0; l<getNbLayers(); l++) {
+        DenseLayer* layer = dynamic_cast<DenseLayer*>(layers->getLayer(l));
+        if(layer != nullptr) {
+            layer->prune(threshold);
+        }
+    }
+}
+
+/**
+ * Prune the weights with the lowest absolute values of each dense layer so that the given proportion of their weights is 0
+ * @param sparsity Proportion of the weights of each layer that must be 0 (between 0 and 1)
+ */
+void NeuralNetwork::pruneToSparsity(float sparsity) {
     for(int l=0; l<getNbLayers(); l++) {
-        out << "Layer " << l << ": " << std::endl;
-        out << layers->getLayer(l)->toString();
-        out << std::endl << std::endl;
+        DenseLayer* layer = dynamic_cast<DenseLayer*>(layers->getLayer(l));
+        if(layer != nullptr) {
+            layer->pruneToSparsity(sparsity);
+        }
+    }
+}
+
+/**
+ * Get the proportion of the weights of the dense layers that are 0
+ * @return Sparsity of the network (between 0 and 1)
+ */
+float NeuralNetwork::getSparsity() {
+    double nbWeights = 0;
+    double nbZeros = 0;
+    for(int l=0; l<getNbLayers(); l++) {
+        DenseLayer* layer = dynamic_cast<DenseLayer*>(layers->getLayer(l));
+        if(layer != nullptr) {
+            double layerNbWeights = (double) layer->getNbNeurons() * layer->getNbNeuronsPrevLayer();
+            nbWeights += layerNbWeights;
+            nbZeros += (1.0 - layer->getDensity()) * layerNbWeights;
+        }
+    }
+    return nbWeights > 0 ? (float) (nbZeros / nbWeights) : 0.0f;
+}
+
+/**
+ * Prune the network gradually during the next trainings: every frequency calls to fit() between startStep and endStep, the weights of the dense layers are pruned to reach the sparsity s = finalSparsity * (1 - (1 - progress)^3), where progress goes from 0 to 1
+ * @remark The sparsity increases quickly at the beginning, when there are many redundant weights, and slowly at the end so that the network can recover from the pruning
+ * @param finalSparsity Proportion of the weights of each layer that are 0 after endStep (between 0 and 1), 0 to disable the schedule
+ * @param startStep Number of calls to fit() before the first pruning
+ * @param endStep Number of calls to fit() after which the final sparsity is reached
+ * @param frequency Number of calls to fit() between two prunings
+ */
+void NeuralNetwork::setPruningSchedule(float finalSparsity, long startStep, long endStep, long frequency) {
+    if(finalSparsity < 0 || finalSparsity >= 1 || startStep < 0 || endStep < startStep || frequency <= 0) {
+        std::cerr << "ERROR: Invalid pruning schedule" << std::endl;
+        return;
+    }
+    pruningSchedule = {finalSparsity, startStep, endStep, frequency};
+}
+
+/**
+ * Prune the network if the current training step is one of the steps of the pruning schedule
+ */
+void NeuralNetwork::applyPruningSchedule() {
+    if(pruningSchedule.finalSparsity <= 0 || nbSteps < pruningSchedule.startStep || nbSteps > pruningSchedule.endStep || (nbSteps - pruningSchedule.startStep) % pruningSchedule.frequency != 0) {
+        return;
     }
-    out.flush();
-    out.close();
+    float progress = pruningSchedule.endStep > pruningSchedule.startStep ? (float) (nbSteps - pruningSchedule.startStep) / (float) (pruningSchedule.endStep - pruningSchedule.startStep) : 1.0f;
+    float sparsity = pruningSchedule.finalSparsity * (1.0f - std::pow(1.0f - progress, 3.0f));
+    pruneToSparsity(sparsity);
 }
@@ -0,0 +1,79 @@
+/**
+ * @file Optimizer.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class Optimizer, common to all the optimizers
+ * @date 2024-01-28
+ */
+
+#include "../include/Optimizer.h"
+#include "../include/ThreadPool.h"
+
+/**
+ * Create an optimizer
+ * @param weightDecay Factor of the weight decay
+ * @param decoupledWeightDecay True if the weight decay is decoupled from the gradient, false if it's an L2 penalty added to the gradient
+ */
+Optimizer::Optimizer(float weightDecay, bool decoupledWeightDecay) : weightDecay(weightDecay), decoupledWeightDecay(decoupledWeightDecay), nbSteps(0) {}
+
+/**
+ * Update an array of parameters from their gradients. The array is split between the threads of the pool.
+ * @param learningRate Learning rate
+ * @param parameters Parameters updated
+ * @param gradients Gradients of the parameters
+ * @param state State of the optimizer for this array: getNbStateValues() blocks of size elements, initialized to 0 before the first update
+ * @param size Number of parameters
+ * @param applyWeightDecay True if the weight decay is applied to these parameters (weights), false otherwise (biases)
+ */
+void Optimizer::update(float learningRate, float* parameters, const float* gradients, float* state, int size, bool applyWeightDecay) {
+    float decay = applyWeightDecay ? weightDecay : 0.0f;
+    ThreadPool::getInstance().parallelFor(size, 4 + 4 * getNbStateValues(), [&](int begin, int end) {
+        updateRange(learningRate, decay, parameters, gradients, state, size, begin, end);
+    });
+}
+
+/**
+ * Start a new update of all the parameters. It must be called once per training step, before the calls to update()
+ */
+void Optimizer::nextStep() {
+    nbSteps++;
+}
+
+/**
+ * Get the number of updates done
+ * @return Number of training steps
+ */
+long Optimizer::getNbSteps() const {
+    return nbSteps;
+}
+
+/**
+ * Set the number of updates done, used to resume a training
+ * @param newValue Number of training steps
+ */
+void Optimizer::setNbSteps(long newValue) {
+    nbSteps = newValue;
+}
+
+/**
+ * Get the factor of the weight decay
+ * @return Weight decay
+ */
+float Optimizer::getWeightDecay() const {
+    return weightDecay;
+}
+
+/**
+ * Set the factor of the weight decay
+ * @param newValue Weight decay
+ */
+void Optimizer::setWeightDecay(float newValue) {
+    weightDecay = newValue;
+}
+
+/**
+ * Check if the weight decay is decoupled from the gradient
+ * @return True if it's decoupled, false if it's an L2 penalty added to the gradient
+ */
+bool Optimizer::isWeightDecayDecoupled() const {
+    return decoupledWeightDecay;
+}
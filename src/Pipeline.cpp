@@ -0,0 +1,373 @@
+/**
+ * @file Pipeline.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class Pipeline, used to train the layers of a network in stages run by different threads
+ * @date 2024-01-30
+ */
+
+#include "../include/Pipeline.h"
+#include "../include/NeuralNetwork.h"
+#include "../include/ThreadPool.h"
+#include <iostream>
+#include <climits>
+#include <algorithm>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+/**
+ * Split the layers in stages and start the thread of each stage
+ * @param network Network whose layers are trained
+ * @param layers Layers of the network. The pipeline must be built again if they change
+ * @param nbStages Number of stages, at most the number of layers
+ * @param pinThreads True to bind the thread of each stage to its own core (only on Linux), so that it keeps the weights of its layers in its caches. If the workers of the ThreadPool are pinned to the first cores, the stages use the next ones. When there are not enough cores left for all the stages, they are not pinned, so that they never share a core with a worker
+ */
+Pipeline::Pipeline(NeuralNetwork &network, LayersList &layers, int nbStages, bool pinThreads) : network(network), layers(layers), pinThreads(pinThreads), capacity(0), batch(nullptr), microBatchSize(0), nbMicroBatches(0), optimizer(nullptr), learningRate(0.0f), generation(0), nbRunningStages(0), stop(false) {
+    int nbLayers = layers.getNbLayers();
+    if(nbStages <= 0 || nbStages > nbLayers) {
+        std::cerr << "ERROR: A pipeline of " << nbLayers << " layers can't have " << nbStages << " stages" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    partition(nbStages);
+    for(int l=0; l<nbLayers; l++) {
+        gradients.push_back(layers.getLayer(l)->getGradients());
+    }
+
+    // The pinned workers of the pool use the cores 0 to getNbThreads() - 1 (the core 0 being the one of the calling thread)
+    int nbCores = std::max(1, (int) std::thread::hardware_concurrency());
+    ThreadPool &pool = ThreadPool::getInstance();
+    int firstCore = pool.arePinned() ? pool.getNbThreads() : 0;
+    if(this->pinThreads && firstCore + nbStages > nbCores) {
+        std::cerr << "WARNING: The " << nbStages << " stages of the pipeline are not pinned: only " << nbCores - std::min(firstCore, nbCores) << " of the " << nbCores << " cores are not used by the pinned workers of the thread pool" << std::endl;
+        this->pinThreads = false;
+    }
+    for(int s=0; s<nbStages; s++) {
+        stages[s]->thread = std::thread(&Pipeline::stageLoop, this, s);
+#ifdef __linux__
+        if(this->pinThreads) {
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            CPU_SET(firstCore + s, &cpuSet);
+            pthread_setaffinity_np(stages[s]->thread.native_handle(), sizeof(cpu_set_t), &cpuSet);
+        }
+#endif
+    }
+}
+
+/**
+ * Stop and join the threads of the stages
+ */
+Pipeline::~Pipeline() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    stepStarted.notify_all();
+    for(Stage* stage : stages) {
+        stage->thread.join();
+        delete stage;
+    }
+}
+
+/**
+ * Split the layers in consecutive stages so that the largest number of parameters of a stage (which is proportional to the work of its passes) is as small as possible
+ * @param nbStages Number of stages
+ */
+void Pipeline::partition(int nbStages) {
+    int nbLayers = layers.getNbLayers();
+    std::vector<long> prefixSums(nbLayers + 1, 0);
+    for(int l=0; l<nbLayers; l++) {
+        prefixSums[l+1] = prefixSums[l] + layers.getLayer(l)->getNbParameters();
+    }
+
+    // bestCosts[k][l] is the smallest maximum cost of a stage when the first l layers are split in k stages, and firstLayers[k][l] is the first layer of the last of these stages
+    std::vector<std::vector<long>> bestCosts(nbStages + 1, std::vector<long>(nbLayers + 1, LONG_MAX));
+    std::vector<std::vector<int>> firstLayers(nbStages + 1, std::vector<int>(nbLayers + 1, 0));
+    bestCosts[0][0] = 0;
+    for(int k=1; k<=nbStages; k++) {
+        for(int l=k; l<=nbLayers; l++) {
+            for(int j=k-1; j<l; j++) {
+                if(bestCosts[k-1][j] == LONG_MAX) {
+                    continue;
+                }
+                long cost = std::max(bestCosts[k-1][j], prefixSums[l] - prefixSums[j]);
+                if(cost < bestCosts[k][l]) {
+                    bestCosts[k][l] = cost;
+                    firstLayers[k][l] = j;
+                }
+            }
+        }
+    }
+
+    stages.resize(nbStages);
+    int endLayer = nbLayers;
+    for(int k=nbStages; k>=1; k--) {
+        Stage* stage = new Stage();
+        stage->firstLayer = firstLayers[k][endLayer];
+        stage->endLayer = endLayer;
+        // With the 1F1B schedule, the stage s has at most nbStages - s micro-batches in flight
+        stage->nbSlots = nbStages - k + 1;
+        stage->nbForwards = 0;
+        stage->nbBackwards = 0;
+        stages[k-1] = stage;
+        endLayer = stage->firstLayer;
+    }
+}
+
+/**
+ * Allocate the tensors of the slots of each stage for capacity instances
+ */
+void Pipeline::allocateSlots() {
+    for(Stage* stage : stages) {
+        size_t nbValuesPerSlot = 0;
+        for(int l=stage->firstLayer; l<stage->endLayer; l++) {
+            nbValuesPerSlot += 3 * (size_t) capacity * layers.getLayer(l)->getOutputSize(0);
+        }
+        stage->memory.assign(nbValuesPerSlot * stage->nbSlots, 0.0f);
+
+        stage->outputs.clear();
+        stage->activationDerivatives.clear();
+        stage->costDerivatives.clear();
+        float* data = stage->memory.data();
+        for(int k=0; k<stage->nbSlots; k++) {
+            for(int l=stage->firstLayer; l<stage->endLayer; l++) {
+                int outputSize = layers.getLayer(l)->getOutputSize(0);
+                size_t nbValues = (size_t) capacity * outputSize;
+                stage->outputs.emplace_back(2, std::vector<int>{capacity, outputSize}, data);
+                stage->activationDerivatives.emplace_back(2, std::vector<int>{capacity, outputSize}, data + nbValues);
+                stage->costDerivatives.emplace_back(2, std::vector<int>{capacity, outputSize}, data + 2 * nbValues);
+                data += 3 * nbValues;
+            }
+        }
+    }
+}
+
+/**
+ * Train the layers on a batch: run the forward and backward passes of its micro-batches through the stages, then update the parameters of each layer from the mean of the gradients over the batch
+ * @remark optimizer.nextStep() must be called before
+ * @param batch Batch of instances
+ * @param nbMicroBatches Number of micro-batches the batch is split in. At least the number of stages is needed to keep all the stages busy
+ * @param optimizer Optimizer updating the parameters
+ * @param learningRate Learning rate
+ */
+void Pipeline::fit(Batch &batch, int nbMicroBatches, Optimizer &optimizer, float learningRate) {
+    int batchSize = batch.getSize();
+    nbMicroBatches = std::max(1, std::min(nbMicroBatches, batchSize));
+    int newMicroBatchSize = (batchSize + nbMicroBatches - 1) / nbMicroBatches;
+    // The tensors are kept when the micro-batches get smaller (e.g. for the last batch of an epoch)
+    if(newMicroBatchSize > capacity) {
+        capacity = newMicroBatchSize;
+        allocateSlots();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    this->batch = &batch;
+    this->microBatchSize = newMicroBatchSize;
+    this->nbMicroBatches = (batchSize + newMicroBatchSize - 1) / newMicroBatchSize;
+    this->optimizer = &optimizer;
+    this->learningRate = learningRate;
+    for(Stage* stage : stages) {
+        stage->nbForwards.store(0, std::memory_order_relaxed);
+        stage->nbBackwards.store(0, std::memory_order_relaxed);
+    }
+    nbRunningStages = (int) stages.size();
+    generation++;
+    stepStarted.notify_all();
+    stepDone.wait(lock, [this] { return nbRunningStages == 0; });
+    this->batch = nullptr;
+}
+
+/**
+ * Run the steps given to a stage until the pipeline is destroyed
+ * @param s Index of the stage
+ */
+void Pipeline::stageLoop(int s) {
+    long lastGeneration = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        stepStarted.wait(lock, [&] { return stop || generation != lastGeneration; });
+        if(stop) {
+            return;
+        }
+        lastGeneration = generation;
+        lock.unlock();
+        runStage(s);
+        lock.lock();
+        nbRunningStages--;
+        if(nbRunningStages == 0) {
+            stepDone.notify_all();
+        }
+    }
+}
+
+/**
+ * Run the 1F1B schedule of a stage for the current step: the forward passes of the first micro-batches fill the pipeline, then the stage alternates between a forward pass and a backward pass, then it runs the remaining backward passes. Finally, it updates the parameters of its layers.
+ * @param s Index of the stage
+ */
+void Pipeline::runStage(int s) {
+    int nbStages = (int) stages.size();
+    int nbWarmupForwards = std::min(nbStages - 1 - s, nbMicroBatches);
+    int nbForwards = 0;
+    int nbBackwards = 0;
+    while(nbForwards < nbWarmupForwards) {
+        forward(s, nbForwards++);
+    }
+    while(nbForwards < nbMicroBatches) {
+        forward(s, nbForwards++);
+        backward(s, nbBackwards++);
+    }
+    while(nbBackwards < nbMicroBatches) {
+        backward(s, nbBackwards++);
+    }
+
+    // No other stage reads the weights of these layers, so they are updated while the previous stages finish their backward passes
+    Stage* stage = stages[s];
+    for(int l=stage->firstLayer; l<stage->endLayer; l++) {
+        layers.getLayer(l)->applyGradients(*optimizer, learningRate);
+    }
+}
+
+/**
+ * Get the slot where a stage keeps the tensors of a micro-batch
+ * @param s Index of the stage
+ * @param m Index of the micro-batch
+ * @return Index of the slot
+ */
+int Pipeline::getSlot(int s, int m) const {
+    return m % stages[s]->nbSlots;
+}
+
+/**
+ * Get the input of a layer for a micro-batch: the instances of the batch for the first layer, or the output of the previous layer (kept by this stage or by the previous one)
+ * @param s Index of the stage of the layer
+ * @param m Index of the micro-batch
+ * @param layer Index of the layer
+ * @param nbInstances Number of instances of the micro-batch
+ * @return Input of the layer
+ */
+TensorView Pipeline::getInput(int s, int m, int layer, int nbInstances) {
+    if(layer == 0) {
+        int begin = m * microBatchSize;
+        return batch->getData()->slice(begin, begin + nbInstances);
+    }
+    Stage* stage = stages[s];
+    if(layer == stage->firstLayer) {
+        stage = stages[s-1];
+        s--;
+    }
+    int nbLayers = stage->endLayer - stage->firstLayer;
+    return stage->outputs[getSlot(s, m) * nbLayers + layer - 1 - stage->firstLayer].slice(0, nbInstances);
+}
+
+/**
+ * Run the forward pass of the layers of a stage on a micro-batch, once the previous stage is done with it. The last stage also computes the cost derivatives of the output.
+ * @param s Index of the stage
+ * @param m Index of the micro-batch
+ */
+void Pipeline::forward(int s, int m) {
+    if(s > 0) {
+        waitFor(stages[s-1]->nbForwards, m + 1);
+    }
+    Stage* stage = stages[s];
+    int begin = m * microBatchSize;
+    int nbInstances = std::min(microBatchSize, batch->getSize() - begin);
+    int offset = getSlot(s, m) * (stage->endLayer - stage->firstLayer) - stage->firstLayer;
+
+    TensorArena::Scope scope(stage->arena);
+    TensorView input = getInput(s, m, stage->firstLayer, nbInstances);
+    for(int l=stage->firstLayer; l<stage->endLayer; l++) {
+        TensorView output = stage->outputs[offset + l].slice(0, nbInstances);
+        TensorView activationDerivatives = stage->activationDerivatives[offset + l].slice(0, nbInstances);
+        layers.getLayer(l)->getOutputAndDerivativesInto(input, output, activationDerivatives);
+        input = output;
+    }
+
+    if(s == (int) stages.size() - 1) {
+        int last = stage->endLayer - 1;
+        TensorView costDerivatives = stage->costDerivatives[offset + last].slice(0, nbInstances);
+        network.getOutputCostDerivativesInto(input, stage->activationDerivatives[offset + last].slice(0, nbInstances), *batch, begin, costDerivatives);
+    }
+    stage->nbForwards.store(m + 1, std::memory_order_release);
+}
+
+/**
+ * Run the backward pass of the layers of a stage on a micro-batch, once the next stage is done with it: propagate the cost derivatives (into the tensors of the previous stage for the first layer) and add the gradients of the micro-batch to the ones of the layers
+ * @param s Index of the stage
+ * @param m Index of the micro-batch
+ */
+void Pipeline::backward(int s, int m) {
+    if(s < (int) stages.size() - 1) {
+        waitFor(stages[s+1]->nbBackwards, m + 1);
+    }
+    Stage* stage = stages[s];
+    int nbInstances = std::min(microBatchSize, batch->getSize() - m * microBatchSize);
+    int offset = getSlot(s, m) * (stage->endLayer - stage->firstLayer) - stage->firstLayer;
+    float gradientScale = 1.0f / (float) batch->getSize();
+
+    TensorArena::Scope scope(stage->arena);
+    for(int l=stage->endLayer-1; l>=stage->firstLayer; l--) {
+        Layer* layer = layers.getLayer(l);
+        TensorView costDerivatives = stage->costDerivatives[offset + l].slice(0, nbInstances);
+        if(l > stage->firstLayer) {
+            TensorView nextCostDerivatives = stage->costDerivatives[offset + l - 1].slice(0, nbInstances);
+            network.propagateCostDerivativesInto(costDerivatives, stage->activationDerivatives[offset + l - 1].slice(0, nbInstances), layer, nextCostDerivatives);
+        } else if(l > 0) {
+            // The previous stage keeps this micro-batch until this pass is done, so its tensors can be written
+            Stage* prevStage = stages[s-1];
+            int prevOffset = getSlot(s-1, m) * (prevStage->endLayer - prevStage->firstLayer) - prevStage->firstLayer;
+            TensorView nextCostDerivatives = prevStage->costDerivatives[prevOffset + l - 1].slice(0, nbInstances);
+            network.propagateCostDerivativesInto(costDerivatives, prevStage->activationDerivatives[prevOffset + l - 1].slice(0, nbInstances), layer, nextCostDerivatives);
+        }
+        layer->computeGradientsInto(costDerivatives, getInput(s, m, l, nbInstances), gradientScale, gradients[l], m > 0);
+    }
+    stage->nbBackwards.store(m + 1, std::memory_order_release);
+}
+
+/**
+ * Wait until a counter of another stage reaches a value. The stages are busy during a step, so they spin instead of sleeping
+ * @param counter Counter of a stage
+ * @param value Value waited for
+ */
+void Pipeline::waitFor(const std::atomic<int> &counter, int value) {
+    while(counter.load(std::memory_order_acquire) < value) {
+        std::this_thread::yield();
+    }
+}
+
+/**
+ * Get the number of stages
+ * @return Number of stages
+ */
+int Pipeline::getNbStages() const {
+    return (int) stages.size();
+}
+
+/**
+ * Get the first layer of a stage
+ * @param s Index of the stage
+ * @return Index of the first layer of the stage
+ */
+int Pipeline::getFirstLayer(int s) const {
+    return stages[s]->firstLayer;
+}
+
+/**
+ * Get the end of the layers of a stage
+ * @param s Index of the stage
+ * @return Index after the last layer of the stage
+ */
+int Pipeline::getEndLayer(int s) const {
+    return stages[s]->endLayer;
+}
+
+/**
+ * Get the memory used by the tensors of the micro-batches in flight
+ * @return Number of bytes of the slots of all the stages
+ */
+size_t Pipeline::getNbBytes() const {
+    size_t nbBytes = 0;
+    for(Stage* stage : stages) {
+        nbBytes += stage->memory.size() * sizeof(float);
+    }
+    return nbBytes;
+}
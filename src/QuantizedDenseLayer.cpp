@@ -0,0 +1,249 @@
+/**
+ * @file QuantizedDenseLayer.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class QuantizedDenseLayer, an int8 version of DenseLayer used for inference
+ * @date 2024-01-18
+ */
+
+#include "../include/QuantizedDenseLayer.h"
+#include "../include/Gemm.h"
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QUANTIZED_DENSE_LAYER_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * Calculate the dot products of one quantized input with 4 rows of quantized weights, with an int32 accumulation
+ * @param input Quantized input (size elements)
+ * @param weights First of the 4 rows of quantized weights (rows of size elements, one after the other)
+ * @param size Size of the input and of each row
+ * @param results Array where the 4 dot products are written
+ */
+static void dotProducts4Scalar(const int8_t* input, const int8_t* weights, int size, int32_t* results) {
+    const int8_t* w0 = weights;
+    const int8_t* w1 = w0 + size;
+    const int8_t* w2 = w1 + size;
+    const int8_t* w3 = w2 + size;
+    int32_t acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+
+    for(int j=0; j<size; j++) {
+        int32_t x = input[j];
+        acc0 += x * w0[j];
+        acc1 += x * w1[j];
+        acc2 += x * w2[j];
+        acc3 += x * w3[j];
+    }
+    results[0] = acc0;
+    results[1] = acc1;
+    results[2] = acc2;
+    results[3] = acc3;
+}
+
+#ifdef QUANTIZED_DENSE_LAYER_X86
+
+/**
+ * Sum the 8 int32 of an AVX2 register
+ * @param v Register summed
+ * @return Sum of its elements
+ */
+__attribute__((target("avx2")))
+static int32_t horizontalSumAvx2(__m256i v) {
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+
+/**
+ * AVX2 version of dotProducts4Scalar(). The int8 are widened to int16 and multiplied-added in pairs into int32 (madd), so 16 elements of each row are processed per iteration and the input is only widened once for the 4 rows
+ * @param input Quantized input (size elements)
+ * @param weights First of the 4 rows of quantized weights (rows of size elements, one after the other)
+ * @param size Size of the input and of each row
+ * @param results Array where the 4 dot products are written
+ */
+__attribute__((target("avx2")))
+static void dotProducts4Avx2(const int8_t* input, const int8_t* weights, int size, int32_t* results) {
+    const int8_t* w0 = weights;
+    const int8_t* w1 = w0 + size;
+    const int8_t* w2 = w1 + size;
+    const int8_t* w3 = w2 + size;
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    __m256i acc2 = _mm256_setzero_si256();
+    __m256i acc3 = _mm256_setzero_si256();
+
+    int j = 0;
+    for(; j+16<=size; j+=16) {
+        __m256i x = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (input + j)));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(x, _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (w0 + j)))));
+        acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(x, _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (w1 + j)))));
+        acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(x, _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (w2 + j)))));
+        acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(x, _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (w3 + j)))));
+    }
+
+    results[0] = horizontalSumAvx2(acc0);
+    results[1] = horizontalSumAvx2(acc1);
+    results[2] = horizontalSumAvx2(acc2);
+    results[3] = horizontalSumAvx2(acc3);
+
+    for(; j<size; j++) {
+        int32_t x = input[j];
+        results[0] += x * w0[j];
+        results[1] += x * w1[j];
+        results[2] += x * w2[j];
+        results[3] += x * w3[j];
+    }
+}
+
+#endif
+
+/**
+ * Create an int8 copy of a dense layer. The weights of each neuron are quantized with the scale max|w_i,j| / 127
+ * @param layer Layer quantized
+ * @param inputScale Scale of the quantized input of this layer (calibrated from the values it receives)
+ */
+QuantizedDenseLayer::QuantizedDenseLayer(DenseLayer &layer, float inputScale) : nbNeurons(layer.getNbNeurons()), nbNeuronsPrevLayer(layer.getNbNeuronsPrevLayer()), weights(nullptr), weightScales(nullptr), biases(nullptr), inputScale(inputScale), activationFunction(layer.getActivationFunction()) {
+    weights = new int8_t[nbNeurons * nbNeuronsPrevLayer];
+    weightScales = new float[nbNeurons];
+    biases = new float[nbNeurons];
+
+    const float* floatWeights = layer.getWeights().getData();
+    const float* floatBiases = layer.getBiases();
+
+    for(int i=0; i<nbNeurons; i++) {
+        const float* row = floatWeights + i * nbNeuronsPrevLayer;
+        float absMax = 0.0f;
+        for(int j=0; j<nbNeuronsPrevLayer; j++) {
+            absMax = std::max(absMax, std::fabs(row[j]));
+        }
+        weightScales[i] = getScale(absMax);
+        quantize(row, nbNeuronsPrevLayer, weightScales[i], weights + i * nbNeuronsPrevLayer);
+        biases[i] = floatBiases[i];
+    }
+}
+
+/**
+ * Free the memory occupied by the quantized layer
+ */
+QuantizedDenseLayer::~QuantizedDenseLayer() {
+    delete[] weights;
+    delete[] weightScales;
+    delete[] biases;
+}
+
+/**
+ * Get the number of neurons in this layer
+ * @return Number of neurons in this layer
+ */
+int QuantizedDenseLayer::getNbNeurons() const {
+    return nbNeurons;
+}
+
+/**
+ * Get the number of neurons in the previous layer
+ * @return Number of neurons in the previous layer
+ */
+int QuantizedDenseLayer::getNbNeuronsPrevLayer() const {
+    return nbNeuronsPrevLayer;
+}
+
+/**
+ * Get the scale of the quantized input of this layer
+ * @return Scale of the input
+ */
+float QuantizedDenseLayer::getInputScale() const {
+    return inputScale;
+}
+
+/**
+ * Get the memory used by the parameters of this layer (quantized weights, their scales and the biases)
+ * @return Number of bytes used by the parameters
+ */
+size_t QuantizedDenseLayer::getNbParameterBytes() const {
+    return (size_t) nbNeurons * nbNeuronsPrevLayer * sizeof(int8_t) + nbNeurons * (sizeof(float) + sizeof(float));
+}
+
+/**
+ * Get the output of the layer for a batch of quantized inputs. The weighted sums are accumulated in int32, then for each instance the requantization, the bias, the activation function and the quantization for the next layer are applied while the row is still in the cache.
+ * @param input Quantized input of the layer (batchSize * getNbNeuronsPrevLayer() elements quantized with getInputScale())
+ * @param batchSize Number of instances in the batch
+ * @param outputScale Scale used to quantize the output (it's the input scale of the next layer). Not used if quantizedOutput is nullptr
+ * @param quantizedOutput Array where the quantized output (batchSize * getNbNeurons() elements) is written, or nullptr if it's not needed (e.g. for the last layer)
+ * @param output Array where the real output (batchSize * getNbNeurons() elements) is written, or nullptr if it's not needed
+ */
+void QuantizedDenseLayer::forward(const int8_t *input, int batchSize, float outputScale, int8_t *quantizedOutput, float *output) const {
+    void (*dotProducts4)(const int8_t*, const int8_t*, int, int32_t*) = dotProducts4Scalar;
+#ifdef QUANTIZED_DENSE_LAYER_X86
+    if(Gemm::getIsa() >= Gemm::AVX2) {
+        dotProducts4 = dotProducts4Avx2;
+    }
+#endif
+
+    // The row is reused by the next calls on this thread, so that the batches of one instance don't allocate memory
+    static thread_local std::vector<float> row;
+    if((int) row.size() < nbNeurons) {
+        row.resize(nbNeurons);
+    }
+    TensorView rowView(2, {1, nbNeurons}, row.data());
+    int32_t dotProducts[4];
+
+    for(int b=0; b<batchSize; b++) {
+        const int8_t* x = input + b * nbNeuronsPrevLayer;
+
+        int i = 0;
+        for(; i+4<=nbNeurons; i+=4) {
+            const int8_t* w = weights + i * nbNeuronsPrevLayer;
+            dotProducts4(x, w, nbNeuronsPrevLayer, dotProducts);
+            for(int k=0; k<4; k++) {
+                row[i+k] = (float) dotProducts[k] * (inputScale * weightScales[i+k]) + biases[i+k];
+            }
+        }
+        for(; i<nbNeurons; i++) {
+            const int8_t* w = weights + i * nbNeuronsPrevLayer;
+            int32_t acc = 0;
+            for(int j=0; j<nbNeuronsPrevLayer; j++) {
+                acc += (int32_t) x[j] * w[j];
+            }
+            row[i] = (float) acc * (inputScale * weightScales[i]) + biases[i];
+        }
+
+        // The activation function is applied in place on this instance only
+        activationFunction->applyInPlace(rowView, 1);
+
+        if(quantizedOutput != nullptr) {
+            quantize(row.data(), nbNeurons, outputScale, quantizedOutput + b * nbNeurons);
+        }
+        if(output != nullptr) {
+            std::copy(row.data(), row.data() + nbNeurons, output + b * nbNeurons);
+        }
+    }
+}
+
+/**
+ * Get the symmetric quantization scale of values whose absolute value is at most absMax
+ * @param absMax Maximum of the absolute values
+ * @return Scale such that absMax is represented by 127
+ */
+float QuantizedDenseLayer::getScale(float absMax) {
+    return absMax > 0.0f ? absMax / 127.0f : 1.0f;
+}
+
+/**
+ * Quantize real values to int8: q = round(x / scale) clamped to [-127, 127]
+ * @param input Values quantized
+ * @param size Number of values
+ * @param scale Scale of the quantization
+ * @param output Array where the size quantized values are written
+ */
+void QuantizedDenseLayer::quantize(const float *input, int size, float scale, int8_t *output) {
+    float invScale = 1.0f / scale;
+    for(int i=0; i<size; i++) {
+        float q = std::nearbyint(input[i] * invScale);
+        q = std::min(127.0f, std::max(-127.0f, q));
+        output[i] = (int8_t) q;
+    }
+}
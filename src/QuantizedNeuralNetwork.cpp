@@ -0,0 +1,201 @@
+/**
+ * @file QuantizedNeuralNetwork.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class QuantizedNeuralNetwork, an int8 copy of a trained network used for inference
+ * @date 2024-01-18
+ */
+
+#include "../include/QuantizedNeuralNetwork.h"
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+/**
+ * Get the maximum absolute value of a tensor
+ * @param tensor Contiguous tensor
+ * @return Maximum of the absolute values of its elements
+ */
+static float getAbsMax(const TensorView &tensor) {
+    const float* data = tensor.getData();
+    float absMax = 0.0f;
+    for(int i=0; i<tensor.size(); i++) {
+        absMax = std::max(absMax, std::fabs(data[i]));
+    }
+    return absMax;
+}
+
+/**
+ * Create an int8 copy of a trained network. The network is first evaluated in fp32 on the calibration set to find the range of the input of each layer, then the weights of each layer are quantized.
+ * @param network Trained network, it must only contain dense layers
+ * @param calibrationSet Instances used to calibrate the scale of the input of each layer (a few hundred instances representative of the data is enough)
+ */
+QuantizedNeuralNetwork::QuantizedNeuralNetwork(NeuralNetwork &network, const std::vector<Instance*> &calibrationSet) : inputSize(network.getInputSize()), inputScale(1.0f) {
+    int nbLayers = network.getNbLayers();
+    if(nbLayers <= 0) {
+        std::cerr << "ERROR: The network has no layer" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<DenseLayer*> denseLayers;
+    for(int l=0; l<nbLayers; l++) {
+        DenseLayer* layer = dynamic_cast<DenseLayer*>(network.getLayer(l));
+        if(layer == nullptr) {
+            std::cerr << "ERROR: Only networks made of dense layers can be quantized" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        denseLayers.push_back(layer);
+    }
+
+    // Calibration: absMax[l] is the maximum absolute value seen in the input of the layer l
+    std::vector<float> absMax(nbLayers, 0.0f);
+    TensorArena arena;
+    for(int i=0; i<(int) calibrationSet.size(); i++) {
+        TensorArena::Scope scope(arena);
+        TensorView input = calibrationSet[i]->getData()->unsqueeze(0);
+        absMax[0] = std::max(absMax[0], getAbsMax(input));
+
+        Tensor layerOutput = denseLayers[0]->getOutput(input);
+        for(int l=1; l<nbLayers; l++) {
+            absMax[l] = std::max(absMax[l], getAbsMax(layerOutput));
+            layerOutput = denseLayers[l]->getOutput(layerOutput);
+        }
+    }
+
+    inputScale = QuantizedDenseLayer::getScale(absMax[0]);
+    size_t bufferSize = inputSize;
+    for(int l=0; l<nbLayers; l++) {
+        layers.push_back(new QuantizedDenseLayer(*denseLayers[l], QuantizedDenseLayer::getScale(absMax[l])));
+        bufferSize = std::max(bufferSize, (size_t) layers[l]->getNbNeurons());
+    }
+    buffers[0].resize(bufferSize);
+    buffers[1].resize(bufferSize);
+    outputBuffer.resize(getOutputSize());
+}
+
+/**
+ * Free the memory occupied by the quantized layers
+ */
+QuantizedNeuralNetwork::~QuantizedNeuralNetwork() {
+    for(auto layer : layers) {
+        delete layer;
+    }
+}
+
+/**
+ * Get the number of layers of this network
+ * @return Number of layers
+ */
+int QuantizedNeuralNetwork::getNbLayers() {
+    return (int) layers.size();
+}
+
+/**
+ * Get the size of the output of this network
+ * @return Number of neurons of the last layer
+ */
+int QuantizedNeuralNetwork::getOutputSize() {
+    return layers.back()->getNbNeurons();
+}
+
+/**
+ * Get the memory used by the parameters of this network
+ * @return Number of bytes used by the quantized weights, their scales and the biases
+ */
+size_t QuantizedNeuralNetwork::getNbParameterBytes() {
+    size_t nbBytes = 0;
+    for(auto layer : layers) {
+        nbBytes += layer->getNbParameterBytes();
+    }
+    return nbBytes;
+}
+
+/**
+ * Get the memory used by the parameters of the original fp32 network
+ * @return Number of bytes used by the fp32 weights and biases
+ */
+size_t QuantizedNeuralNetwork::getNbFloatParameterBytes() {
+    size_t nbBytes = 0;
+    for(auto layer : layers) {
+        nbBytes += (size_t) layer->getNbNeurons() * (layer->getNbNeuronsPrevLayer() + 1) * sizeof(float);
+    }
+    return nbBytes;
+}
+
+/**
+ * Get the output of the network for a batch of inputs
+ * @param input Real input of the network (batchSize * inputSize elements)
+ * @param batchSize Number of instances in the batch
+ * @param output Array where the real output of the last layer (batchSize * getOutputSize() elements) is written
+ */
+void QuantizedNeuralNetwork::getBatchOutputInto(const float *input, int batchSize, float *output) {
+    size_t bufferSize = inputSize;
+    for(auto layer : layers) {
+        bufferSize = std::max(bufferSize, (size_t) layer->getNbNeurons());
+    }
+    bufferSize *= batchSize;
+    if(buffers[0].size() < bufferSize) {
+        buffers[0].resize(bufferSize);
+        buffers[1].resize(bufferSize);
+    }
+
+    QuantizedDenseLayer::quantize(input, batchSize * inputSize, inputScale, buffers[0].data());
+
+    int current = 0;
+    for(int l=0; l<getNbLayers(); l++) {
+        if(l == getNbLayers()-1) {
+            layers[l]->forward(buffers[current].data(), batchSize, 1.0f, nullptr, output);
+        } else {
+            layers[l]->forward(buffers[current].data(), batchSize, layers[l+1]->getInputScale(), buffers[1-current].data(), nullptr);
+            current = 1 - current;
+        }
+    }
+}
+
+/**
+ * Get the output of the quantized network for the given input
+ * @param input Input tensor (contiguous)
+ * @return Output tensor
+ */
+Tensor QuantizedNeuralNetwork::evaluate(const TensorView &input) {
+    if(input.size() != inputSize || !input.isContiguous()) {
+        std::cerr << "ERROR: The input must be a contiguous tensor of size " << inputSize << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    Tensor output(2, {1, getOutputSize()});
+    getBatchOutputInto(input.getData(), 1, output.getData());
+    return output;
+}
+
+/**
+ * Predict the label of the given input
+ * @param input Input tensor (contiguous)
+ * @return Label of the input tensor: number between 0 and the size of the last layer - 1, depending on which component of the output was the highest
+ */
+int QuantizedNeuralNetwork::predict(const TensorView &input) {
+    if(input.size() != inputSize || !input.isContiguous()) {
+        std::cerr << "ERROR: The input must be a contiguous tensor of size " << inputSize << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    getBatchOutputInto(input.getData(), 1, outputBuffer.data());
+    int i_max = 0;
+    for(int i=1; i<getOutputSize(); i++) {
+        if(outputBuffer[i] > outputBuffer[i_max])
+            i_max = i;
+    }
+    return i_max;
+}
+
+/**
+ * Get the accuracy of the quantized model for the given test set
+ * @param testSet Test set: list of instances (input and target output)
+ * @return Accuracy (between 0 and 1)
+ */
+float QuantizedNeuralNetwork::getAccuracy(const std::vector<Instance*> &testSet) {
+    int validPredictions = 0;
+    for(int i=0; i<(int) testSet.size(); i++) {
+        if (testSet[i]->isLabel(predict(*(testSet[i]->getData())))) {
+            validPredictions++;
+        }
+    }
+    return ((float)validPredictions/(float)testSet.size());
+}
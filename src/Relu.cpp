@@ -6,39 +6,65 @@
  */
 
 #include "../include/Relu.h"
+#include "../include/VectorMath.h"
 
 /**
- * For all component xi of the input tensor, calculate Relu(xi) and return a tensor that contains the result for each xi
+ * For all component xi of the input tensor, calculate Relu(xi) and write the result for each xi in the output tensor
  * @param input Input tensor whose rank is greater than or equal to 1
  * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
- * @return Tensor of the output of the function for each component of the input tensor
+ * @param output Tensor where the outputs of the function for each component of the input tensor are written. It can be the input tensor itself
  */
 
-Tensor * Relu::getValues(const Tensor &input, int batchSize) {
-    Tensor* output = new Tensor(input.getNDim(), input.getDimSizes());
-    float* outputData = output->getData();
-    float* inputData = input.getData();
-
-    for(int i=0; i<output->size(); i++) {
-        outputData[i] = inputData[i] <= 0 ? 0 : inputData[i];
-    }
-    return output;
+void Relu::getValuesInto(const TensorView &input, int batchSize, TensorView &output) {
+    VectorMath::reluInto(input.getData(), output.getData(), output.size());
 }
 
 /**
- * For all component xi of the input tensor, calculate the derivative dRelu(xi)/dxi and return a tensor that contains the result for each xi
+ * For all component xi of the input tensor, calculate the derivative dRelu(xi)/dxi and write the result for each xi in the output tensor
  * @param input Input tensor whose rank is greater than or equal to 1
  * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
- * @return Tensor of the derivatives of the function for each component of the input tensor
+ * @param output Tensor where the derivatives of the function for each component of the input tensor are written. It can be the input tensor itself
  */
 
-Tensor* Relu::getDerivatives(const Tensor &input, int batchSize) {
-    Tensor* output = new Tensor(input.getNDim(), input.getDimSizes());
-    float* outputData = output->getData();
-    float* inputData = input.getData();
+void Relu::getDerivativesInto(const TensorView &input, int batchSize, TensorView &output) {
+    VectorMath::reluDerivativesInto(input.getData(), output.getData(), output.size());
+}
 
-    for(int i=0; i<output->size() ; i++) {
-        outputData[i] = inputData[i] <= 0 ? 0 : 1;
-    }
-    return output;
+/**
+ * Check if multiplyByDerivativeInPlace() can be used
+ * @return True since the output is positive exactly where the input is positive, so the derivatives are known from the output
+ */
+bool Relu::canMultiplyByDerivativeInPlace() {
+    return true;
+}
+
+/**
+ * For all component gi of the gradient, multiply it by the derivative of the function (1 where the output is positive, 0 elsewhere)
+ * @param gradient Tensor multiplied in place
+ * @param output Outputs of the function, same shape as the gradient
+ * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
+ */
+void Relu::multiplyByDerivativeInPlace(TensorView &gradient, const TensorView &output, int batchSize) {
+    (void) batchSize;
+    VectorMath::multiplyByReluDerivatives(output.getData(), gradient.getData(), gradient.size());
+}
+
+/**
+ * Get the activation that the matrix multiplication epilogue must apply to compute this function
+ * @param activation Set to Gemm::RELU
+ * @param parameter Set to 0 (not used)
+ * @return True since this function can be fused
+ */
+bool Relu::getFusedActivation(Gemm::Activation &activation, float &parameter) {
+    activation = Gemm::RELU;
+    parameter = 0.0f;
+    return true;
+}
+
+/**
+ * Get the name of the function, used to identify it in the model files
+ * @return "Relu"
+ */
+std::string Relu::getName() {
+    return "Relu";
 }
\ No newline at end of file
@@ -0,0 +1,128 @@
+/**
+ * @file RmsProp.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class RmsProp, the RMSProp optimizer
+ * @date 2024-01-28
+ */
+
+#include "../include/RmsProp.h"
+#include "../include/Gemm.h"
+#include <iostream>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RMS_PROP_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * Update the parameters w and the mean s of their squared gradients in a single pass
+ * @param l2 Factor of the weight decay added to the gradient
+ * @param decoupled Factor of the weight decay added to the step
+ */
+static void updateScalar(float learningRate, float l2, float decoupled, float decay, float epsilon, float* w, const float* g, float* s, int begin, int end) {
+    for(int k=begin; k<end; k++) {
+        float gradient = g[k] + l2 * w[k];
+        s[k] = decay * s[k] + (1.0f - decay) * (gradient * gradient);
+        float step = gradient / (std::sqrt(s[k]) + epsilon);
+        w[k] -= learningRate * (step + decoupled * w[k]);
+    }
+}
+
+#ifdef RMS_PROP_X86
+
+/**
+ * AVX2 version of updateScalar(). No FMA is used so that the result is the same as the scalar version
+ */
+__attribute__((target("avx2")))
+static void updateAvx2(float learningRate, float l2, float decoupled, float decay, float epsilon, float* w, const float* g, float* s, int begin, int end) {
+    __m256 lr = _mm256_set1_ps(learningRate);
+    __m256 l2Decay = _mm256_set1_ps(l2);
+    __m256 decoupledDecay = _mm256_set1_ps(decoupled);
+    __m256 rho = _mm256_set1_ps(decay);
+    __m256 oneMinusRho = _mm256_set1_ps(1.0f - decay);
+    __m256 eps = _mm256_set1_ps(epsilon);
+    int k = begin;
+    for(; k+8<=end; k+=8) {
+        __m256 wk = _mm256_loadu_ps(w + k);
+        __m256 gradient = _mm256_add_ps(_mm256_loadu_ps(g + k), _mm256_mul_ps(l2Decay, wk));
+        __m256 sk = _mm256_add_ps(_mm256_mul_ps(rho, _mm256_loadu_ps(s + k)), _mm256_mul_ps(oneMinusRho, _mm256_mul_ps(gradient, gradient)));
+        _mm256_storeu_ps(s + k, sk);
+        __m256 step = _mm256_div_ps(gradient, _mm256_add_ps(_mm256_sqrt_ps(sk), eps));
+        step = _mm256_add_ps(step, _mm256_mul_ps(decoupledDecay, wk));
+        _mm256_storeu_ps(w + k, _mm256_sub_ps(wk, _mm256_mul_ps(lr, step)));
+    }
+    updateScalar(learningRate, l2, decoupled, decay, epsilon, w, g, s, k, end);
+}
+
+#endif
+
+/**
+ * Create a RMSProp optimizer
+ * @param decay Decay rate of the mean of the squared gradients, in [0, 1)
+ * @param epsilon Value added to the denominator to avoid dividing by 0
+ * @param weightDecay Factor of the weight decay
+ * @param decoupledWeightDecay True if the weight decay is decoupled from the gradient, false if it's an L2 penalty added to the gradient
+ */
+RmsProp::RmsProp(float decay, float epsilon, float weightDecay, bool decoupledWeightDecay) : Optimizer(weightDecay, decoupledWeightDecay), decay(decay), epsilon(epsilon) {
+    if(decay < 0.0f || decay >= 1.0f) {
+        std::cerr << "ERROR: The decay rate of RMSProp must be in [0, 1)" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Update the parameters of the range [begin, end) of an array
+ * @param learningRate Learning rate
+ * @param weightDecay Factor of the weight decay applied to these parameters
+ * @param parameters Parameters updated
+ * @param gradients Gradients of the parameters
+ * @param state Mean of the squared gradients of each parameter
+ * @param size Number of parameters of the array
+ * @param begin First parameter updated
+ * @param end Parameter after the last one updated
+ */
+void RmsProp::updateRange(float learningRate, float weightDecay, float* parameters, const float* gradients, float* state, int size, int begin, int end) {
+    (void) size;
+    float l2 = decoupledWeightDecay ? 0.0f : weightDecay;
+    float decoupled = decoupledWeightDecay ? weightDecay : 0.0f;
+#ifdef RMS_PROP_X86
+    if(Gemm::getIsa() >= Gemm::AVX2) {
+        updateAvx2(learningRate, l2, decoupled, decay, epsilon, parameters, gradients, state, begin, end);
+        return;
+    }
+#endif
+    updateScalar(learningRate, l2, decoupled, decay, epsilon, parameters, gradients, state, begin, end);
+}
+
+/**
+ * Get the decay rate of the mean of the squared gradients
+ * @return Decay rate
+ */
+float RmsProp::getDecay() const {
+    return decay;
+}
+
+/**
+ * Get the value added to the denominator of the step
+ * @return Epsilon
+ */
+float RmsProp::getEpsilon() const {
+    return epsilon;
+}
+
+/**
+ * Get the number of values of the state of the optimizer for each parameter
+ * @return 1 (mean of the squared gradients)
+ */
+int RmsProp::getNbStateValues() const {
+    return 1;
+}
+
+/**
+ * Get the name of the optimizer
+ * @return Name
+ */
+std::string RmsProp::getName() const {
+    return "RMSProp";
+}
@@ -0,0 +1,162 @@
+/**
+ * @file Sgd.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class Sgd, the stochastic gradient descent with momentum
+ * @date 2024-01-28
+ */
+
+#include "../include/Sgd.h"
+#include "../include/Gemm.h"
+#include <iostream>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SGD_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * Update the parameters without momentum: w -= learningRate * (g + weightDecay * w)
+ * @remark The weight decay is the same whether it's decoupled or not
+ */
+static void updatePlainScalar(float learningRate, float weightDecay, float* w, const float* g, int begin, int end) {
+    for(int k=begin; k<end; k++) {
+        w[k] -= learningRate * (g[k] + weightDecay * w[k]);
+    }
+}
+
+/**
+ * Update the parameters and their velocity v with the momentum
+ * @param l2 Factor of the weight decay added to the gradient
+ * @param decoupled Factor of the weight decay added to the step
+ */
+static void updateMomentumScalar(float learningRate, float l2, float decoupled, float momentum, bool nesterov, float* w, const float* g, float* v, int begin, int end) {
+    for(int k=begin; k<end; k++) {
+        float gradient = g[k] + l2 * w[k];
+        v[k] = momentum * v[k] + gradient;
+        float step = nesterov ? gradient + momentum * v[k] : v[k];
+        w[k] -= learningRate * (step + decoupled * w[k]);
+    }
+}
+
+#ifdef SGD_X86
+
+/**
+ * AVX2 version of updatePlainScalar(). No FMA is used so that the result is the same as the scalar version
+ */
+__attribute__((target("avx2")))
+static void updatePlainAvx2(float learningRate, float weightDecay, float* w, const float* g, int begin, int end) {
+    __m256 lr = _mm256_set1_ps(learningRate);
+    __m256 wd = _mm256_set1_ps(weightDecay);
+    int k = begin;
+    for(; k+8<=end; k+=8) {
+        __m256 wk = _mm256_loadu_ps(w + k);
+        __m256 step = _mm256_add_ps(_mm256_loadu_ps(g + k), _mm256_mul_ps(wd, wk));
+        _mm256_storeu_ps(w + k, _mm256_sub_ps(wk, _mm256_mul_ps(lr, step)));
+    }
+    updatePlainScalar(learningRate, weightDecay, w, g, k, end);
+}
+
+/**
+ * AVX2 version of updateMomentumScalar(). No FMA is used so that the result is the same as the scalar version
+ */
+__attribute__((target("avx2")))
+static void updateMomentumAvx2(float learningRate, float l2, float decoupled, float momentum, bool nesterov, float* w, const float* g, float* v, int begin, int end) {
+    __m256 lr = _mm256_set1_ps(learningRate);
+    __m256 l2Decay = _mm256_set1_ps(l2);
+    __m256 decoupledDecay = _mm256_set1_ps(decoupled);
+    __m256 mu = _mm256_set1_ps(momentum);
+    int k = begin;
+    for(; k+8<=end; k+=8) {
+        __m256 wk = _mm256_loadu_ps(w + k);
+        __m256 gradient = _mm256_add_ps(_mm256_loadu_ps(g + k), _mm256_mul_ps(l2Decay, wk));
+        __m256 vk = _mm256_add_ps(_mm256_mul_ps(mu, _mm256_loadu_ps(v + k)), gradient);
+        _mm256_storeu_ps(v + k, vk);
+        __m256 step = nesterov ? _mm256_add_ps(gradient, _mm256_mul_ps(mu, vk)) : vk;
+        step = _mm256_add_ps(step, _mm256_mul_ps(decoupledDecay, wk));
+        _mm256_storeu_ps(w + k, _mm256_sub_ps(wk, _mm256_mul_ps(lr, step)));
+    }
+    updateMomentumScalar(learningRate, l2, decoupled, momentum, nesterov, w, g, v, k, end);
+}
+
+#endif
+
+/**
+ * Create a stochastic gradient descent optimizer
+ * @param momentum Factor applied to the velocity at each step, between 0 and 1 (0 for the plain gradient descent, which has no state)
+ * @param nesterov True to use the Nesterov momentum
+ * @param weightDecay Factor of the weight decay
+ * @param decoupledWeightDecay True if the weight decay is decoupled from the gradient, false if it's an L2 penalty added to the gradient (and so to the velocity)
+ */
+Sgd::Sgd(float momentum, bool nesterov, float weightDecay, bool decoupledWeightDecay) : Optimizer(weightDecay, decoupledWeightDecay), momentum(momentum), nesterov(nesterov) {
+    if(momentum < 0.0f || momentum >= 1.0f) {
+        std::cerr << "ERROR: The momentum must be in [0, 1)" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Update the parameters of the range [begin, end) of an array
+ * @param learningRate Learning rate
+ * @param weightDecay Factor of the weight decay applied to these parameters
+ * @param parameters Parameters updated
+ * @param gradients Gradients of the parameters
+ * @param state Velocity of each parameter (unused without momentum)
+ * @param size Number of parameters of the array
+ * @param begin First parameter updated
+ * @param end Parameter after the last one updated
+ */
+void Sgd::updateRange(float learningRate, float weightDecay, float* parameters, const float* gradients, float* state, int size, int begin, int end) {
+    (void) size;
+    if(momentum == 0.0f) {
+#ifdef SGD_X86
+        if(Gemm::getIsa() >= Gemm::AVX2) {
+            updatePlainAvx2(learningRate, weightDecay, parameters, gradients, begin, end);
+            return;
+        }
+#endif
+        updatePlainScalar(learningRate, weightDecay, parameters, gradients, begin, end);
+        return;
+    }
+
+    float l2 = decoupledWeightDecay ? 0.0f : weightDecay;
+    float decoupled = decoupledWeightDecay ? weightDecay : 0.0f;
+#ifdef SGD_X86
+    if(Gemm::getIsa() >= Gemm::AVX2) {
+        updateMomentumAvx2(learningRate, l2, decoupled, momentum, nesterov, parameters, gradients, state, begin, end);
+        return;
+    }
+#endif
+    updateMomentumScalar(learningRate, l2, decoupled, momentum, nesterov, parameters, gradients, state, begin, end);
+}
+
+/**
+ * Get the momentum
+ * @return Factor applied to the velocity at each step
+ */
+float Sgd::getMomentum() const {
+    return momentum;
+}
+
+/**
+ * Check if the Nesterov momentum is used
+ * @return True if it's the Nesterov momentum, false if it's the classical one
+ */
+bool Sgd::isNesterov() const {
+    return nesterov;
+}
+
+/**
+ * Get the number of values of the state of the optimizer for each parameter
+ * @return 1 (velocity) with momentum, 0 otherwise
+ */
+int Sgd::getNbStateValues() const {
+    return momentum == 0.0f ? 0 : 1;
+}
+
+/**
+ * Get the name of the optimizer
+ * @return Name
+ */
+std::string Sgd::getName() const {
+    return nesterov ? "SGD (Nesterov)" : "SGD";
+}
@@ -6,39 +6,67 @@
  */
 
 #include "../include/Sigmoid.h"
-#include <cmath>
+#include "../include/VectorMath.h"
 
 /**
- * For all component xi of the input tensor, calculate Sigmoid(xi) and return a tensor that contains the result for each xi
+ * For all component xi of the input tensor, calculate Sigmoid(xi) and write the result for each xi in the output tensor
  * @param input Input tensor whose rank is greater than or equal to 1
  * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
- * @return Tensor of the output of the function for each component of the input tensor
+ * @param output Tensor where the outputs of the function for each component of the input tensor are written. It can be the input tensor itself
  */
 
-Tensor * Sigmoid::getValues(const Tensor &input, int batchSize) {
-    Tensor* output = new Tensor(input.getNDim(), input.getDimSizes());
-    float* outputData = output->getData();
-    float* inputData = input.getData();
-
-    for(int i=0; i<input.size() * input.getDimSizes()[0]; i++) {
-        outputData[i] = 1.0f / (1 + exp(-inputData[i]));
-    }
-    return output;
+void Sigmoid::getValuesInto(const TensorView &input, int batchSize, TensorView &output) {
+    VectorMath::sigmoidInto(input.getData(), output.getData(), input.size());
 }
 
 /**
- * For all component xi of the input tensor, calculate the derivative dSigmoid(xi)/dxi and return a tensor that contains the result for each xi.
+ * For all component xi of the input tensor, calculate the derivative dSigmoid(xi)/dxi and write the result for each xi in the output tensor.
  * @param input Input tensor whose rank is greater than or equal to 1
  * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
- * @return Tensor of the derivatives of the function for each component of the input tensor
+ * @param output Tensor where the derivatives of the function for each component of the input tensor are written. It can be the input tensor itself
  */
 
-Tensor* Sigmoid::getDerivatives(const Tensor &input, int batchSize) {
-    Tensor* output = getValues(input, batchSize);
-    float* outputData = output->getData();
+void Sigmoid::getDerivativesInto(const TensorView &input, int batchSize, TensorView &output) {
+    // Sigmoid'(x) = Sigmoid(x) * (1 - Sigmoid(x)), computed from the outputs
+    getValuesInto(input, batchSize, output);
+    VectorMath::sigmoidDerivativesInto(output.getData(), output.getData(), input.size());
+}
 
-    for(int i=0; i<input.size(); i++) {
-        outputData[i] = outputData[i]*(1-outputData[1]);
-    }
-    return output;
+/**
+ * Check if multiplyByDerivativeInPlace() can be used
+ * @return True since the derivatives y * (1 - y) are computed from the outputs
+ */
+bool Sigmoid::canMultiplyByDerivativeInPlace() {
+    return true;
+}
+
+/**
+ * For all component gi of the gradient, multiply it by the derivative of the function yi * (1 - yi), where yi is the corresponding output
+ * @param gradient Tensor multiplied in place
+ * @param output Outputs of the function, same shape as the gradient
+ * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
+ */
+void Sigmoid::multiplyByDerivativeInPlace(TensorView &gradient, const TensorView &output, int batchSize) {
+    (void) batchSize;
+    VectorMath::multiplyBySigmoidDerivatives(output.getData(), gradient.getData(), gradient.size());
+}
+
+/**
+ * Get the activation that the matrix multiplication epilogue must apply to compute this function
+ * @param activation Set to Gemm::SIGMOID
+ * @param parameter Set to 0 (not used)
+ * @return True since this function can be fused
+ */
+bool Sigmoid::getFusedActivation(Gemm::Activation &activation, float &parameter) {
+    activation = Gemm::SIGMOID;
+    parameter = 0.0f;
+    return true;
+}
+
+/**
+ * Get the name of the function, used to identify it in the model files
+ * @return "Sigmoid"
+ */
+std::string Sigmoid::getName() {
+    return "Sigmoid";
 }
\ No newline at end of file
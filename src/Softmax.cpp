@@ -6,85 +6,80 @@
  */
 
 #include "../include/Softmax.h"
-#include <cmath>
-#include <iostream>
+#include "../include/VectorMath.h"
 
 /**
- * Get the max of abs(xi) for all xi in the input vector. Used to normalized the input of Softmax to avoid overflow
- * @param input Input tensor whose rank is greater than or equal to 1
- * @param size Size of the input vector
- * @return Max of the absolute values
- */
-float Softmax::getAbsMax(float* input, int size) {
-    float max = input[0];
-    for(int i=1; i<size; i++) {
-        float absVal = input[i] < 0 ? -input[i] : input[i];
-        if(max < absVal) {
-            max = absVal;
-        }
-    }
-    return max;
-}
-
-/**
- * For all component xi of the input tensor, calculate Softmax(xi) and return a tensor that contains the result for each xi
+ * For all component xi of the input tensor, calculate Softmax(xi) and write the result for each xi in the output tensor
  * @remark Softmax will be applied on each of the input tensor components. The denominator will be the sum of exp(xi) for all the xi component of the same batch (defined by the first dimension coordinate).
  * @param input Input tensor whose rank is greater than or equal to 1.
  * @param batchSize Size of the batch.
- * @return Tensor of the output of the function for each component of the input tensor
+ * @param output Tensor where the outputs of the function for each component of the input tensor are written. It can be the input tensor itself
  */
-Tensor * Softmax::getValues(const Tensor &input, int batchSize) {
-    // Used to avoid overflow. The output doesn't change because e^(a*x) / (sum e^(a*x)) = (e^a * e^x) / (e^a * sum e^x) = e^x / (sum e^x)
-    // We take 40 because exp(40) < 10^18 < 10^38 = float max value. So, if we have less than 10^20 neurons for the layer then we won't get an overflow
-    // Here the exponent is between -40 and 40 since the "max" is the absolute maximum (max(abs(min),abs(max)))
-    Tensor* output = new Tensor(input.getNDim(), input.getDimSizes());
-    float* outputData = output->getData();
-
-    std::vector<int> coordStart;
-
-    for(int i=0; i<input.getNDim(); i++) {
-        coordStart.push_back(0);
-    }
+void Softmax::getValuesInto(const TensorView &input, int batchSize, TensorView &output) {
+    // The maximum m of the instance is subtracted to avoid overflow. The output doesn't change because e^(x-m) / (sum e^(x-m)) = (e^-m * e^x) / (e^-m * sum e^x) = e^x / (sum e^x)
+    // The exponents are then at most 0, and the sum is at least 1 since it contains e^0
+    float* outputData = output.getData();
 
     int instanceSize = input.size() / batchSize;
-    float* expTemp = new float[instanceSize];
-    int k=0;
-
+    float* dataInstance = input.getData();
+    float* outputInstance = outputData;
 
     for(int b=0; b<batchSize; b++) {
-        coordStart[0] = b;
-        float* dataInstance = input.getStart(coordStart);
-        float factor = 40.0f/getAbsMax(dataInstance, instanceSize);
-        float sumExp = 0.0f;
+        float max = VectorMath::max(dataInstance, instanceSize);
 
-        for(int i=0; i<instanceSize; i++) {
-            expTemp[i] = exp(dataInstance[i]*factor);
-            sumExp += expTemp[i];
-        }
+        // The exponentials are stored in the output and then divided by their sum
+        float sumExp = VectorMath::expInto(dataInstance, outputInstance, instanceSize, 1.0f, max);
+        VectorMath::scale(outputInstance, instanceSize, 1.0f / sumExp);
 
-        for(int i=0; i<instanceSize; i++) {
-            outputData[k] = expTemp[i] / sumExp;
-            k++;
-        }
+        dataInstance += instanceSize;
+        outputInstance += instanceSize;
     }
 
-    delete[] expTemp;
-    return output;
 }
 
 /**
- * For all component xi of the input tensor, calculate the derivative dSoftmax(xi)/dxi and return a tensor that contains the result for each xi. Note here that we don't consider dSoftmax(xi)/dxk i != k to avoid increasing drastically the training time (it might not be a good practice)
+ * For all component xi of the input tensor, calculate the derivative dSoftmax(xi)/dxi and write the result for each xi in the output tensor. Note here that we don't consider dSoftmax(xi)/dxk i != k to avoid increasing drastically the training time (it might not be a good practice). The last layer of a network doesn't use them: its cost derivatives are the exact derivatives of the cross-entropy (see isFusedWithCrossEntropy())
  * @remark The derivative is calculated in such a way that we consider that softmax is applied on each of the input tensor components. The denominator will be the sum of exp(xi) for all the xi component of the same batch (defined by the first dimension coordinate).
  * @param input Input tensor whose rank is greater than or equal to 1
  * @param batchSize Size of the batch.
- * @return Tensor of the derivatives of the function for each component of the input tensor
+ * @param output Tensor where the derivatives of the function for each component of the input tensor are written. It can be the input tensor itself
  */
-Tensor* Softmax::getDerivatives(const Tensor &input, int batchSize) {
-    Tensor* output = getValues(input, batchSize);
-    float* outputData = output->getData();
+void Softmax::getDerivativesInto(const TensorView &input, int batchSize, TensorView &output) {
+    getValuesInto(input, batchSize, output);
+    VectorMath::sigmoidDerivativesInto(output.getData(), output.getData(), input.size());
+}
 
-    for(int i=0; i<input.size(); i++) {
-        outputData[i] *= (1-outputData[i]);
-    }
-    return output;
+/**
+ * Check if multiplyByDerivativeInPlace() can be used
+ * @return True since the derivatives y * (1 - y) are computed from the outputs (see getDerivativesInto())
+ */
+bool Softmax::canMultiplyByDerivativeInPlace() {
+    return true;
+}
+
+/**
+ * For all component gi of the gradient, multiply it by the derivative of the function yi * (1 - yi), where yi is the corresponding output
+ * @param gradient Tensor multiplied in place
+ * @param output Outputs of the function, same shape as the gradient
+ * @param batchSize Size of the batch. It's not used for this function, but it is required by the parent class.
+ */
+void Softmax::multiplyByDerivativeInPlace(TensorView &gradient, const TensorView &output, int batchSize) {
+    (void) batchSize;
+    VectorMath::multiplyBySigmoidDerivatives(output.getData(), gradient.getData(), gradient.size());
+}
+
+/**
+ * Check if the cost is the cross-entropy when this function is used by the last layer
+ * @return True: with the cross-entropy C = -sum t_i log(Softmax(x_i)), dC/dx_i = Softmax(x_i) - t_i, so the cost derivatives are computed in one pass without the derivatives of the function
+ */
+bool Softmax::isFusedWithCrossEntropy() {
+    return true;
+}
+
+/**
+ * Get the name of the function, used to identify it in the model files
+ * @return "Softmax"
+ */
+std::string Softmax::getName() {
+    return "Softmax";
 }
\ No newline at end of file
@@ -0,0 +1,459 @@
+/**
+ * @file SparseMatrix.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class SparseMatrix, a matrix in the compressed sparse row format with the products needed by a pruned dense layer
+ * @date 2024-01-24
+ */
+
+#include "../include/SparseMatrix.h"
+#include "../include/ThreadPool.h"
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPARSE_X86
+#include <immintrin.h>
+#endif
+
+// Below this batch size, the products read the input directly instead of transposing it first
+static const int MIN_TRANSPOSED_BATCH_SIZE = 4;
+
+/**
+ * Compute out = sum over k in [begin, end) of values[k] * x_indices[k], where x_j is the row j of a contiguous matrix having batchSize columns
+ * @param indices Row of x used by each element
+ * @param values Factor of each element
+ * @param begin First element
+ * @param end Element after the last one
+ * @param x Matrix (contiguous, batchSize columns)
+ * @param batchSize Number of columns of x and size of out
+ * @param out Array where the sum is written
+ */
+static void combineRowsScalar(const int* indices, const float* values, int begin, int end, const float* x, int batchSize, float* out) {
+    std::fill(out, out + batchSize, 0.0f);
+    for(int k=begin; k<end; k++) {
+        float v = values[k];
+        const float* xRow = x + (size_t) indices[k] * batchSize;
+        for(int b=0; b<batchSize; b++) {
+            out[b] += v * xRow[b];
+        }
+    }
+}
+
+/**
+ * Dot product of two contiguous arrays
+ * @param x First array
+ * @param y Second array
+ * @param size Size of the arrays
+ * @return Sum of x[b] * y[b]
+ */
+static float dotScalar(const float* x, const float* y, int size) {
+    float acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f, acc3 = 0.0f;
+    int b = 0;
+    for(; b+4<=size; b+=4) {
+        acc0 += x[b] * y[b];
+        acc1 += x[b+1] * y[b+1];
+        acc2 += x[b+2] * y[b+2];
+        acc3 += x[b+3] * y[b+3];
+    }
+    for(; b<size; b++) {
+        acc0 += x[b] * y[b];
+    }
+    return (acc0 + acc1) + (acc2 + acc3);
+}
+
+/**
+ * Compute the sum over k in [begin, end) of values[k] * x[indices[k]]
+ * @param indices Element of x used by each element
+ * @param values Factor of each element
+ * @param begin First element
+ * @param end Element after the last one
+ * @param x Array read at the given indices
+ * @return Weighted sum
+ */
+static float gatherDot(const int* indices, const float* values, int begin, int end, const float* x) {
+    // Several sums so that the additions don't wait for each other
+    float acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f, acc3 = 0.0f;
+    int k = begin;
+    for(; k+4<=end; k+=4) {
+        acc0 += values[k] * x[indices[k]];
+        acc1 += values[k+1] * x[indices[k+1]];
+        acc2 += values[k+2] * x[indices[k+2]];
+        acc3 += values[k+3] * x[indices[k+3]];
+    }
+    for(; k<end; k++) {
+        acc0 += values[k] * x[indices[k]];
+    }
+    return (acc0 + acc1) + (acc2 + acc3);
+}
+
+#ifdef SPARSE_X86
+
+/**
+ * AVX2 version of combineRowsScalar(): the sum of 32 columns is kept in registers while all the elements are read
+ */
+__attribute__((target("avx2,fma")))
+static void combineRowsAvx2(const int* indices, const float* values, int begin, int end, const float* x, int batchSize, float* out) {
+    int b0 = 0;
+    for(; b0+32<=batchSize; b0+=32) {
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+        for(int k=begin; k<end; k++) {
+            __m256 v = _mm256_broadcast_ss(values + k);
+            const float* xRow = x + (size_t) indices[k] * batchSize + b0;
+            acc0 = _mm256_fmadd_ps(v, _mm256_loadu_ps(xRow), acc0);
+            acc1 = _mm256_fmadd_ps(v, _mm256_loadu_ps(xRow + 8), acc1);
+            acc2 = _mm256_fmadd_ps(v, _mm256_loadu_ps(xRow + 16), acc2);
+            acc3 = _mm256_fmadd_ps(v, _mm256_loadu_ps(xRow + 24), acc3);
+        }
+        _mm256_storeu_ps(out + b0, acc0);
+        _mm256_storeu_ps(out + b0 + 8, acc1);
+        _mm256_storeu_ps(out + b0 + 16, acc2);
+        _mm256_storeu_ps(out + b0 + 24, acc3);
+    }
+    for(; b0+8<=batchSize; b0+=8) {
+        __m256 acc = _mm256_setzero_ps();
+        for(int k=begin; k<end; k++) {
+            acc = _mm256_fmadd_ps(_mm256_broadcast_ss(values + k), _mm256_loadu_ps(x + (size_t) indices[k] * batchSize + b0), acc);
+        }
+        _mm256_storeu_ps(out + b0, acc);
+    }
+    for(int b=b0; b<batchSize; b++) {
+        float sum = 0.0f;
+        for(int k=begin; k<end; k++) {
+            sum += values[k] * x[(size_t) indices[k] * batchSize + b];
+        }
+        out[b] = sum;
+    }
+}
+
+/**
+ * AVX2 version of dotScalar()
+ */
+__attribute__((target("avx2,fma")))
+static float dotAvx2(const float* x, const float* y, int size) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int b = 0;
+    for(; b+16<=size; b+=16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + b), _mm256_loadu_ps(y + b), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + b + 8), _mm256_loadu_ps(y + b + 8), acc1);
+    }
+    for(; b+8<=size; b+=8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + b), _mm256_loadu_ps(y + b), acc0);
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    float result = _mm_cvtss_f32(sum);
+    for(; b<size; b++) {
+        result += x[b] * y[b];
+    }
+    return result;
+}
+
+#endif
+
+/**
+ * Get the version of combineRowsScalar() used on this CPU
+ * @return Function computing the weighted sum of rows
+ */
+static void (*getCombineRows())(const int*, const float*, int, int, const float*, int, float*) {
+#ifdef SPARSE_X86
+    if(Gemm::getIsa() >= Gemm::AVX2) {
+        return combineRowsAvx2;
+    }
+#endif
+    return combineRowsScalar;
+}
+
+/**
+ * Get the version of dotScalar() used on this CPU
+ * @return Function computing the dot product
+ */
+static float (*getDot())(const float*, const float*, int) {
+#ifdef SPARSE_X86
+    if(Gemm::getIsa() >= Gemm::AVX2) {
+        return dotAvx2;
+    }
+#endif
+    return dotScalar;
+}
+
+/**
+ * Transpose a block of rows: out[j * nbRows + i] = in[i * ldIn + j]
+ * @param in Input matrix (nbRows x nbCols)
+ * @param ldIn Distance between two rows of the input
+ * @param nbRows Number of rows of the input
+ * @param nbCols Number of columns of the input
+ * @param out Output matrix (nbCols x nbRows, contiguous)
+ */
+static void transpose(const float* in, int ldIn, int nbRows, int nbCols, float* out) {
+    // Done by tiles so that both the reads and the writes stay in the cache
+    const int tileSize = 32;
+    for(int i0=0; i0<nbRows; i0+=tileSize) {
+        int i1 = std::min(nbRows, i0 + tileSize);
+        for(int j0=0; j0<nbCols; j0+=tileSize) {
+            int j1 = std::min(nbCols, j0 + tileSize);
+            for(int i=i0; i<i1; i++) {
+                for(int j=j0; j<j1; j++) {
+                    out[(size_t) j * nbRows + i] = in[(size_t) i * ldIn + j];
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Create a sparse matrix from the non-zero elements of a dense matrix
+ * @param dense Dense matrix (nbRows x nbCols, contiguous)
+ * @param nbRows Number of rows
+ * @param nbCols Number of columns
+ */
+SparseMatrix::SparseMatrix(const float *dense, int nbRows, int nbCols) : nbRows(nbRows), nbCols(nbCols) {
+    rowStarts.reserve(nbRows + 1);
+    rowStarts.push_back(0);
+    for(int i=0; i<nbRows; i++) {
+        const float* row = dense + (size_t) i * nbCols;
+        for(int j=0; j<nbCols; j++) {
+            if(row[j] != 0.0f) {
+                columns.push_back(j);
+                values.push_back(row[j]);
+            }
+        }
+        rowStarts.push_back((int) values.size());
+    }
+
+    // Same elements column by column
+    columnStarts.assign(nbCols + 1, 0);
+    for(int column : columns) {
+        columnStarts[column + 1]++;
+    }
+    for(int j=0; j<nbCols; j++) {
+        columnStarts[j + 1] += columnStarts[j];
+    }
+    rows.resize(values.size());
+    transposedPositions.resize(values.size());
+    transposedValues.resize(values.size());
+    std::vector<int> nextPositions(columnStarts.begin(), columnStarts.end() - 1);
+    for(int i=0; i<nbRows; i++) {
+        for(int k=rowStarts[i]; k<rowStarts[i+1]; k++) {
+            int position = nextPositions[columns[k]]++;
+            rows[position] = i;
+            transposedPositions[position] = k;
+            transposedValues[position] = values[k];
+        }
+    }
+}
+
+/**
+ * Get the number of rows
+ * @return Number of rows
+ */
+int SparseMatrix::getNbRows() const {
+    return nbRows;
+}
+
+/**
+ * Get the number of columns
+ * @return Number of columns
+ */
+int SparseMatrix::getNbCols() const {
+    return nbCols;
+}
+
+/**
+ * Get the number of elements stored
+ * @return Number of non-zero elements
+ */
+int SparseMatrix::getNbNonZeros() const {
+    return (int) values.size();
+}
+
+/**
+ * Get the proportion of non-zero elements
+ * @return Density (between 0 and 1)
+ */
+float SparseMatrix::getDensity() const {
+    return nbRows * nbCols > 0 ? (float) values.size() / ((float) nbRows * nbCols) : 0.0f;
+}
+
+/**
+ * Get the memory needed by the products by S^T (inference)
+ * @remark The copy of the elements column by column, only used by the training, is not counted
+ * @return Number of bytes used by the values, the column indices and the row starts
+ */
+size_t SparseMatrix::getNbBytes() const {
+    return values.size() * (sizeof(float) + sizeof(int)) + rowStarts.size() * sizeof(int);
+}
+
+/**
+ * Copy the values of a dense matrix at the positions of the non-zero elements of this matrix. The other elements of the dense matrix are ignored.
+ * @param dense Dense matrix (nbRows x nbCols, contiguous)
+ */
+void SparseMatrix::updateValues(const float *dense) {
+    for(int i=0; i<nbRows; i++) {
+        const float* row = dense + (size_t) i * nbCols;
+        for(int k=rowStarts[i]; k<rowStarts[i+1]; k++) {
+            values[k] = row[columns[k]];
+        }
+    }
+    for(size_t position=0; position<transposedValues.size(); position++) {
+        transposedValues[position] = values[transposedPositions[position]];
+    }
+}
+
+/**
+ * Compute Y = X * S^T, where S is this matrix. This is the forward pass of a dense layer whose weights are S.
+ * @param x Matrix X (batchSize x getNbCols())
+ * @param ldx Distance between two rows of X
+ * @param batchSize Number of rows of X
+ * @param y Matrix Y (batchSize x getNbRows()) where the result is written
+ * @param ldy Distance between two rows of Y
+ * @param epilogue Bias and activation function applied to Y, nullptr if there is none
+ */
+void SparseMatrix::multiplyByTransposeInto(const float *x, int ldx, int batchSize, float *y, int ldy, const Gemm::Epilogue *epilogue) const {
+    ThreadPool& pool = ThreadPool::getInstance();
+    long workPerRow = 2L * std::max(1, getNbNonZeros() / std::max(1, nbRows)) * batchSize;
+
+    if(batchSize < MIN_TRANSPOSED_BATCH_SIZE) {
+        // y_b,i = sum over the non-zero elements k of the row i of v_k * x_b,col_k
+        pool.parallelFor(nbRows, workPerRow, [&](int begin, int end) {
+            for(int b=0; b<batchSize; b++) {
+                const float* xRow = x + (size_t) b * ldx;
+                float* yRow = y + (size_t) b * ldy;
+                for(int i=begin; i<end; i++) {
+                    yRow[i] = gatherDot(columns.data(), values.data(), rowStarts[i], rowStarts[i+1], xRow);
+                }
+                if(epilogue != nullptr) {
+                    Gemm::applyEpilogue(*epilogue, yRow + begin, ldy, b, begin, 1, end - begin);
+                }
+            }
+        });
+        return;
+    }
+
+    // With X^T, each non-zero element adds a contiguous row of batchSize elements: Y^T_i += v_k * X^T_col_k
+    static thread_local std::vector<float> transposedX;
+    static thread_local std::vector<float> transposedY;
+    transposedX.resize((size_t) nbCols * batchSize);
+    transposedY.resize((size_t) nbRows * batchSize);
+    float* xt = transposedX.data();
+    float* yt = transposedY.data();
+    transpose(x, ldx, batchSize, nbCols, xt);
+
+    auto combineRows = getCombineRows();
+    pool.parallelFor(nbRows, workPerRow, [&](int begin, int end) {
+        for(int i=begin; i<end; i++) {
+            combineRows(columns.data(), values.data(), rowStarts[i], rowStarts[i+1], xt, batchSize, yt + (size_t) i * batchSize);
+        }
+    });
+
+    pool.parallelFor(batchSize, 2L * nbRows, [&](int begin, int end) {
+        for(int b=begin; b<end; b++) {
+            float* yRow = y + (size_t) b * ldy;
+            for(int i=0; i<nbRows; i++) {
+                yRow[i] = yt[(size_t) i * batchSize + b];
+            }
+            if(epilogue != nullptr) {
+                Gemm::applyEpilogue(*epilogue, yRow, ldy, b, 0, 1, nbRows);
+            }
+        }
+    });
+}
+
+/**
+ * Compute Y = X * S, where S is this matrix. This is the propagation of the cost derivatives to the input of a dense layer whose weights are S.
+ * @param x Matrix X (batchSize x getNbRows())
+ * @param ldx Distance between two rows of X
+ * @param batchSize Number of rows of X
+ * @param y Matrix Y (batchSize x getNbCols()) where the result is written
+ * @param ldy Distance between two rows of Y
+ */
+void SparseMatrix::multiplyInto(const float *x, int ldx, int batchSize, float *y, int ldy) const {
+    ThreadPool& pool = ThreadPool::getInstance();
+
+    if(batchSize < MIN_TRANSPOSED_BATCH_SIZE) {
+        // y_b,j = sum over the non-zero elements k of the column j of v_k * x_b,row_k
+        long workPerColumn = 2L * std::max(1, getNbNonZeros() / std::max(1, nbCols)) * batchSize;
+        pool.parallelFor(nbCols, workPerColumn, [&](int begin, int end) {
+            for(int b=0; b<batchSize; b++) {
+                const float* xRow = x + (size_t) b * ldx;
+                float* yRow = y + (size_t) b * ldy;
+                for(int j=begin; j<end; j++) {
+                    yRow[j] = gatherDot(rows.data(), transposedValues.data(), columnStarts[j], columnStarts[j+1], xRow);
+                }
+            }
+        });
+        return;
+    }
+
+    // Y^T = S^T * X^T, computed like multiplyByTransposeInto() with the elements stored column by column
+    static thread_local std::vector<float> transposedX;
+    static thread_local std::vector<float> transposedY;
+    transposedX.resize((size_t) nbRows * batchSize);
+    transposedY.resize((size_t) nbCols * batchSize);
+    float* xt = transposedX.data();
+    float* yt = transposedY.data();
+    transpose(x, ldx, batchSize, nbRows, xt);
+
+    auto combineRows = getCombineRows();
+    long workPerColumn = 2L * std::max(1, getNbNonZeros() / std::max(1, nbCols)) * batchSize;
+    pool.parallelFor(nbCols, workPerColumn, [&](int begin, int end) {
+        for(int j=begin; j<end; j++) {
+            combineRows(rows.data(), transposedValues.data(), columnStarts[j], columnStarts[j+1], xt, batchSize, yt + (size_t) j * batchSize);
+        }
+    });
+
+    pool.parallelFor(batchSize, 2L * nbCols, [&](int begin, int end) {
+        for(int b=begin; b<end; b++) {
+            float* yRow = y + (size_t) b * ldy;
+            for(int j=0; j<nbCols; j++) {
+                yRow[j] = yt[(size_t) j * batchSize + b];
+            }
+        }
+    });
+}
+
+/**
+ * Compute alpha * D^T * X only at the positions of the non-zero elements of this matrix and write it in a dense matrix. This is the gradient of the weights of a pruned dense layer: the pruned weights have no gradient.
+ * @param d Matrix D (batchSize x getNbRows()), the derivatives of the cost in respect for the output of the layer
+ * @param ldd Distance between two rows of D
+ * @param x Matrix X (batchSize x getNbCols()), the input of the layer
+ * @param ldx Distance between two rows of X
+ * @param batchSize Number of rows of D and X
+ * @param alpha Factor applied to the product
+ * @param gradients Dense matrix (getNbRows() x getNbCols(), contiguous) where the elements are written. The elements that are zero in this matrix are set to 0
+ * @param accumulate True to add the elements to the values already in the gradients (the elements that are zero in this matrix are left unchanged), false to overwrite them
+ */
+void SparseMatrix::getProductGradientsInto(const float *d, int ldd, const float *x, int ldx, int batchSize, float alpha, float *gradients, bool accumulate) const {
+    // With D^T and X^T, each element is the dot product of two contiguous rows of batchSize elements
+    static thread_local std::vector<float> transposedD;
+    static thread_local std::vector<float> transposedX;
+    transposedD.resize((size_t) nbRows * batchSize);
+    transposedX.resize((size_t) nbCols * batchSize);
+    float* dt = transposedD.data();
+    float* xt = transposedX.data();
+    transpose(d, ldd, batchSize, nbRows, dt);
+    transpose(x, ldx, batchSize, nbCols, xt);
+
+    auto dot = getDot();
+    long workPerRow = 2L * std::max(1, getNbNonZeros() / std::max(1, nbRows)) * batchSize;
+    ThreadPool::getInstance().parallelFor(nbRows, workPerRow, [&](int begin, int end) {
+        for(int i=begin; i<end; i++) {
+            const float* dtRow = dt + (size_t) i * batchSize;
+            float* gradientsRow = gradients + (size_t) i * nbCols;
+            if(accumulate) {
+                for(int k=rowStarts[i]; k<rowStarts[i+1]; k++) {
+                    gradientsRow[columns[k]] += alpha * dot(dtRow, xt + (size_t) columns[k] * batchSize, batchSize);
+                }
+                continue;
+            }
+            std::fill(gradientsRow, gradientsRow + nbCols, 0.0f);
+            for(int k=rowStarts[i]; k<rowStarts[i+1]; k++) {
+                gradientsRow[columns[k]] = alpha * dot(dtRow, xt + (size_t) columns[k] * batchSize, batchSize);
+            }
+        }
+    });
+}
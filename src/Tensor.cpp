@@ -6,6 +6,7 @@
  */
 
 #include "../include/Tensor.h"
+#include "../include/TensorArena.h"
 #include <iostream>
 
 /**
@@ -13,33 +14,78 @@
  * @param nDim Number of dimensions
  * @param dimSizes List of dimension sizes
  */
-Tensor::Tensor(int nDim, const std::vector<int> &dimSizes) : nDim(nDim), dimSizes(dimSizes) {
-    strides = new int[nDim];
-
-    if(nDim != dimSizes.size()) {
+Tensor::Tensor(int nDim, const std::vector<int> &dimSizes) : TensorView((int) dimSizes.size(), dimSizes.data()), isDataInArena(false) {
+    if(nDim != (int) dimSizes.size()) {
         std::cerr << "ERROR: The provided number of dimensions does not match with the size of the dimension sizes array" << std::endl;
         exit(EXIT_FAILURE);
     }
+    allocateData();
+}
 
-    int stepSize = 1;
-    for(int i=nDim-1; i>=0; i--) {
-        strides[i] = stepSize;
-        stepSize *= dimSizes[i];
+/**
+ * Create a tensor from a shape and allocate memory for the data without initializing its values. This is used with a list literal, e.g. Tensor(2, {batchSize, size}), so that no std::vector is created
+ * @param nDim Number of dimensions
+ * @param dimSizes List of dimension sizes
+ */
+Tensor::Tensor(int nDim, std::initializer_list<int> dimSizes) : TensorView((int) dimSizes.size(), dimSizes.begin()), isDataInArena(false) {
+    if(nDim != (int) dimSizes.size()) {
+        std::cerr << "ERROR: The provided number of dimensions does not match with the size of the dimension sizes array" << std::endl;
+        exit(EXIT_FAILURE);
     }
+    allocateData();
+}
+
+/**
+ * Create a tensor from a shape and allocate memory for the data without initializing its values. This is used to create a tensor with the shape of another one, e.g. Tensor(input.getNDim(), input.getShape())
+ * @param nDim Number of dimensions
+ * @param dimSizes Array of the nDim dimension sizes
+ */
+Tensor::Tensor(int nDim, const int *dimSizes) : TensorView(nDim, dimSizes), isDataInArena(false) {
+    allocateData();
+}
 
-    data = new float[stepSize]; // Here stepSize = product of all dim sizes
+/**
+ * Allocate the data of the tensor, in the current arena if there is one or on the heap otherwise
+ */
+void Tensor::allocateData() {
+    data = static_cast<float*>(TensorArena::allocateTensorMemory(size() * sizeof(float), isDataInArena));
 }
 
 /**
  * Create a tensor by copying another one
  * @param copy Tensor copied
  */
-Tensor::Tensor(Tensor const& copy) : Tensor(copy.getNDim(), copy.getDimSizes()){
+Tensor::Tensor(Tensor const& copy) : Tensor(copy.getNDim(), copy.getShape()){
     for(int i=0; i<copy.size(); i++) {
         data[i] = copy.data[i];
     }
 }
 
+/**
+ * Create a tensor by moving the data of another one. No data is copied.
+ * @param other Tensor moved. It has no data afterwards so it must not be used until a tensor is assigned to it
+ */
+Tensor::Tensor(Tensor &&other) noexcept : TensorView(std::move(other)), isDataInArena(other.isDataInArena) {
+    other.data = nullptr;
+    other.isDataInArena = false;
+}
+
+/**
+ * Create a tensor by copying the data seen by a view
+ * @param view View whose shape and data are copied
+ */
+Tensor::Tensor(TensorView const& view) : Tensor(view.getNDim(), view.getShape()) {
+    if(!view.isContiguous()) {
+        std::cerr << "ERROR: Only contiguous views can be copied to a tensor" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    float* viewData = view.getData();
+    for(int i=0; i<size(); i++) {
+        data[i] = viewData[i];
+    }
+}
+
 /**
  * Create a tensor from its shape and with initial data
  * @remark You can delete the data after since we copy it in this function. The size of the initData must match with the shape of the tensor
@@ -62,127 +108,78 @@ Tensor::Tensor(int nDim, const std::vector<int> &dimSizes, const float *initData
  * Free the memory allocated for the tensor
  */
 Tensor::~Tensor() {
-    delete[] data;
-    delete[] strides;
+    TensorArena::freeTensorMemory(data, isDataInArena);
 }
 
 /**
- * Get the index of an element in the tensor from its coordinates
- * @param coord Coordinates of the element (one int per dimension)
- * @return Index of the element in the flattened representation of the tensor
+ * Replace the shape and the data of this tensor by a copy of another tensor. The memory is reused if the sizes match
+ * @param copy Tensor copied
+ * @return This tensor
  */
-int Tensor::getIndex(const std::vector<int>& coord) const {
-    if(getNDim() != coord.size()) {
-        std::cerr << "ERROR: The provided coordinates are not in the dimension of the tensor" << std::endl;
-        exit(EXIT_FAILURE);
+Tensor& Tensor::operator=(Tensor const& copy) {
+    if(this == &copy) {
+        return *this;
     }
 
-    int index = 0;
-    for(int i=0; i<getNDim(); i++) {
-        if(coord[i] >= getDimSize(i)) {
-            std::cerr << "ERROR: One of the provided coordinates is out of bound (check the tensor shape) for the coord " << i << " :  " << getDimSize(i) << " >= " << getDimSize(i) << std::endl;
-            exit(EXIT_FAILURE);
-        }
-        index += coord[i] * strides[i];
-    }
-
-    return index;
-}
-
-/**
- * Get an element from its coordinates
- * @param coord Coordinates of the element (one int per dimension)
- * @return Element at the given coordinates
- */
-float Tensor::get(const std::vector<int>& coord) const {
-    int i = getIndex(coord);
-    return data[i];
-}
-
-/**
- * Get a pointer that points to the element at the given coordinates.
- * @param coordStart Coordinates of the element (one int per dimension) where the returned pointers points to
- * @return Pointer that points to the element whose coordinates are given
- */
-float* Tensor::getStart(const std::vector<int> &coordStart) const {
-    int i = getIndex(coordStart);
-    return &(data[i]);
-}
+    float* oldData = data;
+    bool wasDataInArena = isDataInArena;
+    int oldSize = oldData == nullptr ? -1 : size();
 
-/**
- * Set the value of the at the given coordinates
- * @param coord Coordinates of the element (one int per dimension)
- * @param newValue New value of the element
-*/
-void Tensor::set(const std::vector<int>& coord, float newValue) {
-    int i = getIndex(coord);
-    float a = strides[0];
-    float b = -1;
-    if(coord.size()>1)
-        b = strides[1];
-    data[i] = newValue;
-}
+    TensorView::operator=(copy); // The shape is copied (and the data pointer of the copy, which is replaced below)
 
-/**
- * Get the number of dimensions of this tensor
- * @return Number of dimensions
- */
-int Tensor::getNDim() const {
-    return nDim;
-}
-
-/**
- * Get the list of the dimension sizes
- * @return List of dimension sizes
- */
-std::vector<int> Tensor::getDimSizes() const {
-    return dimSizes;
-}
+    if(oldSize == size()) {
+        data = oldData;
+        isDataInArena = wasDataInArena;
+    } else {
+        TensorArena::freeTensorMemory(oldData, wasDataInArena);
+        allocateData();
+    }
 
-/**
- * Get a pointer to the (flattened) data of this tensor
- * @remark You can use it to read and edit the data of the tensor. But you must NOT delete it.
- * @return Data of this tensor (pointer pointing the first element)
- */
-float * Tensor::getData() const {
-    return data;
+    for(int i=0; i<size(); i++) {
+        data[i] = copy.data[i];
+    }
+    return *this;
 }
 
 /**
- * Get a text representation of the tensor (flatten list of elements)
- * @return String representing the tensor
+ * Replace the shape and the data of this tensor by the ones of another tensor. No data is copied.
+ * @param other Tensor moved. It has no data afterwards so it must not be used until a tensor is assigned to it
+ * @return This tensor
  */
-std::string Tensor::toString() {
-    float* data = getData();
-    std::string s;
-    for(int i=0; i<size(); i++) {
-        s.append(std::to_string(data[i]));
-        s.append(" ");
+Tensor& Tensor::operator=(Tensor&& other) noexcept {
+    if(this == &other) {
+        return *this;
     }
-    return s;
+
+    TensorArena::freeTensorMemory(data, isDataInArena);
+    TensorView::operator=(std::move(other));
+    isDataInArena = other.isDataInArena;
+    other.data = nullptr;
+    other.isDataInArena = false;
+    return *this;
 }
 
 /**
- * Get the size of the tensor (product of the sizes of all the dimensions)
- * @return Size of the tensor
+ * Allocate a tensor created with new, in the current arena if there is one or on the heap otherwise
+ * @remark A header of TensorArena::ALIGNMENT bytes stores where the tensor was allocated, so that it can be deleted even when its arena is not current anymore
+ * @param size Size of the tensor object
+ * @return Pointer to the memory of the tensor object
  */
-int Tensor::size() const {
-    int size = 1;
-    for(int i=0; i<getNDim(); i++) {
-        size *= getDimSize(i);
-    }
-    return size;
+void* Tensor::operator new(size_t size) {
+    bool isInArena;
+    char* memory = static_cast<char*>(TensorArena::allocateTensorMemory(size + TensorArena::ALIGNMENT, isInArena));
+    memory[0] = isInArena;
+    return memory + TensorArena::ALIGNMENT;
 }
 
 /**
- * Get the size of a dimension from its index
- * @param i Index of the dimension
- * @return Size of the dimension
+ * Free a tensor allocated with new. Nothing is done if it is in an arena
+ * @param ptr Pointer to the memory of the tensor object
  */
-int Tensor::getDimSize(int i) const {
-    if(i<0 || i>=getNDim()) {
-        std::cerr << "ERROR: dimension out of bound in getDimSize" << std::endl;
-        exit(EXIT_FAILURE);
+void Tensor::operator delete(void *ptr) {
+    if(ptr == nullptr) {
+        return;
     }
-    return dimSizes[i];
+    char* memory = static_cast<char*>(ptr) - TensorArena::ALIGNMENT;
+    TensorArena::freeTensorMemory(memory, memory[0]);
 }
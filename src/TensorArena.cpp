@@ -0,0 +1,170 @@
+/**
+ * @file TensorArena.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class TensorArena, a bump allocator used to avoid calling malloc for every temporary tensor of a training step
+ * @date 2024-01-15
+ */
+
+#include "../include/TensorArena.h"
+#include <new>
+#include <algorithm>
+
+thread_local TensorArena* TensorArena::current = nullptr;
+std::atomic<long> TensorArena::nbHeapAllocations(0);
+
+/**
+ * Create an empty arena. No memory is reserved until the first allocation.
+ * @param minBlockSize Minimum size in bytes of the blocks reserved by the arena
+ */
+TensorArena::TensorArena(size_t minBlockSize) : currentBlock(0), offset(0), nbBytesUsed(0), minBlockSize(minBlockSize), stats({0, 0, 0, 0, 0}) {}
+
+/**
+ * Free all the memory reserved by the arena
+ */
+TensorArena::~TensorArena() {
+    if(current == this) {
+        current = nullptr;
+    }
+    releaseBlocks();
+}
+
+/**
+ * Reserve a new block on the heap and append it to the list of blocks
+ * @param capacity Size of the block in bytes
+ */
+void TensorArena::addBlock(size_t capacity) {
+    Block block;
+    block.data = static_cast<char*>(::operator new(capacity, std::align_val_t(ALIGNMENT)));
+    block.capacity = capacity;
+    blocks.push_back(block);
+    stats.nbBlockAllocations++;
+    stats.capacity += capacity;
+}
+
+/**
+ * Free all the blocks of the arena
+ */
+void TensorArena::releaseBlocks() {
+    for(auto &block : blocks) {
+        ::operator delete(block.data, std::align_val_t(ALIGNMENT));
+    }
+    blocks.clear();
+    stats.capacity = 0;
+}
+
+/**
+ * Allocate memory in the arena. It's only freed when the arena is reset or deleted.
+ * @param nbBytes Number of bytes allocated
+ * @return Pointer to the allocated memory, aligned on ALIGNMENT bytes
+ */
+void* TensorArena::allocate(size_t nbBytes) {
+    // Round up so that the next allocation is aligned too
+    size_t alignedSize = (std::max(nbBytes, (size_t) 1) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+    while(currentBlock < (int) blocks.size() && offset + alignedSize > blocks[currentBlock].capacity) {
+        currentBlock++;
+        offset = 0;
+    }
+    if(currentBlock == (int) blocks.size()) {
+        addBlock(std::max(alignedSize, minBlockSize));
+    }
+
+    void* ptr = blocks[currentBlock].data + offset;
+    offset += alignedSize;
+    nbBytesUsed += alignedSize;
+
+    stats.nbAllocations++;
+    stats.peakBytes = std::max(stats.peakBytes, nbBytesUsed);
+    return ptr;
+}
+
+/**
+ * Free all the allocations at once. The memory is kept for the next allocations.
+ * @remark If the arena needed several blocks, they are merged in one block large enough for all of them, so the arena stops allocating memory once it has seen its largest use
+ */
+void TensorArena::reset() {
+    if(blocks.size() > 1) {
+        size_t totalCapacity = stats.capacity;
+        releaseBlocks();
+        addBlock(totalCapacity);
+    }
+    currentBlock = 0;
+    offset = 0;
+    nbBytesUsed = 0;
+    stats.nbResets++;
+}
+
+/**
+ * Get the number of bytes allocated since the last reset
+ * @return Number of bytes used (including the padding)
+ */
+size_t TensorArena::getNbBytesUsed() const {
+    return nbBytesUsed;
+}
+
+/**
+ * Get the counters of this arena
+ * @return Counters of this arena
+ */
+TensorArena::Stats TensorArena::getStats() const {
+    return stats;
+}
+
+/**
+ * Get the arena currently used by the tensors created on this thread
+ * @return Current arena or nullptr if no arena is active
+ */
+TensorArena* TensorArena::getCurrent() {
+    return current;
+}
+
+/**
+ * Allocate memory for a tensor (its data or the tensor itself). It's taken from the current arena if there is one, otherwise from the heap.
+ * @param nbBytes Number of bytes allocated
+ * @param isInArena Set to true if the memory was taken from an arena. It must be given to freeTensorMemory()
+ * @return Pointer to the allocated memory, aligned on ALIGNMENT bytes
+ */
+void* TensorArena::allocateTensorMemory(size_t nbBytes, bool &isInArena) {
+    if(current != nullptr) {
+        isInArena = true;
+        return current->allocate(nbBytes);
+    }
+    isInArena = false;
+    nbHeapAllocations++;
+    return ::operator new(std::max(nbBytes, (size_t) 1), std::align_val_t(ALIGNMENT));
+}
+
+/**
+ * Free memory allocated with allocateTensorMemory(). Nothing is done if it is in an arena, it will be freed when the arena is reset.
+ * @param ptr Pointer to the memory freed
+ * @param isInArena Value given by allocateTensorMemory() when ptr was allocated
+ */
+void TensorArena::freeTensorMemory(void *ptr, bool isInArena) {
+    if(!isInArena && ptr != nullptr) {
+        ::operator delete(ptr, std::align_val_t(ALIGNMENT));
+    }
+}
+
+/**
+ * Get the number of tensor allocations done on the heap (on all threads) because there was no arena
+ * @return Number of heap allocations
+ */
+long TensorArena::getNbHeapAllocations() {
+    return nbHeapAllocations;
+}
+
+/**
+ * Reset the arena and make it the current arena of this thread
+ * @param arena Arena used by the tensors created in this scope
+ */
+TensorArena::Scope::Scope(TensorArena &arena) : previous(current) {
+    arena.reset();
+    current = &arena;
+}
+
+/**
+ * Restore the arena that was current before this scope
+ */
+TensorArena::Scope::~Scope() {
+    current = previous;
+}
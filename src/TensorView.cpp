@@ -0,0 +1,295 @@
+/**
+ * @file TensorView.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class TensorView. A view gives a shape to data it does not own, so that reshaping or slicing a tensor does not copy it
+ * @date 2024-01-14
+ */
+
+#include "../include/TensorView.h"
+#include <iostream>
+
+/**
+ * Create a view from a shape with contiguous (row-major) strides. The data pointer is not set.
+ * @param nDim Number of dimensions
+ * @param dimSizes Array of the nDim dimension sizes
+ */
+TensorView::TensorView(int nDim, const int* dimSizes) : nDim(nDim), data(nullptr), owner(nullptr) {
+    if(nDim < 1 || nDim > MAX_N_DIM) {
+        std::cerr << "ERROR: The number of dimensions must be between 1 and " << MAX_N_DIM << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    int stepSize = 1;
+    for(int i=nDim-1; i>=0; i--) {
+        this->dimSizes[i] = dimSizes[i];
+        strides[i] = stepSize;
+        stepSize *= dimSizes[i];
+    }
+}
+
+/**
+ * Create a view of borrowed data
+ * @remark The data is neither copied nor freed by the view, so it must outlive it
+ * @param nDim Number of dimensions
+ * @param dimSizes List of dimension sizes
+ * @param data Flattened data viewed. Its size must match with the shape of the view
+ */
+TensorView::TensorView(int nDim, const std::vector<int> &dimSizes, float *data) : TensorView((int) dimSizes.size(), dimSizes.data()) {
+    if(nDim != (int) dimSizes.size()) {
+        std::cerr << "ERROR: The provided number of dimensions does not match with the size of the dimension sizes array" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    this->data = data;
+}
+
+/**
+ * Create a view sharing the ownership of its data. The data is freed when the last view (or object) sharing it is deleted
+ * @param nDim Number of dimensions
+ * @param dimSizes List of dimension sizes
+ * @param owner Shared pointer to the flattened data. Its size must match with the shape of the view
+ */
+TensorView::TensorView(int nDim, const std::vector<int> &dimSizes, const std::shared_ptr<float> &owner) : TensorView(nDim, dimSizes, owner.get()) {
+    this->owner = owner;
+}
+
+/**
+ * Get the index of an element in the tensor from its coordinates
+ * @remark The coordinates are only checked in debug builds (when NDEBUG is not defined). Prefer at() or TensorRef in loops since they don't need a std::vector
+ * @param coord Coordinates of the element (one int per dimension)
+ * @return Index of the element in the flattened representation of the tensor
+ */
+int TensorView::getIndex(const std::vector<int>& coord) const {
+#ifndef NDEBUG
+    checkCoordinates(nDim, dimSizes, (int) coord.size(), coord.data());
+#endif
+
+    int index = 0;
+    for(int i=0; i<getNDim(); i++) {
+        index += coord[i] * strides[i];
+    }
+
+    return index;
+}
+
+/**
+ * Get an element from its coordinates
+ * @param coord Coordinates of the element (one int per dimension)
+ * @return Element at the given coordinates
+ */
+float TensorView::get(const std::vector<int>& coord) const {
+    int i = getIndex(coord);
+    return data[i];
+}
+
+/**
+ * Get a pointer that points to the element at the given coordinates.
+ * @param coordStart Coordinates of the element (one int per dimension) where the returned pointers points to
+ * @return Pointer that points to the element whose coordinates are given
+ */
+float* TensorView::getStart(const std::vector<int> &coordStart) const {
+    int i = getIndex(coordStart);
+    return &(data[i]);
+}
+
+/**
+ * Set the value of the at the given coordinates
+ * @param coord Coordinates of the element (one int per dimension)
+ * @param newValue New value of the element
+*/
+void TensorView::set(const std::vector<int>& coord, float newValue) {
+    int i = getIndex(coord);
+    data[i] = newValue;
+}
+
+/**
+ * Get the number of dimensions of this tensor
+ * @return Number of dimensions
+ */
+int TensorView::getNDim() const {
+    return nDim;
+}
+
+/**
+ * Get the list of the dimension sizes
+ * @return List of dimension sizes
+ */
+std::vector<int> TensorView::getDimSizes() const {
+    return std::vector<int>(dimSizes, dimSizes + nDim);
+}
+
+/**
+ * Get the dimension sizes without copying them
+ * @return Array of the getNDim() dimension sizes. It's valid as long as this tensor exists
+ */
+const int* TensorView::getShape() const {
+    return dimSizes;
+}
+
+/**
+ * Get a pointer to the (flattened) data of this tensor
+ * @remark You can use it to read and edit the data of the tensor. But you must NOT delete it.
+ * @return Data of this tensor (pointer pointing the first element)
+ */
+float * TensorView::getData() const {
+    return data;
+}
+
+/**
+ * Get a text representation of the tensor (flatten list of elements)
+ * @return String representing the tensor
+ */
+std::string TensorView::toString() {
+    float* data = getData();
+    std::string s;
+    for(int i=0; i<size(); i++) {
+        s.append(std::to_string(data[i]));
+        s.append(" ");
+    }
+    return s;
+}
+
+/**
+ * Get the size of the tensor (product of the sizes of all the dimensions)
+ * @return Size of the tensor
+ */
+int TensorView::size() const {
+    int size = 1;
+    for(int i=0; i<nDim; i++) {
+        size *= dimSizes[i];
+    }
+    return size;
+}
+
+/**
+ * Get the size of a dimension from its index
+ * @param i Index of the dimension
+ * @return Size of the dimension
+ */
+int TensorView::getDimSize(int i) const {
+#ifndef NDEBUG
+    if(i<0 || i>=getNDim()) {
+        std::cerr << "ERROR: dimension out of bound in getDimSize" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+#endif
+    return dimSizes[i];
+}
+
+/**
+ * Check if the elements are stored one after the other in the row-major order, so that getData() can be read as a flat array
+ * @return True if the view is contiguous
+ */
+bool TensorView::isContiguous() const {
+    int stepSize = 1;
+    for(int i=nDim-1; i>=0; i--) {
+        if(dimSizes[i] != 1 && strides[i] != stepSize) {
+            return false;
+        }
+        stepSize *= dimSizes[i];
+    }
+    return true;
+}
+
+/**
+ * Get the stride of a dimension: the number of elements between two consecutive coordinates of this dimension
+ * @param i Index of the dimension
+ * @return Stride of the dimension
+ */
+int TensorView::getStride(int i) const {
+#ifndef NDEBUG
+    if(i<0 || i>=getNDim()) {
+        std::cerr << "ERROR: dimension out of bound in getStride" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+#endif
+    return strides[i];
+}
+
+/**
+ * Check that coordinates are valid for the given shape and stop the program otherwise. It's used by the accessors in debug builds only
+ * @param nDim Number of dimensions of the shape
+ * @param dimSizes Array of the nDim dimension sizes
+ * @param nbCoord Number of coordinates
+ * @param coord Array of the nbCoord coordinates
+ */
+void TensorView::checkCoordinates(int nDim, const int *dimSizes, int nbCoord, const int *coord) {
+    if(nDim != nbCoord) {
+        std::cerr << "ERROR: The provided coordinates are not in the dimension of the tensor (" << nbCoord << " coordinates for a tensor of rank " << nDim << ")" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    for(int i=0; i<nDim; i++) {
+        if(coord[i] < 0 || coord[i] >= dimSizes[i]) {
+            std::cerr << "ERROR: One of the provided coordinates is out of bound (check the tensor shape) for the coord " << i << " :  " << coord[i] << " >= " << dimSizes[i] << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * Get a view of the same data with another shape. The data is not copied.
+ * @param newNDim Number of dimensions of the new shape
+ * @param newDimSizes List of dimension sizes of the new shape. Their product must be equal to the size of this tensor
+ * @return View of the data of this tensor with the new shape
+ */
+TensorView TensorView::reshape(int newNDim, const std::vector<int> &newDimSizes) const {
+    if(!isContiguous()) {
+        std::cerr << "ERROR: Only contiguous tensors can be reshaped" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if(newNDim != (int) newDimSizes.size()) {
+        std::cerr << "ERROR: The provided number of dimensions does not match with the size of the dimension sizes array" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    TensorView view((int) newDimSizes.size(), newDimSizes.data());
+    if(view.size() != size()) {
+        std::cerr << "ERROR: The new shape does not have the same size as the tensor (" << view.size() << " != " << size() << ")" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    view.data = data;
+    view.owner = owner;
+    return view;
+}
+
+/**
+ * Get a view of the elements [start, end[ along the first dimension (e.g. a sub-batch). The data is not copied.
+ * @param start Index of the first element of the first dimension kept
+ * @param end Index following the last element of the first dimension kept
+ * @return View of the data of this tensor whose first dimension size is (end - start)
+ */
+TensorView TensorView::slice(int start, int end) const {
+    if(start < 0 || end > getDimSize(0) || start >= end) {
+        std::cerr << "ERROR: Invalid slice [" << start << "," << end << "[ for a first dimension of size " << getDimSize(0) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    TensorView view(*this);
+    view.dimSizes[0] = end - start;
+    view.data = data + start * strides[0];
+    return view;
+}
+
+/**
+ * Get a view of this tensor with a new dimension of size 1 inserted at the given index (e.g. dim = 0 turns an instance into a batch of size 1). The data is not copied.
+ * @param dim Index of the new dimension (between 0 and the number of dimensions of this tensor)
+ * @return View of the data of this tensor with one more dimension
+ */
+TensorView TensorView::unsqueeze(int dim) const {
+    if(dim < 0 || dim > nDim || nDim >= MAX_N_DIM) {
+        std::cerr << "ERROR: dimension out of bound in unsqueeze" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    TensorView view(*this);
+    view.nDim++;
+    for(int i=nDim; i>dim; i--) {
+        view.dimSizes[i] = dimSizes[i-1];
+        view.strides[i] = strides[i-1];
+    }
+    view.dimSizes[dim] = 1;
+    view.strides[dim] = dim < nDim ? strides[dim] * dimSizes[dim] : 1;
+    return view;
+}
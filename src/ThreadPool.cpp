@@ -0,0 +1,202 @@
+/**
+ * @file ThreadPool.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class ThreadPool, used to run the work of a layer on several cores
+ * @date 2024-01-22
+ */
+
+#include "../include/ThreadPool.h"
+#include <memory>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+thread_local bool ThreadPool::isInTask = false;
+
+/**
+ * Global pool, created by getInstance() or configure()
+ */
+static std::unique_ptr<ThreadPool> instance;
+static std::mutex instanceMutex;
+
+/**
+ * Create a pool and start its workers
+ * @param nbThreads Number of threads working on a job, including the calling thread. If it's 0 or less, the number of cores is used
+ * @param pinThreads True to bind each worker to one core (only on Linux), so that it keeps its caches
+ * @param minWorkPerThread Minimum amount of work (approximately in floating point operations) given to a thread. Below it, adding a thread costs more in synchronization than it saves
+ */
+ThreadPool::ThreadPool(int nbThreads, bool pinThreads, long minWorkPerThread) : currentJob(nullptr), generation(0), stop(false), nbThreads(nbThreads), pinThreads(pinThreads), minWorkPerThread(std::max(minWorkPerThread, 1L)) {
+    int nbCores = std::max(1, (int) std::thread::hardware_concurrency());
+    if(this->nbThreads <= 0) {
+        this->nbThreads = nbCores;
+    }
+
+    for(int i=0; i<this->nbThreads-1; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+#ifdef __linux__
+        if(pinThreads) {
+            // The calling thread is expected to run on the first core, worker i is bound to the core i+1
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            CPU_SET((i + 1) % nbCores, &cpuSet);
+            pthread_setaffinity_np(workers.back().native_handle(), sizeof(cpu_set_t), &cpuSet);
+        }
+#endif
+    }
+}
+
+/**
+ * Stop and join the workers
+ */
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    jobAvailable.notify_all();
+    for(auto &worker : workers) {
+        worker.join();
+    }
+}
+
+/**
+ * Loop of a worker: wait for a job, work on it until there is no task left and wait for the next one
+ */
+void ThreadPool::workerLoop() {
+    long lastGeneration = 0;
+    while(true) {
+        Job* job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobAvailable.wait(lock, [&] { return stop || (currentJob != nullptr && generation != lastGeneration); });
+            if(stop) {
+                return;
+            }
+            lastGeneration = generation;
+            job = currentJob;
+            job->nbActiveWorkers++;
+        }
+
+        runTasks(*job);
+
+        {
+            // The notification is done while holding the lock so that the job is still alive
+            std::lock_guard<std::mutex> lock(mutex);
+            job->nbActiveWorkers--;
+            if(job->nbActiveWorkers == 0) {
+                jobDone.notify_all();
+            }
+        }
+    }
+}
+
+/**
+ * Run the tasks of a job that are not started yet, until there is none left
+ * @param job Job whose tasks are run
+ */
+void ThreadPool::runTasks(Job &job) {
+    isInTask = true;
+    int task;
+    while((task = job.nextTask.fetch_add(1)) < job.nbTasks) {
+        job.function(job.context, task);
+    }
+    isInTask = false;
+}
+
+/**
+ * Run tasks on the workers and on the calling thread, and wait until they are all done
+ * @param nbTasks Number of tasks
+ * @param function Function called for each task with the context and the index of the task
+ * @param context First argument given to the function
+ */
+void ThreadPool::run(int nbTasks, void (*function)(void *, int), void *context) {
+    if(workers.empty() || isInTask || !runMutex.try_lock()) {
+        // No worker available: the tasks are run here
+        for(int task=0; task<nbTasks; task++) {
+            function(context, task);
+        }
+        return;
+    }
+    std::lock_guard<std::mutex> runLock(runMutex, std::adopt_lock);
+
+    Job job;
+    job.function = function;
+    job.context = context;
+    job.nbTasks = nbTasks;
+    job.nextTask = 0;
+    job.nbActiveWorkers = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        currentJob = &job;
+        generation++;
+    }
+    jobAvailable.notify_all();
+
+    runTasks(job);
+
+    // No worker can join the job once it's removed, so we only wait for the ones already working on it
+    std::unique_lock<std::mutex> lock(mutex);
+    currentJob = nullptr;
+    jobDone.wait(lock, [&] { return job.nbActiveWorkers == 0; });
+}
+
+/**
+ * Get the number of threads working on a job (including the calling thread)
+ * @return Number of threads
+ */
+int ThreadPool::getNbThreads() const {
+    return nbThreads;
+}
+
+/**
+ * Check if the workers are bound to a core
+ * @return True if they are pinned
+ */
+bool ThreadPool::arePinned() const {
+    return pinThreads;
+}
+
+/**
+ * Get the minimum amount of work given to a thread
+ * @return Minimum work per thread (approximately in floating point operations)
+ */
+long ThreadPool::getMinWorkPerThread() const {
+    return minWorkPerThread;
+}
+
+/**
+ * Get the number of threads worth using for the given amount of work
+ * @param work Approximate number of operations to do
+ * @return Number of threads (between 1 and getNbThreads()). It's 1 if called from a task
+ */
+int ThreadPool::getNbThreadsFor(long work) const {
+    if(isInTask) {
+        return 1;
+    }
+    return (int) std::max(1L, std::min((long) nbThreads, work / minWorkPerThread));
+}
+
+/**
+ * Get the pool used by the layers. It's created with the default parameters (one thread per core) if configure() was not called.
+ * @return Global pool
+ */
+ThreadPool& ThreadPool::getInstance() {
+    std::lock_guard<std::mutex> lock(instanceMutex);
+    if(!instance) {
+        instance.reset(new ThreadPool());
+    }
+    return *instance;
+}
+
+/**
+ * Replace the pool used by the layers. It must not be called while the pool is used.
+ * @param nbThreads Number of threads working on a job, including the calling thread. If it's 0 or less, the number of cores is used
+ * @param pinThreads True to bind each worker to one core (only on Linux)
+ * @param minWorkPerThread Minimum amount of work (approximately in floating point operations) given to a thread
+ */
+void ThreadPool::configure(int nbThreads, bool pinThreads, long minWorkPerThread) {
+    std::lock_guard<std::mutex> lock(instanceMutex);
+    instance.reset();
+    instance.reset(new ThreadPool(nbThreads, pinThreads, minWorkPerThread));
+}
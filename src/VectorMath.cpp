@@ -0,0 +1,718 @@
+/**
+ * @file VectorMath.cpp
+ * @author Robin MENEUST
+ * @brief Methods of the class VectorMath, used to compute the activation functions on arrays with vector instructions
+ * @date 2024-02-02
+ */
+
+#include "../include/VectorMath.h"
+#include "../include/Gemm.h"
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_MATH_X86
+#include <immintrin.h>
+#endif
+
+static std::atomic<bool> fastExp(false); /**< True if the exponential uses the polynomial of degree 3. It only selects a polynomial, so it is read with a relaxed order */
+
+// exp(x) = 2^k * exp(r) with k = round(x / ln(2)) and r = x - k * ln(2) in [-ln(2)/2, ln(2)/2]. ln(2) is split in two constants so that k * LN2_HI is exact
+static const float EXP_MIN = -87.0f;
+static const float EXP_MAX = 88.0f;
+static const float LOG2E = 1.44269504088896341f;
+static const float LN2_HI = 0.693359375f;
+static const float LN2_LO = -2.12194440e-4f;
+
+// Polynomial of Cephes for exp(r): 1 + r + r^2 * (P5 + r * (P4 + r * (P3 + r * (P2 + r * (P1 + r * P0)))))
+static const float P0 = 1.9875691500e-4f;
+static const float P1 = 1.3981999507e-3f;
+static const float P2 = 8.3334519073e-3f;
+static const float P3 = 4.1665795894e-2f;
+static const float P4 = 1.6666665459e-1f;
+static const float P5 = 5.0000001201e-1f;
+
+// Minimax polynomial of degree 3 for the relative error of exp(r) on [-ln(2)/2, ln(2)/2]: F0 + r * (F1 + r * (F2 + r * F3))
+static const float F0 = 0.999928074f;
+static const float F1 = 1.00016419f;
+static const float F2 = 0.504963264f;
+static const float F3 = 0.165668423f;
+
+/**
+ * @enum Operation
+ * @brief Element-wise operations computed by the kernels
+ */
+enum Operation {
+    RELU, /**< max(0, x) */
+    RELU_DERIVATIVES, /**< 1 if x > 0, otherwise 0 */
+    LEAKY_RELU, /**< x if x > 0, otherwise parameter * x */
+    LEAKY_RELU_DERIVATIVES, /**< 1 if x > 0, otherwise parameter */
+    SIGMOID, /**< 1 / (1 + e^-x) */
+    SIGMOID_DERIVATIVES /**< x * (1 - x), where x is the output of the sigmoid */
+};
+
+/**
+ * Compute the exponential of a float (see the remark of VectorMath)
+ * @param x Exponent
+ * @param fast True to use the polynomial of degree 3
+ * @return e^x
+ */
+static inline float expScalar(float x, bool fast) {
+    if(x < EXP_MIN) {
+        return 0.0f;
+    }
+    x = std::min(x, EXP_MAX);
+    float k = std::nearbyint(x * LOG2E);
+    float r = x - k * LN2_HI;
+    r = r - k * LN2_LO;
+    float p;
+    if(fast) {
+        p = F0 + r * (F1 + r * (F2 + r * F3));
+    } else {
+        p = P0 * r + P1;
+        p = p * r + P2;
+        p = p * r + P3;
+        p = p * r + P4;
+        p = p * r + P5;
+        p = p * (r * r) + r + 1.0f;
+    }
+    int32_t bits = ((int32_t) k + 127) << 23;
+    float powerOfTwo;
+    memcpy(&powerOfTwo, &bits, sizeof(float));
+    return p * powerOfTwo;
+}
+
+/**
+ * Compute an operation on a float
+ * @param x Input
+ * @param parameter Parameter of the operation (slope of LEAKY_RELU)
+ * @param fast True to use the fast exponential
+ * @return Result
+ */
+template<Operation op>
+static inline float computeScalar(float x, float parameter, bool fast) {
+    switch(op) {
+        case RELU: return x <= 0 ? 0.0f : x;
+        case RELU_DERIVATIVES: return x <= 0 ? 0.0f : 1.0f;
+        case LEAKY_RELU: return x <= 0 ? parameter * x : x;
+        case LEAKY_RELU_DERIVATIVES: return x <= 0 ? parameter : 1.0f;
+        case SIGMOID: return 1.0f / (1.0f + expScalar(-x, fast));
+        default: return x * (1.0f - x);
+    }
+}
+
+/**
+ * Compute an operation on each element of an array
+ * @param x Input array
+ * @param y Output array, it can be the input array
+ * @param n Number of elements
+ * @param parameter Parameter of the operation
+ * @param fast True to use the fast exponential
+ */
+template<Operation op>
+static void applyScalar(const float* x, float* y, int n, float parameter, bool fast) {
+    for(int i=0; i<n; i++) {
+        y[i] = computeScalar<op>(x[i], parameter, fast);
+    }
+}
+
+/**
+ * Multiply each element of an array by the derivative of the leaky ReLU
+ * @param x Inputs or outputs of the leaky ReLU (they have the same sign)
+ * @param g Array multiplied in place
+ * @param n Number of elements
+ * @param slope Slope for the negative values
+ */
+static void multiplyByLeakyReluDerivativesScalar(const float* x, float* g, int n, float slope) {
+    for(int i=0; i<n; i++) {
+        g[i] = x[i] <= 0 ? slope * g[i] : g[i];
+    }
+}
+
+/**
+ * Multiply each element of an array by the derivative of the sigmoid, computed from its output
+ * @param y Outputs of the sigmoid
+ * @param g Array multiplied in place
+ * @param n Number of elements
+ */
+static void multiplyBySigmoidDerivativesScalar(const float* y, float* g, int n) {
+    for(int i=0; i<n; i++) {
+        g[i] *= y[i] * (1.0f - y[i]);
+    }
+}
+
+/**
+ * Compute e^(scale * x - offset) for each element of an array
+ * @param x Input array
+ * @param y Output array, it can be the input array
+ * @param n Number of elements
+ * @param scale Factor applied to the inputs
+ * @param offset Value subtracted from the scaled inputs
+ * @param fast True to use the fast exponential
+ * @return Sum of the outputs
+ */
+static float expScalarArray(const float* x, float* y, int n, float scale, float offset, bool fast) {
+    float sum = 0.0f;
+    for(int i=0; i<n; i++) {
+        y[i] = expScalar(x[i] * scale - offset, fast);
+        sum += y[i];
+    }
+    return sum;
+}
+
+#ifdef VECTOR_MATH_X86
+
+/**
+ * AVX2 version of expScalar() on 8 floats
+ */
+__attribute__((target("avx2,fma")))
+static inline __m256 expAvx2(__m256 x, bool fast) {
+    __m256 underflow = _mm256_cmp_ps(x, _mm256_set1_ps(EXP_MIN), _CMP_LT_OQ);
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_MIN)), _mm256_set1_ps(EXP_MAX));
+    __m256 k = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(k, _mm256_set1_ps(LN2_HI), x);
+    r = _mm256_fnmadd_ps(k, _mm256_set1_ps(LN2_LO), r);
+    __m256 p;
+    if(fast) {
+        p = _mm256_fmadd_ps(_mm256_set1_ps(F3), r, _mm256_set1_ps(F2));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(F1));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(F0));
+    } else {
+        p = _mm256_fmadd_ps(_mm256_set1_ps(P0), r, _mm256_set1_ps(P1));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P2));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P3));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P4));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P5));
+        p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+    }
+    __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(k), _mm256_set1_epi32(127)), 23);
+    return _mm256_andnot_ps(underflow, _mm256_mul_ps(p, _mm256_castsi256_ps(bits)));
+}
+
+/**
+ * AVX2 version of computeScalar() on 8 floats
+ */
+template<Operation op>
+__attribute__((target("avx2,fma")))
+static inline __m256 computeAvx2(__m256 x, __m256 parameter, bool fast) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    switch(op) {
+        case RELU: return _mm256_max_ps(x, zero);
+        case RELU_DERIVATIVES: return _mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_GT_OQ), one);
+        case LEAKY_RELU: return _mm256_blendv_ps(x, _mm256_mul_ps(x, parameter), _mm256_cmp_ps(x, zero, _CMP_LE_OQ));
+        case LEAKY_RELU_DERIVATIVES: return _mm256_blendv_ps(one, parameter, _mm256_cmp_ps(x, zero, _CMP_LE_OQ));
+        case SIGMOID: return _mm256_div_ps(one, _mm256_add_ps(one, expAvx2(_mm256_sub_ps(zero, x), fast)));
+        default: return _mm256_mul_ps(x, _mm256_sub_ps(one, x));
+    }
+}
+
+/**
+ * AVX2 version of applyScalar(). The last elements are computed in a padded vector, so that they get the same results as if they were in the middle of the array
+ */
+template<Operation op>
+__attribute__((target("avx2,fma")))
+static void applyAvx2(const float* x, float* y, int n, float parameter, bool fast) {
+    __m256 broadcastParameter = _mm256_set1_ps(parameter);
+    int i = 0;
+    for(; i+8<=n; i+=8) {
+        _mm256_storeu_ps(y + i, computeAvx2<op>(_mm256_loadu_ps(x + i), broadcastParameter, fast));
+    }
+    if(i < n) {
+        float tail[8] = {0.0f};
+        std::copy(x + i, x + n, tail);
+        _mm256_storeu_ps(tail, computeAvx2<op>(_mm256_loadu_ps(tail), broadcastParameter, fast));
+        std::copy(tail, tail + (n - i), y + i);
+    }
+}
+
+/**
+ * AVX2 version of multiplyByLeakyReluDerivativesScalar()
+ */
+__attribute__((target("avx2")))
+static void multiplyByLeakyReluDerivativesAvx2(const float* x, float* g, int n, float slope) {
+    __m256 broadcastSlope = _mm256_set1_ps(slope);
+    int i = 0;
+    for(; i+8<=n; i+=8) {
+        __m256 values = _mm256_loadu_ps(g + i);
+        __m256 negative = _mm256_cmp_ps(_mm256_loadu_ps(x + i), _mm256_setzero_ps(), _CMP_LE_OQ);
+        _mm256_storeu_ps(g + i, _mm256_blendv_ps(values, _mm256_mul_ps(values, broadcastSlope), negative));
+    }
+    multiplyByLeakyReluDerivativesScalar(x + i, g + i, n - i, slope);
+}
+
+/**
+ * AVX2 version of multiplyBySigmoidDerivativesScalar()
+ */
+__attribute__((target("avx2")))
+static void multiplyBySigmoidDerivativesAvx2(const float* y, float* g, int n) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    int i = 0;
+    for(; i+8<=n; i+=8) {
+        __m256 outputs = _mm256_loadu_ps(y + i);
+        __m256 derivatives = _mm256_mul_ps(outputs, _mm256_sub_ps(one, outputs));
+        _mm256_storeu_ps(g + i, _mm256_mul_ps(_mm256_loadu_ps(g + i), derivatives));
+    }
+    multiplyBySigmoidDerivativesScalar(y + i, g + i, n - i);
+}
+
+/**
+ * Get the sum of the 8 floats of a vector
+ */
+__attribute__((target("avx2")))
+static inline float sumAvx2(__m256 x) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+/**
+ * Get the maximum of the 8 floats of a vector
+ */
+__attribute__((target("avx2")))
+static inline float maxAvx2(__m256 x) {
+    __m128 max = _mm_max_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+    max = _mm_max_ps(max, _mm_movehl_ps(max, max));
+    max = _mm_max_ss(max, _mm_movehdup_ps(max));
+    return _mm_cvtss_f32(max);
+}
+
+/**
+ * AVX2 version of expScalarArray()
+ */
+__attribute__((target("avx2,fma")))
+static float expAvx2Array(const float* x, float* y, int n, float scale, float offset, bool fast) {
+    __m256 broadcastScale = _mm256_set1_ps(scale);
+    __m256 broadcastOffset = _mm256_set1_ps(offset);
+    __m256 sum = _mm256_setzero_ps();
+    int i = 0;
+    for(; i+8<=n; i+=8) {
+        __m256 e = expAvx2(_mm256_fmsub_ps(_mm256_loadu_ps(x + i), broadcastScale, broadcastOffset), fast);
+        _mm256_storeu_ps(y + i, e);
+        sum = _mm256_add_ps(sum, e);
+    }
+    float total = sumAvx2(sum);
+    if(i < n) {
+        float tail[8] = {0.0f};
+        std::copy(x + i, x + n, tail);
+        _mm256_storeu_ps(tail, expAvx2(_mm256_fmsub_ps(_mm256_loadu_ps(tail), broadcastScale, broadcastOffset), fast));
+        for(int j=0; j<n-i; j++) {
+            y[i + j] = tail[j];
+            total += tail[j];
+        }
+    }
+    return total;
+}
+
+/**
+ * AVX2 version of VectorMath::max() and VectorMath::absMax() for at least 8 elements
+ */
+__attribute__((target("avx2")))
+static float maxAvx2Array(const float* x, int n, bool absolute) {
+    __m256 mask = absolute ? _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)) : _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    __m256 max = _mm256_and_ps(_mm256_loadu_ps(x), mask);
+    int i = 8;
+    for(; i+8<=n; i+=8) {
+        max = _mm256_max_ps(max, _mm256_and_ps(_mm256_loadu_ps(x + i), mask));
+    }
+    float result = maxAvx2(max);
+    for(; i<n; i++) {
+        result = std::max(result, absolute ? std::fabs(x[i]) : x[i]);
+    }
+    return result;
+}
+
+// GCC 12 reports the undefined vectors used by its AVX-512 intrinsics as uninitialized when they are enabled by a target attribute
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+/**
+ * AVX-512 version of expScalar() on 16 floats
+ */
+__attribute__((target("avx512f")))
+static inline __m512 expAvx512(__m512 x, bool fast) {
+    __mmask16 underflow = _mm512_cmp_ps_mask(x, _mm512_set1_ps(EXP_MIN), _CMP_LT_OQ);
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(EXP_MIN)), _mm512_set1_ps(EXP_MAX));
+    __m512 k = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(k, _mm512_set1_ps(LN2_HI), x);
+    r = _mm512_fnmadd_ps(k, _mm512_set1_ps(LN2_LO), r);
+    __m512 p;
+    if(fast) {
+        p = _mm512_fmadd_ps(_mm512_set1_ps(F3), r, _mm512_set1_ps(F2));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(F1));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(F0));
+    } else {
+        p = _mm512_fmadd_ps(_mm512_set1_ps(P0), r, _mm512_set1_ps(P1));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P2));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P3));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P4));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P5));
+        p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+    }
+    __m512i bits = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(k), _mm512_set1_epi32(127)), 23);
+    return _mm512_maskz_mov_ps((__mmask16) ~underflow, _mm512_mul_ps(p, _mm512_castsi512_ps(bits)));
+}
+
+/**
+ * AVX-512 version of computeScalar() on 16 floats
+ */
+template<Operation op>
+__attribute__((target("avx512f")))
+static inline __m512 computeAvx512(__m512 x, __m512 parameter, bool fast) {
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 one = _mm512_set1_ps(1.0f);
+    switch(op) {
+        case RELU: return _mm512_max_ps(x, zero);
+        case RELU_DERIVATIVES: return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(x, zero, _CMP_GT_OQ), one);
+        case LEAKY_RELU: return _mm512_mask_mul_ps(x, _mm512_cmp_ps_mask(x, zero, _CMP_LE_OQ), x, parameter);
+        case LEAKY_RELU_DERIVATIVES: return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, zero, _CMP_LE_OQ), one, parameter);
+        case SIGMOID: return _mm512_div_ps(one, _mm512_add_ps(one, expAvx512(_mm512_sub_ps(zero, x), fast)));
+        default: return _mm512_mul_ps(x, _mm512_sub_ps(one, x));
+    }
+}
+
+/**
+ * AVX-512 version of applyScalar(). The last elements are computed with a masked load and store
+ */
+template<Operation op>
+__attribute__((target("avx512f")))
+static void applyAvx512(const float* x, float* y, int n, float parameter, bool fast) {
+    __m512 broadcastParameter = _mm512_set1_ps(parameter);
+    int i = 0;
+    for(; i+16<=n; i+=16) {
+        _mm512_storeu_ps(y + i, computeAvx512<op>(_mm512_loadu_ps(x + i), broadcastParameter, fast));
+    }
+    if(i < n) {
+        __mmask16 mask = (__mmask16) ((1u << (n - i)) - 1);
+        _mm512_mask_storeu_ps(y + i, mask, computeAvx512<op>(_mm512_maskz_loadu_ps(mask, x + i), broadcastParameter, fast));
+    }
+}
+
+/**
+ * AVX-512 version of multiplyByLeakyReluDerivativesScalar()
+ */
+__attribute__((target("avx512f")))
+static void multiplyByLeakyReluDerivativesAvx512(const float* x, float* g, int n, float slope) {
+    __m512 broadcastSlope = _mm512_set1_ps(slope);
+    int i = 0;
+    for(; i+16<=n; i+=16) {
+        __m512 values = _mm512_loadu_ps(g + i);
+        __mmask16 negative = _mm512_cmp_ps_mask(_mm512_loadu_ps(x + i), _mm512_setzero_ps(), _CMP_LE_OQ);
+        _mm512_storeu_ps(g + i, _mm512_mask_mul_ps(values, negative, values, broadcastSlope));
+    }
+    if(i < n) {
+        __mmask16 mask = (__mmask16) ((1u << (n - i)) - 1);
+        __m512 values = _mm512_maskz_loadu_ps(mask, g + i);
+        __mmask16 negative = _mm512_mask_cmp_ps_mask(mask, _mm512_maskz_loadu_ps(mask, x + i), _mm512_setzero_ps(), _CMP_LE_OQ);
+        _mm512_mask_storeu_ps(g + i, mask, _mm512_mask_mul_ps(values, negative, values, broadcastSlope));
+    }
+}
+
+/**
+ * AVX-512 version of multiplyBySigmoidDerivativesScalar()
+ */
+__attribute__((target("avx512f")))
+static void multiplyBySigmoidDerivativesAvx512(const float* y, float* g, int n) {
+    const __m512 one = _mm512_set1_ps(1.0f);
+    int i = 0;
+    for(; i+16<=n; i+=16) {
+        __m512 outputs = _mm512_loadu_ps(y + i);
+        __m512 derivatives = _mm512_mul_ps(outputs, _mm512_sub_ps(one, outputs));
+        _mm512_storeu_ps(g + i, _mm512_mul_ps(_mm512_loadu_ps(g + i), derivatives));
+    }
+    if(i < n) {
+        __mmask16 mask = (__mmask16) ((1u << (n - i)) - 1);
+        __m512 outputs = _mm512_maskz_loadu_ps(mask, y + i);
+        __m512 derivatives = _mm512_mul_ps(outputs, _mm512_sub_ps(one, outputs));
+        _mm512_mask_storeu_ps(g + i, mask, _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, g + i), derivatives));
+    }
+}
+
+/**
+ * AVX-512 version of expScalarArray()
+ */
+__attribute__((target("avx512f")))
+static float expAvx512Array(const float* x, float* y, int n, float scale, float offset, bool fast) {
+    __m512 broadcastScale = _mm512_set1_ps(scale);
+    __m512 broadcastOffset = _mm512_set1_ps(offset);
+    __m512 sum = _mm512_setzero_ps();
+    int i = 0;
+    for(; i+16<=n; i+=16) {
+        __m512 e = expAvx512(_mm512_fmsub_ps(_mm512_loadu_ps(x + i), broadcastScale, broadcastOffset), fast);
+        _mm512_storeu_ps(y + i, e);
+        sum = _mm512_add_ps(sum, e);
+    }
+    if(i < n) {
+        __mmask16 mask = (__mmask16) ((1u << (n - i)) - 1);
+        __m512 e = expAvx512(_mm512_fmsub_ps(_mm512_maskz_loadu_ps(mask, x + i), broadcastScale, broadcastOffset), fast);
+        _mm512_mask_storeu_ps(y + i, mask, e);
+        sum = _mm512_mask_add_ps(sum, mask, sum, e);
+    }
+    return _mm512_reduce_add_ps(sum);
+}
+
+/**
+ * AVX-512 version of VectorMath::max() and VectorMath::absMax() for at least 16 elements
+ */
+__attribute__((target("avx512f")))
+static float maxAvx512Array(const float* x, int n, bool absolute) {
+    __m512 max = _mm512_loadu_ps(x);
+    max = absolute ? _mm512_abs_ps(max) : max;
+    int i = 16;
+    for(; i+16<=n; i+=16) {
+        __m512 values = _mm512_loadu_ps(x + i);
+        max = _mm512_max_ps(max, absolute ? _mm512_abs_ps(values) : values);
+    }
+    if(i < n) {
+        __mmask16 mask = (__mmask16) ((1u << (n - i)) - 1);
+        __m512 values = _mm512_maskz_loadu_ps(mask, x + i);
+        max = _mm512_mask_max_ps(max, mask, max, absolute ? _mm512_abs_ps(values) : values);
+    }
+    return _mm512_reduce_max_ps(max);
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+/**
+ * Compute an operation on each element of an array with the instruction set used by Gemm
+ * @param x Input array
+ * @param y Output array, it can be the input array
+ * @param n Number of elements
+ * @param parameter Parameter of the operation
+ */
+template<Operation op>
+static void apply(const float* x, float* y, int n, float parameter) {
+    bool fast = fastExp.load(std::memory_order_relaxed);
+#ifdef VECTOR_MATH_X86
+    Gemm::Isa isa = Gemm::getIsa();
+    if(isa >= Gemm::AVX512) {
+        applyAvx512<op>(x, y, n, parameter, fast);
+        return;
+    }
+    if(isa >= Gemm::AVX2) {
+        applyAvx2<op>(x, y, n, parameter, fast);
+        return;
+    }
+#endif
+    applyScalar<op>(x, y, n, parameter, fast);
+}
+
+/**
+ * Compute max(0, x) for each element of an array
+ * @param x Input array
+ * @param y Output array, it can be the input array
+ * @param n Number of elements
+ */
+void VectorMath::reluInto(const float* x, float* y, int n) {
+    apply<RELU>(x, y, n, 0.0f);
+}
+
+/**
+ * Compute the derivative of max(0, x) for each element of an array
+ * @param x Input array
+ * @param d Output array (1 if x > 0, otherwise 0), it can be the input array
+ * @param n Number of elements
+ */
+void VectorMath::reluDerivativesInto(const float* x, float* d, int n) {
+    apply<RELU_DERIVATIVES>(x, d, n, 0.0f);
+}
+
+/**
+ * Compute x if x > 0, otherwise slope * x, for each element of an array
+ * @param x Input array
+ * @param y Output array, it can be the input array
+ * @param n Number of elements
+ * @param slope Slope for the negative values
+ */
+void VectorMath::leakyReluInto(const float* x, float* y, int n, float slope) {
+    apply<LEAKY_RELU>(x, y, n, slope);
+}
+
+/**
+ * Compute the derivative of the leaky ReLU for each element of an array
+ * @param x Input array
+ * @param d Output array (1 if x > 0, otherwise slope), it can be the input array
+ * @param n Number of elements
+ * @param slope Slope for the negative values
+ */
+void VectorMath::leakyReluDerivativesInto(const float* x, float* d, int n, float slope) {
+    apply<LEAKY_RELU_DERIVATIVES>(x, d, n, slope);
+}
+
+/**
+ * Multiply each element of an array by the derivative of max(0, x), i.e. set it to 0 where x <= 0
+ * @param x Inputs or outputs of the ReLU (they are positive at the same places)
+ * @param g Array multiplied in place, e.g. the cost derivatives in respect for the outputs
+ * @param n Number of elements
+ */
+void VectorMath::multiplyByReluDerivatives(const float* x, float* g, int n) {
+    multiplyByLeakyReluDerivatives(x, g, n, 0.0f);
+}
+
+/**
+ * Multiply each element of an array by the derivative of the leaky ReLU, i.e. by slope where x <= 0
+ * @param x Inputs or outputs of the leaky ReLU (they have the same sign)
+ * @param g Array multiplied in place, e.g. the cost derivatives in respect for the outputs
+ * @param n Number of elements
+ * @param slope Slope for the negative values
+ */
+void VectorMath::multiplyByLeakyReluDerivatives(const float* x, float* g, int n, float slope) {
+#ifdef VECTOR_MATH_X86
+    Gemm::Isa isa = Gemm::getIsa();
+    if(isa >= Gemm::AVX512) {
+        multiplyByLeakyReluDerivativesAvx512(x, g, n, slope);
+        return;
+    }
+    if(isa >= Gemm::AVX2) {
+        multiplyByLeakyReluDerivativesAvx2(x, g, n, slope);
+        return;
+    }
+#endif
+    multiplyByLeakyReluDerivativesScalar(x, g, n, slope);
+}
+
+/**
+ * Compute 1 / (1 + e^-x) for each element of an array
+ * @param x Input array
+ * @param y Output array, it can be the input array
+ * @param n Number of elements
+ */
+void VectorMath::sigmoidInto(const float* x, float* y, int n) {
+    apply<SIGMOID>(x, y, n, 0.0f);
+}
+
+/**
+ * Compute y * (1 - y) for each element of an array of outputs of the sigmoid, which is its derivative. It's also the derivative of a softmax output in respect for its own input
+ * @param y Outputs of the function
+ * @param d Output array, it can be the input array
+ * @param n Number of elements
+ */
+void VectorMath::sigmoidDerivativesInto(const float* y, float* d, int n) {
+    apply<SIGMOID_DERIVATIVES>(y, d, n, 0.0f);
+}
+
+/**
+ * Multiply each element of an array by the derivative of the sigmoid y * (1 - y), computed from its outputs. It gives the same results as sigmoidDerivativesInto() followed by a multiplication, without storing the derivatives
+ * @param y Outputs of the sigmoid (or of a softmax)
+ * @param g Array multiplied in place, e.g. the cost derivatives in respect for the outputs
+ * @param n Number of elements
+ */
+void VectorMath::multiplyBySigmoidDerivatives(const float* y, float* g, int n) {
+#ifdef VECTOR_MATH_X86
+    Gemm::Isa isa = Gemm::getIsa();
+    if(isa >= Gemm::AVX512) {
+        multiplyBySigmoidDerivativesAvx512(y, g, n);
+        return;
+    }
+    if(isa >= Gemm::AVX2) {
+        multiplyBySigmoidDerivativesAvx2(y, g, n);
+        return;
+    }
+#endif
+    multiplyBySigmoidDerivativesScalar(y, g, n);
+}
+
+/**
+ * Compute e^(scale * x - offset) for each element of an array
+ * @param x Input array
+ * @param y Output array, it can be the input array
+ * @param n Number of elements
+ * @param scale Factor applied to the inputs
+ * @param offset Value subtracted from the scaled inputs (e.g. their maximum, so that the exponentials don't overflow)
+ * @return Sum of the outputs
+ */
+float VectorMath::expInto(const float* x, float* y, int n, float scale, float offset) {
+    bool fast = fastExp.load(std::memory_order_relaxed);
+#ifdef VECTOR_MATH_X86
+    Gemm::Isa isa = Gemm::getIsa();
+    if(isa >= Gemm::AVX512) {
+        return expAvx512Array(x, y, n, scale, offset, fast);
+    }
+    if(isa >= Gemm::AVX2) {
+        return expAvx2Array(x, y, n, scale, offset, fast);
+    }
+#endif
+    return expScalarArray(x, y, n, scale, offset, fast);
+}
+
+/**
+ * Get the maximum of an array
+ * @param x Array
+ * @param n Number of elements
+ * @return Highest element, -infinity if the array is empty
+ */
+float VectorMath::max(const float* x, int n) {
+#ifdef VECTOR_MATH_X86
+    Gemm::Isa isa = Gemm::getIsa();
+    if(isa >= Gemm::AVX512 && n >= 16) {
+        return maxAvx512Array(x, n, false);
+    }
+    if(isa >= Gemm::AVX2 && n >= 8) {
+        return maxAvx2Array(x, n, false);
+    }
+#endif
+    float result = -INFINITY;
+    for(int i=0; i<n; i++) {
+        result = std::max(result, x[i]);
+    }
+    return result;
+}
+
+/**
+ * Get the maximum of the absolute values of an array
+ * @param x Array
+ * @param n Number of elements
+ * @return Highest absolute value, 0 if the array is empty
+ */
+float VectorMath::absMax(const float* x, int n) {
+#ifdef VECTOR_MATH_X86
+    Gemm::Isa isa = Gemm::getIsa();
+    if(isa >= Gemm::AVX512 && n >= 16) {
+        return maxAvx512Array(x, n, true);
+    }
+    if(isa >= Gemm::AVX2 && n >= 8) {
+        return maxAvx2Array(x, n, true);
+    }
+#endif
+    float result = 0.0f;
+    for(int i=0; i<n; i++) {
+        result = std::max(result, std::fabs(x[i]));
+    }
+    return result;
+}
+
+/**
+ * Multiply each element of an array by a factor
+ * @param x Array
+ * @param n Number of elements
+ * @param factor Factor
+ */
+void VectorMath::scale(float* x, int n, float factor) {
+    // The compiler vectorizes this loop, and a product gives the same result whatever the instruction set
+    for(int i=0; i<n; i++) {
+        x[i] *= factor;
+    }
+}
+
+/**
+ * Enable or disable the fast mode of the exponential, used by the sigmoid and the softmax. Its maximum relative error goes from ACCURATE_EXP_ERROR to FAST_EXP_ERROR, which is usually negligible for the training
+ * @param enabled True to use the polynomial of degree 3
+ */
+void VectorMath::setFastExp(bool enabled) {
+    fastExp.store(enabled, std::memory_order_relaxed);
+}
+
+/**
+ * Check if the fast mode of the exponential is enabled
+ * @return True if the exponential uses the polynomial of degree 3
+ */
+bool VectorMath::isFastExp() {
+    return fastExp.load(std::memory_order_relaxed);
+}
@@ -9,13 +9,22 @@
 #include <cstdlib>
 #include <vector>
 #include "../include/NeuralNetwork.h"
+#include "../include/QuantizedNeuralNetwork.h"
+#include "../include/Gemm.h"
+#include "../include/ThreadPool.h"
 #include <opencv2/opencv.hpp>
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <random>
 #include "../include/Softmax.h"
 #include "../include/LeakyRelu.h"
+#include "../include/Adam.h"
 #include <chrono>
+#include <fstream>
+#include <sstream>
+#include "../include/Checkpointer.h"
+#include "../include/Pipeline.h"
+#include "../include/InferenceQueue.h"
 
 using namespace cv;
 
@@ -45,7 +54,26 @@ NeuralNetwork* initNN() {
 //    network->addLayer(32, new Sigmoid());
     network->addLayer(512, new LeakyRelu());
     network->addLayer(10, new Softmax());
-    network->setLearningRate(0.03f);
+    // AdamW with a small decoupled weight decay (the default optimizer is the plain SGD with an L2 weight decay of 0.02)
+    network->setOptimizer(new Adam(0.9f, 0.999f, 1e-8f, 1e-4f, true));
+    network->setLearningRate(0.001f);
+
+    return network;
+}
+
+/**
+ * Create a deeper neural network, with more layers of fewer neurons, used to compare the training modes that split the layers
+ * @return Pointer to the neural network created
+ */
+
+NeuralNetwork* initDeepNN() {
+    NeuralNetwork* network = new NeuralNetwork(28*28);
+    for(int i=0; i<6; i++) {
+        network->addLayer(128, new LeakyRelu());
+    }
+    network->addLayer(10, new Softmax());
+    network->setOptimizer(new Adam(0.9f, 0.999f, 1e-8f, 1e-4f, true));
+    network->setLearningRate(0.001f);
 
     return network;
 }
@@ -109,11 +137,10 @@ float* flatten(Mat matrix, int width, int height) {
 /**
  * Get a list of instances (instance data and label) by getting the list of dataset files and normalizing their data
  * @param isTestSet If true we look into the folder test/ otherwise it's train/
- * @param expectedResult List of expected results per class in a one-hot representation. This must NOT be deleted since the values are not copied in the instance (it just keeps the address)
  * @param maxNbInstancesPerClass Max number of instances per class
- * @return List of instances of the dataset
+ * @return List of instances of the dataset, labeled by the index of their class
  */
-std::vector<Instance*> getDataset(bool isTestSet, float expectedResult[10][10], int maxNbInstancesPerClass) {
+std::vector<Instance*> getDataset(bool isTestSet, int maxNbInstancesPerClass) {
     std::vector<Instance*> instances;
     if(maxNbInstancesPerClass<1) {
         std::cerr << "Invalid value for maxNbExamples must be greater or equal to 1" << std::endl;
@@ -139,7 +166,7 @@ std::vector<Instance*> getDataset(bool isTestSet, float expectedResult[10][10],
             cv::normalize(image, normalizedImage, 0, 1, cv::NORM_MINMAX);
 
             float* flattenInput = flatten(normalizedImage, 28, 28); // TODO: Don't flatten it, it will be done by a flatten layer in a future update
-            Instance* instance = new Instance(new Tensor(1, {28*28}, flattenInput), expectedResult[i]);
+            Instance* instance = new Instance(new Tensor(1, {28*28}, flattenInput), i);
             delete[] flattenInput;
 
             instances.push_back(instance);
@@ -154,24 +181,20 @@ std::vector<Instance*> getDataset(bool isTestSet, float expectedResult[10][10],
 /**
  * Get a list of instances (instance data and label) by getting the list of ALL the dataset files and normalizing their data
  * @param isTestSet If true we look into the folder test/ otherwise it's train/
- * @param expectedResult List of expected results per class in a one-hot representation. This must NOT be deleted since the values are not copied in the instance (it just keeps the address)
- * @return List of instances of the dataset
+ * @return List of instances of the dataset, labeled by the index of their class
  */
-std::vector<Instance*> getDataset(bool isTestSet, float expectedResult[10][10]) {
-    return getDataset(isTestSet, expectedResult, INT32_MAX);
+std::vector<Instance*> getDataset(bool isTestSet) {
+    return getDataset(isTestSet, INT32_MAX);
 }
 
 /**
  * Generate batches from the dataset instances and the target outputs
  * @param batchSize Number of instance per batch
- * @param dataset List of instances (label in one-hot representation and data)
+ * @param dataset List of instances (label and data)
+ * @param gen Random generator used to shuffle the instances. It's shared by all the epochs so that each one gets a different order, and it's saved in the checkpoints
  * @return List of batches generated
  */
-std::vector<Batch*> generateBatches(int batchSize, std::vector<Instance*> dataset) {
-//    auto seed = (unsigned) time(nullptr);
-    int seed = 5;
-    std::default_random_engine gen(seed);
-
+std::vector<Batch*> generateBatches(int batchSize, std::vector<Instance*> dataset, std::default_random_engine &gen) {
     std::vector<Batch*> batches;
     std::shuffle(std::begin(dataset), std::end(dataset), gen);
 
@@ -179,36 +202,150 @@ std::vector<Batch*> generateBatches(int batchSize, std::vector<Instance*> datase
 
     int k=0;
     for(int i=0; i<dataset.size()/batchSize; i++) {
-        float* batchDataHead = new float[batchSize*instanceSize];
-        float* batchData = batchDataHead;
-        std::vector<float*> targets;
+        // The batch shares the ownership of this buffer so that it's not copied again
+        std::shared_ptr<float> batchDataHead(new float[batchSize*instanceSize], std::default_delete<float[]>());
+        float* batchData = batchDataHead.get();
+        std::vector<int> labels;
 
         for(int j=0; j<batchSize; j++) {
             float* instanceData = dataset[k]->getData()->getData();
-            targets.push_back(dataset[k]->getOneHotLabel());
+            labels.push_back(dataset[k]->getLabel());
 
             std::copy(instanceData, instanceData + instanceSize, batchData);
             batchData += instanceSize;
             k++;
         }
 
-        Batch* batch = new Batch(2, {batchSize, instanceSize}, batchDataHead, targets);
-        delete[] batchDataHead;
+        Batch* batch = new Batch(TensorView(2, {batchSize, instanceSize}, batchDataHead), labels);
         batches.push_back(batch);
 
     }
     return batches;
 }
 
+/**
+ * Train a network for some epochs and print its accuracy after each one. The instances are shuffled by a generator created from the seed, so that the networks compared are trained on the same batches
+ * @param network Neural network trained
+ * @param name Name of the training printed before the accuracies
+ * @param trainingSet Instances used to train the network
+ * @param testSet Instances used to compute the accuracy
+ * @param batchSize Number of instances per batch
+ * @param nbEpochs Number of epochs
+ * @param seed Seed of the generator shuffling the instances
+ * @return Duration of the training in milliseconds, without the computation of the accuracies
+ */
+long trainEpochs(NeuralNetwork* network, const std::string &name, const std::vector<Instance*> &trainingSet, const std::vector<Instance*> &testSet, int batchSize, int nbEpochs, int seed) {
+    std::default_random_engine generator(seed);
+    auto duration = std::chrono::high_resolution_clock::duration::zero();
+    for(int epoch=0; epoch<nbEpochs; epoch++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<Batch*> batches = generateBatches(batchSize, trainingSet, generator);
+        for(auto &batch : batches) {
+            network->fit(*batch);
+        }
+        for(int i=0; i<batches.size(); i++) {
+            delete batches[i];
+        }
+        duration += std::chrono::high_resolution_clock::now() - start;
+        std::cout << name << " training epoch: " << epoch << " / " << nbEpochs << " accuracy: " << network->getAccuracy(testSet) << std::endl;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+}
+
+/**
+ * Compare the training modes on the same batches and from the same initial weights: float and bfloat16 storage, gradient accumulation in micro-batches, pipeline parallelism and activation recomputation
+ * @param trainingSet Instances used to train the networks
+ * @param testSet Instances used to compute the accuracy
+ * @param batchSize Number of instances per batch
+ * @param seed Seed of the generator shuffling the instances
+ */
+void compareTrainingModes(const std::vector<Instance*> &trainingSet, const std::vector<Instance*> &testSet, int batchSize, int seed) {
+    int nbComparisonEpochs = 5;
+
+    // Mixed-precision training: the same network is trained in float and in bfloat16 to compare their convergence
+    for(bool mixedPrecision : {false, true}) {
+        std::string precisionName = mixedPrecision ? "bf16" : "fp32";
+        NeuralNetwork* comparedNetwork = initNN();
+        comparedNetwork->setMixedPrecision(mixedPrecision);
+        long duration = trainEpochs(comparedNetwork, precisionName, trainingSet, testSet, batchSize, nbComparisonEpochs, seed);
+        std::cout << precisionName << " training memory: " << comparedNetwork->getTrainingMemory(batchSize) << " bytes took: " << duration << "ms" << std::endl;
+        delete comparedNetwork;
+    }
+
+    // Gradient accumulation: large batches are trained in micro-batches whose tensors fit in a memory budget, with one update per batch
+    int largeBatchSize = 1024;
+    size_t microBatchMemory = 256 * 1024;
+    NeuralNetwork* accumulatedNetwork = initNN();
+    accumulatedNetwork->setMicroBatchMemory(microBatchMemory);
+    long accumulationDuration = trainEpochs(accumulatedNetwork, "micro-batch", trainingSet, testSet, largeBatchSize, nbComparisonEpochs, seed);
+    int microBatchSize = accumulatedNetwork->getMicroBatchSize(largeBatchSize);
+    std::cout << "batch " << largeBatchSize << " in micro-batches of " << microBatchSize << " training memory: " << accumulatedNetwork->getTrainingMemory(microBatchSize) << " bytes instead of " << accumulatedNetwork->getTrainingMemory(largeBatchSize) << " took: " << accumulationDuration << "ms" << std::endl;
+    delete accumulatedNetwork;
+
+    // Pipeline-parallel training: the layers of a deeper network are split in stages run by different threads, and the micro-batches of each batch stream through them
+    NeuralNetwork* pipelinedNetwork = initDeepNN();
+    pipelinedNetwork->setPipelineParallelism(4, 8);
+    long pipelineDuration = trainEpochs(pipelinedNetwork, "pipeline", trainingSet, testSet, batchSize, nbComparisonEpochs, seed);
+    Pipeline* pipeline = pipelinedNetwork->getPipeline();
+    std::cout << "pipeline stages:";
+    for(int s=0; s<pipeline->getNbStages(); s++) {
+        std::cout << " [" << pipeline->getFirstLayer(s) << "," << pipeline->getEndLayer(s) << ")";
+    }
+    std::cout << " memory: " << pipeline->getNbBytes() << " bytes took: " << pipelineDuration << "ms" << std::endl;
+    delete pipelinedNetwork;
+
+    // Activation recomputation: the same deep network only keeps the outputs of some layers for the backward pass, chosen so that the tensors of a batch fit in two thirds of their memory
+    NeuralNetwork* recomputedNetwork = initDeepNN();
+    size_t fullTrainingMemory = recomputedNetwork->getTrainingMemory(batchSize);
+    recomputedNetwork->setActivationCheckpointMemory(fullTrainingMemory * 2 / 3);
+    long recomputationDuration = trainEpochs(recomputedNetwork, "recomputation", trainingSet, testSet, batchSize, nbComparisonEpochs, seed);
+    std::cout << "checkpoints:";
+    for(int l : recomputedNetwork->getActivationCheckpoints(batchSize)) {
+        std::cout << " " << l;
+    }
+    std::cout << " training memory: " << recomputedNetwork->getTrainingMemory(batchSize) << " bytes instead of " << fullTrainingMemory << " took: " << recomputationDuration << "ms" << std::endl;
+    delete recomputedNetwork;
+}
+
 /**
  * @brief Main function
+ * Usage: AI [--checkpoint file] [--resume] [--compare]
+ * The checkpoints of the training are only written if a file is given with --checkpoint, and the training is only resumed from this file with --resume
+ * The training modes are only compared with --compare, since it trains several other networks (see compareTrainingModes())
+ * @param argc Number of arguments
+ * @param argv Arguments
  * @return Returns 0 if it ends correctly
  */
 
-int main()
+int main(int argc, char* argv[])
 {
+    std::string checkpointFileName;
+    bool resume = false;
+    bool compare = false;
+    bool validArguments = true;
+    for(int i=1; i<argc; i++) {
+        std::string argument = argv[i];
+        if(argument == "--checkpoint" && i+1 < argc) {
+            checkpointFileName = argv[++i];
+        } else if(argument == "--resume") {
+            resume = true;
+        } else if(argument == "--compare") {
+            compare = true;
+        } else {
+            validArguments = false;
+        }
+    }
+    if(!validArguments || (resume && checkpointFileName.empty())) {
+        std::cerr << "Usage: " << argv[0] << " [--checkpoint file] [--resume] [--compare]" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // One thread per core, each worker bound to its core. A thread is only used if it gets at least 100000 operations
+    ThreadPool::configure(0, true, 100000);
     NeuralNetwork* network = initNN();
     std::cout << "ANN created" << std::endl;
+    std::cout << "Matrix multiplication kernel: " << Gemm::getIsaName(Gemm::getIsa()) << std::endl;
+    std::cout << "Threads: " << ThreadPool::getInstance().getNbThreads() << std::endl;
 
     std::vector<Instance*> trainingSet;
     std::vector<Instance*> testSet;
@@ -216,24 +353,42 @@ int main()
     int nbEpochs = 100;
     int batchSize = 64;
 
-    float expectedResult[10][10];
-    for(int i=0; i<10; i++) {
-        for (int j=0; j<10; j++) {
-            expectedResult[i][j] = i==j ? 1 : 0;
-        }
-    }
-
     std::cout << "Fetching and transforming data..." << std::endl;
-    trainingSet = getDataset(false, expectedResult,300);
-    testSet = getDataset(true, expectedResult, 50);
+    trainingSet = getDataset(false, 300);
+    testSet = getDataset(true, 50);
+
 
+    // With --resume the training continues from the checkpoint: the parameters, the optimizer state and the shuffling generator are restored
+//    auto seed = (unsigned) time(nullptr);
+    int seed = 5;
+    std::default_random_engine shuffleGenerator(seed);
+    long firstEpoch = 0;
+    if(resume) {
+        std::string shuffleGeneratorState;
+        if(!network->restoreCheckpoint(checkpointFileName, firstEpoch, shuffleGeneratorState)) {
+            std::cerr << "ERROR: The training can't be resumed from " << checkpointFileName << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        std::istringstream(shuffleGeneratorState) >> shuffleGenerator;
+        if(firstEpoch >= nbEpochs) {
+            std::cout << "The training of " << checkpointFileName << " is already done (" << firstEpoch << " epochs), there is nothing to resume" << std::endl;
+        } else {
+            std::cout << "Training resumed at epoch " << firstEpoch << std::endl;
+        }
+    } else if(!checkpointFileName.empty() && std::ifstream(checkpointFileName).good()) {
+        std::cerr << "WARNING: The checkpoint " << checkpointFileName << " is ignored and will be overwritten, use --resume to resume its training" << std::endl;
+    }
+    // The checkpoints are written by a background thread, the training only waits for the copy of its state
+    Checkpointer* checkpointer = checkpointFileName.empty() ? nullptr : new Checkpointer(checkpointFileName);
 
     // TRAIN
     std::cout << "Training..." << std::endl;
-    for(int epoch=0; epoch<nbEpochs; epoch++) {
+    for(long epoch=firstEpoch; epoch<nbEpochs; epoch++) {
         auto start = std::chrono::high_resolution_clock::now();
+        long nbHeapAllocationsStart = TensorArena::getNbHeapAllocations();
+        long nbArenaBlocksStart = network->getArenaStats().nbBlockAllocations;
         std::cout << "Generating batches..." << std::endl;
-        std::vector<Batch*> batches = generateBatches(batchSize, trainingSet);
+        std::vector<Batch*> batches = generateBatches(batchSize, trainingSet, shuffleGenerator);
 
         std::cout << "Training batches..." << std::endl;
         if(batches.empty()) {
@@ -244,10 +399,19 @@ int main()
         for(auto &batch : batches) {
             network->fit(*batch);
         }
-        std::string fileName = "log.txt";
-//        network->save(fileName);
+        auto checkpointStart = std::chrono::high_resolution_clock::now();
+        if(checkpointer != nullptr) {
+            std::ostringstream shuffleGeneratorState;
+            shuffleGeneratorState << shuffleGenerator;
+            if(!checkpointer->save(*network, epoch + 1, shuffleGeneratorState.str())) {
+                std::cerr << "The checkpoint of the epoch " << epoch << " could not be saved" << std::endl;
+            }
+        }
+        auto checkpointDuration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - checkpointStart);
         auto duration = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::high_resolution_clock::now() - start);
-        std::cout << "epoch: " << epoch << " / " << nbEpochs << " accuracy: " << std::fixed << std::setprecision(2) << network->getAccuracy(testSet) << " took: " << duration.count() << "s" << std::endl;
+        std::cout << "epoch: " << epoch << " / " << nbEpochs << " accuracy: " << std::fixed << std::setprecision(2) << network->getAccuracy(testSet) << " took: " << duration.count() << "s checkpoint: " << checkpointDuration.count() << "us" << std::endl;
+        // Both are 0 in the steady state: all the temporary tensors come from the arena, which stops growing after the first steps
+        std::cout << "tensor heap allocations: " << TensorArena::getNbHeapAllocations() - nbHeapAllocationsStart << " arena blocks allocated: " << network->getArenaStats().nbBlockAllocations - nbArenaBlocksStart << std::endl;
 
         // Clear batch data
         for(int i=0; i<batches.size(); i++) {
@@ -255,7 +419,83 @@ int main()
         }
         batches.clear();
     }
-    std::cout << "training done" << std::endl;
+    if(checkpointer != nullptr) {
+        checkpointer->wait();
+        std::cout << "training done, checkpoints written: " << checkpointer->getNbWritten() << std::endl;
+        delete checkpointer;
+    } else {
+        std::cout << "training done" << std::endl;
+    }
+
+    // The trained model is saved in the binary format and mapped again: the loaded network uses the weights of the file in place
+    std::string modelFileName = "model.bin";
+    if(network->save(modelFileName)) {
+        auto loadStart = std::chrono::high_resolution_clock::now();
+        NeuralNetwork* loadedNetwork = NeuralNetwork::load(modelFileName);
+        auto loadDuration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - loadStart);
+        if(loadedNetwork != nullptr) {
+            std::cout << "loaded model accuracy: " << loadedNetwork->getAccuracy(testSet) << " load time: " << loadDuration.count() << "us" << std::endl;
+            delete loadedNetwork;
+        }
+    }
+
+    // Int8 post-training quantization: the input scale of each layer is calibrated on a part of the training set
+    std::vector<Instance*> calibrationSet(trainingSet.begin(), trainingSet.begin() + std::min((size_t) 500, trainingSet.size()));
+    QuantizedNeuralNetwork quantizedNetwork(*network, calibrationSet);
+
+    auto fp32Start = std::chrono::high_resolution_clock::now();
+    float fp32Accuracy = network->getAccuracy(testSet);
+    auto fp32Duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - fp32Start);
+    auto int8Start = std::chrono::high_resolution_clock::now();
+    float int8Accuracy = quantizedNetwork.getAccuracy(testSet);
+    auto int8Duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - int8Start);
+
+    std::cout << "fp32 accuracy: " << fp32Accuracy << " weights: " << quantizedNetwork.getNbFloatParameterBytes() << " bytes predict time: " << fp32Duration.count() / std::max((size_t) 1, testSet.size()) << "us" << std::endl;
+    std::cout << "int8 accuracy: " << int8Accuracy << " weights: " << quantizedNetwork.getNbParameterBytes() << " bytes predict time: " << int8Duration.count() / std::max((size_t) 1, testSet.size()) << "us" << std::endl;
+
+    // Dynamic batching: several client threads request the predictions of the test set one image at a time, and the queue runs them in batches
+    {
+        int nbClients = 4;
+        InferenceQueue queue(*network, 32, std::chrono::microseconds(200));
+        std::vector<int> nbCorrect(nbClients, 0);
+        std::vector<std::thread> clients;
+        for(int c=0; c<nbClients; c++) {
+            clients.emplace_back([&, c]() {
+                for(int i=c; i<testSet.size(); i+=nbClients) {
+                    int label = queue.submit(*testSet[i]->getData()).get();
+                    if(testSet[i]->isLabel(label)) {
+                        nbCorrect[c]++;
+                    }
+                }
+            });
+        }
+        for(auto &client : clients) {
+            client.join();
+        }
+        int nbCorrectTotal = 0;
+        for(int n : nbCorrect) {
+            nbCorrectTotal += n;
+        }
+        InferenceQueue::Stats stats = queue.getStats();
+        std::cout << "queued accuracy: " << (float) nbCorrectTotal / (float) std::max((size_t) 1, testSet.size()) << " mean batch size: " << stats.meanBatchSize << " queue latency p50: " << stats.queueP50 << "us p99: " << stats.queueP99 << "us compute latency p50: " << stats.computeP50 << "us p99: " << stats.computeP99 << "us" << std::endl;
+    }
+
+    // Magnitude pruning: the smallest weights are removed, the layers use the sparse kernels once they are sparse enough
+    for(float sparsity : {0.8f, 0.9f}) {
+        network->pruneToSparsity(sparsity);
+        size_t nbWeightBytes = 0;
+        for(int l=0; l<network->getNbLayers(); l++) {
+            nbWeightBytes += static_cast<DenseLayer*>(network->getLayer(l))->getNbWeightBytes();
+        }
+        auto prunedStart = std::chrono::high_resolution_clock::now();
+        float prunedAccuracy = network->getAccuracy(testSet);
+        auto prunedDuration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - prunedStart);
+        std::cout << "pruned (sparsity " << network->getSparsity() << ") accuracy: " << prunedAccuracy << " weights: " << nbWeightBytes << " bytes predict time: " << prunedDuration.count() / std::max((size_t) 1, testSet.size()) << "us" << std::endl;
+    }
+
+    if(compare) {
+        compareTrainingModes(trainingSet, testSet, batchSize, seed);
+    }
 
     // TODO: delete instances (we have a memory leak here) and create an Instance class instead of enum to simplify the destruction process
 
@@ -272,4 +512,4 @@ int main()
     delete network;
 
 	return 0;
-}
\ No newline at end of file
+}
\ No newline at end of file
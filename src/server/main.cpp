@@ -0,0 +1,93 @@
+/**
+ * @file main.cpp
+ * @author Robin MENEUST
+ * @brief Inference server: loads a model saved by NeuralNetwork::save() once and answers the predictions of local clients (see InferenceClient)
+ * @date 2024-02-01
+ */
+
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <climits>
+#include <cerrno>
+#include <cstdlib>
+#include <csignal>
+#include "../../include/NeuralNetwork.h"
+#include "../../include/ThreadPool.h"
+#include "../../include/InferenceServer.h"
+
+std::atomic<InferenceServer*> server(nullptr); /**< Server stopped by the signal handler */
+
+/**
+ * Stop the server on SIGINT and SIGTERM
+ */
+void handleSignal(int) {
+    InferenceServer* runningServer = server.load();
+    if(runningServer != nullptr) {
+        runningServer->stop();
+    }
+}
+
+/**
+ * Parse an integer argument of the command line
+ * @param text Argument
+ * @param min Smallest accepted value
+ * @param max Largest accepted value
+ * @param value Set to the parsed value
+ * @return True if the whole argument is an integer between min and max, false otherwise
+ */
+bool parseArgument(const char* text, long min, long max, long &value) {
+    char* end = nullptr;
+    errno = 0;
+    value = strtol(text, &end, 10);
+    return end != text && *end == '\0' && errno == 0 && value >= min && value <= max;
+}
+
+/**
+ * Start the server
+ * Usage: AIServer model.bin [socketPath] [maxBatchSize] [maxWaitMicroseconds] [nbThreads]
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return EXIT_SUCCESS once the server is stopped, EXIT_FAILURE if it could not start
+ */
+int main(int argc, char* argv[]) {
+    long maxBatchSize = 64;
+    long maxWaitMicroseconds = 200;
+    long nbThreads = 0;
+    if(argc < 2 || (argc > 3 && !parseArgument(argv[3], 1, INT_MAX, maxBatchSize)) || (argc > 4 && !parseArgument(argv[4], 0, LONG_MAX, maxWaitMicroseconds)) || (argc > 5 && !parseArgument(argv[5], 0, INT_MAX, nbThreads))) {
+        std::cerr << "Usage: " << argv[0] << " model.bin [socketPath] [maxBatchSize] [maxWaitMicroseconds] [nbThreads]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::string modelFileName = argv[1];
+    std::string socketPath = argc > 2 ? argv[2] : "/tmp/ai_inference.sock";
+    std::chrono::microseconds maxWait(maxWaitMicroseconds);
+
+    // The workers are bound to the cores 1 to n and the scheduler of the queue, which calls the pool, to the core 0
+    ThreadPool::configure((int) nbThreads, true, 100000);
+
+    NeuralNetwork* network = NeuralNetwork::load(modelFileName);
+    if(network == nullptr) {
+        return EXIT_FAILURE;
+    }
+
+    InferenceServer* runningServer = new InferenceServer(*network, socketPath, (int) maxBatchSize, maxWait, true);
+    server.store(runningServer);
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+
+    std::cout << "Listening on " << socketPath << " (batches of up to " << maxBatchSize << " requests, " << maxWait.count() << " us of wait)" << std::endl;
+    bool success = runningServer->run();
+
+    InferenceProtocol::StatsMessage stats = runningServer->getStats();
+    std::cout << "requests: " << stats.nbRequests << ", batches: " << stats.nbBatches << ", mean batch size: " << stats.meanBatchSize << std::endl;
+    std::cout << "throughput: " << stats.requestsPerSecond << " requests/s" << std::endl;
+    std::cout << "queue latency p50/p99: " << stats.queueP50 << " / " << stats.queueP99 << " us, compute latency p50/p99: " << stats.computeP50 << " / " << stats.computeP99 << " us" << std::endl;
+
+    // The signals are ignored before the server is deleted, so that the handler can't use it anymore
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+    server.store(nullptr);
+    delete runningServer;
+    delete network;
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}